@@ -0,0 +1,85 @@
+import { connect, useServingOrigin } from './session.js';
+
+// Alternates WebSocket and WHEP sessions against one server and reports, per
+// transport, the time from connect() to signaling done, ICE connected and
+// the first presented frame.
+
+const statusEl = document.getElementById('status');
+const resultsEl = document.getElementById('results');
+const videoEl = document.getElementById('video');
+const runButton = document.getElementById('run');
+
+useServingOrigin('ws-url', 'whep-url');
+
+const FRAME_TIMEOUT_MS = 10000;
+
+function firstFrame(start) {
+  return new Promise((resolve, reject) => {
+    const timer = setTimeout(() => reject(new Error('no frame')), FRAME_TIMEOUT_MS);
+    videoEl.requestVideoFrameCallback((now) => {
+      clearTimeout(timer);
+      resolve(now - start);
+    });
+  });
+}
+
+async function measure(url) {
+  videoEl.srcObject = null;
+  let frame;
+  const session = await connect(url, {
+    onTrack: (stream) => {
+      videoEl.srcObject = stream;
+    }
+  });
+  try {
+    frame = await firstFrame(session.start);
+  } finally {
+    session.close();
+  }
+  return { ...session.timings, frame };
+}
+
+function percentile(sorted, p) {
+  return sorted[Math.min(sorted.length - 1, Math.floor((sorted.length * p) / 100))];
+}
+
+function report(samples) {
+  const rows = ['transport   metric         p50 ms   p90 ms   max ms   n'];
+  for (const [transport, runs] of Object.entries(samples)) {
+    for (const metric of ['signaled', 'iceConnected', 'frame']) {
+      const values = runs.map((run) => run[metric]).filter((v) => v !== undefined).sort((a, b) => a - b);
+      if (!values.length) {
+        continue;
+      }
+      rows.push(`${transport.padEnd(11)} ${metric.padEnd(13)} ${percentile(values, 50).toFixed(0).padStart(7)}  ` +
+                `${percentile(values, 90).toFixed(0).padStart(7)}  ${values[values.length - 1].toFixed(0).padStart(7)}  ${values.length}`);
+    }
+  }
+  resultsEl.textContent = rows.join('\n');
+}
+
+runButton.addEventListener('click', async () => {
+  runButton.disabled = true;
+  const urls = {
+    websocket: document.getElementById('ws-url').value,
+    whep: document.getElementById('whep-url').value
+  };
+  const runs = Number(document.getElementById('runs').value) || 1;
+  const samples = { websocket: [], whep: [] };
+  let failures = 0;
+
+  for (let i = 0; i < runs; ++i) {
+    for (const transport of Object.keys(urls)) {
+      statusEl.textContent = `run ${i + 1}/${runs} ${transport}`;
+      try {
+        samples[transport].push(await measure(urls[transport]));
+      } catch (error) {
+        failures += 1;
+      }
+      report(samples);
+    }
+  }
+
+  statusEl.textContent = failures ? `done, ${failures} failed` : 'done';
+  runButton.disabled = false;
+});
@@ -1,74 +1,178 @@
+import { connect, useServingOrigin } from './session.js';
+
 const connectButton = document.getElementById('connect');
 const statusEl = document.getElementById('status');
-const wsUrlInput = document.getElementById('ws-url');
+const urlInput = document.getElementById('server-url');
 const videoEl = document.getElementById('video');
+const canvasEl = document.getElementById('canvas');
+const latencyEl = document.getElementById('latency');
+
+useServingOrigin('server-url');
 
-let ws;
-let pc;
+let session;
+let channel;
+
+// Orbit camera driven by drag and wheel; sent over the "input" data channel.
+const camera = { yaw: 0, pitch: 0, zoom: 1 };
+let cameraSeq = 0;
+let cameraDirty = false;
+let drag = null;
+const sentAt = new Map();
+let latencyAvg = null;
+// Stream mode draws WebCodecs frames itself; callbacks waiting for the next
+// presented frame are run after the draw.
+let frameWaiters = [];
 
 function setStatus(text) {
   statusEl.textContent = text;
 }
 
-async function createPeerConnection() {
-  pc = new RTCPeerConnection({
-    iceServers: [{ urls: 'stun:stun.l.google.com:19302' }]
-  });
-
-  pc.ontrack = (event) => {
-    if (videoEl.srcObject !== event.streams[0]) {
-      videoEl.srcObject = event.streams[0];
-    }
+function onDataChannel(dataChannel) {
+  if (dataChannel.label !== 'input') {
+    return;
+  }
+  channel = dataChannel;
+  channel.onmessage = (message) => handleChannelMessage(JSON.parse(message.data));
+  channel.onclose = () => {
+    channel = null;
   };
+}
 
-  pc.onicecandidate = (event) => {
-    if (event.candidate && ws?.readyState === WebSocket.OPEN) {
-      ws.send(JSON.stringify({
-        type: 'ice',
-        candidate: event.candidate.candidate,
-        sdpMLineIndex: event.candidate.sdpMLineIndex,
-        sdpMid: event.candidate.sdpMid
-      }));
-    }
-  };
+function onTrack(stream) {
+  if (videoEl.srcObject !== stream) {
+    videoEl.srcObject = stream;
+  }
 }
 
-connectButton.addEventListener('click', async () => {
-  if (ws && ws.readyState === WebSocket.OPEN) {
+function onFrame(frame) {
+  if (canvasEl.width !== frame.displayWidth || canvasEl.height !== frame.displayHeight) {
+    canvasEl.width = frame.displayWidth;
+    canvasEl.height = frame.displayHeight;
+  }
+  canvasEl.getContext('2d').drawImage(frame, 0, 0);
+  frame.close();
+  const waiters = frameWaiters;
+  frameWaiters = [];
+  const now = performance.now();
+  for (const waiter of waiters) {
+    waiter(now);
+  }
+}
+
+// Calls back with the presentation time of the next frame on screen.
+function onNextFrame(callback) {
+  if (session?.transport === 'stream') {
+    frameWaiters.push(callback);
+  } else if (videoEl.requestVideoFrameCallback) {
+    videoEl.requestVideoFrameCallback((now, metadata) => callback(metadata.expectedDisplayTime ?? now));
+  }
+}
+
+function flushCamera() {
+  if (!cameraDirty || channel?.readyState !== 'open') {
     return;
   }
+  cameraDirty = false;
+  cameraSeq += 1;
+  sentAt.set(cameraSeq, performance.now());
+  channel.send(JSON.stringify({ type: 'camera', seq: cameraSeq, ...camera }));
+}
 
-  setStatus('connecting');
-  ws = new WebSocket(wsUrlInput.value);
+function updateCamera(change) {
+  Object.assign(camera, change);
+  camera.pitch = Math.max(-1.4, Math.min(1.4, camera.pitch));
+  camera.zoom = Math.max(0.25, Math.min(3, camera.zoom));
+  if (!cameraDirty) {
+    cameraDirty = true;
+    requestAnimationFrame(flushCamera);
+  }
+}
 
-  ws.onopen = async () => {
-    await createPeerConnection();
-    setStatus('connected');
-  };
+// The server acks an input once the first frame rendered after it has been
+// encoded; the next frame presented after the ack approximates photon time.
+function handleChannelMessage(message) {
+  if (message.type !== 'ack') {
+    return;
+  }
+  const start = sentAt.get(message.seq);
+  for (const seq of sentAt.keys()) {
+    if (seq <= message.seq) {
+      sentAt.delete(seq);
+    }
+  }
+  if (start === undefined) {
+    return;
+  }
+  onNextFrame((shown) => {
+    const ms = shown - start;
+    latencyAvg = latencyAvg === null ? ms : latencyAvg * 0.9 + ms * 0.1;
+    latencyEl.textContent = `input→photon ${latencyAvg.toFixed(0)} ms (server ${message.server_ms.toFixed(0)} ms)`;
+    if (channel?.readyState === 'open') {
+      channel.send(JSON.stringify({ type: 'latency', seq: message.seq, ms }));
+    }
+  });
+}
 
-  ws.onmessage = async (event) => {
-    const message = JSON.parse(event.data);
-    if (message.type === 'offer') {
-      await pc.setRemoteDescription({ type: 'offer', sdp: message.sdp });
-      const answer = await pc.createAnswer();
-      await pc.setLocalDescription(answer);
-      ws.send(JSON.stringify({ type: 'answer', sdp: answer.sdp }));
-    } else if (message.type === 'ice') {
-      if (message.candidate) {
-        await pc.addIceCandidate({
-          candidate: message.candidate,
-          sdpMid: message.sdpMid,
-          sdpMLineIndex: message.sdpMLineIndex
-        });
-      }
+for (const surface of [videoEl, canvasEl]) {
+  surface.addEventListener('pointerdown', (event) => {
+    drag = { x: event.clientX, y: event.clientY };
+    surface.setPointerCapture(event.pointerId);
+  });
+
+  surface.addEventListener('pointermove', (event) => {
+    if (!drag) {
+      return;
     }
-  };
+    const scale = Math.PI / surface.clientWidth;
+    updateCamera({
+      yaw: camera.yaw + (event.clientX - drag.x) * scale,
+      pitch: camera.pitch + (event.clientY - drag.y) * scale
+    });
+    drag = { x: event.clientX, y: event.clientY };
+  });
 
-  ws.onclose = () => {
-    setStatus('closed');
-  };
+  surface.addEventListener('pointerup', () => {
+    drag = null;
+  });
 
-  ws.onerror = () => {
+  surface.addEventListener('wheel', (event) => {
+    event.preventDefault();
+    updateCamera({ zoom: camera.zoom * Math.exp(event.deltaY * 0.001) });
+  }, { passive: false });
+}
+
+connectButton.addEventListener('click', async () => {
+  if (session) {
+    return;
+  }
+
+  setStatus('connecting');
+  try {
+    session = await connect(urlInput.value, {
+      onTrack,
+      onDataChannel,
+      onFrame,
+      onClose: () => {
+        session = null;
+        frameWaiters = [];
+        setStatus('closed');
+      }
+    });
+  } catch (error) {
+    session = null;
     setStatus('error');
-  };
+    return;
+  }
+  setStatus('connected');
+  const stream = session.transport === 'stream';
+  videoEl.hidden = stream;
+  canvasEl.hidden = !stream;
+
+  // Setup time: click to first presented frame.
+  const current = session;
+  onNextFrame((shown) => {
+    if (session === current) {
+      setStatus(`connected (${current.transport}, first frame ${(shown - current.start).toFixed(0)} ms)`);
+    }
+  });
 });
@@ -0,0 +1,289 @@
+// Receive-only peer connection to the server. ws:// URLs use the
+// cs-signaling WebSocket protocol (server offers, both sides trickle);
+// http:// URLs use WHEP (client offers in one POST, the answer carries every
+// server candidate); ws:// URLs ending in /stream skip WebRTC and decode the
+// cs-stream access units with WebCodecs. `timings` holds milliseconds since
+// connect() was called.
+
+const ICE_SERVERS = [{ urls: 'stun:stun.l.google.com:19302' }];
+
+function createPeerConnection(handlers, timings, start) {
+  const pc = new RTCPeerConnection({ iceServers: ICE_SERVERS });
+  pc.ontrack = (event) => handlers.onTrack?.(event.streams[0] ?? new MediaStream([event.track]));
+  pc.ondatachannel = (event) => handlers.onDataChannel?.(event.channel);
+  pc.oniceconnectionstatechange = () => {
+    if (pc.iceConnectionState === 'connected' && timings.iceConnected === undefined) {
+      timings.iceConnected = performance.now() - start;
+    }
+  };
+  return pc;
+}
+
+function connectWebSocket(url, handlers, timings, start) {
+  return new Promise((resolve, reject) => {
+    const ws = new WebSocket(url);
+    let pc;
+    const close = () => {
+      ws.close();
+      pc?.close();
+    };
+
+    ws.onopen = () => {
+      pc = createPeerConnection(handlers, timings, start);
+      pc.onicecandidate = (event) => {
+        if (event.candidate && ws.readyState === WebSocket.OPEN) {
+          ws.send(JSON.stringify({
+            type: 'ice',
+            candidate: event.candidate.candidate,
+            sdpMLineIndex: event.candidate.sdpMLineIndex,
+            sdpMid: event.candidate.sdpMid
+          }));
+        }
+      };
+    };
+
+    ws.onmessage = async (event) => {
+      const message = JSON.parse(event.data);
+      if (message.type === 'offer') {
+        await pc.setRemoteDescription({ type: 'offer', sdp: message.sdp });
+        const answer = await pc.createAnswer();
+        await pc.setLocalDescription(answer);
+        ws.send(JSON.stringify({ type: 'answer', sdp: answer.sdp }));
+        timings.signaled = performance.now() - start;
+        resolve({ pc, close });
+      } else if (message.type === 'ice' && message.candidate) {
+        await pc.addIceCandidate({
+          candidate: message.candidate,
+          sdpMid: message.sdpMid,
+          sdpMLineIndex: message.sdpMLineIndex
+        });
+      }
+    };
+
+    ws.onclose = () => {
+      handlers.onClose?.();
+      reject(new Error('signaling closed'));
+    };
+    ws.onerror = () => reject(new Error('signaling error'));
+  });
+}
+
+function candidateFragment(pc, candidate) {
+  const ice = pc.localDescription.sdp.match(/a=ice-(ufrag|pwd):.*\r\n/g) ?? [];
+  return `${ice.slice(0, 2).join('')}a=mid:${candidate.sdpMid}\r\na=${candidate.candidate}\r\n`;
+}
+
+async function connectWhep(url, handlers, timings, start) {
+  const pc = createPeerConnection(handlers, timings, start);
+  pc.addTransceiver('video', { direction: 'recvonly' });
+  // Only there so the offer carries an SCTP m-line; the server opens the
+  // "input" channel itself once SCTP is up.
+  pc.createDataChannel('whep');
+
+  // Client candidates found before the session URL is known are sent in one
+  // PATCH once it is.
+  let resource = null;
+  let queued = [];
+  const patch = (fragment) => fetch(resource, {
+    method: 'PATCH',
+    headers: { 'Content-Type': 'application/trickle-ice-sdpfrag' },
+    body: fragment
+  }).catch(() => {});
+  pc.onicecandidate = (event) => {
+    if (!event.candidate || !event.candidate.candidate) {
+      return;
+    }
+    const fragment = candidateFragment(pc, event.candidate);
+    if (resource) {
+      patch(fragment);
+    } else {
+      queued.push(fragment);
+    }
+  };
+
+  const offer = await pc.createOffer();
+  await pc.setLocalDescription(offer);
+  const response = await fetch(url, {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/sdp' },
+    body: offer.sdp
+  });
+  if (response.status !== 201) {
+    pc.close();
+    throw new Error(`WHEP POST failed: ${response.status}`);
+  }
+  resource = new URL(response.headers.get('Location'), url).href;
+  await pc.setRemoteDescription({ type: 'answer', sdp: await response.text() });
+  timings.signaled = performance.now() - start;
+
+  if (queued.length) {
+    patch(queued.join(''));
+    queued = [];
+  }
+
+  // No socket to watch, so a failed transport ends the session.
+  pc.onconnectionstatechange = () => {
+    if (pc.connectionState === 'failed') {
+      handlers.onClose?.();
+    }
+  };
+  const close = () => {
+    fetch(resource, { method: 'DELETE' }).catch(() => {});
+    pc.close();
+    handlers.onClose?.();
+  };
+  return { pc, close };
+}
+
+const STREAM_HEADER = 12;
+
+// RFC 6381 codec string from the first SPS in an Annex B access unit.
+function avcCodec(data) {
+  for (let i = 0; i + 7 < data.length; ++i) {
+    if (data[i] === 0 && data[i + 1] === 0 && data[i + 2] === 1 && (data[i + 3] & 0x1f) === 7) {
+      const hex = (byte) => byte.toString(16).padStart(2, '0');
+      return `avc1.${hex(data[i + 4])}${hex(data[i + 5])}${hex(data[i + 6])}`;
+    }
+  }
+  return null;
+}
+
+// Each binary message is one access unit behind a 12-byte header (version,
+// flags with bit 0 = keyframe, two reserved bytes, pts in microseconds as a
+// little-endian u64). Text messages are the same JSON the "input" data channel
+// carries, so the socket is handed to onDataChannel as that channel.
+function connectStream(url, handlers, timings, start) {
+  return new Promise((resolve, reject) => {
+    if (typeof VideoDecoder === 'undefined') {
+      reject(new Error('WebCodecs unavailable'));
+      return;
+    }
+    const ws = new WebSocket(url, 'cs-stream');
+    ws.binaryType = 'arraybuffer';
+    let decoder = null;
+    let opened = false;
+
+    const channel = {
+      label: 'input',
+      onmessage: null,
+      onclose: null,
+      get readyState() {
+        return ws.readyState === WebSocket.OPEN ? 'open' : 'closed';
+      },
+      send: (text) => ws.send(text)
+    };
+    const close = () => {
+      ws.close();
+      if (decoder && decoder.state !== 'closed') {
+        decoder.close();
+      }
+    };
+
+    const createDecoder = (codec) => {
+      const created = new VideoDecoder({
+        output: (frame) => {
+          if (handlers.onFrame) {
+            handlers.onFrame(frame);
+          } else {
+            frame.close();
+          }
+        },
+        error: () => {
+          // Start over on the next keyframe, which the server only sends
+          // on request.
+          decoder = null;
+          if (ws.readyState === WebSocket.OPEN) {
+            ws.send(JSON.stringify({ type: 'keyframe' }));
+          }
+        }
+      });
+      // Without a description the decoder expects Annex B, which is what the
+      // server sends (SPS/PPS repeated before every keyframe).
+      created.configure({ codec, optimizeForLatency: true });
+      return created;
+    };
+
+    ws.onopen = () => {
+      opened = true;
+      timings.signaled = performance.now() - start;
+      handlers.onDataChannel?.(channel);
+      resolve({ pc: null, close });
+    };
+
+    ws.onmessage = (event) => {
+      if (typeof event.data === 'string') {
+        channel.onmessage?.({ data: event.data });
+        return;
+      }
+      if (event.data.byteLength <= STREAM_HEADER) {
+        return;
+      }
+      const header = new DataView(event.data, 0, STREAM_HEADER);
+      const key = (header.getUint8(1) & 1) !== 0;
+      const payload = new Uint8Array(event.data, STREAM_HEADER);
+      if (!decoder) {
+        const codec = key ? avcCodec(payload) : null;
+        if (!codec) {
+          return;
+        }
+        decoder = createDecoder(codec);
+      }
+      decoder.decode(new EncodedVideoChunk({
+        type: key ? 'key' : 'delta',
+        timestamp: Number(header.getBigUint64(4, true)),
+        data: payload
+      }));
+    };
+
+    ws.onclose = () => {
+      channel.onclose?.();
+      if (decoder && decoder.state !== 'closed') {
+        decoder.close();
+      }
+      handlers.onClose?.();
+      if (!opened) {
+        reject(new Error('stream closed'));
+      }
+    };
+    ws.onerror = () => reject(new Error('stream error'));
+  });
+}
+
+function transportFor(url) {
+  if (/^https?:/i.test(url)) {
+    return 'whep';
+  }
+  return /\/stream\/?$/.test(new URL(url).pathname) ? 'stream' : 'websocket';
+}
+
+export async function connect(url, handlers = {}) {
+  const start = performance.now();
+  const timings = {};
+  const transport = transportFor(url);
+  let session;
+  if (transport === 'whep') {
+    session = await connectWhep(url, handlers, timings, start);
+  } else if (transport === 'stream') {
+    session = await connectStream(url, handlers, timings, start);
+  } else {
+    session = await connectWebSocket(url, handlers, timings, start);
+  }
+  return { ...session, timings, start, transport };
+}
+
+// A production build is served by cube_server itself, so point the given
+// URL inputs at the server that served the page, keeping their paths. The
+// Vite dev server keeps the defaults from the HTML.
+export function useServingOrigin(...ids) {
+  if (import.meta.env.DEV) {
+    return;
+  }
+  for (const id of ids) {
+    const input = document.getElementById(id);
+    const url = new URL(input.value);
+    const secure = location.protocol === 'https:';
+    url.protocol = url.protocol.startsWith('ws') ? (secure ? 'wss:' : 'ws:') : location.protocol;
+    url.host = location.host;
+    input.value = url.href === `${url.protocol}//${url.host}/` ? url.href.slice(0, -1) : url.href;
+  }
+}
@@ -0,0 +1,166 @@
+import { connect, useServingOrigin } from './session.js';
+
+// Connects and disconnects one viewer in a loop, alternating WebSocket and
+// WHEP, and samples the server's /stats once it reports no peers. After the
+// warmup window, file descriptors, threads and pipeline objects must be back
+// at their baseline, RSS must not keep climbing and setup time must not
+// drift; the run fails otherwise.
+
+const statusEl = document.getElementById('status');
+const resultsEl = document.getElementById('results');
+const videoEl = document.getElementById('video');
+const runButton = document.getElementById('run');
+
+useServingOrigin('ws-url', 'whep-url', 'stats-url');
+
+const FRAME_TIMEOUT_MS = 10000;
+const IDLE_TIMEOUT_MS = 10000;
+// Allocator caches and lazily created encoder state settle over the first
+// cycles; the baseline is taken after them.
+const WARMUP_CYCLES = 20;
+const RSS_SLOPE_LIMIT_KB = 2048; // per 1000 cycles
+const SETUP_DRIFT_LIMIT = 1.5;
+const COUNTED = ['fds', 'threads', 'gst_elements', 'gst_pads'];
+
+function sleep(ms) {
+  return new Promise((resolve) => setTimeout(resolve, ms));
+}
+
+function firstFrame(start) {
+  return new Promise((resolve, reject) => {
+    const timer = setTimeout(() => reject(new Error('no frame')), FRAME_TIMEOUT_MS);
+    videoEl.requestVideoFrameCallback((now) => {
+      clearTimeout(timer);
+      resolve(now - start);
+    });
+  });
+}
+
+async function cycle(url) {
+  videoEl.srcObject = null;
+  const session = await connect(url, {
+    onTrack: (stream) => {
+      videoEl.srcObject = stream;
+    }
+  });
+  try {
+    return await firstFrame(session.start);
+  } finally {
+    session.close();
+  }
+}
+
+// Peers are torn down asynchronously on the server; sample only once the
+// last one is gone so the counts compare like with like.
+async function idleStats(url) {
+  const deadline = performance.now() + IDLE_TIMEOUT_MS;
+  for (;;) {
+    const stats = await (await fetch(url, { cache: 'no-store' })).json();
+    if ((stats.peers === 0 && stats.pipeline_peers === 0) || performance.now() > deadline) {
+      return stats;
+    }
+    await sleep(100);
+  }
+}
+
+function median(values) {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted.length ? sorted[Math.floor(sorted.length / 2)] : 0;
+}
+
+// Least-squares slope of RSS over cycle count, in kB per 1000 cycles.
+function rssSlope(samples) {
+  if (samples.length < 2) {
+    return 0;
+  }
+  const n = samples.length;
+  const mx = samples.reduce((s, x) => s + x.cycle, 0) / n;
+  const my = samples.reduce((s, x) => s + x.stats.rss_kb, 0) / n;
+  let num = 0;
+  let den = 0;
+  for (const { cycle: x, stats } of samples) {
+    num += (x - mx) * (stats.rss_kb - my);
+    den += (x - mx) * (x - mx);
+  }
+  return den ? (num / den) * 1000 : 0;
+}
+
+function evaluate(samples, windows) {
+  const failures = [];
+  const baseline = samples.find((s) => s.cycle >= WARMUP_CYCLES);
+  if (!baseline) {
+    return failures;
+  }
+  const after = samples.filter((s) => s.cycle >= baseline.cycle);
+  const last = samples[samples.length - 1];
+  for (const key of COUNTED) {
+    if (last.stats[key] > baseline.stats[key]) {
+      failures.push(`${key} ${baseline.stats[key]} -> ${last.stats[key]}`);
+    }
+  }
+  const slope = rssSlope(after);
+  if (after.length >= 3 && slope > RSS_SLOPE_LIMIT_KB) {
+    failures.push(`rss +${slope.toFixed(0)} kB/1000 cycles`);
+  }
+  const first = windows.find((w) => w.cycle >= WARMUP_CYCLES);
+  const latest = windows[windows.length - 1];
+  if (first && latest !== first && latest.setup > first.setup * SETUP_DRIFT_LIMIT) {
+    failures.push(`setup p50 ${first.setup.toFixed(0)} -> ${latest.setup.toFixed(0)} ms`);
+  }
+  return failures;
+}
+
+function report(samples, windows, failures, errors) {
+  const rows = ['cycle    rss_kb    fds  threads  elements   pads  setup_p50_ms'];
+  samples.forEach((sample, i) => {
+    const { stats } = sample;
+    const setup = windows[i] ? windows[i].setup.toFixed(0) : '-';
+    rows.push(`${String(sample.cycle).padStart(5)}  ${String(stats.rss_kb).padStart(8)}  ${String(stats.fds).padStart(5)}  ` +
+              `${String(stats.threads).padStart(7)}  ${String(stats.gst_elements).padStart(8)}  ` +
+              `${String(stats.gst_pads).padStart(5)}  ${setup.padStart(12)}`);
+  });
+  rows.push('');
+  rows.push(failures.length ? `FAIL: ${failures.join('; ')}` : 'PASS');
+  if (errors) {
+    rows.push(`${errors} cycles without a frame`);
+  }
+  resultsEl.textContent = rows.join('\n');
+}
+
+runButton.addEventListener('click', async () => {
+  runButton.disabled = true;
+  const urls = [document.getElementById('ws-url').value, document.getElementById('whep-url').value];
+  const statsUrl = document.getElementById('stats-url').value;
+  const cycles = Number(document.getElementById('cycles').value) || 1;
+  const every = Number(document.getElementById('sample-every').value) || 1;
+
+  // samples[i] is taken after windows[i]'s cycles; samples[0] before any.
+  const samples = [];
+  const windows = [null];
+  let setups = [];
+  let failures = [];
+  let errors = 0;
+
+  try {
+    samples.push({ cycle: 0, stats: await idleStats(statsUrl) });
+    for (let i = 1; i <= cycles; ++i) {
+      statusEl.textContent = `cycle ${i}/${cycles}`;
+      try {
+        setups.push(await cycle(urls[i % urls.length]));
+      } catch (error) {
+        errors += 1;
+      }
+      if (i % every === 0 || i === cycles) {
+        samples.push({ cycle: i, stats: await idleStats(statsUrl) });
+        windows.push({ cycle: i, setup: median(setups) });
+        setups = [];
+        failures = evaluate(samples, windows.slice(1));
+        report(samples, windows, failures, errors);
+      }
+    }
+    statusEl.textContent = failures.length ? 'failed' : 'passed';
+  } catch (error) {
+    statusEl.textContent = `stats unavailable: ${error.message}`;
+  }
+  runButton.disabled = false;
+});
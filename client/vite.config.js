@@ -4,5 +4,14 @@ export default defineConfig({
   server: {
     port: 5173,
     host: true
+  },
+  build: {
+    rollupOptions: {
+      input: {
+        main: 'index.html',
+        bench: 'bench.html',
+        soak: 'soak.html'
+      }
+    }
   }
 });
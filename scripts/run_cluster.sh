@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Starts a router on :8080 (workers register on :8090) and N workers on
+# :8081.. on localhost.
+workers="${1:-3}"
+
+cmake -S server -B build
+cmake --build build
+
+tmp="$(mktemp -d)"
+pids=()
+trap 'kill "${pids[@]}" 2>/dev/null; rm -rf "$tmp"' EXIT
+
+printf 'mode=router\nsignaling_port=8080\n' > "$tmp/router.conf"
+./build/cube_server "$tmp/router.conf" &
+pids+=($!)
+
+for i in $(seq 1 "$workers"); do
+    port=$((8080 + i))
+    printf 'signaling_port=%d\nrouter_host=127.0.0.1\nrouter_port=8090\n' "$port" > "$tmp/worker$i.conf"
+    ./build/cube_server "$tmp/worker$i.conf" &
+    pids+=($!)
+done
+
+wait
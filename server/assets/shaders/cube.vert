@@ -1,11 +1,18 @@
 attribute vec3 a_pos;
 attribute vec3 a_color;
+// Per instance: xyz offset and uniform scale, then yaw/pitch in radians.
+attribute vec4 a_offset_scale;
+attribute vec2 a_rotation;
 
-uniform mat4 u_mvp;
+uniform mat4 u_view_proj;
 
 varying vec3 v_color;
 
 void main() {
+    float cy = cos(a_rotation.x); float sy = sin(a_rotation.x);
+    float cx = cos(a_rotation.y); float sx = sin(a_rotation.y);
+    vec3 p = vec3(a_pos.x, cx * a_pos.y - sx * a_pos.z, sx * a_pos.y + cx * a_pos.z);
+    p = vec3(cy * p.x + sy * p.z, p.y, -sy * p.x + cy * p.z);
     v_color = a_color;
-    gl_Position = u_mvp * vec4(a_pos, 1.0);
+    gl_Position = u_view_proj * vec4(p * a_offset_scale.w + a_offset_scale.xyz, 1.0);
 }
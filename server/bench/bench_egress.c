@@ -0,0 +1,313 @@
+// sendmmsg and struct mmsghdr.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Fans one view's RTP out to many peers over loopback and compares egress
+// strategies at the same packet load:
+//   sendto    one socket per peer, one sendto per packet (libnice today)
+//   sendmmsg  one socket per peer, one sendmmsg per peer and slot
+//   shared    one socket for every peer, one sendmmsg per slot
+//   gso       shared socket, one UDP_SEGMENT message per peer and slot
+// Peers are spread over `slots` send times per frame interval, so a frame
+// never leaves as one burst. Every peer's packets are distinct memory, as
+// SRTP makes them. The sink socket is never read; loopback drops what does
+// not fit, which costs the sender nothing extra.
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// RTP header, payload and SRTP auth tag, as webrtcbin sends them.
+#define BENCH_PACKET 1200
+// UIO_MAXIOV: most messages one sendmmsg takes.
+#define BENCH_BATCH 1024
+// Most segments the kernel accepts in one GSO send.
+#define BENCH_GSO_SEGMENTS 64
+
+typedef enum {
+    BENCH_SENDTO,
+    BENCH_SENDMMSG,
+    BENCH_SHARED,
+    BENCH_GSO
+} bench_mode;
+
+typedef struct {
+    int peers;
+    int packets;
+    size_t last_len;
+    int slots;
+    int *fds;
+    struct sockaddr_in sink;
+    uint8_t *payload;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } *cmsgs;
+    uint64_t syscalls;
+    uint64_t errors;
+} bench_egress;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint8_t *packet_data(bench_egress *b, int peer, int packet) {
+    return b->payload + ((size_t)peer * (size_t)b->packets + (size_t)packet) * BENCH_PACKET;
+}
+
+static size_t packet_len(bench_egress *b, int packet) {
+    return packet == b->packets - 1 ? b->last_len : BENCH_PACKET;
+}
+
+static void flush(bench_egress *b, int fd, int count) {
+    int sent = 0;
+    while (sent < count) {
+        int ret = sendmmsg(fd, b->msgs + sent, (unsigned int)(count - sent), 0);
+        b->syscalls++;
+        if (ret <= 0) {
+            b->errors += (uint64_t)(count - sent);
+            return;
+        }
+        sent += ret;
+    }
+}
+
+// Queues one message of packets [first, first + count) of a peer; a
+// multi-packet message is one GSO send of BENCH_PACKET segments.
+static int queue_message(bench_egress *b, int index, int peer, int first, int count) {
+    size_t len = 0;
+    for (int i = first; i < first + count; ++i) {
+        len += packet_len(b, i);
+    }
+    b->iovs[index].iov_base = packet_data(b, peer, first);
+    b->iovs[index].iov_len = len;
+    struct msghdr *hdr = &b->msgs[index].msg_hdr;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_name = &b->sink;
+    hdr->msg_namelen = sizeof(b->sink);
+    hdr->msg_iov = &b->iovs[index];
+    hdr->msg_iovlen = 1;
+    if (count > 1) {
+        hdr->msg_control = b->cmsgs[index].buf;
+        hdr->msg_controllen = sizeof(b->cmsgs[index].buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t segment = BENCH_PACKET;
+        memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+    }
+    return index + 1;
+}
+
+static void send_slot(bench_egress *b, bench_mode mode, int slot) {
+    int queued = 0;
+    for (int peer = slot; peer < b->peers; peer += b->slots) {
+        switch (mode) {
+        case BENCH_SENDTO:
+            for (int i = 0; i < b->packets; ++i) {
+                ssize_t ret = sendto(b->fds[peer], packet_data(b, peer, i), packet_len(b, i), 0,
+                                     (const struct sockaddr *)&b->sink, sizeof(b->sink));
+                b->syscalls++;
+                if (ret < 0) {
+                    b->errors++;
+                }
+            }
+            break;
+        case BENCH_SENDMMSG:
+            for (int i = 0; i < b->packets; ++i) {
+                queued = queue_message(b, queued, peer, i, 1);
+                if (queued == BENCH_BATCH) {
+                    flush(b, b->fds[peer], queued);
+                    queued = 0;
+                }
+            }
+            if (queued > 0) {
+                flush(b, b->fds[peer], queued);
+                queued = 0;
+            }
+            break;
+        case BENCH_SHARED:
+        case BENCH_GSO: {
+            int step = mode == BENCH_GSO ? BENCH_GSO_SEGMENTS : 1;
+            for (int i = 0; i < b->packets; i += step) {
+                int count = b->packets - i < step ? b->packets - i : step;
+                queued = queue_message(b, queued, peer, i, count);
+                if (queued == BENCH_BATCH) {
+                    flush(b, b->fds[0], queued);
+                    queued = 0;
+                }
+            }
+            break;
+        }
+        }
+    }
+    if (queued > 0) {
+        flush(b, b->fds[0], queued);
+    }
+}
+
+static void close_sockets(bench_egress *b, int count) {
+    for (int i = 0; i < count; ++i) {
+        close(b->fds[i]);
+    }
+}
+
+// Sends in real time for `frames` frames; returns 0 with the row printed,
+// or -1 when the mode cannot run here.
+static int run_mode(bench_egress *b, bench_mode mode, const char *name, int fps, int frames) {
+    int shared = mode == BENCH_SHARED || mode == BENCH_GSO;
+    int sockets = shared ? 1 : b->peers;
+    for (int i = 0; i < sockets; ++i) {
+        b->fds[i] = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (b->fds[i] < 0) {
+            fprintf(stderr, "%s: socket %d: %s\n", name, i, strerror(errno));
+            close_sockets(b, i);
+            return -1;
+        }
+    }
+    if (mode == BENCH_GSO) {
+        // Rejected by kernels older than 4.18, the first with UDP GSO.
+        int segment = BENCH_PACKET;
+        if (setsockopt(b->fds[0], SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) != 0) {
+            printf("%-9s not supported by this kernel (%s)\n", name, strerror(errno));
+            close_sockets(b, sockets);
+            return -1;
+        }
+    }
+
+    b->syscalls = 0;
+    b->errors = 0;
+    uint64_t interval = 1000000000ull / (uint64_t)fps;
+    uint64_t slot_interval = interval / (uint64_t)b->slots;
+    uint64_t max_slot_ns = 0;
+    int late = 0;
+    uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t start = clock_ns(CLOCK_MONOTONIC) + interval;
+    for (int frame = 0; frame < frames; ++frame) {
+        for (int slot = 0; slot < b->slots; ++slot) {
+            uint64_t deadline = start + (uint64_t)frame * interval + (uint64_t)slot * slot_interval;
+            uint64_t now = clock_ns(CLOCK_MONOTONIC);
+            if (now < deadline) {
+                struct timespec ts = { (time_t)(deadline / 1000000000ull), (long)(deadline % 1000000000ull) };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            } else if (now > deadline + slot_interval) {
+                late++;
+            }
+            uint64_t begin = clock_ns(CLOCK_MONOTONIC);
+            send_slot(b, mode, slot);
+            uint64_t took = clock_ns(CLOCK_MONOTONIC) - begin;
+            if (took > max_slot_ns) {
+                max_slot_ns = took;
+            }
+        }
+    }
+    uint64_t cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    close_sockets(b, sockets);
+
+    double cpu_us_frame = cpu_ns / 1e3 / frames;
+    printf("%-9s %12.1f %12.1f %12.2f %8.1f %10.1f %6d %8llu\n", name,
+           (double)b->syscalls / frames, cpu_us_frame, cpu_us_frame / b->peers,
+           cpu_ns * 100.0 / ((double)frames * (double)interval), max_slot_ns / 1e3, late,
+           (unsigned long long)b->errors);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int peers = argc > 1 ? atoi(argv[1]) : 200;
+    int kbps = argc > 2 ? atoi(argv[2]) : 1500;
+    int fps = argc > 3 ? atoi(argv[3]) : 30;
+    int seconds = argc > 4 ? atoi(argv[4]) : 3;
+    int slots = argc > 5 ? atoi(argv[5]) : 4;
+    if (peers <= 0 || kbps <= 0 || fps <= 0 || seconds <= 0 || slots <= 0) {
+        fprintf(stderr, "usage: cube_bench_egress [peers kbps fps seconds slots]\n");
+        return 1;
+    }
+    if (slots > peers) {
+        slots = peers;
+    }
+
+    // One socket per peer in the per-peer modes, as libnice has.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    bench_egress b;
+    memset(&b, 0, sizeof(b));
+    size_t frame_bytes = (size_t)kbps * 1000 / 8 / (size_t)fps;
+    b.peers = peers;
+    b.slots = slots;
+    b.packets = (int)((frame_bytes + BENCH_PACKET - 1) / BENCH_PACKET);
+    if (b.packets < 1) {
+        b.packets = 1;
+    }
+    b.last_len = frame_bytes - (size_t)(b.packets - 1) * BENCH_PACKET;
+    if (b.last_len == 0 || b.last_len > BENCH_PACKET) {
+        b.last_len = BENCH_PACKET;
+    }
+
+    b.fds = (int *)calloc((size_t)peers, sizeof(int));
+    b.payload = (uint8_t *)malloc((size_t)peers * (size_t)b.packets * BENCH_PACKET);
+    b.msgs = (struct mmsghdr *)calloc(BENCH_BATCH, sizeof(struct mmsghdr));
+    b.iovs = (struct iovec *)calloc(BENCH_BATCH, sizeof(struct iovec));
+    b.cmsgs = calloc(BENCH_BATCH, sizeof(*b.cmsgs));
+    int sink = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (!b.fds || !b.payload || !b.msgs || !b.iovs || !b.cmsgs || sink < 0) {
+        fprintf(stderr, "Setup failed\n");
+        return 1;
+    }
+    for (size_t i = 0; i < (size_t)peers * (size_t)b.packets * BENCH_PACKET; ++i) {
+        b.payload[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+
+    b.sink.sin_family = AF_INET;
+    b.sink.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t sink_len = sizeof(b.sink);
+    if (bind(sink, (const struct sockaddr *)&b.sink, sizeof(b.sink)) != 0 ||
+        getsockname(sink, (struct sockaddr *)&b.sink, &sink_len) != 0) {
+        fprintf(stderr, "Sink bind failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    printf("%d peers, %d packets per frame (%zu bytes), %d fps, %d slots per frame\n",
+           peers, b.packets, frame_bytes, fps, slots);
+    printf("%-9s %12s %12s %12s %8s %10s %6s %8s\n", "mode", "syscalls/fr", "cpu_us/fr",
+           "cpu_us/peer", "cpu_%", "max_slot_us", "late", "errors");
+    const struct {
+        bench_mode mode;
+        const char *name;
+    } modes[] = {
+        { BENCH_SENDTO, "sendto" },
+        { BENCH_SENDMMSG, "sendmmsg" },
+        { BENCH_SHARED, "shared" },
+        { BENCH_GSO, "gso" },
+    };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        run_mode(&b, modes[i].mode, modes[i].name, fps, fps * seconds);
+    }
+
+    close(sink);
+    free(b.cmsgs);
+    free(b.iovs);
+    free(b.msgs);
+    free(b.payload);
+    free(b.fds);
+    return 0;
+}
@@ -0,0 +1,832 @@
+#include "pipeline.h"
+#include "render.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Rate-distortion sweep. Renders a fixed sequence with cs_render_frame, then
+// for every encoder[:preset] config and target bitrate streams it in real
+// time through a cs_pipeline (the server's appsrc, videoconvert, view
+// encoder and stream branch), collects the access units a cs-stream viewer
+// would get, decodes them with avdec_h264 and scores them against the I420
+// the pipeline encoded. Frames the leaky view queue dropped are scored as
+// the previous frame repeated, as a viewer sees them.
+//
+// Reports per point: delivered kbps, luma and all-plane PSNR, luma SSIM
+// (x264's 8x8 windows at a 4-pixel step) and encode CPU per frame (process
+// CPU of the run minus the RGBA to I420 conversion). Per config: BD-rate
+// against the first config on PSNR-Y, and the bitrate and CPU at which it
+// reaches the quality bar. Run once per resolution of interest.
+
+#define BENCH_FPS 30
+#define BENCH_MAX_CONFIGS 16
+#define BENCH_MAX_BITRATES 16
+// Time for the pre-roll frame to clear the encoder before the view opens.
+#define BENCH_SETTLE_NS 500000000ull
+// Longest wait for the last frames to leave the encoder.
+#define BENCH_DRAIN_NS 2000000000ull
+
+typedef struct {
+    const char *encoder;
+    // NULL keeps the pipeline's default.
+    const char *preset;
+    char name[64];
+} bench_config;
+
+typedef struct {
+    int target_kbps;
+    int ok;
+    double kbps;
+    double psnr_y;
+    double psnr_yuv;
+    double ssim_y;
+    double enc_ms;
+    int dropped;
+} bench_point;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    int index;
+} bench_unit;
+
+// Access units of one run, indexed by source frame.
+typedef struct {
+    int frames;
+    bench_unit *units;
+    int count;
+    int64_t first_pts_us;
+    int last_index;
+    uint64_t bytes;
+} bench_encode;
+
+// Packed I420 source frames and the scratch the metrics need.
+typedef struct {
+    int width;
+    int height;
+    int frames;
+    int plane_width[3];
+    int plane_height[3];
+    size_t plane_offset[3];
+    size_t frame_size;
+    uint8_t **i420;
+    double convert_ms;
+    int (*blocks)[4];
+} bench_source;
+
+typedef struct {
+    uint64_t sse[3];
+    double pixels[3];
+    double ssim;
+    int scored;
+} bench_score;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline) {
+    struct timespec ts = { (time_t)(deadline / 1000000000ull), (long)(deadline % 1000000000ull) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+// Sum of squared differences over one plane.
+static uint64_t plane_sse(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height) {
+    uint64_t total = 0;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *pa = a + (size_t)y * (size_t)a_stride;
+        const uint8_t *pb = b + (size_t)y * (size_t)b_stride;
+        int x = 0;
+#if defined(__SSE2__)
+        // 16-bit differences squared and pair-summed into 32-bit lanes; one
+        // row cannot overflow them below 250k pixels.
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        for (; x + 16 <= width; x += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *)(pa + x));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(pb + x));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        total += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; x + 16 <= width; x += 16) {
+            uint8x16_t d = vabdq_u8(vld1q_u8(pa + x), vld1q_u8(pb + x));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+        }
+        total += vaddvq_u32(acc);
+#endif
+        for (; x < width; ++x) {
+            int d = (int)pa[x] - (int)pb[x];
+            total += (uint64_t)(d * d);
+        }
+    }
+    return total;
+}
+
+// Sums of a, b, a^2 + b^2 and a*b over one 4x4 block.
+static void block_sums_4x4(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int sums[4]) {
+    memset(sums, 0, 4 * sizeof(int));
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 4; ++x) {
+            int va = a[y * a_stride + x];
+            int vb = b[y * b_stride + x];
+            sums[0] += va;
+            sums[1] += vb;
+            sums[2] += va * va + vb * vb;
+            sums[3] += va * vb;
+        }
+    }
+}
+
+// The same for two horizontally adjacent blocks.
+static void block_sums_8x4(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int sums[2][4]) {
+#if defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+    int32_t lanes[4][4];
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i ones = _mm_set1_epi16(1);
+    __m128i s1 = zero;
+    __m128i s2 = zero;
+    __m128i ss = zero;
+    __m128i s12 = zero;
+    for (int y = 0; y < 4; ++y) {
+        __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + y * a_stride)), zero);
+        __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + y * b_stride)), zero);
+        s1 = _mm_add_epi32(s1, _mm_madd_epi16(va, ones));
+        s2 = _mm_add_epi32(s2, _mm_madd_epi16(vb, ones));
+        ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(va, va), _mm_madd_epi16(vb, vb)));
+        s12 = _mm_add_epi32(s12, _mm_madd_epi16(va, vb));
+    }
+    _mm_storeu_si128((__m128i *)lanes[0], s1);
+    _mm_storeu_si128((__m128i *)lanes[1], s2);
+    _mm_storeu_si128((__m128i *)lanes[2], ss);
+    _mm_storeu_si128((__m128i *)lanes[3], s12);
+#else
+    uint32x4_t s1 = vdupq_n_u32(0);
+    uint32x4_t s2 = s1;
+    uint32x4_t ss = s1;
+    uint32x4_t s12 = s1;
+    for (int y = 0; y < 4; ++y) {
+        uint8x8_t va = vld1_u8(a + y * a_stride);
+        uint8x8_t vb = vld1_u8(b + y * b_stride);
+        s1 = vpadalq_u16(s1, vmovl_u8(va));
+        s2 = vpadalq_u16(s2, vmovl_u8(vb));
+        ss = vpadalq_u16(ss, vmull_u8(va, va));
+        ss = vpadalq_u16(ss, vmull_u8(vb, vb));
+        s12 = vpadalq_u16(s12, vmull_u8(va, vb));
+    }
+    vst1q_s32(lanes[0], vreinterpretq_s32_u32(s1));
+    vst1q_s32(lanes[1], vreinterpretq_s32_u32(s2));
+    vst1q_s32(lanes[2], vreinterpretq_s32_u32(ss));
+    vst1q_s32(lanes[3], vreinterpretq_s32_u32(s12));
+#endif
+    // Lanes hold column pairs 0-1, 2-3, 4-5 and 6-7.
+    for (int k = 0; k < 4; ++k) {
+        sums[0][k] = lanes[k][0] + lanes[k][1];
+        sums[1][k] = lanes[k][2] + lanes[k][3];
+    }
+#else
+    block_sums_4x4(a, a_stride, b, b_stride, sums[0]);
+    block_sums_4x4(a + 4, a_stride, b + 4, b_stride, sums[1]);
+#endif
+}
+
+// SSIM of one 8x8 window from its four blocks, with x264's constants.
+static double ssim_window(const int *b0, const int *b1, const int *b2, const int *b3) {
+    const double c1 = .01 * .01 * 255 * 255 * 64;
+    const double c2 = .03 * .03 * 255 * 255 * 64 * 63;
+    double s1 = b0[0] + b1[0] + b2[0] + b3[0];
+    double s2 = b0[1] + b1[1] + b2[1] + b3[1];
+    double ss = b0[2] + b1[2] + b2[2] + b3[2];
+    double s12 = b0[3] + b1[3] + b2[3] + b3[3];
+    double vars = ss * 64 - s1 * s1 - s2 * s2;
+    double covar = s12 * 64 - s1 * s2;
+    return (2 * s1 * s2 + c1) * (2 * covar + c2) / ((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+}
+
+// Mean SSIM over every 8x8 window at a 4-pixel step. blocks holds
+// (width / 4) * (height / 4) entries.
+static double plane_ssim(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height,
+                         int (*blocks)[4]) {
+    int bw = width / 4;
+    int bh = height / 4;
+    if (bw < 2 || bh < 2) {
+        return 1.0;
+    }
+    for (int by = 0; by < bh; ++by) {
+        const uint8_t *ra = a + (size_t)by * 4 * (size_t)a_stride;
+        const uint8_t *rb = b + (size_t)by * 4 * (size_t)b_stride;
+        int (*row)[4] = blocks + (size_t)by * (size_t)bw;
+        int bx = 0;
+        for (; bx + 2 <= bw; bx += 2) {
+            block_sums_8x4(ra + bx * 4, a_stride, rb + bx * 4, b_stride, &row[bx]);
+        }
+        if (bx < bw) {
+            block_sums_4x4(ra + bx * 4, a_stride, rb + bx * 4, b_stride, row[bx]);
+        }
+    }
+    double total = 0.0;
+    for (int by = 0; by + 1 < bh; ++by) {
+        int (*top)[4] = blocks + (size_t)by * (size_t)bw;
+        int (*bottom)[4] = top + bw;
+        for (int bx = 0; bx + 1 < bw; ++bx) {
+            total += ssim_window(top[bx], top[bx + 1], bottom[bx], bottom[bx + 1]);
+        }
+    }
+    return total / ((double)(bw - 1) * (double)(bh - 1));
+}
+
+static double psnr(uint64_t sse, double pixels) {
+    if (pixels <= 0.0) {
+        return 0.0;
+    }
+    if (sse == 0) {
+        return 99.0;
+    }
+    return 10.0 * log10(255.0 * 255.0 * pixels / (double)sse);
+}
+
+// Scores decoded frame planes against source frame index.
+static void score_frame(const bench_source *src, int index, const uint8_t *const planes[3], const int strides[3],
+                        bench_score *score) {
+    const uint8_t *ref = src->i420[index];
+    for (int p = 0; p < 3; ++p) {
+        score->sse[p] += plane_sse(ref + src->plane_offset[p], src->plane_width[p], planes[p], strides[p],
+                                   src->plane_width[p], src->plane_height[p]);
+        score->pixels[p] += (double)src->plane_width[p] * (double)src->plane_height[p];
+    }
+    score->ssim += plane_ssim(ref, src->plane_width[0], planes[0], strides[0], src->width, src->height,
+                              src->blocks);
+    score->scored++;
+}
+
+static GstElement *parse_pipeline(const char *description) {
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+    if (!pipeline) {
+        fprintf(stderr, "Pipeline parse failed: %s\n", error ? error->message : "unknown");
+    }
+    if (error) {
+        g_error_free(error);
+    }
+    return pipeline;
+}
+
+// Converts the rendered frames to I420 with the pipeline's own videoconvert
+// settings and times that, so it can be taken out of the encode cost.
+static int convert_source(bench_source *src, uint8_t **rgba) {
+    GstElement *pipeline = parse_pipeline(
+        "appsrc name=src format=time ! videoconvert ! video/x-raw,format=I420 ! appsink name=sink sync=false");
+    if (!pipeline) {
+        return -1;
+    }
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format", G_TYPE_STRING, "RGBA",
+                                        "width", G_TYPE_INT, src->width,
+                                        "height", G_TYPE_INT, src->height,
+                                        "framerate", GST_TYPE_FRACTION, BENCH_FPS, 1,
+                                        NULL);
+    g_object_set(G_OBJECT(appsrc), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    size_t rgba_size = (size_t)src->width * (size_t)src->height * 4;
+    uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    for (int i = 0; i < src->frames; ++i) {
+        GstBuffer *buffer = gst_buffer_new_wrapped_full(0, rgba[i], rgba_size, 0, rgba_size, NULL, NULL);
+        GST_BUFFER_PTS(buffer) = (GstClockTime)i * GST_SECOND / BENCH_FPS;
+        GST_BUFFER_DURATION(buffer) = GST_SECOND / BENCH_FPS;
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+
+    int converted = 0;
+    GstSample *sample;
+    while (converted < src->frames && (sample = gst_app_sink_pull_sample(GST_APP_SINK(sink)))) {
+        GstVideoInfo info;
+        GstVideoFrame frame;
+        if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+            gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+            for (int p = 0; p < 3; ++p) {
+                const uint8_t *in = (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, p);
+                int stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, p);
+                uint8_t *out = src->i420[converted] + src->plane_offset[p];
+                for (int y = 0; y < src->plane_height[p]; ++y) {
+                    memcpy(out + (size_t)y * (size_t)src->plane_width[p], in + (size_t)y * (size_t)stride,
+                           (size_t)src->plane_width[p]);
+                }
+            }
+            gst_video_frame_unmap(&frame);
+            ++converted;
+        }
+        gst_sample_unref(sample);
+    }
+    src->convert_ms = (double)(clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e6 / src->frames;
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(appsrc);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return converted == src->frames ? 0 : -1;
+}
+
+// Stream units carry the capture time as PTS, so the first keyframe after
+// the view opened is frame 0 and the rest follow at the frame interval.
+static void on_view_unit(void *user, int view, const cs_pipeline_unit *unit) {
+    bench_encode *enc = (bench_encode *)user;
+    (void)view;
+    if (enc->first_pts_us < 0) {
+        if (!unit->keyframe) {
+            return;
+        }
+        enc->first_pts_us = (int64_t)unit->pts_us;
+    }
+    long long index = llround(((double)unit->pts_us - (double)enc->first_pts_us) * BENCH_FPS / 1e6);
+    if (index < 0 || index >= enc->frames || enc->count == enc->frames) {
+        return;
+    }
+    bench_unit *out = &enc->units[enc->count];
+    out->data = (uint8_t *)malloc(unit->len);
+    if (!out->data) {
+        return;
+    }
+    memcpy(out->data, unit->data, unit->len);
+    out->len = unit->len;
+    out->index = (int)index;
+    enc->count++;
+    enc->last_index = (int)index;
+    enc->bytes += unit->len;
+}
+
+static void poll_for(cs_pipeline *pipeline, uint64_t ns) {
+    uint64_t end = clock_ns(CLOCK_MONOTONIC) + ns;
+    while (clock_ns(CLOCK_MONOTONIC) < end) {
+        cs_pipeline_poll(pipeline);
+        sleep_until(clock_ns(CLOCK_MONOTONIC) + 5000000ull);
+    }
+}
+
+// Pushes the sequence in real time, as the render loop does, so rate
+// control and the leaky view queue behave as in the server.
+static int encode_run(const bench_source *src, uint8_t **rgba, const bench_config *config, int bitrate_kbps,
+                      bench_encode *enc, double *cpu_ms) {
+    cs_pipeline_config cfg = {
+        .width = src->width,
+        .height = src->height,
+        .atlas_cols = 1,
+        .atlas_rows = 1,
+        .fps = BENCH_FPS,
+        .bitrate_kbps = bitrate_kbps,
+        .encoder = config->encoder,
+        .encoder_preset = config->preset,
+        .ice_tcp = 1,
+        .user = enc,
+        .on_view_unit = on_view_unit,
+    };
+    cs_pipeline *pipeline = cs_pipeline_create(&cfg);
+    if (!pipeline) {
+        return -1;
+    }
+    poll_for(pipeline, BENCH_SETTLE_NS);
+    cs_pipeline_watch_view(pipeline, 0, 1);
+    cs_pipeline_request_keyframe(pipeline, 0);
+
+    size_t rgba_size = (size_t)src->width * (size_t)src->height * 4;
+    uint64_t interval = 1000000000ull / BENCH_FPS;
+    uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t start = clock_ns(CLOCK_MONOTONIC) + interval;
+    for (int i = 0; i < src->frames; ++i) {
+        uint64_t deadline = start + (uint64_t)i * interval;
+        sleep_until(deadline);
+        cs_pipeline_push_wrapped(pipeline, rgba[i], rgba_size, deadline, NULL, 0, NULL, NULL);
+        cs_pipeline_poll(pipeline);
+    }
+    uint64_t drain_end = clock_ns(CLOCK_MONOTONIC) + BENCH_DRAIN_NS;
+    while (enc->last_index < src->frames - 1 && clock_ns(CLOCK_MONOTONIC) < drain_end) {
+        sleep_until(clock_ns(CLOCK_MONOTONIC) + 2000000ull);
+        cs_pipeline_poll(pipeline);
+    }
+    *cpu_ms = (double)(clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e6 / src->frames;
+
+    cs_pipeline_watch_view(pipeline, 0, -1);
+    cs_pipeline_destroy(pipeline);
+    return 0;
+}
+
+// Decodes the collected units and scores every source frame; a frame that
+// never arrived is scored as the last one decoded before it.
+static int decode_and_score(const bench_source *src, const bench_encode *enc, bench_score *score, int *dropped) {
+    GstElement *pipeline = parse_pipeline(
+        "appsrc name=src format=time ! h264parse ! avdec_h264 ! videoconvert ! video/x-raw,format=I420 ! "
+        "appsink name=sink sync=false");
+    if (!pipeline) {
+        return -1;
+    }
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstCaps *caps = gst_caps_new_simple("video/x-h264",
+                                        "stream-format", G_TYPE_STRING, "byte-stream",
+                                        "alignment", G_TYPE_STRING, "au",
+                                        NULL);
+    g_object_set(G_OBJECT(appsrc), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    for (int i = 0; i < enc->count; ++i) {
+        const bench_unit *unit = &enc->units[i];
+        GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, unit->data, unit->len, 0,
+                                                        unit->len, NULL, NULL);
+        GST_BUFFER_PTS(buffer) = (GstClockTime)unit->index * GST_SECOND / BENCH_FPS;
+        GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+
+    uint8_t *held = (uint8_t *)malloc(src->frame_size);
+    const uint8_t *held_planes[3] = { 0 };
+    int held_strides[3] = { src->plane_width[0], src->plane_width[1], src->plane_width[2] };
+    int next = 0;
+    *dropped = 0;
+    GstSample *sample;
+    while (held && (sample = gst_app_sink_pull_sample(GST_APP_SINK(sink)))) {
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        GstVideoInfo info;
+        GstVideoFrame frame;
+        long long index = llround((double)GST_BUFFER_PTS(buffer) * BENCH_FPS / GST_SECOND);
+        if (index >= next && index < src->frames &&
+            gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+            GST_VIDEO_INFO_WIDTH(&info) == src->width && GST_VIDEO_INFO_HEIGHT(&info) == src->height &&
+            gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ)) {
+            for (; next < index; ++next) {
+                if (held_planes[0]) {
+                    score_frame(src, next, held_planes, held_strides, score);
+                }
+                (*dropped)++;
+            }
+            const uint8_t *planes[3];
+            int strides[3];
+            for (int p = 0; p < 3; ++p) {
+                planes[p] = (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, p);
+                strides[p] = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, p);
+                uint8_t *out = held + src->plane_offset[p];
+                for (int y = 0; y < src->plane_height[p]; ++y) {
+                    memcpy(out + (size_t)y * (size_t)src->plane_width[p], planes[p] + (size_t)y * (size_t)strides[p],
+                           (size_t)src->plane_width[p]);
+                }
+                held_planes[p] = out;
+            }
+            score_frame(src, (int)index, planes, strides, score);
+            gst_video_frame_unmap(&frame);
+            next = (int)index + 1;
+        }
+        gst_sample_unref(sample);
+    }
+    for (; next < src->frames; ++next) {
+        if (held_planes[0]) {
+            score_frame(src, next, held_planes, held_strides, score);
+        }
+        (*dropped)++;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(appsrc);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    free(held);
+    return score->scored == src->frames ? 0 : -1;
+}
+
+static int measure_point(const bench_source *src, uint8_t **rgba, const bench_config *config, bench_point *point) {
+    bench_encode enc = {
+        .frames = src->frames,
+        .units = (bench_unit *)calloc((size_t)src->frames, sizeof(bench_unit)),
+        .first_pts_us = -1,
+        .last_index = -1,
+    };
+    bench_score score;
+    memset(&score, 0, sizeof(score));
+    double cpu_ms = 0.0;
+    int status = -1;
+    if (enc.units && encode_run(src, rgba, config, point->target_kbps, &enc, &cpu_ms) == 0 && enc.count > 0 &&
+        decode_and_score(src, &enc, &score, &point->dropped) == 0) {
+        uint64_t sse_all = score.sse[0] + score.sse[1] + score.sse[2];
+        point->kbps = (double)enc.bytes * 8.0 * BENCH_FPS / (double)src->frames / 1000.0;
+        point->psnr_y = psnr(score.sse[0], score.pixels[0]);
+        point->psnr_yuv = psnr(sse_all, score.pixels[0] + score.pixels[1] + score.pixels[2]);
+        point->ssim_y = score.ssim / score.scored;
+        point->enc_ms = cpu_ms - src->convert_ms;
+        point->ok = 1;
+        status = 0;
+    }
+    for (int i = 0; i < enc.count; ++i) {
+        free(enc.units[i].data);
+    }
+    free(enc.units);
+    return status;
+}
+
+// Least-squares cubic through (x, y); 0 on success.
+static int fit_cubic(const double *x, const double *y, int n, double coeff[4]) {
+    double m[4][5];
+    memset(m, 0, sizeof(m));
+    for (int i = 0; i < n; ++i) {
+        double pow_x[7] = { 1.0 };
+        for (int k = 1; k < 7; ++k) {
+            pow_x[k] = pow_x[k - 1] * x[i];
+        }
+        for (int r = 0; r < 4; ++r) {
+            for (int c = 0; c < 4; ++c) {
+                m[r][c] += pow_x[r + c];
+            }
+            m[r][4] += pow_x[r] * y[i];
+        }
+    }
+    for (int c = 0; c < 4; ++c) {
+        int pivot = c;
+        for (int r = c + 1; r < 4; ++r) {
+            if (fabs(m[r][c]) > fabs(m[pivot][c])) {
+                pivot = r;
+            }
+        }
+        if (fabs(m[pivot][c]) < 1e-12) {
+            return -1;
+        }
+        for (int k = 0; k < 5; ++k) {
+            double t = m[c][k];
+            m[c][k] = m[pivot][k];
+            m[pivot][k] = t;
+        }
+        for (int r = 0; r < 4; ++r) {
+            if (r != c) {
+                double f = m[r][c] / m[c][c];
+                for (int k = c; k < 5; ++k) {
+                    m[r][k] -= f * m[c][k];
+                }
+            }
+        }
+    }
+    for (int c = 0; c < 4; ++c) {
+        coeff[c] = m[c][4] / m[c][c];
+    }
+    return 0;
+}
+
+static double cubic_integral(const double coeff[4], double lo, double hi) {
+    double total = 0.0;
+    for (int k = 0; k < 4; ++k) {
+        total += coeff[k] * (pow(hi, k + 1) - pow(lo, k + 1)) / (k + 1);
+    }
+    return total;
+}
+
+// Bjontegaard delta rate on PSNR-Y: the average bitrate difference of test
+// against ref at equal quality over their common PSNR range, in percent.
+// NAN with fewer than four points on either curve or no overlap.
+static double bd_rate(const bench_point *ref, const bench_point *test, int n) {
+    double x[2][BENCH_MAX_BITRATES];
+    double y[2][BENCH_MAX_BITRATES];
+    double lo[2] = { INFINITY, INFINITY };
+    double hi[2] = { -INFINITY, -INFINITY };
+    double coeff[2][4];
+    const bench_point *curves[2] = { ref, test };
+    for (int c = 0; c < 2; ++c) {
+        int count = 0;
+        for (int i = 0; i < n; ++i) {
+            if (!curves[c][i].ok || curves[c][i].kbps <= 0.0) {
+                continue;
+            }
+            x[c][count] = curves[c][i].psnr_y;
+            y[c][count] = log10(curves[c][i].kbps);
+            lo[c] = fmin(lo[c], x[c][count]);
+            hi[c] = fmax(hi[c], x[c][count]);
+            ++count;
+        }
+        if (count < 4 || fit_cubic(x[c], y[c], count, coeff[c]) != 0) {
+            return NAN;
+        }
+    }
+    double from = fmax(lo[0], lo[1]);
+    double to = fmin(hi[0], hi[1]);
+    if (to <= from) {
+        return NAN;
+    }
+    double diff = (cubic_integral(coeff[1], from, to) - cubic_integral(coeff[0], from, to)) / (to - from);
+    return (pow(10.0, diff) - 1.0) * 100.0;
+}
+
+static double quality_of(const bench_point *point, int use_ssim) {
+    return use_ssim ? point->ssim_y : point->psnr_y;
+}
+
+// Bitrate and encode CPU where the curve first reaches bar, interpolated
+// between measured points in log rate. -1 when no point reaches it.
+static int reach_bar(const bench_point *points, int n, double bar, int use_ssim, double *kbps, double *enc_ms) {
+    const bench_point *below = NULL;
+    for (int i = 0; i < n; ++i) {
+        const bench_point *point = &points[i];
+        if (!point->ok) {
+            continue;
+        }
+        double q = quality_of(point, use_ssim);
+        if (q < bar) {
+            below = point;
+            continue;
+        }
+        if (!below || q <= quality_of(below, use_ssim)) {
+            *kbps = point->kbps;
+            *enc_ms = point->enc_ms;
+            return 0;
+        }
+        double t = (bar - quality_of(below, use_ssim)) / (q - quality_of(below, use_ssim));
+        *kbps = pow(10.0, log10(below->kbps) + t * (log10(point->kbps) - log10(below->kbps)));
+        *enc_ms = below->enc_ms + t * (point->enc_ms - below->enc_ms);
+        return 0;
+    }
+    return -1;
+}
+
+static int parse_configs(char *list, bench_config *configs) {
+    int count = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(list, ",", &save); item && count < BENCH_MAX_CONFIGS;
+         item = strtok_r(NULL, ",", &save)) {
+        bench_config *config = &configs[count++];
+        snprintf(config->name, sizeof(config->name), "%s", item);
+        char *colon = strchr(item, ':');
+        if (colon) {
+            *colon = '\0';
+        }
+        config->encoder = item;
+        config->preset = colon && colon[1] ? colon + 1 : NULL;
+    }
+    return count;
+}
+
+static int parse_bitrates(const char *list, int *bitrates) {
+    int count = 0;
+    while (list && *list && count < BENCH_MAX_BITRATES) {
+        int kbps = atoi(list);
+        if (kbps > 0) {
+            bitrates[count++] = kbps;
+        }
+        list = strchr(list, ',');
+        list = list ? list + 1 : NULL;
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 640;
+    int height = argc > 2 ? atoi(argv[2]) : 480;
+    int frames = argc > 3 ? atoi(argv[3]) : 150;
+    char *config_list = strdup(argc > 4 ? argv[4] : "x264enc:ultrafast,x264enc:superfast,x264enc:veryfast,x264enc:faster");
+    const char *bitrate_list = argc > 5 ? argv[5] : "250,500,1000,1500,2500";
+    double bar = argc > 6 ? atof(argv[6]) : 38.0;
+    // A bar below 1 is an SSIM, anything else a PSNR-Y in dB.
+    int use_ssim = bar < 1.0;
+
+    bench_config configs[BENCH_MAX_CONFIGS];
+    int bitrates[BENCH_MAX_BITRATES];
+    int config_count = config_list ? parse_configs(config_list, configs) : 0;
+    int bitrate_count = parse_bitrates(bitrate_list, bitrates);
+    // Even sizes keep the chroma planes exact.
+    width &= ~1;
+    height &= ~1;
+    if (width <= 0 || height <= 0 || frames <= 0 || config_count == 0 || bitrate_count == 0) {
+        fprintf(stderr, "usage: cube_bench_quality [width height frames encoder[:preset],... kbps,... bar]\n");
+        return 1;
+    }
+
+    gst_init(&argc, &argv);
+
+    cs_render_config render_cfg = { .width = width, .height = height, .fps = (float)BENCH_FPS };
+    cs_renderer *renderer = cs_render_create(&render_cfg);
+    if (!renderer) {
+        fprintf(stderr, "Renderer init failed\n");
+        return 1;
+    }
+
+    bench_source src = {
+        .width = width,
+        .height = height,
+        .frames = frames,
+        .plane_width = { width, width / 2, width / 2 },
+        .plane_height = { height, height / 2, height / 2 },
+    };
+    src.plane_offset[1] = (size_t)width * (size_t)height;
+    src.plane_offset[2] = src.plane_offset[1] + (size_t)(width / 2) * (size_t)(height / 2);
+    src.frame_size = src.plane_offset[2] + (size_t)(width / 2) * (size_t)(height / 2);
+    src.i420 = (uint8_t **)calloc((size_t)frames, sizeof(uint8_t *));
+    src.blocks = calloc((size_t)(width / 4) * (size_t)(height / 4) + 1, sizeof(*src.blocks));
+    size_t rgba_size = (size_t)width * (size_t)height * 4;
+    uint8_t **rgba = (uint8_t **)calloc((size_t)frames, sizeof(uint8_t *));
+    bench_point *points = (bench_point *)calloc((size_t)config_count * (size_t)bitrate_count, sizeof(bench_point));
+    if (!src.i420 || !src.blocks || !rgba || !points) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < frames; ++i) {
+        rgba[i] = (uint8_t *)malloc(rgba_size);
+        src.i420[i] = (uint8_t *)malloc(src.frame_size);
+        if (!rgba[i] || !src.i420[i] || cs_render_frame(renderer, rgba[i], rgba_size, NULL) != 0) {
+            fprintf(stderr, "Render failed at frame %d\n", i);
+            return 1;
+        }
+    }
+    cs_render_destroy(renderer);
+    if (convert_source(&src, rgba) != 0) {
+        fprintf(stderr, "I420 conversion failed\n");
+        return 1;
+    }
+
+    printf("%dx%d, %d frames at %d fps; I420 conversion %.2f ms/frame (not in enc_ms)\n", width, height, frames,
+           BENCH_FPS, src.convert_ms);
+    printf("%-24s %7s %9s %8s %9s %8s %8s %8s\n", "config", "target", "kbps", "psnr_y", "psnr_yuv", "ssim_y",
+           "enc_ms", "dropped");
+    int status = 0;
+    for (int c = 0; c < config_count; ++c) {
+        for (int b = 0; b < bitrate_count; ++b) {
+            bench_point *point = &points[c * bitrate_count + b];
+            point->target_kbps = bitrates[b];
+            if (measure_point(&src, rgba, &configs[c], point) != 0) {
+                printf("%-24s %7d failed\n", configs[c].name, bitrates[b]);
+                status = 1;
+                continue;
+            }
+            printf("%-24s %7d %9.1f %8.2f %9.2f %8.4f %8.2f %8d\n", configs[c].name, bitrates[b], point->kbps,
+                   point->psnr_y, point->psnr_yuv, point->ssim_y, point->enc_ms, point->dropped);
+            fflush(stdout);
+        }
+    }
+
+    printf("\nBD-rate against %s; bar %s >= %.*f\n", configs[0].name, use_ssim ? "ssim_y" : "psnr_y",
+           use_ssim ? 4 : 2, bar);
+    printf("%-24s %9s %12s %12s\n", "config", "bd_rate", "kbps@bar", "enc_ms@bar");
+    int cheapest = -1;
+    double cheapest_kbps = 0.0;
+    double cheapest_ms = 0.0;
+    for (int c = 0; c < config_count; ++c) {
+        const bench_point *curve = &points[c * bitrate_count];
+        double bd = c == 0 ? 0.0 : bd_rate(points, curve, bitrate_count);
+        double kbps = 0.0;
+        double enc_ms = 0.0;
+        char bd_text[16];
+        if (isnan(bd)) {
+            snprintf(bd_text, sizeof(bd_text), "n/a");
+        } else {
+            snprintf(bd_text, sizeof(bd_text), "%+.1f%%", bd);
+        }
+        if (reach_bar(curve, bitrate_count, bar, use_ssim, &kbps, &enc_ms) != 0) {
+            printf("%-24s %9s %12s %12s\n", configs[c].name, bd_text, "not reached", "-");
+            continue;
+        }
+        printf("%-24s %9s %12.1f %12.2f\n", configs[c].name, bd_text, kbps, enc_ms);
+        if (cheapest < 0 || enc_ms < cheapest_ms) {
+            cheapest = c;
+            cheapest_kbps = kbps;
+            cheapest_ms = enc_ms;
+        }
+    }
+    if (cheapest >= 0) {
+        printf("Cheapest at the bar: %s, %.0f kbps, %.2f ms/frame\n", configs[cheapest].name, cheapest_kbps,
+               cheapest_ms);
+    } else {
+        printf("No config reaches the bar\n");
+    }
+
+    for (int i = 0; i < frames; ++i) {
+        free(rgba[i]);
+        free(src.i420[i]);
+    }
+    free(rgba);
+    free(src.i420);
+    free(src.blocks);
+    free(points);
+    free(config_list);
+    return status;
+}
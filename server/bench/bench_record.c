@@ -0,0 +1,256 @@
+#include "recorder.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Pushes frames in real time through an encoder whose output feeds a live
+// branch and, in the second run, the recording branch built exactly as
+// cs_pipeline does (leaky queue, h264parse, mpegtsmux, cs_recorder). Reports
+// push-to-live-output latency percentiles for both runs; recording must not
+// move them. Point dir at the storage to be judged.
+
+typedef struct {
+    int fps;
+    int frames;
+    uint64_t *pushed_ns;
+    uint64_t *latency_ns;
+    cs_recorder *recorder;
+} bench_run;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static GstFlowReturn on_live_sample(GstAppSink *sink, gpointer user_data) {
+    bench_run *run = (bench_run *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    uint64_t now = monotonic_ns();
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    guint64 index = GST_BUFFER_PTS(buffer) * (guint64)run->fps / GST_SECOND;
+    if (index < (guint64)run->frames && run->pushed_ns[index]) {
+        run->latency_ns[index] = now - run->pushed_ns[index];
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static GstFlowReturn on_record_sample(GstAppSink *sink, gpointer user_data) {
+    bench_run *run = (bench_run *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        int keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        cs_recorder_write(run->recorder, 0, map.data, map.size, keyframe);
+        gst_buffer_unmap(buffer, &map);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void fill_frame(uint8_t *rgba, int width, int height, int frame) {
+    // A moving gradient keeps the encoder busy without a renderer.
+    for (int y = 0; y < height; ++y) {
+        uint8_t *row = rgba + (size_t)y * (size_t)width * 4;
+        for (int x = 0; x < width; ++x) {
+            row[x * 4 + 0] = (uint8_t)(x + frame * 3);
+            row[x * 4 + 1] = (uint8_t)(y + frame * 2);
+            row[x * 4 + 2] = (uint8_t)((x ^ y) + frame);
+            row[x * 4 + 3] = 255;
+        }
+    }
+}
+
+static int run_once(bench_run *run, int width, int height, int bitrate_kbps) {
+    char description[1024];
+    int n = snprintf(description, sizeof(description),
+                     "appsrc name=src format=time is-live=true ! videoconvert ! video/x-raw,format=I420 ! "
+                     "x264enc tune=zerolatency speed-preset=ultrafast bitrate=%d ! tee name=t "
+                     "t. ! queue ! appsink name=live sync=false",
+                     bitrate_kbps);
+    if (run->recorder) {
+        snprintf(description + n, sizeof(description) - (size_t)n,
+                 " t. ! queue leaky=downstream max-size-buffers=0 max-size-bytes=0 max-size-time=1000000000 ! "
+                 "h264parse config-interval=-1 ! mpegtsmux alignment=7 ! appsink name=rec sync=false async=false");
+    }
+
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+    if (!pipeline) {
+        fprintf(stderr, "Pipeline parse failed: %s\n", error ? error->message : "unknown");
+        if (error) {
+            g_error_free(error);
+        }
+        return -1;
+    }
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *live = gst_bin_get_by_name(GST_BIN(pipeline), "live");
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format", G_TYPE_STRING, "RGBA",
+                                        "width", G_TYPE_INT, width,
+                                        "height", G_TYPE_INT, height,
+                                        "framerate", GST_TYPE_FRACTION, run->fps, 1,
+                                        NULL);
+    g_object_set(G_OBJECT(src), "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = on_live_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(live), &callbacks, run, NULL);
+    GstElement *rec = NULL;
+    if (run->recorder) {
+        rec = gst_bin_get_by_name(GST_BIN(pipeline), "rec");
+        GstAppSinkCallbacks record_callbacks = { 0 };
+        record_callbacks.new_sample = on_record_sample;
+        gst_app_sink_set_callbacks(GST_APP_SINK(rec), &record_callbacks, run, NULL);
+    }
+
+    memset(run->pushed_ns, 0, (size_t)run->frames * sizeof(uint64_t));
+    memset(run->latency_ns, 0, (size_t)run->frames * sizeof(uint64_t));
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    size_t frame_size = (size_t)width * (size_t)height * 4;
+    const uint64_t frame_ns = 1000000000ull / (uint64_t)run->fps;
+    uint64_t next = monotonic_ns();
+    for (int i = 0; i < run->frames; ++i) {
+        GstBuffer *buffer = gst_buffer_new_allocate(NULL, frame_size, NULL);
+        GstMapInfo map;
+        if (gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+            fill_frame(map.data, width, height, i);
+            gst_buffer_unmap(buffer, &map);
+        }
+        GST_BUFFER_PTS(buffer) = (GstClockTime)i * GST_SECOND / (GstClockTime)run->fps;
+        GST_BUFFER_DURATION(buffer) = GST_SECOND / (GstClockTime)run->fps;
+        run->pushed_ns[i] = monotonic_ns();
+        gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+
+        next += frame_ns;
+        struct timespec until = { (time_t)(next / 1000000000ull), (long)(next % 1000000000ull) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, 5 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (msg) {
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    if (rec) {
+        gst_object_unref(rec);
+    }
+    gst_object_unref(live);
+    gst_object_unref(src);
+    gst_object_unref(pipeline);
+    return 0;
+}
+
+static void report(const char *label, bench_run *run, const cs_recorder_stats *stats) {
+    uint64_t *sorted = (uint64_t *)malloc((size_t)run->frames * sizeof(uint64_t));
+    int count = 0;
+    if (!sorted) {
+        return;
+    }
+    for (int i = 0; i < run->frames; ++i) {
+        if (run->latency_ns[i]) {
+            sorted[count++] = run->latency_ns[i];
+        }
+    }
+    if (count == 0) {
+        printf("%-10s %8d %10s %10s %10s\n", label, 0, "-", "-", "-");
+        free(sorted);
+        return;
+    }
+    qsort(sorted, (size_t)count, sizeof(uint64_t), compare_u64);
+    printf("%-10s %8d %10.2f %10.2f %10.2f", label, count, sorted[count / 2] / 1e6,
+           sorted[(count * 99) / 100] / 1e6, sorted[count - 1] / 1e6);
+    if (stats) {
+        printf(" %12.1f %12.1f", stats->written_bytes / 1024.0, stats->dropped_bytes / 1024.0);
+    }
+    printf("\n");
+    free(sorted);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : "bench-recordings";
+    int frames = argc > 2 ? atoi(argv[2]) : 600;
+    int width = argc > 3 ? atoi(argv[3]) : 1280;
+    int height = argc > 4 ? atoi(argv[4]) : 720;
+    int bitrate_kbps = argc > 5 ? atoi(argv[5]) : 8000;
+
+    width &= ~3;
+    height &= ~1;
+    if (width <= 0 || height <= 0 || frames <= 0 || bitrate_kbps <= 0) {
+        return 1;
+    }
+
+    gst_init(&argc, &argv);
+
+    bench_run run = { .fps = 30, .frames = frames };
+    run.pushed_ns = (uint64_t *)calloc((size_t)frames, sizeof(uint64_t));
+    run.latency_ns = (uint64_t *)calloc((size_t)frames, sizeof(uint64_t));
+    if (!run.pushed_ns || !run.latency_ns) {
+        free(run.pushed_ns);
+        free(run.latency_ns);
+        return 1;
+    }
+
+    printf("%dx%d @ %d kbps, %d frames, recording to %s\n", width, height, bitrate_kbps, frames, dir);
+    printf("%-10s %8s %10s %10s %10s %12s %12s\n", "recording", "frames", "p50_ms", "p99_ms", "max_ms",
+           "written_kb", "dropped_kb");
+
+    int status = 0;
+    if (run_once(&run, width, height, bitrate_kbps) != 0) {
+        status = 1;
+    } else {
+        report("off", &run, NULL);
+    }
+
+    cs_recorder_config recorder_cfg = {
+        .dir = dir,
+        .tracks = 1,
+        .segment_s = 10,
+        .max_bytes = 256ull << 20,
+        .buffer_bytes = 1u << 20,
+        .buffers = 8
+    };
+    run.recorder = cs_recorder_create(&recorder_cfg);
+    if (!run.recorder) {
+        fprintf(stderr, "Recorder init failed for %s\n", dir);
+        status = 1;
+    } else if (run_once(&run, width, height, bitrate_kbps) != 0) {
+        status = 1;
+    } else {
+        // Written bytes lag by whatever is still queued for the writer.
+        cs_recorder_stats stats;
+        cs_recorder_get_stats(run.recorder, &stats);
+        report("on", &run, &stats);
+    }
+    cs_recorder_destroy(run.recorder);
+
+    free(run.pushed_ns);
+    free(run.latency_ns);
+    return status;
+}
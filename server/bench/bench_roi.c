@@ -0,0 +1,470 @@
+#include "pipeline.h"
+#include "render.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Streams a rendered sequence through a cs_pipeline at several bitrates,
+// with roi_delta_qp off and on and the renderer's box passed to
+// cs_pipeline_push_wrapped, so the ROI goes through the server's own probe.
+// The stream a cs-stream viewer would get is decoded again and scored
+// against the I420 the pipeline encoded: bitrate plus luma PSNR for the
+// whole frame, inside the box and outside it. Frames the leaky view queue
+// dropped are scored as the previous frame repeated.
+//
+// Only encoders that read GstVideoRegionOfInterestMeta (e.g. vaapih264enc)
+// can show a difference. x264enc is refused up front, since cs_pipeline
+// drops ROI for it, and a run where ROI changed nothing fails.
+
+#define BENCH_FPS 30
+// Time for the pre-roll frame to clear the encoder before the view opens.
+#define BENCH_SETTLE_NS 500000000ull
+// Longest wait for the last frames to leave the encoder.
+#define BENCH_DRAIN_NS 2000000000ull
+// ROI counts as applied once it moves PSNR inside or outside the box by
+// more than this many dB at some bitrate.
+#define BENCH_ROI_EFFECT_DB 0.05
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    int index;
+} bench_unit;
+
+// Access units of one run, indexed by source frame.
+typedef struct {
+    int frames;
+    bench_unit *units;
+    int count;
+    int64_t first_pts_us;
+    int last_index;
+    uint64_t bytes;
+} bench_encode;
+
+typedef struct {
+    int width;
+    int height;
+    int frames;
+    // Packed luma of each source frame after the pipeline's videoconvert.
+    uint8_t **luma;
+    const cs_render_rect *rois;
+} bench_source;
+
+typedef struct {
+    double sse_all;
+    double sse_in;
+    double sse_out;
+    double px_all;
+    double px_in;
+    double px_out;
+} bench_error;
+
+typedef struct {
+    double kbps;
+    double psnr_all;
+    double psnr_in;
+    double psnr_out;
+    int dropped;
+} bench_point;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline) {
+    struct timespec ts = { (time_t)(deadline / 1000000000ull), (long)(deadline % 1000000000ull) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void accumulate(bench_error *err, const bench_source *src, int index, const uint8_t *dec, int stride) {
+    const uint8_t *ref = src->luma[index];
+    const cs_render_rect *roi = &src->rois[index];
+    for (int y = 0; y < src->height; ++y) {
+        for (int x = 0; x < src->width; ++x) {
+            double d = (double)ref[y * src->width + x] - (double)dec[y * stride + x];
+            int inside = x >= roi->x && x < roi->x + roi->width && y >= roi->y && y < roi->y + roi->height;
+            err->sse_all += d * d;
+            err->px_all += 1.0;
+            if (inside) {
+                err->sse_in += d * d;
+                err->px_in += 1.0;
+            } else {
+                err->sse_out += d * d;
+                err->px_out += 1.0;
+            }
+        }
+    }
+}
+
+static double psnr(double sse, double pixels) {
+    if (pixels <= 0.0) {
+        return 0.0;
+    }
+    if (sse <= 0.0) {
+        return 99.0;
+    }
+    return 10.0 * log10(255.0 * 255.0 * pixels / sse);
+}
+
+static GstElement *parse_pipeline(const char *description) {
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+    if (!pipeline) {
+        fprintf(stderr, "Pipeline parse failed: %s\n", error ? error->message : "unknown");
+    }
+    if (error) {
+        g_error_free(error);
+    }
+    return pipeline;
+}
+
+// Converts the rendered frames with the pipeline's own videoconvert and
+// keeps the Y planes as the reference.
+static int convert_source(bench_source *src, uint8_t **rgba) {
+    GstElement *pipeline = parse_pipeline(
+        "appsrc name=src format=time ! videoconvert ! video/x-raw,format=I420 ! appsink name=sink sync=false");
+    if (!pipeline) {
+        return -1;
+    }
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format", G_TYPE_STRING, "RGBA",
+                                        "width", G_TYPE_INT, src->width,
+                                        "height", G_TYPE_INT, src->height,
+                                        "framerate", GST_TYPE_FRACTION, BENCH_FPS, 1,
+                                        NULL);
+    g_object_set(G_OBJECT(appsrc), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    size_t rgba_size = (size_t)src->width * (size_t)src->height * 4;
+    for (int i = 0; i < src->frames; ++i) {
+        GstBuffer *buffer = gst_buffer_new_wrapped_full(0, rgba[i], rgba_size, 0, rgba_size, NULL, NULL);
+        GST_BUFFER_PTS(buffer) = (GstClockTime)i * GST_SECOND / BENCH_FPS;
+        GST_BUFFER_DURATION(buffer) = GST_SECOND / BENCH_FPS;
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+
+    int converted = 0;
+    GstSample *sample;
+    while (converted < src->frames && (sample = gst_app_sink_pull_sample(GST_APP_SINK(sink)))) {
+        GstVideoInfo info;
+        GstVideoFrame frame;
+        if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+            gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+            const uint8_t *in = (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+            int stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+            for (int y = 0; y < src->height; ++y) {
+                memcpy(src->luma[converted] + (size_t)y * (size_t)src->width, in + (size_t)y * (size_t)stride,
+                       (size_t)src->width);
+            }
+            gst_video_frame_unmap(&frame);
+            ++converted;
+        }
+        gst_sample_unref(sample);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(appsrc);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return converted == src->frames ? 0 : -1;
+}
+
+// Stream units carry the capture time as PTS, so the first keyframe after
+// the view opened is frame 0 and the rest follow at the frame interval.
+static void on_view_unit(void *user, int view, const cs_pipeline_unit *unit) {
+    bench_encode *enc = (bench_encode *)user;
+    (void)view;
+    if (enc->first_pts_us < 0) {
+        if (!unit->keyframe) {
+            return;
+        }
+        enc->first_pts_us = (int64_t)unit->pts_us;
+    }
+    long long index = llround(((double)unit->pts_us - (double)enc->first_pts_us) * BENCH_FPS / 1e6);
+    if (index < 0 || index >= enc->frames || enc->count == enc->frames) {
+        return;
+    }
+    bench_unit *out = &enc->units[enc->count];
+    out->data = (uint8_t *)malloc(unit->len);
+    if (!out->data) {
+        return;
+    }
+    memcpy(out->data, unit->data, unit->len);
+    out->len = unit->len;
+    out->index = (int)index;
+    enc->count++;
+    enc->last_index = (int)index;
+    enc->bytes += unit->len;
+}
+
+static void poll_for(cs_pipeline *pipeline, uint64_t ns) {
+    uint64_t end = clock_ns(CLOCK_MONOTONIC) + ns;
+    while (clock_ns(CLOCK_MONOTONIC) < end) {
+        cs_pipeline_poll(pipeline);
+        sleep_until(clock_ns(CLOCK_MONOTONIC) + 5000000ull);
+    }
+}
+
+// Pushes the sequence in real time with each frame's box, as the render
+// loop does.
+static int encode_run(const bench_source *src, uint8_t **rgba, const char *encoder_name, int bitrate_kbps,
+                      int delta_qp, bench_encode *enc) {
+    cs_pipeline_config cfg = {
+        .width = src->width,
+        .height = src->height,
+        .atlas_cols = 1,
+        .atlas_rows = 1,
+        .fps = BENCH_FPS,
+        .bitrate_kbps = bitrate_kbps,
+        .encoder = encoder_name,
+        .ice_tcp = 1,
+        .roi_delta_qp = delta_qp,
+        .user = enc,
+        .on_view_unit = on_view_unit,
+    };
+    cs_pipeline *pipeline = cs_pipeline_create(&cfg);
+    if (!pipeline) {
+        return -1;
+    }
+    poll_for(pipeline, BENCH_SETTLE_NS);
+    cs_pipeline_watch_view(pipeline, 0, 1);
+    cs_pipeline_request_keyframe(pipeline, 0);
+
+    size_t rgba_size = (size_t)src->width * (size_t)src->height * 4;
+    uint64_t interval = 1000000000ull / BENCH_FPS;
+    uint64_t start = clock_ns(CLOCK_MONOTONIC) + interval;
+    for (int i = 0; i < src->frames; ++i) {
+        const cs_render_rect *roi = &src->rois[i];
+        cs_pipeline_region region = { 0, roi->x, roi->y, roi->width, roi->height };
+        uint64_t deadline = start + (uint64_t)i * interval;
+        sleep_until(deadline);
+        cs_pipeline_push_wrapped(pipeline, rgba[i], rgba_size, deadline, &region, 1, NULL, NULL);
+        cs_pipeline_poll(pipeline);
+    }
+    uint64_t drain_end = clock_ns(CLOCK_MONOTONIC) + BENCH_DRAIN_NS;
+    while (enc->last_index < src->frames - 1 && clock_ns(CLOCK_MONOTONIC) < drain_end) {
+        sleep_until(clock_ns(CLOCK_MONOTONIC) + 2000000ull);
+        cs_pipeline_poll(pipeline);
+    }
+
+    cs_pipeline_watch_view(pipeline, 0, -1);
+    cs_pipeline_destroy(pipeline);
+    return 0;
+}
+
+// Decodes the collected units and scores every source frame; a frame that
+// never arrived is scored as the last one decoded before it.
+static int decode_and_score(const bench_source *src, const bench_encode *enc, bench_error *err, int *dropped) {
+    GstElement *pipeline = parse_pipeline(
+        "appsrc name=src format=time ! h264parse ! avdec_h264 ! videoconvert ! video/x-raw,format=I420 ! "
+        "appsink name=sink sync=false");
+    if (!pipeline) {
+        return -1;
+    }
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstCaps *caps = gst_caps_new_simple("video/x-h264",
+                                        "stream-format", G_TYPE_STRING, "byte-stream",
+                                        "alignment", G_TYPE_STRING, "au",
+                                        NULL);
+    g_object_set(G_OBJECT(appsrc), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    for (int i = 0; i < enc->count; ++i) {
+        const bench_unit *unit = &enc->units[i];
+        GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, unit->data, unit->len, 0,
+                                                        unit->len, NULL, NULL);
+        GST_BUFFER_PTS(buffer) = (GstClockTime)unit->index * GST_SECOND / BENCH_FPS;
+        GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+
+    uint8_t *held = (uint8_t *)malloc((size_t)src->width * (size_t)src->height);
+    int have_held = 0;
+    int next = 0;
+    int scored = 0;
+    *dropped = 0;
+    memset(err, 0, sizeof(*err));
+    GstSample *sample;
+    while (held && (sample = gst_app_sink_pull_sample(GST_APP_SINK(sink)))) {
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        GstVideoInfo info;
+        GstVideoFrame frame;
+        long long index = llround((double)GST_BUFFER_PTS(buffer) * BENCH_FPS / GST_SECOND);
+        if (index >= next && index < src->frames &&
+            gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+            GST_VIDEO_INFO_WIDTH(&info) == src->width && GST_VIDEO_INFO_HEIGHT(&info) == src->height &&
+            gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ)) {
+            for (; next < index; ++next) {
+                if (have_held) {
+                    accumulate(err, src, next, held, src->width);
+                    ++scored;
+                }
+                (*dropped)++;
+            }
+            const uint8_t *luma = (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+            int stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+            for (int y = 0; y < src->height; ++y) {
+                memcpy(held + (size_t)y * (size_t)src->width, luma + (size_t)y * (size_t)stride, (size_t)src->width);
+            }
+            have_held = 1;
+            accumulate(err, src, (int)index, luma, stride);
+            ++scored;
+            gst_video_frame_unmap(&frame);
+            next = (int)index + 1;
+        }
+        gst_sample_unref(sample);
+    }
+    for (; next < src->frames; ++next) {
+        if (have_held) {
+            accumulate(err, src, next, held, src->width);
+            ++scored;
+        }
+        (*dropped)++;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(appsrc);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    free(held);
+    return scored == src->frames ? 0 : -1;
+}
+
+static int measure_point(const bench_source *src, uint8_t **rgba, const char *encoder_name, int bitrate_kbps,
+                         int delta_qp, bench_point *point) {
+    bench_encode enc = {
+        .frames = src->frames,
+        .units = (bench_unit *)calloc((size_t)src->frames, sizeof(bench_unit)),
+        .first_pts_us = -1,
+        .last_index = -1,
+    };
+    bench_error err;
+    int status = -1;
+    if (enc.units && encode_run(src, rgba, encoder_name, bitrate_kbps, delta_qp, &enc) == 0 && enc.count > 0 &&
+        decode_and_score(src, &enc, &err, &point->dropped) == 0) {
+        point->kbps = (double)enc.bytes * 8.0 * BENCH_FPS / (double)src->frames / 1000.0;
+        point->psnr_all = psnr(err.sse_all, err.px_all);
+        point->psnr_in = psnr(err.sse_in, err.px_in);
+        point->psnr_out = psnr(err.sse_out, err.px_out);
+        status = 0;
+    }
+    for (int i = 0; i < enc.count; ++i) {
+        free(enc.units[i].data);
+    }
+    free(enc.units);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 640;
+    int height = argc > 2 ? atoi(argv[2]) : 480;
+    int frames = argc > 3 ? atoi(argv[3]) : 90;
+    const char *encoder_name = argc > 4 ? argv[4] : "vaapih264enc";
+    int delta_qp = argc > 5 ? atoi(argv[5]) : -6;
+    const int bitrates[] = { 250, 500, 1000, 1500 };
+
+    // Even sizes keep the chroma planes exact.
+    width &= ~1;
+    height &= ~1;
+    if (width <= 0 || height <= 0 || frames <= 0 || delta_qp == 0) {
+        fprintf(stderr, "usage: cube_bench_roi [width height frames encoder delta_qp], delta_qp != 0\n");
+        return 1;
+    }
+    if (strcmp(encoder_name, "x264enc") == 0) {
+        fprintf(stderr, "x264enc does not read ROI metadata; pick an encoder that does, e.g. vaapih264enc\n");
+        return 1;
+    }
+
+    gst_init(&argc, &argv);
+
+    cs_render_config cfg = { .width = width, .height = height, .fps = (float)BENCH_FPS };
+    cs_renderer *renderer = cs_render_create(&cfg);
+    if (!renderer) {
+        fprintf(stderr, "Renderer init failed\n");
+        return 1;
+    }
+
+    size_t rgba_size = (size_t)width * (size_t)height * 4;
+    uint8_t **rgba = (uint8_t **)calloc((size_t)frames, sizeof(uint8_t *));
+    uint8_t **luma = (uint8_t **)calloc((size_t)frames, sizeof(uint8_t *));
+    cs_render_rect *rois = (cs_render_rect *)calloc((size_t)frames, sizeof(cs_render_rect));
+    if (!rgba || !luma || !rois) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    double roi_area = 0.0;
+    for (int i = 0; i < frames; ++i) {
+        rgba[i] = (uint8_t *)malloc(rgba_size);
+        luma[i] = (uint8_t *)malloc((size_t)width * (size_t)height);
+        if (!rgba[i] || !luma[i] || cs_render_frame(renderer, rgba[i], rgba_size, &rois[i]) != 0) {
+            fprintf(stderr, "Render failed at frame %d\n", i);
+            return 1;
+        }
+        roi_area += (double)rois[i].width * (double)rois[i].height;
+    }
+    cs_render_destroy(renderer);
+
+    bench_source src = { .width = width, .height = height, .frames = frames, .luma = luma, .rois = rois };
+    if (convert_source(&src, rgba) != 0) {
+        fprintf(stderr, "I420 conversion failed\n");
+        return 1;
+    }
+    printf("%s %dx%d, %d frames, ROI covers %.1f%% of the frame\n", encoder_name, width, height, frames,
+           100.0 * roi_area / ((double)frames * width * height));
+
+    printf("%-8s %-6s %10s %10s %10s %10s %8s\n", "target", "roi", "kbps", "psnr_y", "psnr_in", "psnr_out",
+           "dropped");
+    int status = 0;
+    int affected = 0;
+    for (size_t b = 0; b < sizeof(bitrates) / sizeof(bitrates[0]); ++b) {
+        bench_point points[2];
+        int ok = 1;
+        for (int with_roi = 0; with_roi < 2; ++with_roi) {
+            bench_point *point = &points[with_roi];
+            if (measure_point(&src, rgba, encoder_name, bitrates[b], with_roi ? delta_qp : 0, point) != 0) {
+                fprintf(stderr, "Encode at %d kbps failed\n", bitrates[b]);
+                status = 1;
+                ok = 0;
+                continue;
+            }
+            printf("%-8d %-6s %10.1f %10.2f %10.2f %10.2f %8d\n", bitrates[b], with_roi ? "on" : "off", point->kbps,
+                   point->psnr_all, point->psnr_in, point->psnr_out, point->dropped);
+        }
+        if (ok && (fabs(points[1].psnr_in - points[0].psnr_in) > BENCH_ROI_EFFECT_DB ||
+                   fabs(points[1].psnr_out - points[0].psnr_out) > BENCH_ROI_EFFECT_DB)) {
+            affected = 1;
+        }
+    }
+    if (status == 0 && !affected) {
+        fprintf(stderr, "%s ignored the ROI metadata: on and off match at every bitrate\n", encoder_name);
+        status = 1;
+    }
+
+    for (int i = 0; i < frames; ++i) {
+        free(rgba[i]);
+        free(luma[i]);
+    }
+    free(rgba);
+    free(luma);
+    free(rois);
+    return status;
+}
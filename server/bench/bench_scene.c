@@ -0,0 +1,114 @@
+#include "render.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Renders the instanced scene at several object counts and reports frame
+// time (draw + readback) percentiles. With threads > 1 frames go through the
+// render pool back to back: times are submit-to-result and fps is the
+// measured throughput.
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Keeps every worker busy until frames results are in; returns wall time.
+static uint64_t run_pool(cs_renderer *renderer, int frames, uint64_t *samples) {
+    cs_render_view view = { .tile = 0, .camera = { 0.0f, 0.0f, 0.0f } };
+    int submitted = 0;
+    int done = 0;
+    uint64_t start = monotonic_ns();
+    while (done < frames) {
+        while (submitted < frames && cs_render_submit(renderer, &view, 1, monotonic_ns()) == 0) {
+            submitted++;
+        }
+        struct pollfd pfd = { .fd = cs_render_fd(renderer), .events = POLLIN };
+        poll(&pfd, 1, 1000);
+        uint64_t count;
+        if (read(pfd.fd, &count, sizeof(count)) < 0) {
+            // Nothing finished yet.
+        }
+        cs_render_result result;
+        while (done < frames && cs_render_take(renderer, &result) == 0) {
+            samples[done++] = monotonic_ns() - result.tag;
+            cs_render_release(renderer, &result);
+        }
+    }
+    return monotonic_ns() - start;
+}
+
+int main(int argc, char **argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 640;
+    int height = argc > 2 ? atoi(argv[2]) : 480;
+    int frames = argc > 3 ? atoi(argv[3]) : 120;
+    int threads = argc > 4 ? atoi(argv[4]) : 1;
+    const int counts[] = { 1, 1000, 10000, 100000 };
+
+    size_t frame_size = (size_t)width * (size_t)height * 4;
+    uint8_t *frame = (uint8_t *)malloc(frame_size);
+    uint64_t *samples = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)frames);
+    if (!frame || !samples || frames <= 0) {
+        return 1;
+    }
+
+    printf("%-8s %10s %10s %10s %10s\n", "cubes", "mean_ms", "p50_ms", "p99_ms", "fps");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        cs_render_config cfg = {
+            .width = width,
+            .height = height,
+            .fps = 30.0f,
+            .scene_objects = counts[c],
+            .threads = threads
+        };
+        cs_renderer *renderer = cs_render_create(&cfg);
+        if (!renderer) {
+            fprintf(stderr, "Renderer init failed at %d cubes\n", counts[c]);
+            return 1;
+        }
+
+        // Warm up shader compilation and buffer allocation.
+        for (int i = 0; i < 5; ++i) {
+            cs_render_frame(renderer, frame, frame_size, NULL);
+        }
+
+        uint64_t total = 0;
+        uint64_t wall = 0;
+        if (threads > 1) {
+            wall = run_pool(renderer, frames, samples);
+            for (int i = 0; i < frames; ++i) {
+                total += samples[i];
+            }
+        } else {
+            for (int i = 0; i < frames; ++i) {
+                uint64_t start = monotonic_ns();
+                cs_render_frame(renderer, frame, frame_size, NULL);
+                samples[i] = monotonic_ns() - start;
+                total += samples[i];
+            }
+            wall = total;
+        }
+        qsort(samples, (size_t)frames, sizeof(uint64_t), compare_u64);
+
+        double mean_ms = (double)total / (double)frames / 1e6;
+        printf("%-8d %10.3f %10.3f %10.3f %10.1f\n", counts[c], mean_ms,
+               (double)samples[frames / 2] / 1e6,
+               (double)samples[(frames * 99) / 100] / 1e6,
+               (double)frames * 1e9 / (double)wall);
+        cs_render_destroy(renderer);
+    }
+
+    free(samples);
+    free(frame);
+    return 0;
+}
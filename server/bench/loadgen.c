@@ -0,0 +1,770 @@
+#include "event_loop.h"
+#include "json.h"
+#include "msg_queue.h"
+
+#include <gst/gst.h>
+#include <gst/sdp/sdp.h>
+#include <gst/webrtc/webrtc.h>
+#include <libwebsockets.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Synthetic viewers for one cube_server. Opens peers cs-signaling
+// WebSockets at rate per second and answers each offer with a receive-only
+// webrtcbin, or in mock mode with a rewritten copy of the offer and no
+// media. All peers are held for hold_s seconds after the last one started,
+// then closed. The report lists setup-time percentiles, failures, and
+// receive rates per peer.
+//
+//   cube_loadgen [host port peers rate hold_s webrtc|mock]
+//
+// A progress line per second shows where setup starts to fail or slow down
+// as the ramp goes on.
+
+#define CS_LOADGEN_TIMEOUT_NS 15000000000ull
+#define CS_LOADGEN_SDP_MAX 16384
+
+typedef enum {
+    PEER_IDLE,
+    PEER_CONNECTING,
+    PEER_SIGNALING,
+    // Answered (mock) or receiving media (webrtc).
+    PEER_UP,
+    PEER_FAILED,
+    PEER_CLOSED
+} peer_state;
+
+typedef struct loadgen loadgen;
+
+typedef struct {
+    loadgen *gen;
+    int index;
+    peer_state state;
+    const char *failure;
+    struct lws *wsi;
+    int closing;
+    cs_msg_assembler rx;
+    // Written from webrtcbin threads under gen->lock.
+    cs_msg_queue tx;
+    int tx_pending;
+
+    uint64_t start_ns;
+    uint64_t open_ns;
+    uint64_t offer_ns;
+    // Set from webrtcbin threads.
+    uint64_t answer_ns;
+    uint64_t ice_ns;
+    uint64_t media_ns;
+    int answer_failed;
+    int ice_failed;
+    uint64_t bytes;
+    uint64_t frames;
+
+    GstElement *pipeline;
+    GstElement *webrtcbin;
+} loadgen_peer;
+
+struct loadgen {
+    const char *host;
+    int port;
+    int mock;
+    struct lws_context *context;
+    cs_event_loop *loop;
+    int wake_fd;
+    pthread_mutex_t lock;
+    loadgen_peer *peers;
+    int peer_count;
+    int started;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void fail_peer(loadgen_peer *peer, const char *reason) {
+    if (peer->state == PEER_FAILED || peer->state == PEER_CLOSED) {
+        return;
+    }
+    peer->state = PEER_FAILED;
+    peer->failure = reason;
+    if (peer->wsi) {
+        peer->closing = 1;
+        lws_callback_on_writable(peer->wsi);
+    }
+}
+
+// Queues a message from any thread; the loop asks lws for writability.
+static void send_text(loadgen_peer *peer, const char *text) {
+    loadgen *gen = peer->gen;
+    pthread_mutex_lock(&gen->lock);
+    cs_msg_queue_push_str(&peer->tx, text);
+    peer->tx_pending = 1;
+    pthread_mutex_unlock(&gen->lock);
+    uint64_t one = 1;
+    if (write(gen->wake_fd, &one, sizeof(one)) < 0) {
+        // Already signalled.
+    }
+}
+
+static void on_wake(void *user, int fd, uint32_t events) {
+    loadgen *gen = (loadgen *)user;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        return;
+    }
+    pthread_mutex_lock(&gen->lock);
+    for (int i = 0; i < gen->started; ++i) {
+        loadgen_peer *peer = &gen->peers[i];
+        if (peer->tx_pending && peer->wsi) {
+            peer->tx_pending = 0;
+            lws_callback_on_writable(peer->wsi);
+        }
+    }
+    pthread_mutex_unlock(&gen->lock);
+}
+
+static void on_ice_candidate(GstElement *webrtcbin, guint mlineindex, gchar *candidate, gpointer user_data) {
+    loadgen_peer *peer = (loadgen_peer *)user_data;
+    char *escaped = cs_json_escape(candidate);
+    if (!escaped) {
+        return;
+    }
+    size_t len = strlen(escaped) + 96;
+    char *msg = (char *)malloc(len);
+    if (msg) {
+        snprintf(msg, len, "{\"type\":\"ice\",\"candidate\":\"%s\",\"sdpMLineIndex\":%u}", escaped, mlineindex);
+        send_text(peer, msg);
+    }
+    free(msg);
+    free(escaped);
+}
+
+static void on_connection_state(GObject *webrtcbin, GParamSpec *pspec, gpointer user_data) {
+    loadgen_peer *peer = (loadgen_peer *)user_data;
+    GstWebRTCICEConnectionState state = GST_WEBRTC_ICE_CONNECTION_STATE_NEW;
+    g_object_get(webrtcbin, "ice-connection-state", &state, NULL);
+    if ((state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED || state == GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED) &&
+        __atomic_load_n(&peer->ice_ns, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&peer->ice_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    } else if (state == GST_WEBRTC_ICE_CONNECTION_STATE_FAILED) {
+        __atomic_store_n(&peer->ice_failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Counts RTP as it leaves webrtcbin: bytes, and frames by the marker bit
+// that ends each H.264 access unit.
+static GstPadProbeReturn on_rtp(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    loadgen_peer *peer = (loadgen_peer *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (__atomic_load_n(&peer->media_ns, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&peer->media_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&peer->bytes, (uint64_t)map.size, __ATOMIC_RELAXED);
+    if (map.size > 1 && (map.data[1] & 0x80)) {
+        __atomic_fetch_add(&peer->frames, 1, __ATOMIC_RELAXED);
+    }
+    gst_buffer_unmap(buffer, &map);
+    return GST_PAD_PROBE_OK;
+}
+
+static void on_pad_added(GstElement *webrtcbin, GstPad *pad, gpointer user_data) {
+    loadgen_peer *peer = (loadgen_peer *)user_data;
+    if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC) {
+        return;
+    }
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+    if (!sink) {
+        return;
+    }
+    g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add(GST_BIN(peer->pipeline), sink);
+    gst_element_sync_state_with_parent(sink);
+    GstPad *sink_pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_rtp, peer, NULL);
+    gst_pad_link(pad, sink_pad);
+    gst_object_unref(sink_pad);
+}
+
+static int create_receiver(loadgen_peer *peer) {
+    peer->pipeline = gst_pipeline_new(NULL);
+    peer->webrtcbin = gst_element_factory_make("webrtcbin", NULL);
+    if (!peer->pipeline || !peer->webrtcbin) {
+        if (peer->webrtcbin) {
+            gst_object_unref(peer->webrtcbin);
+            peer->webrtcbin = NULL;
+        }
+        return -1;
+    }
+    // The server bundles video and the data channel onto one transport.
+    g_object_set(G_OBJECT(peer->webrtcbin), "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+    gst_bin_add(GST_BIN(peer->pipeline), peer->webrtcbin);
+    g_signal_connect(peer->webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate), peer);
+    g_signal_connect(peer->webrtcbin, "notify::ice-connection-state", G_CALLBACK(on_connection_state), peer);
+    g_signal_connect(peer->webrtcbin, "pad-added", G_CALLBACK(on_pad_added), peer);
+    return gst_element_set_state(peer->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE ? -1 : 0;
+}
+
+static void destroy_receiver(loadgen_peer *peer) {
+    if (!peer->pipeline) {
+        return;
+    }
+    gst_element_set_state(peer->pipeline, GST_STATE_NULL);
+    gst_object_unref(peer->pipeline);
+    peer->pipeline = NULL;
+    peer->webrtcbin = NULL;
+}
+
+// Sends the answer from any thread; send_text does the locking.
+static int send_answer(loadgen_peer *peer, const char *sdp) {
+    char *escaped = cs_json_escape(sdp);
+    if (!escaped) {
+        return -1;
+    }
+    size_t len = strlen(escaped) + 64;
+    char *msg = (char *)malloc(len);
+    if (msg) {
+        snprintf(msg, len, "{\"type\":\"answer\",\"sdp\":\"%s\"}", escaped);
+        send_text(peer, msg);
+        __atomic_store_n(&peer->answer_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    }
+    free(msg);
+    free(escaped);
+    return msg ? 0 : -1;
+}
+
+// The answer promise holds its own reference to webrtcbin, so the receiver
+// can be torn down while one is outstanding.
+typedef struct {
+    loadgen_peer *peer;
+    GstElement *webrtcbin;
+} loadgen_answer;
+
+static void free_answer(gpointer user_data) {
+    loadgen_answer *pending = (loadgen_answer *)user_data;
+    gst_object_unref(pending->webrtcbin);
+    free(pending);
+}
+
+// Runs on a webrtcbin thread, so a thousand peers answering at once do not
+// stall the loop that services their sockets. Failures reach fail_peer
+// through check_peers.
+static void on_answer_created(GstPromise *promise, gpointer user_data) {
+    loadgen_answer *pending = (loadgen_answer *)user_data;
+    const GstStructure *reply =
+        gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED ? gst_promise_get_reply(promise) : NULL;
+    GstWebRTCSessionDescription *answer = NULL;
+    if (reply) {
+        gst_structure_get(reply, "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+    }
+    gst_promise_unref(promise);
+    char *sdp_text = NULL;
+    if (answer) {
+        g_signal_emit_by_name(pending->webrtcbin, "set-local-description", answer, NULL);
+        sdp_text = gst_sdp_message_as_text(answer->sdp);
+        gst_webrtc_session_description_free(answer);
+    }
+    if (!sdp_text || send_answer(pending->peer, sdp_text) != 0) {
+        __atomic_store_n(&pending->peer->answer_failed, 1, __ATOMIC_RELAXED);
+    }
+    g_free(sdp_text);
+}
+
+static int answer_webrtc(loadgen_peer *peer, const char *offer) {
+    GstSDPMessage *sdp_msg = NULL;
+    gst_sdp_message_new(&sdp_msg);
+    if (gst_sdp_message_parse_buffer((const guint8 *)offer, strlen(offer), sdp_msg) != GST_SDP_OK) {
+        gst_sdp_message_free(sdp_msg);
+        return -1;
+    }
+    GstWebRTCSessionDescription *desc = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_OFFER, sdp_msg);
+    g_signal_emit_by_name(peer->webrtcbin, "set-remote-description", desc, NULL);
+    gst_webrtc_session_description_free(desc);
+
+    loadgen_answer *pending = (loadgen_answer *)malloc(sizeof(loadgen_answer));
+    if (!pending) {
+        return -1;
+    }
+    pending->peer = peer;
+    pending->webrtcbin = (GstElement *)gst_object_ref(peer->webrtcbin);
+    GstPromise *promise = gst_promise_new_with_change_func(on_answer_created, pending, free_answer);
+    g_signal_emit_by_name(peer->webrtcbin, "create-answer", NULL, promise);
+    return 0;
+}
+
+// Mock mode: the offer with its direction and DTLS role flipped, fresh ICE
+// credentials and no candidates or sender lines. The server accepts it and
+// keeps its webrtcbin waiting for connectivity checks that never come, so
+// only signaling and peer setup are exercised.
+static char *answer_mock(loadgen_peer *peer, const char *offer) {
+    size_t cap = strlen(offer) + 256;
+    char *out = (char *)malloc(cap);
+    if (!out) {
+        return NULL;
+    }
+    size_t len = 0;
+    const char *line = offer;
+    while (*line) {
+        const char *end = strchr(line, '\n');
+        size_t n = end ? (size_t)(end - line + 1) : strlen(line);
+        const char *replace = NULL;
+        char buf[64];
+        if (strncmp(line, "a=candidate", 11) == 0 || strncmp(line, "a=end-of-candidates", 19) == 0 ||
+            strncmp(line, "a=ssrc", 6) == 0 || strncmp(line, "a=msid", 6) == 0) {
+            line += n;
+            continue;
+        }
+        if (strncmp(line, "a=setup:actpass", 15) == 0) {
+            replace = "a=setup:active\r\n";
+        } else if (strncmp(line, "a=sendonly", 10) == 0) {
+            replace = "a=recvonly\r\n";
+        } else if (strncmp(line, "a=ice-ufrag:", 12) == 0) {
+            snprintf(buf, sizeof(buf), "a=ice-ufrag:lg%06d\r\n", peer->index);
+            replace = buf;
+        } else if (strncmp(line, "a=ice-pwd:", 10) == 0) {
+            snprintf(buf, sizeof(buf), "a=ice-pwd:loadgenmockpassword%06d\r\n", peer->index);
+            replace = buf;
+        }
+        const char *src = replace ? replace : line;
+        size_t src_len = replace ? strlen(replace) : n;
+        if (len + src_len + 1 > cap) {
+            free(out);
+            return NULL;
+        }
+        memcpy(out + len, src, src_len);
+        len += src_len;
+        line += n;
+    }
+    out[len] = '\0';
+    return out;
+}
+
+static void handle_offer(loadgen_peer *peer, const char *payload) {
+    char *sdp = (char *)malloc(CS_LOADGEN_SDP_MAX);
+    if (!sdp || cs_json_get_string(payload, "sdp", sdp, CS_LOADGEN_SDP_MAX) != 0) {
+        free(sdp);
+        fail_peer(peer, "sdp");
+        return;
+    }
+    peer->offer_ns = monotonic_ns();
+    if (!peer->gen->mock) {
+        if (answer_webrtc(peer, sdp) != 0) {
+            fail_peer(peer, "sdp");
+        }
+        free(sdp);
+        return;
+    }
+    char *answer = answer_mock(peer, sdp);
+    free(sdp);
+    if (!answer || send_answer(peer, answer) != 0) {
+        fail_peer(peer, "sdp");
+    } else {
+        peer->state = PEER_UP;
+    }
+    free(answer);
+}
+
+static void handle_message(loadgen_peer *peer, const char *payload) {
+    char type[16];
+    if (cs_json_get_string(payload, "type", type, sizeof(type)) != 0) {
+        return;
+    }
+    if (strcmp(type, "offer") == 0 && peer->offer_ns == 0) {
+        handle_offer(peer, payload);
+    } else if (strcmp(type, "ice") == 0 && peer->webrtcbin) {
+        char candidate[1024];
+        int sdp_mline_index = 0;
+        if (cs_json_get_string(payload, "candidate", candidate, sizeof(candidate)) == 0) {
+            cs_json_get_int(payload, "sdpMLineIndex", &sdp_mline_index);
+            g_signal_emit_by_name(peer->webrtcbin, "add-ice-candidate", sdp_mline_index, candidate);
+        }
+    }
+}
+
+static void on_socket_ready(void *user, int fd, uint32_t events) {
+    loadgen *gen = (loadgen *)user;
+    struct lws_pollfd pollfd = { .fd = fd, .events = (short)events, .revents = (short)events };
+    lws_service_fd(gen->context, &pollfd);
+}
+
+static int peer_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    loadgen *gen = (loadgen *)lws_context_user(lws_get_context(wsi));
+    loadgen_peer *peer = (loadgen_peer *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_ADD_POLL_FD: {
+        const struct lws_pollargs *args = (const struct lws_pollargs *)in;
+        return cs_event_loop_add(gen->loop, args->fd, (uint32_t)args->events, on_socket_ready, gen) == 0 ? 0 : 1;
+    }
+    case LWS_CALLBACK_DEL_POLL_FD:
+        cs_event_loop_remove(gen->loop, ((const struct lws_pollargs *)in)->fd);
+        return 0;
+    case LWS_CALLBACK_CHANGE_MODE_POLL_FD: {
+        const struct lws_pollargs *args = (const struct lws_pollargs *)in;
+        return cs_event_loop_modify(gen->loop, args->fd, (uint32_t)args->events) == 0 ? 0 : 1;
+    }
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        if (!peer) {
+            return -1;
+        }
+        peer->open_ns = monotonic_ns();
+        peer->state = PEER_SIGNALING;
+        if (!gen->mock && create_receiver(peer) != 0) {
+            fail_peer(peer, "webrtcbin");
+            return -1;
+        }
+        break;
+    case LWS_CALLBACK_CLIENT_RECEIVE: {
+        if (!peer) {
+            return -1;
+        }
+        int complete = cs_msg_assembler_append(&peer->rx, wsi, in, len);
+        if (complete < 0) {
+            return -1;
+        }
+        if (complete) {
+            handle_message(peer, peer->rx.buf);
+            cs_msg_assembler_reset(&peer->rx);
+        }
+        break;
+    }
+    case LWS_CALLBACK_CLIENT_WRITEABLE: {
+        if (!peer || peer->closing) {
+            return -1;
+        }
+        pthread_mutex_lock(&gen->lock);
+        size_t msg_len = 0;
+        unsigned char *msg = cs_msg_queue_peek(&peer->tx, &msg_len);
+        int ok = !msg || lws_write(wsi, msg, msg_len, LWS_WRITE_TEXT) >= (int)msg_len;
+        if (msg && ok) {
+            cs_msg_queue_pop(&peer->tx);
+        }
+        int more = peer->tx.head != NULL;
+        pthread_mutex_unlock(&gen->lock);
+        if (!ok) {
+            return -1;
+        }
+        if (more) {
+            lws_callback_on_writable(wsi);
+        }
+        break;
+    }
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        if (!peer) {
+            break;
+        }
+        pthread_mutex_lock(&gen->lock);
+        peer->wsi = NULL;
+        pthread_mutex_unlock(&gen->lock);
+        if (peer->state == PEER_UP) {
+            peer->state = PEER_CLOSED;
+        } else {
+            fail_peer(peer, reason == LWS_CALLBACK_CLIENT_CONNECTION_ERROR ? "connect" : "closed");
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static void start_peer(loadgen *gen, loadgen_peer *peer) {
+    struct lws_client_connect_info info;
+    memset(&info, 0, sizeof(info));
+    info.context = gen->context;
+    info.address = gen->host;
+    info.port = gen->port;
+    info.path = "/";
+    info.host = gen->host;
+    info.origin = gen->host;
+    info.protocol = "cs-signaling";
+    info.userdata = peer;
+    info.pwsi = &peer->wsi;
+
+    peer->start_ns = monotonic_ns();
+    peer->state = PEER_CONNECTING;
+    if (!lws_client_connect_via_info(&info)) {
+        fail_peer(peer, "connect");
+    }
+}
+
+// Promotes webrtc peers once media flows and fails the stuck ones.
+static void check_peers(loadgen *gen, uint64_t now) {
+    for (int i = 0; i < gen->started; ++i) {
+        loadgen_peer *peer = &gen->peers[i];
+        if (peer->state != PEER_CONNECTING && peer->state != PEER_SIGNALING) {
+            continue;
+        }
+        if (__atomic_load_n(&peer->answer_failed, __ATOMIC_RELAXED)) {
+            fail_peer(peer, "sdp");
+        } else if (__atomic_load_n(&peer->ice_failed, __ATOMIC_RELAXED)) {
+            fail_peer(peer, "ice");
+        } else if (__atomic_load_n(&peer->media_ns, __ATOMIC_RELAXED) != 0) {
+            peer->state = PEER_UP;
+        } else if (now - peer->start_ns > CS_LOADGEN_TIMEOUT_NS) {
+            fail_peer(peer, "timeout");
+        }
+    }
+}
+
+static void print_progress(loadgen *gen, uint64_t now, uint64_t t0, uint64_t *last_bytes, uint64_t *last_ns) {
+    int up = 0;
+    int failed = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < gen->started; ++i) {
+        loadgen_peer *peer = &gen->peers[i];
+        up += peer->state == PEER_UP;
+        failed += peer->state == PEER_FAILED;
+        bytes += __atomic_load_n(&peer->bytes, __ATOMIC_RELAXED);
+    }
+    double seconds = (double)(now - *last_ns) / 1e9;
+    double kbps = seconds > 0.0 ? (double)(bytes - *last_bytes) * 8.0 / 1000.0 / seconds : 0.0;
+    printf("%7.1fs  started %5d  up %5d  failed %5d  rx %10.0f kbps\n", (double)(now - t0) / 1e9,
+           gen->started, up, failed, kbps);
+    fflush(stdout);
+    *last_bytes = bytes;
+    *last_ns = now;
+}
+
+static void print_percentiles(const char *name, uint64_t *samples, int count) {
+    if (count == 0) {
+        printf("%-14s %6d %10s %10s %10s %10s\n", name, 0, "-", "-", "-", "-");
+        return;
+    }
+    qsort(samples, (size_t)count, sizeof(uint64_t), compare_u64);
+    printf("%-14s %6d %10.1f %10.1f %10.1f %10.1f\n", name, count,
+           (double)samples[count / 2] / 1e6,
+           (double)samples[(count * 90) / 100] / 1e6,
+           (double)samples[(count * 99) / 100] / 1e6,
+           (double)samples[count - 1] / 1e6);
+}
+
+static void report(loadgen *gen, uint64_t end_ns) {
+    uint64_t *samples = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)gen->peer_count);
+    uint64_t *rates = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)gen->peer_count);
+    uint64_t *fps = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)gen->peer_count);
+    if (!samples || !rates || !fps) {
+        free(samples);
+        free(rates);
+        free(fps);
+        return;
+    }
+
+    printf("\n%-14s %6s %10s %10s %10s %10s\n", "setup (ms)", "n", "p50", "p90", "p99", "max");
+    static const char *const phases[] = { "ws_open", "offer", "answer", "ice_connected", "first_media" };
+    for (int p = 0; p < 5; ++p) {
+        if (gen->mock && p >= 3) {
+            break;
+        }
+        int n = 0;
+        for (int i = 0; i < gen->started; ++i) {
+            loadgen_peer *peer = &gen->peers[i];
+            uint64_t at = p == 0 ? peer->open_ns : p == 1 ? peer->offer_ns : p == 2 ? __atomic_load_n(&peer->answer_ns, __ATOMIC_RELAXED)
+                        : p == 3 ? __atomic_load_n(&peer->ice_ns, __ATOMIC_RELAXED)
+                                 : __atomic_load_n(&peer->media_ns, __ATOMIC_RELAXED);
+            if (at != 0) {
+                samples[n++] = at - peer->start_ns;
+            }
+        }
+        print_percentiles(phases[p], samples, n);
+    }
+
+    static const char *const reasons[] = { "connect", "closed", "sdp", "webrtcbin", "ice", "timeout" };
+    printf("\nfailures:");
+    int failures = 0;
+    for (int r = 0; r < 6; ++r) {
+        int n = 0;
+        for (int i = 0; i < gen->started; ++i) {
+            n += gen->peers[i].state == PEER_FAILED && strcmp(gen->peers[i].failure, reasons[r]) == 0;
+        }
+        if (n > 0) {
+            printf(" %s %d", reasons[r], n);
+        }
+        failures += n;
+    }
+    printf("%s (%d of %d)\n", failures ? "" : " none", failures, gen->started);
+
+    if (gen->mock) {
+        free(samples);
+        free(rates);
+        free(fps);
+        return;
+    }
+
+    // Rates per peer from its first media packet to the end of the hold.
+    int n = 0;
+    uint64_t total_bytes = 0;
+    for (int i = 0; i < gen->started; ++i) {
+        loadgen_peer *peer = &gen->peers[i];
+        uint64_t media_ns = __atomic_load_n(&peer->media_ns, __ATOMIC_RELAXED);
+        if (media_ns == 0 || end_ns <= media_ns) {
+            continue;
+        }
+        double seconds = (double)(end_ns - media_ns) / 1e9;
+        uint64_t bytes = __atomic_load_n(&peer->bytes, __ATOMIC_RELAXED);
+        total_bytes += bytes;
+        rates[n] = (uint64_t)((double)bytes * 8.0 / seconds);
+        fps[n] = (uint64_t)((double)__atomic_load_n(&peer->frames, __ATOMIC_RELAXED) * 1000.0 / seconds);
+        n++;
+    }
+    printf("\n%-14s %6s %10s %10s %10s %10s\n", "per peer", "n", "min", "p10", "p50", "max");
+    if (n > 0) {
+        qsort(rates, (size_t)n, sizeof(uint64_t), compare_u64);
+        qsort(fps, (size_t)n, sizeof(uint64_t), compare_u64);
+        printf("%-14s %6d %10.0f %10.0f %10.0f %10.0f\n", "kbps", n, (double)rates[0] / 1000.0,
+               (double)rates[n / 10] / 1000.0, (double)rates[n / 2] / 1000.0, (double)rates[n - 1] / 1000.0);
+        printf("%-14s %6d %10.1f %10.1f %10.1f %10.1f\n", "fps", n, (double)fps[0] / 1000.0,
+               (double)fps[n / 10] / 1000.0, (double)fps[n / 2] / 1000.0, (double)fps[n - 1] / 1000.0);
+    }
+    printf("received %.1f MB in total\n", (double)total_bytes / 1e6);
+
+    free(samples);
+    free(rates);
+    free(fps);
+}
+
+int main(int argc, char **argv) {
+    loadgen gen;
+    memset(&gen, 0, sizeof(gen));
+    gen.host = argc > 1 ? argv[1] : "127.0.0.1";
+    gen.port = argc > 2 ? atoi(argv[2]) : 8080;
+    gen.peer_count = argc > 3 ? atoi(argv[3]) : 10;
+    double rate = argc > 4 ? atof(argv[4]) : 5.0;
+    int hold_s = argc > 5 ? atoi(argv[5]) : 10;
+    gen.mock = argc > 6 && strcmp(argv[6], "mock") == 0;
+    if (gen.peer_count <= 0 || rate <= 0.0 || hold_s < 0) {
+        fprintf(stderr, "usage: cube_loadgen [host port peers rate hold_s webrtc|mock]\n");
+        return 1;
+    }
+
+    if (!gen.mock) {
+        gst_init(&argc, &argv);
+    }
+    lws_set_log_level(LLL_ERR, NULL);
+
+    gen.peers = (loadgen_peer *)calloc((size_t)gen.peer_count, sizeof(loadgen_peer));
+    gen.loop = cs_event_loop_create();
+    gen.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (!gen.peers || !gen.loop || gen.wake_fd < 0 ||
+        cs_event_loop_add(gen.loop, gen.wake_fd, POLLIN, on_wake, &gen) != 0) {
+        fprintf(stderr, "Setup failed\n");
+        return 1;
+    }
+    pthread_mutex_init(&gen.lock, NULL);
+    for (int i = 0; i < gen.peer_count; ++i) {
+        gen.peers[i].gen = &gen;
+        gen.peers[i].index = i;
+    }
+
+    static struct lws_protocols protocols[] = {
+        { "cs-signaling", peer_callback, 0, 8192 },
+        { NULL, NULL, 0, 0 }
+    };
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = protocols;
+    info.user = &gen;
+    // Every peer is a socket, plus webrtcbin's on top in webrtc mode.
+    info.fd_limit_per_thread = (unsigned int)gen.peer_count * 2 + 64;
+    gen.context = lws_create_context(&info);
+    if (!gen.context) {
+        fprintf(stderr, "lws init failed\n");
+        return 1;
+    }
+
+    printf("%d %s peers to %s:%d at %.1f/s, held %d s\n", gen.peer_count, gen.mock ? "mock" : "webrtc",
+           gen.host, gen.port, rate, hold_s);
+    const uint64_t interval_ns = (uint64_t)(1e9 / rate);
+    const uint64_t t0 = monotonic_ns();
+    uint64_t next_start = t0;
+    uint64_t next_progress = t0 + 1000000000ull;
+    uint64_t last_bytes = 0;
+    uint64_t last_ns = t0;
+    uint64_t end_ns = 0;
+
+    while (1) {
+        uint64_t now = monotonic_ns();
+        while (gen.started < gen.peer_count && now >= next_start) {
+            start_peer(&gen, &gen.peers[gen.started]);
+            gen.started++;
+            next_start += interval_ns;
+        }
+        check_peers(&gen, now);
+        if (now >= next_progress) {
+            print_progress(&gen, now, t0, &last_bytes, &last_ns);
+            next_progress += 1000000000ull;
+        }
+        if (gen.started == gen.peer_count && end_ns == 0) {
+            end_ns = now + (uint64_t)hold_s * 1000000000ull;
+        }
+        if (end_ns != 0 && now >= end_ns) {
+            break;
+        }
+
+        uint64_t deadline = next_progress;
+        if (gen.started < gen.peer_count && next_start < deadline) {
+            deadline = next_start;
+        }
+        if (end_ns != 0 && end_ns < deadline) {
+            deadline = end_ns;
+        }
+        int timeout_ms = deadline > now ? (int)((deadline - now + 999999ull) / 1000000ull) : 0;
+        timeout_ms = lws_service_adjust_timeout(gen.context, timeout_ms, 0);
+        cs_event_loop_run_once(gen.loop, timeout_ms);
+        lws_service_fd(gen.context, NULL);
+    }
+
+    report(&gen, end_ns);
+
+    // Close every socket, give lws a moment to finish, then stop receivers.
+    for (int i = 0; i < gen.started; ++i) {
+        if (gen.peers[i].wsi) {
+            gen.peers[i].closing = 1;
+            lws_callback_on_writable(gen.peers[i].wsi);
+        }
+    }
+    uint64_t close_deadline = monotonic_ns() + 2000000000ull;
+    while (monotonic_ns() < close_deadline) {
+        int open = 0;
+        for (int i = 0; i < gen.started; ++i) {
+            open += gen.peers[i].wsi != NULL;
+        }
+        if (open == 0) {
+            break;
+        }
+        cs_event_loop_run_once(gen.loop, lws_service_adjust_timeout(gen.context, 50, 0));
+        lws_service_fd(gen.context, NULL);
+    }
+    lws_context_destroy(gen.context);
+    for (int i = 0; i < gen.peer_count; ++i) {
+        destroy_receiver(&gen.peers[i]);
+        cs_msg_queue_clear(&gen.peers[i].tx);
+        cs_msg_assembler_reset(&gen.peers[i].rx);
+    }
+    pthread_mutex_destroy(&gen.lock);
+    close(gen.wake_fd);
+    cs_event_loop_destroy(gen.loop);
+    free(gen.peers);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef CS_ASSETS_H
+#define CS_ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The built web client (client/dist), read once at startup and kept in
+// memory together with gzip and, when built with brotli, brotli copies of
+// every compressible file. Read-only once loaded.
+typedef struct cs_assets cs_assets;
+
+typedef enum {
+    CS_ASSET_IDENTITY,
+    CS_ASSET_GZIP,
+    CS_ASSET_BROTLI,
+    CS_ASSET_ENCODINGS
+} cs_asset_encoding;
+
+// One stored representation of a file.
+typedef struct {
+    // Preceded by the headroom given to cs_assets_load, which the caller
+    // may overwrite (lws frames writes in place).
+    uint8_t *data;
+    size_t len;
+    const char *content_type;
+    // Content-Encoding value; NULL for identity.
+    const char *encoding;
+    // Strong validator of this representation, quotes included.
+    const char *etag;
+    // Vite's content-hashed output under assets/ never changes, so caches
+    // keep it for good; everything else is revalidated by ETag.
+    const char *cache_control;
+} cs_asset;
+
+// Loads every regular file under dir (dot files skipped) and compresses the
+// text ones, keeping a compressed copy only when it saves at least 10%.
+// Every body gets headroom writable bytes in front. NULL when dir cannot be
+// read or holds no index.html.
+cs_assets *cs_assets_load(const char *dir, size_t headroom);
+void cs_assets_destroy(cs_assets *assets);
+
+// Bits of (1 << cs_asset_encoding) a request accepts, from its
+// Accept-Encoding value (NULL when absent); identity is always included.
+unsigned int cs_assets_accept(const char *accept_encoding);
+
+// Finds path (relative to the loaded dir, with or without a leading '/';
+// "" or a trailing '/' means that directory's index.html) and returns its
+// smallest representation within accept. 0 on success, -1 when missing.
+int cs_assets_lookup(const cs_assets *assets, const char *path, unsigned int accept, cs_asset *asset);
+
+// Files loaded, and their identity and stored (all representations) bytes.
+void cs_assets_stats(const cs_assets *assets, size_t *files, size_t *bytes, size_t *stored_bytes);
+
+#endif
@@ -1,12 +1,85 @@
 #ifndef CS_CONFIG_H
 #define CS_CONFIG_H
 
+typedef enum {
+    CS_MODE_STANDALONE,
+    CS_MODE_ROUTER
+} cs_server_mode;
+
 typedef struct {
+    cs_server_mode mode;
     int width;
     int height;
     float fps;
     int bitrate_kbps;
+    char encoder[64];
+    // Encoder speed preset (see cs_pipeline_config); empty keeps the default.
+    char encoder_preset[64];
+    // QP offset inside the projected scene bounds; 0 (the default) disables
+    // ROI metadata. Only encoders that read it, e.g. vaapih264enc, use it.
+    int roi_delta_qp;
     int signaling_port;
+    int scene_objects;
+    // Shader assets; empty means the source tree's assets directory.
+    char asset_dir[256];
+    // Linked GL programs are cached here; empty disables the cache. Defaults
+    // to $XDG_CACHE_HOME/cube-streamer or ~/.cache/cube-streamer.
+    char shader_cache_dir[256];
+    // EGL platform: auto, surfaceless, device or default.
+    char egl_platform[32];
+    // Render threads, each with its own GL context; frames are drawn
+    // concurrently and pushed in order. 1 renders on the main loop.
+    int render_threads;
+    int max_peers;
+    // Peer branches (webrtcbin included) built ahead of joins, so a burst
+    // of viewers mostly skips element setup.
+    int peer_pool;
+    // Certificate and private key (PEM) presented over DTLS by every peer;
+    // empty generates one per process at startup.
+    char dtls_pem[256];
+    // Port range for peer media; each peer binds one port per host
+    // interface in it (and one more per interface for ICE-TCP when
+    // ice_tcp is set). 0 uses the kernel's ephemeral range.
+    int rtp_port_min;
+    int rtp_port_max;
+    int ice_tcp;
+    // Distinct cameras rendered per frame; peers with matching cameras share
+    // a view and its encoder.
+    int max_views;
+    // Router mode: maximum number of worker processes tracked, and the
+    // listener workers register on (empty iface binds every interface).
+    int router_max_workers;
+    char router_worker_iface[64];
+    int router_worker_port;
+    // Worker side: when router_host is set, register with the router's
+    // worker listener at router_port and report load.
+    char router_host[128];
+    int router_port;
+    char advertise_host[128];
+    // Split mode: render in a separate cs_renderer process over a shared frame ring.
+    int render_process;
+    int frame_ring_slots;
+    char renderer_path[256];
+    // LL-HLS output of the default camera under /hls on the signaling port.
+    int hls;
+    int hls_segment_ms;
+    int hls_part_ms;
+    // Segments kept in memory.
+    int hls_window;
+    // MPEG-TS recordings of every watched view; empty disables recording.
+    char record_dir[256];
+    int record_segment_s;
+    // Oldest recordings in record_dir are deleted past this; 0 keeps all.
+    int record_max_mb;
+    // Trace captures (SIGUSR2 or GET /trace?start=N) last trace_seconds and
+    // are written to trace_dir as Chrome trace JSON; empty keeps them in
+    // memory only.
+    char trace_dir[256];
+    int trace_seconds;
+    // Serve the built web client on the signaling port; client_dir empty
+    // uses the build tree's client/dist.
+    int serve_client;
+    char client_dir[256];
 } cs_config;
 
 int cs_config_load(cs_config *config, const char *path);
@@ -0,0 +1,25 @@
+#ifndef CS_EVENT_LOOP_H
+#define CS_EVENT_LOOP_H
+
+#include <stdint.h>
+
+// Single-threaded epoll loop shared by signaling, the pipeline bus and the
+// frame sources. Event masks use poll(2) bits (POLLIN, POLLOUT, ...), which
+// match both epoll and lws_pollfd.
+typedef struct cs_event_loop cs_event_loop;
+
+typedef void (*cs_event_fn)(void *user, int fd, uint32_t events);
+
+cs_event_loop *cs_event_loop_create(void);
+void cs_event_loop_destroy(cs_event_loop *loop);
+
+int cs_event_loop_add(cs_event_loop *loop, int fd, uint32_t events, cs_event_fn fn, void *user);
+int cs_event_loop_modify(cs_event_loop *loop, int fd, uint32_t events);
+int cs_event_loop_remove(cs_event_loop *loop, int fd);
+
+// Waits up to timeout_ms (-1 blocks) and dispatches ready fds. Handlers may
+// add or remove fds, including ones still pending in the same batch.
+// Returns the number of handlers run, or -1 on error.
+int cs_event_loop_run_once(cs_event_loop *loop, int timeout_ms);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CS_FRAME_RING_H
+#define CS_FRAME_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Shared-memory ring of RGBA frame slots between a renderer process
+// (producer) and the pipeline process (consumer). The slots live in a memfd
+// so the consumer can hand them to GStreamer without copying; slot ownership
+// moves through atomic state transitions, and an eventfd signals new frames.
+typedef struct cs_frame_ring cs_frame_ring;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    uint64_t seq;
+    uint64_t pts_ns;
+    uint64_t epoch;
+    // Bounds of the rendered geometry (x, y, width, height); set by the
+    // producer before publishing.
+    int32_t roi[4];
+    // Opaque handle for cs_frame_ring_release_token (usable as a destroy notify).
+    void *token;
+    int index;
+} cs_frame_slot;
+
+// Consumer side: creates the memfd and eventfd and owns both.
+cs_frame_ring *cs_frame_ring_create(int width, int height, int slot_count);
+// Producer side: maps a ring from file descriptors inherited from the consumer.
+cs_frame_ring *cs_frame_ring_attach(int mem_fd, int notify_fd);
+void cs_frame_ring_destroy(cs_frame_ring *ring);
+
+int cs_frame_ring_mem_fd(const cs_frame_ring *ring);
+int cs_frame_ring_notify_fd(const cs_frame_ring *ring);
+int cs_frame_ring_width(const cs_frame_ring *ring);
+int cs_frame_ring_height(const cs_frame_ring *ring);
+
+// Producer: claim a free slot, fill slot->data, then publish. Returns -1 when
+// every slot is still held by the consumer (the frame should be dropped).
+int cs_frame_ring_begin_write(cs_frame_ring *ring, cs_frame_slot *slot);
+int cs_frame_ring_publish(cs_frame_ring *ring, cs_frame_slot *slot, uint64_t pts_ns);
+void cs_frame_ring_abort_write(cs_frame_ring *ring, cs_frame_slot *slot);
+
+// Consumer: waits up to timeout_ms for a notification. Returns 1 if signalled.
+int cs_frame_ring_wait(cs_frame_ring *ring, int timeout_ms);
+// Takes the newest ready frame; older ready frames are recycled as dropped.
+int cs_frame_ring_acquire_latest(cs_frame_ring *ring, cs_frame_slot *slot);
+void cs_frame_ring_release(cs_frame_ring *ring, const cs_frame_slot *slot);
+void cs_frame_ring_release_token(void *token);
+
+// Bumped by every producer that attaches; a change means the renderer restarted.
+uint64_t cs_frame_ring_producer_epoch(const cs_frame_ring *ring);
+uint64_t cs_frame_ring_dropped(const cs_frame_ring *ring);
+// Returns slots a dead producer left mid-write to the free list.
+void cs_frame_ring_recover(cs_frame_ring *ring);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef CS_HLS_H
+#define CS_HLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Low-latency HLS output for one view. H.264 access units are packaged into
+// CMAF (fragmented MP4) partial segments, grouped into segments that start
+// at keyframes, and kept in memory for a fixed window of segments. Resource
+// names carry a per-process prefix so caches never mix two runs. Main
+// thread only.
+typedef struct cs_hls cs_hls;
+
+typedef struct {
+    int width;
+    int height;
+    // A segment closes at the first keyframe after segment_ms (one is
+    // requested then) and is cut regardless at twice that.
+    int segment_ms;
+    int part_ms;
+    // Complete segments kept. Each segment owns one max_segment_bytes
+    // buffer, so memory stays below (window + 1) * max_segment_bytes.
+    int window;
+    size_t max_segment_bytes;
+} cs_hls_config;
+
+typedef enum {
+    CS_HLS_FOUND,
+    // Will exist shortly (the next part, or the init segment before the
+    // first keyframe); worth a blocking wait.
+    CS_HLS_PENDING,
+    CS_HLS_MISSING
+} cs_hls_status;
+
+typedef struct cs_hls_segment cs_hls_segment;
+
+// Bytes of a served resource. Holds a reference on the segment they live in,
+// so they stay valid after the segment leaves the window.
+typedef struct {
+    cs_hls_segment *segment;
+    const uint8_t *data;
+    size_t len;
+} cs_hls_blob;
+
+cs_hls *cs_hls_create(const cs_hls_config *config);
+void cs_hls_destroy(cs_hls *hls);
+
+// Adds one Annex B access unit. Returns 1 when the open segment has reached
+// its target and the encoder should produce a keyframe, 0 otherwise.
+int cs_hls_push(cs_hls *hls, const uint8_t *data, size_t len, uint64_t pts_us, int keyframe);
+
+// Whether a blocking playlist reload for _HLS_msn=msn (and _HLS_part=part,
+// or -1 when absent) can be answered: 1 yes, 0 not yet, -1 never (too far
+// ahead; answer 400).
+int cs_hls_playlist_ready(const cs_hls *hls, long long msn, int part);
+// The media playlist, NUL terminated; free() it. NULL before the first part.
+char *cs_hls_playlist(const cs_hls *hls, size_t *len);
+
+// Looks up "<prefix>-init.mp4", "<prefix>-<msn>.m4s" or
+// "<prefix>-<msn>.<part>.m4s". On CS_HLS_FOUND, release the blob.
+cs_hls_status cs_hls_lookup(cs_hls *hls, const char *name, cs_hls_blob *blob);
+void cs_hls_blob_release(cs_hls_blob *blob);
+
+// How long a blocked request may wait, and the max-age for caching a
+// blocking playlist response.
+int cs_hls_block_ms(const cs_hls *hls);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CS_JSON_H
+#define CS_JSON_H
+
+#include <stddef.h>
+
+// Minimal helpers for the flat JSON messages used by signaling and the router.
+// Returned strings are heap allocated and owned by the caller.
+char *cs_json_escape(const char *input);
+
+int cs_json_get_string(const char *json, const char *key, char *out, size_t out_len);
+int cs_json_get_int(const char *json, const char *key, int *out_value);
+int cs_json_get_double(const char *json, const char *key, double *out_value);
+
+#endif
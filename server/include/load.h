@@ -0,0 +1,33 @@
+#ifndef CS_LOAD_H
+#define CS_LOAD_H
+
+#include <stdint.h>
+
+typedef struct {
+    double cpu;             // process CPU time over wall time, normalised to all cores (0..1)
+    double encode_headroom; // share of the frame interval not spent rendering/pushing (0..1)
+    int peers;
+    int capacity;           // peers the worker accepts at most, 0 when unbounded
+} cs_load_report;
+
+// Resources held by this process, read from /proc/self; -1 when unknown.
+typedef struct {
+    long rss_kb;
+    int fds;
+    int threads;
+} cs_process_stats;
+
+typedef struct cs_load_monitor cs_load_monitor;
+
+cs_load_monitor *cs_load_monitor_create(float fps);
+void cs_load_monitor_destroy(cs_load_monitor *monitor);
+
+// Records how long one frame kept the render loop busy.
+void cs_load_monitor_frame(cs_load_monitor *monitor, uint64_t busy_ns);
+
+// Fills cpu and encode_headroom for the interval since the previous sample.
+int cs_load_monitor_sample(cs_load_monitor *monitor, cs_load_report *report);
+
+void cs_process_stats_sample(cs_process_stats *stats);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef CS_MAT4_H
+#define CS_MAT4_H
+
+// Column-major 4x4 matrices, laid out as OpenGL expects them.
+typedef struct {
+    float m[16];
+} mat4;
+
+mat4 mat4_identity(void);
+// Returns a * b, i.e. b is applied first.
+mat4 mat4_mul(mat4 a, mat4 b);
+mat4 mat4_translate(float x, float y, float z);
+mat4 mat4_rotate_y(float r);
+mat4 mat4_rotate_x(float r);
+mat4 mat4_perspective(float fovy_rad, float aspect, float z_near, float z_far);
+
+#endif
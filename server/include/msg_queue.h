@@ -0,0 +1,38 @@
+#ifndef CS_MSG_QUEUE_H
+#define CS_MSG_QUEUE_H
+
+#include <stddef.h>
+
+typedef struct cs_msg cs_msg;
+
+// FIFO of outgoing WebSocket messages. Messages are copied on push and
+// stored with LWS_PRE bytes of headroom so they can be written in place.
+typedef struct {
+    cs_msg *head;
+    cs_msg *tail;
+    size_t count;
+} cs_msg_queue;
+
+int cs_msg_queue_push(cs_msg_queue *queue, const char *data, size_t len);
+int cs_msg_queue_push_str(cs_msg_queue *queue, const char *text);
+
+// Returns a pointer to the payload of the oldest message (LWS_PRE bytes of
+// writable headroom precede it), or NULL when empty.
+unsigned char *cs_msg_queue_peek(cs_msg_queue *queue, size_t *len);
+void cs_msg_queue_pop(cs_msg_queue *queue);
+void cs_msg_queue_clear(cs_msg_queue *queue);
+
+// Reassembles fragmented WebSocket messages received on one connection.
+typedef struct {
+    char *buf;
+    size_t len;
+} cs_msg_assembler;
+
+struct lws;
+
+// Appends a received fragment; returns 1 once the whole message is buffered
+// (NUL terminated in assembler->buf), 0 while more is expected, -1 on error.
+int cs_msg_assembler_append(cs_msg_assembler *assembler, struct lws *wsi, const void *in, size_t len);
+void cs_msg_assembler_reset(cs_msg_assembler *assembler);
+
+#endif
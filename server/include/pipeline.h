@@ -1,30 +1,154 @@
 #ifndef CS_PIPELINE_H
 #define CS_PIPELINE_H
 
+#include "event_loop.h"
+#include "recorder.h"
+
 #include <stdint.h>
 #include <stddef.h>
 
 typedef struct cs_pipeline cs_pipeline;
 
+// Region of interest inside one view, in that view's pixel coordinates.
 typedef struct {
+    int view;
+    int x;
+    int y;
     int width;
     int height;
+} cs_pipeline_region;
+
+// One encoded H.264 access unit (Annex B, SPS/PPS in front of keyframes).
+// Only valid during on_view_unit.
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    uint64_t pts_us;
+    int keyframe;
+} cs_pipeline_unit;
+
+typedef struct {
+    // Size of one view. Frames pushed are an atlas of atlas_cols x atlas_rows
+    // views; each view gets its own encoder and is shared by all peers on it.
+    int width;
+    int height;
+    int atlas_cols;
+    int atlas_rows;
     float fps;
     int bitrate_kbps;
+    // H.264 encoder element, x264enc when NULL.
+    const char *encoder;
+    // Speed/quality trade-off of the encoder, set on whichever of
+    // speed-preset (x264enc), preset (nvh264enc), complexity (openh264enc)
+    // or quality-level (vaapih264enc) it has. NULL or empty keeps the
+    // default, ultrafast for x264enc.
+    const char *encoder_preset;
+    // Peer branches kept built and PLAYING ahead of joins; cs_pipeline_poll
+    // refills the pool one branch per call. 0 builds every peer on join.
+    int peer_pool;
+    // File holding the DTLS certificate and private key (PEM) every peer
+    // presents. NULL or empty uses one certificate generated per process.
+    const char *dtls_pem;
+    // UDP (and ICE-TCP) ports peers bind their candidates in; 0 leaves the
+    // kernel's ephemeral range. Needs GStreamer 1.20. With ice_tcp 0 peers
+    // offer UDP candidates only and open no TCP listeners.
+    int rtp_port_min;
+    int rtp_port_max;
+    int ice_tcp;
+    // QP offset for regions of interest; 0 disables ROI metadata. Ignored
+    // with x264enc, which does not read it.
+    int roi_delta_qp;
+    // When set, each view's encoder output is also muxed to MPEG-TS behind a
+    // leaky queue and written to track <view> of the recorder. Like the
+    // other branches it only carries data while the view is watched.
+    cs_recorder *recorder;
+    // When set, the bus and the internal event queue are registered with the
+    // loop and cs_pipeline_poll runs whenever either has work.
+    cs_event_loop *loop;
     void *user;
-    void (*on_local_sdp)(void *user, const char *type, const char *sdp);
-    void (*on_local_ice)(void *user, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+    // Callbacks run on the thread calling cs_pipeline_create_offer/answer or
+    // cs_pipeline_poll, never on GStreamer streaming threads.
+    void (*on_local_sdp)(void *user, int peer_id, const char *type, const char *sdp);
+    void (*on_local_ice)(void *user, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+    // Every local candidate of the peer has been reported.
+    void (*on_ice_gathering_done)(void *user, int peer_id);
+    // ICE gave up on the peer; nothing will reach it until it is removed.
+    void (*on_peer_failed)(void *user, int peer_id);
+    void (*on_data_message)(void *user, int peer_id, const char *message);
+    void (*on_view_encoded)(void *user, int view, uint64_t tag);
+    // Encoder output of views with stream viewers (cs_pipeline_watch_view).
+    void (*on_view_unit)(void *user, int view, const cs_pipeline_unit *unit);
 } cs_pipeline_config;
 
+// Initializes GStreamer and loads the plugins the pipeline uses (encoder is
+// the configured element, x264enc when NULL) on a background thread, so the
+// registry scan overlaps other startup work. The process-wide DTLS key is
+// generated there too. cs_pipeline_create waits for it. Optional; call at
+// most once.
+void cs_pipeline_preload(const char *encoder);
+
+// Every encoder is pre-rolled with one black frame, so the first viewer's
+// frames do not pay for caps negotiation and encoder setup.
 cs_pipeline *cs_pipeline_create(const cs_pipeline_config *config);
 void cs_pipeline_destroy(cs_pipeline *pipeline);
 
-// Push a raw RGBA frame into the pipeline.
-int cs_pipeline_push_frame(cs_pipeline *pipeline, const uint8_t *rgba, size_t len, uint64_t pts_ns);
+// Push a raw RGBA frame into the pipeline. Each region is attached to the
+// matching view's encoder input as GstVideoRegionOfInterestMeta.
+int cs_pipeline_push_frame(cs_pipeline *pipeline, const uint8_t *rgba, size_t len, uint64_t pts_ns,
+                           const cs_pipeline_region *regions, int region_count);
+
+// Push a raw RGBA frame without copying. release(user) runs once GStreamer
+// no longer references the memory, possibly from a streaming thread.
+int cs_pipeline_push_wrapped(cs_pipeline *pipeline, uint8_t *rgba, size_t len, uint64_t pts_ns,
+                             const cs_pipeline_region *regions, int region_count,
+                             void (*release)(void *user), void *user);
+
+typedef struct {
+    int peers;
+    // Idle branches in the peer pool, not counted in peers.
+    int pooled;
+    // Every element in the pipeline, nested bins included, and their pads.
+    int elements;
+    int pads;
+} cs_pipeline_stats;
+
+// Peers: one webrtcbin each, fed from the encoder of the view they watch.
+// Every peer also gets an "input" data channel. A joining peer takes a
+// branch from the pool when one is ready, so only linking it to the view
+// and its offer or answer remain.
+int cs_pipeline_add_peer(cs_pipeline *pipeline, int peer_id, int view);
+int cs_pipeline_remove_peer(cs_pipeline *pipeline, int peer_id);
+int cs_pipeline_set_peer_view(cs_pipeline *pipeline, int peer_id, int view);
+int cs_pipeline_send_data(cs_pipeline *pipeline, int peer_id, const char *message);
+
+// Viewers outside WebRTC (WebSocket streams) watching a view: keeps its
+// encoder running and delivers its access units through on_view_unit.
+int cs_pipeline_watch_view(cs_pipeline *pipeline, int view, int delta);
+int cs_pipeline_request_keyframe(cs_pipeline *pipeline, int view);
+
+// Reports through on_view_encoded once the most recently pushed frame has
+// left the view's encoder.
+int cs_pipeline_track_view(cs_pipeline *pipeline, int view, uint64_t tag);
+
+// Drains the bus, delivers queued callbacks and finishes peer removals.
+// Runs from the event loop when one is configured; call regularly otherwise.
+void cs_pipeline_poll(cs_pipeline *pipeline);
 
 // Signaling hooks for SDP/ICE exchange.
-int cs_pipeline_set_remote_description(cs_pipeline *pipeline, const char *sdp_type, const char *sdp);
-char *cs_pipeline_create_offer(cs_pipeline *pipeline);
-int cs_pipeline_add_ice_candidate(cs_pipeline *pipeline, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+int cs_pipeline_set_remote_description(cs_pipeline *pipeline, int peer_id, const char *sdp_type, const char *sdp);
+char *cs_pipeline_create_offer(cs_pipeline *pipeline, int peer_id);
+// Answers a remote offer applied with cs_pipeline_set_remote_description.
+char *cs_pipeline_create_answer(cs_pipeline *pipeline, int peer_id);
+int cs_pipeline_add_ice_candidate(cs_pipeline *pipeline, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+
+// Times every view's encoder and every peer's payloader into the running
+// trace capture (trace.h), plus GStreamer latency tracer lines when
+// GST_TRACERS enables it. Call with 1 when a capture starts and 0 when
+// cs_trace_poll ends it.
+void cs_pipeline_trace(cs_pipeline *pipeline, int on);
+
+// Live object counts; once every peer has left they should be back at their
+// value before the first peer joined.
+int cs_pipeline_get_stats(cs_pipeline *pipeline, cs_pipeline_stats *stats);
 
 #endif
@@ -0,0 +1,45 @@
+#ifndef CS_RECORDER_H
+#define CS_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Disk recording of muxed streams (one track per view) that never blocks the
+// caller on I/O. Data is copied into page-aligned buffers; a writer thread
+// flushes each full buffer with a single write(), rotates files at keyframes
+// and deletes the oldest recordings once the directory exceeds its cap. When
+// the disk falls behind and every buffer is queued, new data is dropped up to
+// the next keyframe instead of waiting.
+typedef struct cs_recorder cs_recorder;
+
+typedef struct {
+    // Files are named view<track>-<UTC time>.ts.
+    const char *dir;
+    int tracks;
+    // A file closes at the first keyframe after segment_s.
+    int segment_s;
+    // Recordings in dir, earlier runs included, are deleted oldest first
+    // while they add up to more than this; 0 keeps everything.
+    uint64_t max_bytes;
+    // Size (rounded up to whole pages) and count of the write buffers.
+    // Partly filled buffers are flushed after a second.
+    size_t buffer_bytes;
+    int buffers;
+} cs_recorder_config;
+
+typedef struct {
+    uint64_t written_bytes;
+    uint64_t dropped_bytes;
+    int files;
+} cs_recorder_stats;
+
+cs_recorder *cs_recorder_create(const cs_recorder_config *config);
+// Writes out everything queued, then closes the files.
+void cs_recorder_destroy(cs_recorder *recorder);
+
+// Appends muxed bytes to a track; keyframe marks data a file may start with.
+// Any thread. Returns -1 when the data was dropped.
+int cs_recorder_write(cs_recorder *recorder, int track, const uint8_t *data, size_t len, int keyframe);
+void cs_recorder_get_stats(cs_recorder *recorder, cs_recorder_stats *stats);
+
+#endif
@@ -10,12 +10,90 @@ typedef struct {
     int width;
     int height;
     float fps;
+    int scene_objects;
+    // Views are tiled into an atlas of atlas_cols x atlas_rows tiles, each
+    // width x height. Zero means a single view.
+    int atlas_cols;
+    int atlas_rows;
+    // Passed to the scene; NULL for the source tree's assets and no cache.
+    const char *asset_dir;
+    const char *shader_cache_dir;
+    // EGL platform: "surfaceless", "device" or "default"; NULL or "auto"
+    // tries them in that order.
+    const char *platform;
+    // Render threads, each with its own context sharing the scene geometry.
+    // Above 1, frames are normally queued with cs_render_submit; otherwise
+    // rendering runs on the creating thread.
+    int threads;
 } cs_render_config;
 
+// Orbit camera around the scene origin. zoom scales the distance that frames
+// the whole scene; <= 0 means 1.
+typedef struct {
+    float yaw;
+    float pitch;
+    float zoom;
+} cs_camera;
+
+// Pixel rectangle within a tile, top-left origin as in the video frame.
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} cs_render_rect;
+
+typedef struct {
+    int tile;
+    cs_camera camera;
+    // Output: screen bounds of everything drawn in the tile; zero size when
+    // the tile is empty.
+    cs_render_rect roi;
+} cs_render_view;
+
 cs_renderer *cs_render_create(const cs_render_config *config);
 void cs_render_destroy(cs_renderer *renderer);
 
 // Renders one frame into the provided RGBA buffer (size width*height*4).
-int cs_render_frame(cs_renderer *renderer, uint8_t *rgba_out, size_t rgba_len);
+// roi_out, when not NULL, receives the bounds of the drawn geometry.
+int cs_render_frame(cs_renderer *renderer, uint8_t *rgba_out, size_t rgba_len, cs_render_rect *roi_out);
+
+// Renders each view into its atlas tile in one pass over the shared scene
+// and reads the whole atlas back (size width*cols * height*rows * 4).
+int cs_render_frame_views(cs_renderer *renderer, cs_render_view *views, int view_count,
+                          uint8_t *rgba_out, size_t rgba_len);
+
+// Pooled renderers (threads > 1). Frames are drawn concurrently and handed
+// back in submission order, each advancing the animation by one frame.
+typedef struct {
+    uint64_t seq;
+    uint64_t tag;
+    // Nonzero when the frame failed to render; release it all the same.
+    int status;
+    const uint8_t *rgba;
+    size_t len;
+    // The submitted views with their roi filled in.
+    const cs_render_view *views;
+    int view_count;
+    // Draw plus readback on the worker.
+    uint64_t render_ns;
+} cs_render_result;
+
+int cs_render_threads(const cs_renderer *renderer);
+
+// Readable (eventfd) once a submitted frame has finished; drain it, then
+// take results until cs_render_take fails.
+int cs_render_fd(const cs_renderer *renderer);
+
+// Queues views for the next free worker; tag is passed through. Returns -1
+// when every worker is busy, in which case the caller skips the frame.
+// cs_render_frame_views on a pooled renderer submits and waits, and must
+// not be mixed with this.
+int cs_render_submit(cs_renderer *renderer, const cs_render_view *views, int view_count, uint64_t tag);
+
+// The oldest finished frame, in submission order. Its buffers stay valid
+// until cs_render_release. Returns -1 when it is not done yet.
+int cs_render_take(cs_renderer *renderer, cs_render_result *result);
+void cs_render_release(cs_renderer *renderer, const cs_render_result *result);
 
 #endif
@@ -0,0 +1,25 @@
+#ifndef CS_RENDER_PROCESS_H
+#define CS_RENDER_PROCESS_H
+
+#include "frame_ring.h"
+
+// Supervises a cs_renderer child that renders into a shared frame ring.
+// The child is respawned if it exits, so a GL driver crash costs a few
+// frames instead of the whole server.
+typedef struct cs_render_process cs_render_process;
+
+typedef struct {
+    const char *renderer_path;
+    const char *config_path;
+    cs_frame_ring *ring;
+    int respawn_delay_ms;
+} cs_render_process_config;
+
+cs_render_process *cs_render_process_create(const cs_render_process_config *config);
+void cs_render_process_destroy(cs_render_process *process);
+
+// Reaps an exited renderer and respawns it once the delay has passed.
+// Returns 1 while a renderer is running, 0 otherwise.
+int cs_render_process_check(cs_render_process *process);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef CS_ROUTER_H
+#define CS_ROUTER_H
+
+typedef struct cs_router cs_router;
+
+typedef struct {
+    // Public port for viewers ("cs-signaling" only).
+    int port;
+    // Workers register on their own listener ("cs-worker" only), so viewers
+    // cannot reach it; NULL or empty binds every interface.
+    const char *worker_iface;
+    int worker_port;
+    int max_workers;
+    // Workers whose last load report is older than this are not placed on.
+    int worker_timeout_ms;
+} cs_router_config;
+
+// The router owns the public signaling endpoint. Worker cube_server processes
+// connect to the worker listener with the "cs-worker" protocol and report
+// load; each viewer that
+// connects with "cs-signaling" is placed on the least-loaded worker and its
+// SDP/ICE messages are relayed unchanged in both directions.
+cs_router *cs_router_create(const cs_router_config *config);
+void cs_router_destroy(cs_router *router);
+
+int cs_router_poll(cs_router *router, int timeout_ms);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef CS_SCENE_H
+#define CS_SCENE_H
+
+#include "mat4.h"
+
+// A field of spinning cubes drawn as indexed, instanced geometry. Instance
+// state is kept structure-of-arrays so CPU frustum culling streams through
+// it; only visible instances are uploaded each frame. Requires a current GL
+// ES context; falls back to one draw per instance without instancing support.
+typedef struct cs_scene cs_scene;
+
+typedef struct {
+    int object_count;
+    unsigned int seed;
+    // Where shaders/cube.{vert,frag} live and where linked programs are
+    // cached (see cs_shader_program).
+    const char *asset_dir;
+    const char *shader_cache_dir;
+} cs_scene_config;
+
+typedef struct {
+    int visible;
+    int draw_calls;
+    // Conservative screen bounds of the visible instances in NDC
+    // (min_x, min_y, max_x, max_y); min > max when nothing is visible.
+    float bounds[4];
+} cs_scene_stats;
+
+cs_scene *cs_scene_create(const cs_scene_config *config);
+// A second scene drawing the same cubes from another thread. The current
+// context must share objects with the source's; geometry and instance
+// layout are the source's and read-only, while the program, the animation
+// (starting from the source's current state) and per-frame buffers are its
+// own. Only the shader settings of config are used. Destroy it before the
+// source.
+cs_scene *cs_scene_create_shared(const cs_scene *source, const cs_scene_config *config);
+void cs_scene_destroy(cs_scene *scene);
+
+// Camera distance that frames the whole scene from the origin.
+float cs_scene_view_distance(const cs_scene *scene);
+
+void cs_scene_update(cs_scene *scene, float dt);
+int cs_scene_draw(cs_scene *scene, const mat4 *view_proj, cs_scene_stats *stats);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef CS_SHADER_H
+#define CS_SHADER_H
+
+// GL programs built from shader assets, <asset_dir>/shaders/<name>.vert and
+// <name>.frag. With a cache_dir and program binary support (ES 3 or
+// OES_get_program_binary), linked programs are stored there keyed by their
+// sources and the driver, so later starts skip compiling and linking.
+// Compile and link errors are logged with the driver's info log. Requires a
+// current GL ES context.
+typedef struct {
+    // NULL or empty: the assets directory of the source tree.
+    const char *asset_dir;
+    // NULL or empty: no binary cache.
+    const char *cache_dir;
+} cs_shader_config;
+
+// Returns the program, or 0 on failure.
+unsigned int cs_shader_program(const cs_shader_config *config, const char *name);
+
+#endif
@@ -1,26 +1,100 @@
 #ifndef CS_SIGNALING_H
 #define CS_SIGNALING_H
 
+#include "event_loop.h"
+#include "hls.h"
+#include "load.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct cs_signaling cs_signaling;
 
 typedef struct {
     int port;
+    // Connections beyond this many concurrent peers are refused.
+    int max_peers;
+    // When router_host is set, the server registers with a router as a worker
+    // and sends periodic load reports (see cs_signaling_report_load).
+    const char *router_host;
+    int router_port;
+    const char *advertise_host;
+    // When set, lws sockets are registered with the loop and serviced as
+    // soon as they are ready; cs_signaling_poll then only runs timers.
+    cs_event_loop *loop;
+    // When set, its playlist, init segment, segments and parts are served
+    // under /hls (see cs_signaling_hls_updated).
+    cs_hls *hls;
+    // Built web client (cs_assets), loaded into memory at startup and served
+    // for GET on every path no other handler claims; empty uses the build's
+    // client/dist, NULL serves none.
+    const char *client_dir;
 } cs_signaling_config;
 
+// Every WebSocket connection and every WHEP session (POST /whep) is one peer,
+// identified by a positive peer_id that stays unique for the lifetime of the
+// process.
 typedef struct {
     void *user;
-    void (*on_offer_needed)(void *user);
-    void (*on_local_sdp)(void *user, const char *type, const char *sdp);
-    void (*on_remote_sdp)(void *user, const char *type, const char *sdp);
-    void (*on_remote_ice)(void *user, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+    void (*on_offer_needed)(void *user, int peer_id);
+    // A WHEP client offered; answer through cs_signaling_send_sdp. Nonzero
+    // rejects the session.
+    int (*on_remote_offer)(void *user, int peer_id, const char *sdp);
+    void (*on_peer_closed)(void *user, int peer_id);
+    void (*on_remote_sdp)(void *user, int peer_id, const char *type, const char *sdp);
+    void (*on_remote_ice)(void *user, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+    // A cs-stream WebSocket viewer connected; it gets access units through
+    // cs_signaling_stream_send and sends JSON text (camera input).
+    void (*on_stream_opened)(void *user, int peer_id);
+    void (*on_stream_message)(void *user, int peer_id, const char *message);
+    // GET /stats: writes a JSON object into out and returns its length, or
+    // -1 when there is nothing to report. Like snprintf, returns the full
+    // length when out is too small; the caller then retries with more room.
+    int (*on_stats)(void *user, char *out, size_t out_len);
+    // POST /trace {"seconds":<s>}: starts a trace capture of s seconds (0
+    // for the configured length); returns -1 while one is still running.
+    // GET /trace: the last finished capture as malloc'd JSON, or NULL when
+    // there is none.
+    int (*on_trace_start)(void *user, int seconds);
+    char *(*on_trace_dump)(void *user, size_t *len);
 } cs_signaling_callbacks;
 
+// One encoded access unit framed for cs-stream viewers: a 12-byte header
+// (version 1, flags with bit 0 = keyframe, two reserved bytes, timestamp in
+// microseconds as little-endian u64) followed by Annex B H.264. Created once
+// and shared by reference with every viewer it is sent to; main thread only.
+typedef struct cs_stream_unit cs_stream_unit;
+
+cs_stream_unit *cs_stream_unit_create(const uint8_t *data, size_t len, uint64_t pts_us, int keyframe);
+void cs_stream_unit_unref(cs_stream_unit *unit);
+
 cs_signaling *cs_signaling_create(const cs_signaling_config *config, const cs_signaling_callbacks *callbacks);
 void cs_signaling_destroy(cs_signaling *signaling);
 
-int cs_signaling_broadcast_sdp(cs_signaling *signaling, const char *type, const char *sdp);
-int cs_signaling_broadcast_ice(cs_signaling *signaling, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+int cs_signaling_send_sdp(cs_signaling *signaling, int peer_id, const char *type, const char *sdp);
+int cs_signaling_send_ice(cs_signaling *signaling, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid);
+
+// WHEP answers are held until this is called for the peer (or a timeout), so
+// they carry all server candidates. A no-op for WebSocket peers.
+int cs_signaling_ice_gathering_done(cs_signaling *signaling, int peer_id);
+// Ends a peer from the server side; on_peer_closed follows.
+int cs_signaling_close_peer(cs_signaling *signaling, int peer_id);
+
+// Queues a unit for a cs-stream viewer; until a keyframe arrives, viewers
+// that just joined or fell behind skip delta units. Returns 1 when the
+// viewer's backlog was dropped just now and a keyframe is needed.
+int cs_signaling_stream_send(cs_signaling *signaling, int peer_id, cs_stream_unit *unit);
+int cs_signaling_stream_send_text(cs_signaling *signaling, int peer_id, const char *text);
+
+// Call after pushing to the cs_hls: answers blocked playlist reloads and
+// preload-hint requests that can now be served.
+void cs_signaling_hls_updated(cs_signaling *signaling);
+
+int cs_signaling_peer_count(const cs_signaling *signaling);
+int cs_signaling_report_load(cs_signaling *signaling, const cs_load_report *report);
 
 int cs_signaling_poll(cs_signaling *signaling);
+// Milliseconds (at most max_ms) until cs_signaling_poll has timer work.
+int cs_signaling_timeout_ms(cs_signaling *signaling, int max_ms);
 
 #endif
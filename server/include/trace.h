@@ -0,0 +1,47 @@
+#ifndef CS_TRACE_H
+#define CS_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// On-demand capture of per-frame spans, dumped as Chrome trace-event JSON
+// for Perfetto or chrome://tracing. Every thread records into its own ring,
+// created the first time it records; nothing is shared on the hot path.
+// Outside a capture each trace point costs one predictable branch.
+extern int cs_trace_active;
+
+uint64_t cs_trace_now_ns(void);
+
+// name and arg_name must outlive the capture (string literals). detail is
+// copied and may be NULL; arg_name NULL omits the argument.
+void cs_trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, const char *arg_name, int64_t arg,
+                     const char *detail);
+
+static inline uint64_t cs_trace_begin(void) {
+    return __builtin_expect(__atomic_load_n(&cs_trace_active, __ATOMIC_RELAXED), 0) ? cs_trace_now_ns() : 0;
+}
+
+// Closes a span opened by cs_trace_begin; a no-op when it returned 0.
+static inline void cs_trace_end(uint64_t start_ns, const char *name, const char *arg_name, int64_t arg) {
+    if (__builtin_expect(start_ns != 0, 0)) {
+        cs_trace_record(name, start_ns, cs_trace_now_ns(), arg_name, arg, NULL);
+    }
+}
+
+// Starts a capture of seconds (clamped to 1..60). When the window has
+// passed, the events are formatted off the caller's thread and, with a dir,
+// written to <dir>/cube-trace-<UTC time>.json. Returns -1 while a capture
+// or its dump is still running.
+int cs_trace_start(int seconds, const char *dir);
+
+// Call regularly from one thread; ends the capture once its window has
+// passed. Returns 1 on the call that ended it, 0 otherwise.
+int cs_trace_poll(void);
+
+// The last finished capture (malloc'd, caller frees), or NULL.
+char *cs_trace_copy_last(size_t *len);
+
+// Waits for a running dump and frees every ring.
+void cs_trace_shutdown(void);
+
+#endif
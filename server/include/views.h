@@ -0,0 +1,30 @@
+#ifndef CS_VIEWS_H
+#define CS_VIEWS_H
+
+#include "render.h"
+
+// Assigns peers to atlas views. Peers whose cameras match (after
+// quantisation) share a view and therefore one encode; a peer alone in its
+// view updates that view's camera in place.
+typedef struct cs_view_set cs_view_set;
+
+cs_view_set *cs_view_set_create(int max_views);
+void cs_view_set_destroy(cs_view_set *set);
+
+// Picks the grid used to tile max_views views of equal size.
+void cs_view_atlas_layout(int max_views, int *cols, int *rows);
+
+// Adds a peer with the default camera. Returns its view, or -1 when the
+// peer could not be tracked.
+int cs_view_set_add_peer(cs_view_set *set, int peer_id);
+void cs_view_set_remove_peer(cs_view_set *set, int peer_id);
+
+// Applies a new camera for a peer and returns the view it now belongs to.
+// When every view is taken by other cameras the peer keeps its current view.
+int cs_view_set_update(cs_view_set *set, int peer_id, const cs_camera *camera);
+int cs_view_set_view_of(const cs_view_set *set, int peer_id);
+
+// Fills views[] with every view that has at least one peer.
+int cs_view_set_active(const cs_view_set *set, cs_render_view *views, int max);
+
+#endif
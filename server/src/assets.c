@@ -0,0 +1,384 @@
+#include "assets.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#ifdef CS_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+// Deep enough for any bundler layout; guards against symlink loops.
+#define CS_ASSETS_MAX_DEPTH 8
+
+typedef struct {
+    // Headroom bytes, then the body.
+    uint8_t *block;
+    size_t len;
+    char etag[24];
+} asset_variant;
+
+typedef struct {
+    char *path;
+    const char *content_type;
+    const char *cache_control;
+    int compressible;
+    asset_variant variants[CS_ASSET_ENCODINGS];
+} asset_entry;
+
+struct cs_assets {
+    size_t headroom;
+    // Sorted by path for bsearch.
+    asset_entry *entries;
+    size_t count;
+    size_t cap;
+};
+
+static const char *const encoding_names[CS_ASSET_ENCODINGS] = { NULL, "gzip", "br" };
+static const char *const etag_suffixes[CS_ASSET_ENCODINGS] = { "", "-gz", "-br" };
+
+static const struct {
+    const char *ext;
+    const char *type;
+    int compressible;
+} content_types[] = {
+    { ".html", "text/html; charset=utf-8", 1 },
+    { ".js", "text/javascript; charset=utf-8", 1 },
+    { ".mjs", "text/javascript; charset=utf-8", 1 },
+    { ".css", "text/css; charset=utf-8", 1 },
+    { ".json", "application/json", 1 },
+    { ".map", "application/json", 1 },
+    { ".svg", "image/svg+xml", 1 },
+    { ".txt", "text/plain; charset=utf-8", 1 },
+    { ".wasm", "application/wasm", 1 },
+    { ".png", "image/png", 0 },
+    { ".jpg", "image/jpeg", 0 },
+    { ".jpeg", "image/jpeg", 0 },
+    { ".webp", "image/webp", 0 },
+    { ".ico", "image/x-icon", 0 },
+    { ".woff2", "font/woff2", 0 },
+};
+
+static void classify(asset_entry *entry) {
+    const char *dot = strrchr(entry->path, '.');
+    entry->content_type = "application/octet-stream";
+    entry->compressible = 0;
+    for (size_t i = 0; dot && i < sizeof(content_types) / sizeof(content_types[0]); ++i) {
+        if (strcasecmp(dot, content_types[i].ext) == 0) {
+            entry->content_type = content_types[i].type;
+            entry->compressible = content_types[i].compressible;
+            break;
+        }
+    }
+    entry->cache_control = strncmp(entry->path, "assets/", 7) == 0 ? "public, max-age=31536000, immutable"
+                                                                   : "no-cache";
+}
+
+static uint64_t fnv1a(const uint8_t *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static uint8_t *read_file(const char *path, size_t headroom, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    struct stat st;
+    uint8_t *block = NULL;
+    if (fstat(fileno(file), &st) == 0 && st.st_size >= 0) {
+        block = (uint8_t *)malloc(headroom + (size_t)st.st_size + 1);
+        if (block && fread(block + headroom, 1, (size_t)st.st_size, file) != (size_t)st.st_size) {
+            free(block);
+            block = NULL;
+        }
+        *len = (size_t)st.st_size;
+    }
+    fclose(file);
+    return block;
+}
+
+// gzip (RFC 1952) at the highest level; startup pays once for every viewer.
+static uint8_t *compress_gzip(const uint8_t *data, size_t len, size_t headroom, size_t *out_len) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    size_t cap = deflateBound(&stream, (uLong)len) + 32;
+    uint8_t *block = (uint8_t *)malloc(headroom + cap);
+    if (!block) {
+        deflateEnd(&stream);
+        return NULL;
+    }
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)len;
+    stream.next_out = block + headroom;
+    stream.avail_out = (uInt)cap;
+    int ret = deflate(&stream, Z_FINISH);
+    *out_len = stream.total_out;
+    deflateEnd(&stream);
+    if (ret != Z_STREAM_END) {
+        free(block);
+        return NULL;
+    }
+    return block;
+}
+
+static uint8_t *compress_brotli(const uint8_t *data, size_t len, size_t headroom, size_t *out_len) {
+#ifdef CS_HAVE_BROTLI
+    size_t cap = BrotliEncoderMaxCompressedSize(len);
+    if (cap == 0) {
+        return NULL;
+    }
+    uint8_t *block = (uint8_t *)malloc(headroom + cap);
+    if (!block) {
+        return NULL;
+    }
+    *out_len = cap;
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, data,
+                               out_len, block + headroom)) {
+        free(block);
+        return NULL;
+    }
+    return block;
+#else
+    (void)data;
+    (void)len;
+    (void)headroom;
+    (void)out_len;
+    return NULL;
+#endif
+}
+
+static int add_file(cs_assets *assets, const char *full_path, const char *rel_path) {
+    if (assets->count == assets->cap) {
+        size_t cap = assets->cap ? assets->cap * 2 : 32;
+        asset_entry *entries = (asset_entry *)realloc(assets->entries, cap * sizeof(asset_entry));
+        if (!entries) {
+            return -1;
+        }
+        assets->entries = entries;
+        assets->cap = cap;
+    }
+    asset_entry *entry = &assets->entries[assets->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->path = strdup(rel_path);
+    if (!entry->path) {
+        return -1;
+    }
+    asset_variant *identity = &entry->variants[CS_ASSET_IDENTITY];
+    identity->block = read_file(full_path, assets->headroom, &identity->len);
+    if (!identity->block) {
+        fprintf(stderr, "Client asset %s unreadable\n", full_path);
+        free(entry->path);
+        return -1;
+    }
+    classify(entry);
+
+    const uint8_t *body = identity->block + assets->headroom;
+    uint64_t hash = fnv1a(body, identity->len);
+    for (int e = 0; e < CS_ASSET_ENCODINGS; ++e) {
+        asset_variant *variant = &entry->variants[e];
+        if (e != CS_ASSET_IDENTITY && entry->compressible) {
+            size_t len = 0;
+            variant->block = e == CS_ASSET_GZIP ? compress_gzip(body, identity->len, assets->headroom, &len)
+                                                : compress_brotli(body, identity->len, assets->headroom, &len);
+            if (variant->block && len * 10 > identity->len * 9) {
+                // Not worth a second representation.
+                free(variant->block);
+                variant->block = NULL;
+            }
+            variant->len = len;
+        }
+        snprintf(variant->etag, sizeof(variant->etag), "\"%016llx%s\"", (unsigned long long)hash, etag_suffixes[e]);
+    }
+    assets->count++;
+    return 0;
+}
+
+static int load_dir(cs_assets *assets, const char *root, const char *rel, int depth) {
+    if (depth > CS_ASSETS_MAX_DEPTH) {
+        return 0;
+    }
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s%s", root, rel[0] ? "/" : "", rel);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    int ret = 0;
+    struct dirent *ent;
+    while (ret == 0 && (ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        char child_rel[512];
+        char child_path[1024];
+        int n = snprintf(child_rel, sizeof(child_rel), "%s%s%s", rel, rel[0] ? "/" : "", ent->d_name);
+        if (n < 0 || (size_t)n >= sizeof(child_rel)) {
+            continue;
+        }
+        snprintf(child_path, sizeof(child_path), "%s/%s", root, child_rel);
+        struct stat st;
+        if (stat(child_path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            ret = load_dir(assets, root, child_rel, depth + 1);
+        } else if (S_ISREG(st.st_mode)) {
+            ret = add_file(assets, child_path, child_rel);
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const asset_entry *)a)->path, ((const asset_entry *)b)->path);
+}
+
+static int compare_key(const void *key, const void *entry) {
+    return strcmp((const char *)key, ((const asset_entry *)entry)->path);
+}
+
+cs_assets *cs_assets_load(const char *dir, size_t headroom) {
+    if (!dir || !dir[0]) {
+        return NULL;
+    }
+    cs_assets *assets = (cs_assets *)calloc(1, sizeof(cs_assets));
+    if (!assets) {
+        return NULL;
+    }
+    assets->headroom = headroom;
+    if (load_dir(assets, dir, "", 0) != 0) {
+        cs_assets_destroy(assets);
+        return NULL;
+    }
+    qsort(assets->entries, assets->count, sizeof(asset_entry), compare_entries);
+
+    cs_asset index;
+    if (cs_assets_lookup(assets, "", 1u << CS_ASSET_IDENTITY, &index) != 0) {
+        cs_assets_destroy(assets);
+        return NULL;
+    }
+    return assets;
+}
+
+void cs_assets_destroy(cs_assets *assets) {
+    if (!assets) {
+        return;
+    }
+    for (size_t i = 0; i < assets->count; ++i) {
+        for (int e = 0; e < CS_ASSET_ENCODINGS; ++e) {
+            free(assets->entries[i].variants[e].block);
+        }
+        free(assets->entries[i].path);
+    }
+    free(assets->entries);
+    free(assets);
+}
+
+// Coding names with their parameters; an explicit q=0 refuses the coding.
+unsigned int cs_assets_accept(const char *accept_encoding) {
+    unsigned int accept = 1u << CS_ASSET_IDENTITY;
+    const char *p = accept_encoding;
+    while (p && *p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char *token = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        size_t token_len = (size_t)(p - token);
+        const char *params = p;
+        while (*p && *p != ',') {
+            p++;
+        }
+        int refused = 0;
+        const char *q = params;
+        while ((q = strstr(q, "q=")) != NULL && q < p) {
+            refused = strtod(q + 2, NULL) <= 0.0;
+            q += 2;
+        }
+        if (refused || token_len == 0) {
+            continue;
+        }
+        if ((token_len == 4 && strncasecmp(token, "gzip", 4) == 0) ||
+            (token_len == 6 && strncasecmp(token, "x-gzip", 6) == 0)) {
+            accept |= 1u << CS_ASSET_GZIP;
+        } else if (token_len == 2 && strncasecmp(token, "br", 2) == 0) {
+            accept |= 1u << CS_ASSET_BROTLI;
+        } else if (token_len == 1 && token[0] == '*') {
+            accept |= (1u << CS_ASSET_GZIP) | (1u << CS_ASSET_BROTLI);
+        }
+    }
+    return accept;
+}
+
+int cs_assets_lookup(const cs_assets *assets, const char *path, unsigned int accept, cs_asset *asset) {
+    if (!assets || !path || !asset) {
+        return -1;
+    }
+    while (*path == '/') {
+        path++;
+    }
+    char key[512];
+    size_t len = strlen(path);
+    int n = snprintf(key, sizeof(key), "%s%s", path, len == 0 || path[len - 1] == '/' ? "index.html" : "");
+    if (n < 0 || (size_t)n >= sizeof(key)) {
+        return -1;
+    }
+    const asset_entry *entry =
+        (const asset_entry *)bsearch(key, assets->entries, assets->count, sizeof(asset_entry), compare_key);
+    if (!entry) {
+        return -1;
+    }
+
+    int best = CS_ASSET_IDENTITY;
+    for (int e = 0; e < CS_ASSET_ENCODINGS; ++e) {
+        if ((accept & (1u << e)) && entry->variants[e].block &&
+            entry->variants[e].len < entry->variants[best].len) {
+            best = e;
+        }
+    }
+    const asset_variant *variant = &entry->variants[best];
+    asset->data = variant->block + assets->headroom;
+    asset->len = variant->len;
+    asset->content_type = entry->content_type;
+    asset->encoding = encoding_names[best];
+    asset->etag = variant->etag;
+    asset->cache_control = entry->cache_control;
+    return 0;
+}
+
+void cs_assets_stats(const cs_assets *assets, size_t *files, size_t *bytes, size_t *stored_bytes) {
+    size_t total = 0;
+    size_t stored = 0;
+    for (size_t i = 0; assets && i < assets->count; ++i) {
+        total += assets->entries[i].variants[CS_ASSET_IDENTITY].len;
+        for (int e = 0; e < CS_ASSET_ENCODINGS; ++e) {
+            if (assets->entries[i].variants[e].block) {
+                stored += assets->entries[i].variants[e].len;
+            }
+        }
+    }
+    if (files) {
+        *files = assets ? assets->count : 0;
+    }
+    if (bytes) {
+        *bytes = total;
+    }
+    if (stored_bytes) {
+        *stored_bytes = stored;
+    }
+}
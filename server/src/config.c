@@ -5,7 +5,9 @@
 #include <stdlib.h>
 
 static void apply_kv(cs_config *config, const char *key, const char *value) {
-    if (strcmp(key, "width") == 0) {
+    if (strcmp(key, "mode") == 0) {
+        config->mode = strcmp(value, "router") == 0 ? CS_MODE_ROUTER : CS_MODE_STANDALONE;
+    } else if (strcmp(key, "width") == 0) {
         config->width = atoi(value);
     } else if (strcmp(key, "height") == 0) {
         config->height = atoi(value);
@@ -13,17 +15,131 @@ static void apply_kv(cs_config *config, const char *key, const char *value) {
         config->fps = (float)atof(value);
     } else if (strcmp(key, "bitrate_kbps") == 0) {
         config->bitrate_kbps = atoi(value);
+    } else if (strcmp(key, "encoder") == 0) {
+        snprintf(config->encoder, sizeof(config->encoder), "%s", value);
+    } else if (strcmp(key, "encoder_preset") == 0) {
+        snprintf(config->encoder_preset, sizeof(config->encoder_preset), "%s", value);
+    } else if (strcmp(key, "roi_delta_qp") == 0) {
+        config->roi_delta_qp = atoi(value);
     } else if (strcmp(key, "signaling_port") == 0) {
         config->signaling_port = atoi(value);
+    } else if (strcmp(key, "scene_objects") == 0) {
+        config->scene_objects = atoi(value);
+    } else if (strcmp(key, "asset_dir") == 0) {
+        snprintf(config->asset_dir, sizeof(config->asset_dir), "%s", value);
+    } else if (strcmp(key, "shader_cache_dir") == 0) {
+        snprintf(config->shader_cache_dir, sizeof(config->shader_cache_dir), "%s", value);
+    } else if (strcmp(key, "egl_platform") == 0) {
+        snprintf(config->egl_platform, sizeof(config->egl_platform), "%s", value);
+    } else if (strcmp(key, "render_threads") == 0) {
+        config->render_threads = atoi(value);
+    } else if (strcmp(key, "max_peers") == 0) {
+        config->max_peers = atoi(value);
+    } else if (strcmp(key, "peer_pool") == 0) {
+        config->peer_pool = atoi(value);
+    } else if (strcmp(key, "dtls_pem") == 0) {
+        snprintf(config->dtls_pem, sizeof(config->dtls_pem), "%s", value);
+    } else if (strcmp(key, "rtp_port_min") == 0) {
+        config->rtp_port_min = atoi(value);
+    } else if (strcmp(key, "rtp_port_max") == 0) {
+        config->rtp_port_max = atoi(value);
+    } else if (strcmp(key, "ice_tcp") == 0) {
+        config->ice_tcp = atoi(value);
+    } else if (strcmp(key, "max_views") == 0) {
+        config->max_views = atoi(value);
+    } else if (strcmp(key, "router_max_workers") == 0) {
+        config->router_max_workers = atoi(value);
+    } else if (strcmp(key, "router_worker_iface") == 0) {
+        snprintf(config->router_worker_iface, sizeof(config->router_worker_iface), "%s", value);
+    } else if (strcmp(key, "router_worker_port") == 0) {
+        config->router_worker_port = atoi(value);
+    } else if (strcmp(key, "router_host") == 0) {
+        snprintf(config->router_host, sizeof(config->router_host), "%s", value);
+    } else if (strcmp(key, "router_port") == 0) {
+        config->router_port = atoi(value);
+    } else if (strcmp(key, "advertise_host") == 0) {
+        snprintf(config->advertise_host, sizeof(config->advertise_host), "%s", value);
+    } else if (strcmp(key, "render_process") == 0) {
+        config->render_process = atoi(value);
+    } else if (strcmp(key, "frame_ring_slots") == 0) {
+        config->frame_ring_slots = atoi(value);
+    } else if (strcmp(key, "renderer_path") == 0) {
+        snprintf(config->renderer_path, sizeof(config->renderer_path), "%s", value);
+    } else if (strcmp(key, "hls") == 0) {
+        config->hls = atoi(value);
+    } else if (strcmp(key, "hls_segment_ms") == 0) {
+        config->hls_segment_ms = atoi(value);
+    } else if (strcmp(key, "hls_part_ms") == 0) {
+        config->hls_part_ms = atoi(value);
+    } else if (strcmp(key, "hls_window") == 0) {
+        config->hls_window = atoi(value);
+    } else if (strcmp(key, "record_dir") == 0) {
+        snprintf(config->record_dir, sizeof(config->record_dir), "%s", value);
+    } else if (strcmp(key, "record_segment_s") == 0) {
+        config->record_segment_s = atoi(value);
+    } else if (strcmp(key, "record_max_mb") == 0) {
+        config->record_max_mb = atoi(value);
+    } else if (strcmp(key, "trace_dir") == 0) {
+        snprintf(config->trace_dir, sizeof(config->trace_dir), "%s", value);
+    } else if (strcmp(key, "trace_seconds") == 0) {
+        config->trace_seconds = atoi(value);
+    } else if (strcmp(key, "serve_client") == 0) {
+        config->serve_client = atoi(value);
+    } else if (strcmp(key, "client_dir") == 0) {
+        snprintf(config->client_dir, sizeof(config->client_dir), "%s", value);
     }
 }
 
 void cs_config_defaults(cs_config *config) {
+    config->mode = CS_MODE_STANDALONE;
     config->width = 640;
     config->height = 480;
     config->fps = 30.0f;
     config->bitrate_kbps = 1500;
+    snprintf(config->encoder, sizeof(config->encoder), "x264enc");
+    config->encoder_preset[0] = '\0';
+    config->roi_delta_qp = 0;
     config->signaling_port = 8080;
+    config->scene_objects = 1;
+    config->asset_dir[0] = '\0';
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cache_home && cache_home[0]) {
+        snprintf(config->shader_cache_dir, sizeof(config->shader_cache_dir), "%s/cube-streamer", cache_home);
+    } else if (home && home[0]) {
+        snprintf(config->shader_cache_dir, sizeof(config->shader_cache_dir), "%s/.cache/cube-streamer", home);
+    } else {
+        config->shader_cache_dir[0] = '\0';
+    }
+    snprintf(config->egl_platform, sizeof(config->egl_platform), "auto");
+    config->render_threads = 1;
+    config->max_peers = 8;
+    config->peer_pool = 4;
+    config->dtls_pem[0] = '\0';
+    config->rtp_port_min = 0;
+    config->rtp_port_max = 0;
+    config->ice_tcp = 1;
+    config->max_views = 1;
+    config->router_max_workers = 64;
+    snprintf(config->router_worker_iface, sizeof(config->router_worker_iface), "127.0.0.1");
+    config->router_worker_port = 8090;
+    config->router_host[0] = '\0';
+    config->router_port = 8090;
+    snprintf(config->advertise_host, sizeof(config->advertise_host), "127.0.0.1");
+    config->render_process = 0;
+    config->frame_ring_slots = 4;
+    config->renderer_path[0] = '\0';
+    config->hls = 0;
+    config->hls_segment_ms = 2000;
+    config->hls_part_ms = 333;
+    config->hls_window = 6;
+    config->record_dir[0] = '\0';
+    config->record_segment_s = 60;
+    config->record_max_mb = 4096;
+    snprintf(config->trace_dir, sizeof(config->trace_dir), "/tmp");
+    config->trace_seconds = 10;
+    config->serve_client = 1;
+    config->client_dir[0] = '\0';
 }
 
 int cs_config_load(cs_config *config, const char *path) {
@@ -0,0 +1,128 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define CS_EVENT_BATCH 32
+
+typedef struct {
+    cs_event_fn fn;
+    void *user;
+} cs_event_entry;
+
+struct cs_event_loop {
+    int epoll_fd;
+    // Indexed by fd; dispatch looks entries up by fd so a handler removing
+    // another pending fd never leaves a dangling pointer in the batch.
+    cs_event_entry *entries;
+    int entry_count;
+};
+
+cs_event_loop *cs_event_loop_create(void) {
+    cs_event_loop *loop = (cs_event_loop *)calloc(1, sizeof(cs_event_loop));
+    if (!loop) {
+        return NULL;
+    }
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+void cs_event_loop_destroy(cs_event_loop *loop) {
+    if (!loop) {
+        return;
+    }
+    close(loop->epoll_fd);
+    free(loop->entries);
+    free(loop);
+}
+
+static int reserve(cs_event_loop *loop, int fd) {
+    if (fd < loop->entry_count) {
+        return 0;
+    }
+    int count = loop->entry_count ? loop->entry_count : 64;
+    while (count <= fd) {
+        count *= 2;
+    }
+    cs_event_entry *grown = (cs_event_entry *)realloc(loop->entries, sizeof(cs_event_entry) * (size_t)count);
+    if (!grown) {
+        return -1;
+    }
+    memset(grown + loop->entry_count, 0, sizeof(cs_event_entry) * (size_t)(count - loop->entry_count));
+    loop->entries = grown;
+    loop->entry_count = count;
+    return 0;
+}
+
+int cs_event_loop_add(cs_event_loop *loop, int fd, uint32_t events, cs_event_fn fn, void *user) {
+    if (!loop || fd < 0 || !fn || reserve(loop, fd) != 0) {
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        return -1;
+    }
+    loop->entries[fd].fn = fn;
+    loop->entries[fd].user = user;
+    return 0;
+}
+
+int cs_event_loop_modify(cs_event_loop *loop, int fd, uint32_t events) {
+    if (!loop || fd < 0 || fd >= loop->entry_count || !loop->entries[fd].fn) {
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int cs_event_loop_remove(cs_event_loop *loop, int fd) {
+    if (!loop || fd < 0 || fd >= loop->entry_count || !loop->entries[fd].fn) {
+        return -1;
+    }
+    loop->entries[fd].fn = NULL;
+    loop->entries[fd].user = NULL;
+    // The fd may already be closed, which removed it from the epoll set.
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL) != 0 && errno != EBADF && errno != ENOENT) {
+        return -1;
+    }
+    return 0;
+}
+
+int cs_event_loop_run_once(cs_event_loop *loop, int timeout_ms) {
+    if (!loop) {
+        return -1;
+    }
+
+    struct epoll_event events[CS_EVENT_BATCH];
+    int n = epoll_wait(loop->epoll_fd, events, CS_EVENT_BATCH, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    int handled = 0;
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd >= loop->entry_count || !loop->entries[fd].fn) {
+            continue;
+        }
+        cs_event_entry entry = loop->entries[fd];
+        entry.fn(entry.user, fd, events[i].events);
+        handled++;
+    }
+    return handled;
+}
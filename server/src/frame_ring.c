@@ -0,0 +1,387 @@
+// memfd_create and file sealing.
+#define _GNU_SOURCE
+
+#include "frame_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CS_FRAME_RING_MAGIC 0x43534652u /* "CSFR" */
+#define CS_FRAME_RING_VERSION 2u
+#define CS_FRAME_RING_ALIGN 4096u
+
+enum {
+    SLOT_FREE = 0,
+    SLOT_WRITING = 1,
+    SLOT_READY = 2,
+    SLOT_READING = 3
+};
+
+typedef struct {
+    _Atomic uint32_t state;
+    uint32_t reserved;
+    uint64_t seq;
+    uint64_t epoch;
+    uint64_t pts_ns;
+    int32_t roi[4];
+    uint8_t pad[16];
+} ring_slot_header;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint32_t slot_count;
+    uint32_t reserved;
+    uint64_t frame_size;
+    uint64_t slot_stride;
+    uint64_t data_offset;
+    _Atomic uint64_t producer_epoch;
+    _Atomic uint64_t write_seq;
+    _Atomic uint64_t dropped;
+    ring_slot_header slots[];
+} ring_header;
+
+typedef struct {
+    cs_frame_ring *ring;
+    int index;
+} ring_token;
+
+struct cs_frame_ring {
+    int mem_fd;
+    int notify_fd;
+    int owner;
+    uint8_t *base;
+    size_t map_size;
+    ring_header *header;
+    uint64_t epoch;
+    ring_token *tokens;
+};
+
+static size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+static int map_ring(cs_frame_ring *ring, size_t size) {
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->mem_fd, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    ring->base = (uint8_t *)base;
+    ring->map_size = size;
+    ring->header = (ring_header *)base;
+    return 0;
+}
+
+static int init_tokens(cs_frame_ring *ring) {
+    ring->tokens = (ring_token *)calloc(ring->header->slot_count, sizeof(ring_token));
+    if (!ring->tokens) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < ring->header->slot_count; ++i) {
+        ring->tokens[i].ring = ring;
+        ring->tokens[i].index = (int)i;
+    }
+    return 0;
+}
+
+static uint8_t *slot_data(cs_frame_ring *ring, int index) {
+    return ring->base + ring->header->data_offset + (size_t)index * ring->header->slot_stride;
+}
+
+cs_frame_ring *cs_frame_ring_create(int width, int height, int slot_count) {
+    if (width <= 0 || height <= 0 || slot_count < 2) {
+        return NULL;
+    }
+
+    cs_frame_ring *ring = (cs_frame_ring *)calloc(1, sizeof(cs_frame_ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->owner = 1;
+    ring->mem_fd = -1;
+    ring->notify_fd = -1;
+
+    size_t frame_size = (size_t)width * (size_t)height * 4;
+    size_t header_size = sizeof(ring_header) + (size_t)slot_count * sizeof(ring_slot_header);
+    size_t data_offset = align_up(header_size, CS_FRAME_RING_ALIGN);
+    size_t slot_stride = align_up(frame_size, CS_FRAME_RING_ALIGN);
+    size_t total = data_offset + slot_stride * (size_t)slot_count;
+
+    // Descriptors are close-on-exec; the spawner clears the flag only on the
+    // copies it hands to the renderer.
+    ring->mem_fd = memfd_create("cs-frame-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->mem_fd < 0 || ftruncate(ring->mem_fd, (off_t)total) != 0) {
+        cs_frame_ring_destroy(ring);
+        return NULL;
+    }
+    fcntl(ring->mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    ring->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ring->notify_fd < 0 || map_ring(ring, total) != 0) {
+        cs_frame_ring_destroy(ring);
+        return NULL;
+    }
+
+    ring_header *header = ring->header;
+    header->magic = CS_FRAME_RING_MAGIC;
+    header->version = CS_FRAME_RING_VERSION;
+    header->width = width;
+    header->height = height;
+    header->slot_count = (uint32_t)slot_count;
+    header->frame_size = frame_size;
+    header->slot_stride = slot_stride;
+    header->data_offset = data_offset;
+    atomic_init(&header->producer_epoch, 0);
+    atomic_init(&header->write_seq, 0);
+    atomic_init(&header->dropped, 0);
+    for (int i = 0; i < slot_count; ++i) {
+        atomic_init(&header->slots[i].state, SLOT_FREE);
+    }
+
+    if (init_tokens(ring) != 0) {
+        cs_frame_ring_destroy(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+cs_frame_ring *cs_frame_ring_attach(int mem_fd, int notify_fd) {
+    struct stat st;
+    if (mem_fd < 0 || notify_fd < 0 || fstat(mem_fd, &st) != 0 || (size_t)st.st_size < sizeof(ring_header)) {
+        return NULL;
+    }
+
+    cs_frame_ring *ring = (cs_frame_ring *)calloc(1, sizeof(cs_frame_ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->mem_fd = mem_fd;
+    ring->notify_fd = notify_fd;
+
+    if (map_ring(ring, (size_t)st.st_size) != 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring_header *header = ring->header;
+    size_t expected = header->data_offset + header->slot_stride * header->slot_count;
+    if (header->magic != CS_FRAME_RING_MAGIC || header->version != CS_FRAME_RING_VERSION ||
+        expected > ring->map_size || init_tokens(ring) != 0) {
+        munmap(ring->base, ring->map_size);
+        free(ring->tokens);
+        free(ring);
+        return NULL;
+    }
+
+    ring->epoch = atomic_fetch_add(&header->producer_epoch, 1) + 1;
+    return ring;
+}
+
+void cs_frame_ring_destroy(cs_frame_ring *ring) {
+    if (!ring) {
+        return;
+    }
+
+    if (ring->base) {
+        munmap(ring->base, ring->map_size);
+    }
+    if (ring->mem_fd >= 0) {
+        close(ring->mem_fd);
+    }
+    if (ring->notify_fd >= 0) {
+        close(ring->notify_fd);
+    }
+    free(ring->tokens);
+    free(ring);
+}
+
+int cs_frame_ring_mem_fd(const cs_frame_ring *ring) {
+    return ring ? ring->mem_fd : -1;
+}
+
+int cs_frame_ring_notify_fd(const cs_frame_ring *ring) {
+    return ring ? ring->notify_fd : -1;
+}
+
+int cs_frame_ring_width(const cs_frame_ring *ring) {
+    return ring ? ring->header->width : 0;
+}
+
+int cs_frame_ring_height(const cs_frame_ring *ring) {
+    return ring ? ring->header->height : 0;
+}
+
+static void fill_slot(cs_frame_ring *ring, int index, cs_frame_slot *slot) {
+    ring_slot_header *sh = &ring->header->slots[index];
+    slot->data = slot_data(ring, index);
+    slot->len = ring->header->frame_size;
+    slot->seq = sh->seq;
+    slot->pts_ns = sh->pts_ns;
+    slot->epoch = sh->epoch;
+    memcpy(slot->roi, sh->roi, sizeof(slot->roi));
+    slot->token = &ring->tokens[index];
+    slot->index = index;
+}
+
+int cs_frame_ring_begin_write(cs_frame_ring *ring, cs_frame_slot *slot) {
+    if (!ring || !slot) {
+        return -1;
+    }
+
+    ring_header *header = ring->header;
+    for (uint32_t i = 0; i < header->slot_count; ++i) {
+        uint32_t expected = SLOT_FREE;
+        if (atomic_compare_exchange_strong_explicit(&header->slots[i].state, &expected, SLOT_WRITING,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            fill_slot(ring, (int)i, slot);
+            return 0;
+        }
+    }
+
+    // A ready frame nobody has picked up yet is stale by now; reuse the oldest.
+    int oldest = -1;
+    for (uint32_t i = 0; i < header->slot_count; ++i) {
+        if (atomic_load_explicit(&header->slots[i].state, memory_order_relaxed) == SLOT_READY &&
+            (oldest < 0 || header->slots[i].seq < header->slots[oldest].seq)) {
+            oldest = (int)i;
+        }
+    }
+    if (oldest >= 0) {
+        uint32_t expected = SLOT_READY;
+        if (atomic_compare_exchange_strong_explicit(&header->slots[oldest].state, &expected, SLOT_WRITING,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+            fill_slot(ring, oldest, slot);
+            return 0;
+        }
+    }
+
+    atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+    return -1;
+}
+
+int cs_frame_ring_publish(cs_frame_ring *ring, cs_frame_slot *slot, uint64_t pts_ns) {
+    if (!ring || !slot || slot->index < 0 || (uint32_t)slot->index >= ring->header->slot_count) {
+        return -1;
+    }
+
+    ring_slot_header *sh = &ring->header->slots[slot->index];
+    sh->seq = atomic_fetch_add_explicit(&ring->header->write_seq, 1, memory_order_relaxed) + 1;
+    sh->epoch = ring->epoch;
+    sh->pts_ns = pts_ns;
+    memcpy(sh->roi, slot->roi, sizeof(sh->roi));
+    atomic_store_explicit(&sh->state, SLOT_READY, memory_order_release);
+
+    uint64_t one = 1;
+    if (write(ring->notify_fd, &one, sizeof(one)) != (ssize_t)sizeof(one) && errno != EAGAIN) {
+        return -1;
+    }
+    return 0;
+}
+
+void cs_frame_ring_abort_write(cs_frame_ring *ring, cs_frame_slot *slot) {
+    if (!ring || !slot || slot->index < 0 || (uint32_t)slot->index >= ring->header->slot_count) {
+        return;
+    }
+    atomic_store_explicit(&ring->header->slots[slot->index].state, SLOT_FREE, memory_order_release);
+}
+
+int cs_frame_ring_wait(cs_frame_ring *ring, int timeout_ms) {
+    if (!ring) {
+        return -1;
+    }
+
+    struct pollfd pfd = { .fd = ring->notify_fd, .events = POLLIN };
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret <= 0) {
+        return 0;
+    }
+
+    uint64_t count = 0;
+    if (read(ring->notify_fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+        return 0;
+    }
+    return 1;
+}
+
+int cs_frame_ring_acquire_latest(cs_frame_ring *ring, cs_frame_slot *slot) {
+    if (!ring || !slot) {
+        return -1;
+    }
+
+    ring_header *header = ring->header;
+    for (;;) {
+        int newest = -1;
+        for (uint32_t i = 0; i < header->slot_count; ++i) {
+            if (atomic_load_explicit(&header->slots[i].state, memory_order_acquire) == SLOT_READY &&
+                (newest < 0 || header->slots[i].seq > header->slots[newest].seq)) {
+                newest = (int)i;
+            }
+        }
+        if (newest < 0) {
+            return -1;
+        }
+
+        uint32_t expected = SLOT_READY;
+        if (!atomic_compare_exchange_strong_explicit(&header->slots[newest].state, &expected, SLOT_READING,
+                                                     memory_order_acquire, memory_order_relaxed)) {
+            // The producer recycled it under us; look again.
+            continue;
+        }
+
+        for (uint32_t i = 0; i < header->slot_count; ++i) {
+            expected = SLOT_READY;
+            if ((int)i != newest && header->slots[i].seq < header->slots[newest].seq &&
+                atomic_compare_exchange_strong_explicit(&header->slots[i].state, &expected, SLOT_FREE,
+                                                        memory_order_acq_rel, memory_order_relaxed)) {
+                atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+            }
+        }
+
+        fill_slot(ring, newest, slot);
+        return 0;
+    }
+}
+
+void cs_frame_ring_release(cs_frame_ring *ring, const cs_frame_slot *slot) {
+    if (!ring || !slot || slot->index < 0 || (uint32_t)slot->index >= ring->header->slot_count) {
+        return;
+    }
+    atomic_store_explicit(&ring->header->slots[slot->index].state, SLOT_FREE, memory_order_release);
+}
+
+void cs_frame_ring_release_token(void *token) {
+    ring_token *t = (ring_token *)token;
+    if (!t) {
+        return;
+    }
+    atomic_store_explicit(&t->ring->header->slots[t->index].state, SLOT_FREE, memory_order_release);
+}
+
+uint64_t cs_frame_ring_producer_epoch(const cs_frame_ring *ring) {
+    return ring ? atomic_load_explicit(&ring->header->producer_epoch, memory_order_acquire) : 0;
+}
+
+uint64_t cs_frame_ring_dropped(const cs_frame_ring *ring) {
+    return ring ? atomic_load_explicit(&ring->header->dropped, memory_order_relaxed) : 0;
+}
+
+void cs_frame_ring_recover(cs_frame_ring *ring) {
+    if (!ring) {
+        return;
+    }
+    for (uint32_t i = 0; i < ring->header->slot_count; ++i) {
+        uint32_t expected = SLOT_WRITING;
+        atomic_compare_exchange_strong(&ring->header->slots[i].state, &expected, SLOT_FREE);
+    }
+}
@@ -0,0 +1,784 @@
+#include "hls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CS_HLS_TIMESCALE 90000
+// Segments (counting from the newest) whose parts are listed; older ones
+// appear as whole segments only.
+#define CS_HLS_PART_SEGMENTS 3
+// trun sample flags: a sync sample depends on nothing; everything else
+// depends on earlier samples and is not a sync point.
+#define CS_HLS_SYNC_FLAGS 0x02000000u
+#define CS_HLS_DELTA_FLAGS 0x01010000u
+
+typedef struct {
+    size_t offset;
+    size_t len;
+    uint32_t duration;
+    int independent;
+} hls_part;
+
+struct cs_hls_segment {
+    int refs;
+    long long msn;
+    uint64_t duration;
+    int complete;
+    hls_part *parts;
+    int part_count;
+    int part_cap;
+    // Fixed at max_segment_bytes and never reallocated, so blobs pointing
+    // into it stay valid while parts are appended.
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+};
+
+typedef struct {
+    uint32_t size;
+    uint32_t duration;
+    int keyframe;
+} hls_sample;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} hls_buf;
+
+struct cs_hls {
+    cs_hls_config config;
+    char prefix[24];
+    uint32_t part_ticks;
+    uint32_t segment_ticks;
+    int target_duration;
+    hls_buf init;
+    int have_init;
+    // Oldest first. While a segment is open it is the last entry.
+    cs_hls_segment **segments;
+    int segment_count;
+    cs_hls_segment *open;
+    long long next_msn;
+    uint32_t sequence;
+    int key_requested;
+    // The part being assembled, as length-prefixed NAL units. The newest
+    // sample's duration is only known once the next unit arrives.
+    hls_buf mdat;
+    hls_sample *samples;
+    int sample_count;
+    int sample_cap;
+    uint64_t part_start;
+    uint64_t last_ts;
+    uint32_t last_duration;
+    uint64_t base_us;
+    int have_base;
+    hls_buf moof;
+};
+
+static int buf_reserve(hls_buf *buf, size_t extra) {
+    if (buf->failed) {
+        return -1;
+    }
+    if (buf->len + extra <= buf->cap) {
+        return 0;
+    }
+    size_t cap = buf->cap ? buf->cap : 256;
+    while (cap < buf->len + extra) {
+        cap *= 2;
+    }
+    uint8_t *grown = (uint8_t *)realloc(buf->data, cap);
+    if (!grown) {
+        buf->failed = 1;
+        return -1;
+    }
+    buf->data = grown;
+    buf->cap = cap;
+    return 0;
+}
+
+static void put_bytes(hls_buf *buf, const void *data, size_t len) {
+    if (buf_reserve(buf, len) == 0) {
+        memcpy(buf->data + buf->len, data, len);
+        buf->len += len;
+    }
+}
+
+static void put_zeros(hls_buf *buf, size_t len) {
+    if (buf_reserve(buf, len) == 0) {
+        memset(buf->data + buf->len, 0, len);
+        buf->len += len;
+    }
+}
+
+static void put_u8(hls_buf *buf, uint32_t value) {
+    uint8_t b = (uint8_t)value;
+    put_bytes(buf, &b, 1);
+}
+
+static void put_u16(hls_buf *buf, uint32_t value) {
+    uint8_t b[2] = { (uint8_t)(value >> 8), (uint8_t)value };
+    put_bytes(buf, b, sizeof(b));
+}
+
+static void put_u32(hls_buf *buf, uint32_t value) {
+    uint8_t b[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+    put_bytes(buf, b, sizeof(b));
+}
+
+static void put_u64(hls_buf *buf, uint64_t value) {
+    put_u32(buf, (uint32_t)(value >> 32));
+    put_u32(buf, (uint32_t)value);
+}
+
+static void set_u32(uint8_t *at, uint32_t value) {
+    at[0] = (uint8_t)(value >> 24);
+    at[1] = (uint8_t)(value >> 16);
+    at[2] = (uint8_t)(value >> 8);
+    at[3] = (uint8_t)value;
+}
+
+// Boxes are written with a zero size and patched by box_end.
+static size_t box_begin(hls_buf *buf, const char *type) {
+    size_t at = buf->len;
+    put_u32(buf, 0);
+    put_bytes(buf, type, 4);
+    return at;
+}
+
+static size_t full_box_begin(hls_buf *buf, const char *type, uint32_t version, uint32_t flags) {
+    size_t at = box_begin(buf, type);
+    put_u32(buf, (version << 24) | (flags & 0xffffff));
+    return at;
+}
+
+static void box_end(hls_buf *buf, size_t at) {
+    if (!buf->failed) {
+        set_u32(buf->data + at, (uint32_t)(buf->len - at));
+    }
+}
+
+// Next NAL unit of an Annex B buffer starting the search at *pos; trailing
+// zero bytes (the next 4-byte start code) are not part of it.
+static const uint8_t *next_nal(const uint8_t *data, size_t len, size_t *pos, size_t *nal_len) {
+    size_t i = *pos;
+    while (i + 3 <= len && !(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)) {
+        i++;
+    }
+    if (i + 3 > len) {
+        return NULL;
+    }
+    size_t start = i + 3;
+    size_t end = start;
+    while (end + 3 <= len && !(data[end] == 0 && data[end + 1] == 0 && data[end + 2] == 1)) {
+        end++;
+    }
+    if (end + 3 > len) {
+        end = len;
+    }
+    *pos = end;
+    while (end > start && data[end - 1] == 0) {
+        end--;
+    }
+    *nal_len = end - start;
+    return data + start;
+}
+
+static const uint8_t unity_matrix[36] = {
+    0x00, 0x01, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0x00, 0x01, 0x00, 0x00, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x00, 0x00, 0x00,
+};
+
+// ftyp + moov for one H.264 track (track 1, 90 kHz), samples described by
+// the moof of each part.
+static int build_init(cs_hls *hls, const uint8_t *sps, size_t sps_len, const uint8_t *pps, size_t pps_len) {
+    hls_buf *b = &hls->init;
+    b->len = 0;
+    b->failed = 0;
+
+    size_t ftyp = box_begin(b, "ftyp");
+    put_bytes(b, "iso6", 4);
+    put_u32(b, 0);
+    put_bytes(b, "iso6cmfcmp41", 12);
+    box_end(b, ftyp);
+
+    size_t moov = box_begin(b, "moov");
+    size_t mvhd = full_box_begin(b, "mvhd", 0, 0);
+    put_zeros(b, 8);
+    put_u32(b, 1000);
+    put_u32(b, 0);
+    put_u32(b, 0x00010000);
+    put_u16(b, 0x0100);
+    put_zeros(b, 10);
+    put_bytes(b, unity_matrix, sizeof(unity_matrix));
+    put_zeros(b, 24);
+    put_u32(b, 2);
+    box_end(b, mvhd);
+
+    size_t trak = box_begin(b, "trak");
+    size_t tkhd = full_box_begin(b, "tkhd", 0, 3);
+    put_zeros(b, 8);
+    put_u32(b, 1);
+    put_zeros(b, 8);
+    put_zeros(b, 8);
+    put_zeros(b, 8);
+    put_bytes(b, unity_matrix, sizeof(unity_matrix));
+    put_u32(b, (uint32_t)hls->config.width << 16);
+    put_u32(b, (uint32_t)hls->config.height << 16);
+    box_end(b, tkhd);
+
+    size_t mdia = box_begin(b, "mdia");
+    size_t mdhd = full_box_begin(b, "mdhd", 0, 0);
+    put_zeros(b, 8);
+    put_u32(b, CS_HLS_TIMESCALE);
+    put_u32(b, 0);
+    put_u16(b, 0x55c4); // "und"
+    put_u16(b, 0);
+    box_end(b, mdhd);
+    size_t hdlr = full_box_begin(b, "hdlr", 0, 0);
+    put_u32(b, 0);
+    put_bytes(b, "vide", 4);
+    put_zeros(b, 12);
+    put_bytes(b, "cube", 5);
+    box_end(b, hdlr);
+
+    size_t minf = box_begin(b, "minf");
+    size_t vmhd = full_box_begin(b, "vmhd", 0, 1);
+    put_zeros(b, 8);
+    box_end(b, vmhd);
+    size_t dinf = box_begin(b, "dinf");
+    size_t dref = full_box_begin(b, "dref", 0, 0);
+    put_u32(b, 1);
+    box_end(b, full_box_begin(b, "url ", 0, 1));
+    box_end(b, dref);
+    box_end(b, dinf);
+
+    size_t stbl = box_begin(b, "stbl");
+    size_t stsd = full_box_begin(b, "stsd", 0, 0);
+    put_u32(b, 1);
+    size_t avc1 = box_begin(b, "avc1");
+    put_zeros(b, 6);
+    put_u16(b, 1);
+    put_zeros(b, 16);
+    put_u16(b, (uint32_t)hls->config.width);
+    put_u16(b, (uint32_t)hls->config.height);
+    put_u32(b, 0x00480000);
+    put_u32(b, 0x00480000);
+    put_u32(b, 0);
+    put_u16(b, 1);
+    put_zeros(b, 32);
+    put_u16(b, 0x0018);
+    put_u16(b, 0xffff);
+    size_t avcc = box_begin(b, "avcC");
+    put_u8(b, 1);
+    put_u8(b, sps[1]);
+    put_u8(b, sps[2]);
+    put_u8(b, sps[3]);
+    put_u8(b, 0xff); // 4-byte NAL lengths
+    put_u8(b, 0xe1); // one SPS
+    put_u16(b, (uint32_t)sps_len);
+    put_bytes(b, sps, sps_len);
+    put_u8(b, 1);
+    put_u16(b, (uint32_t)pps_len);
+    put_bytes(b, pps, pps_len);
+    if (sps[1] == 100 || sps[1] == 110 || sps[1] == 122 || sps[1] == 144) {
+        // High profiles carry the chroma format and bit depths; the
+        // pipeline always encodes 8-bit 4:2:0.
+        put_u8(b, 0xfc | 1);
+        put_u8(b, 0xf8);
+        put_u8(b, 0xf8);
+        put_u8(b, 0);
+    }
+    box_end(b, avcc);
+    box_end(b, avc1);
+    box_end(b, stsd);
+    size_t stts = full_box_begin(b, "stts", 0, 0);
+    put_u32(b, 0);
+    box_end(b, stts);
+    size_t stsc = full_box_begin(b, "stsc", 0, 0);
+    put_u32(b, 0);
+    box_end(b, stsc);
+    size_t stsz = full_box_begin(b, "stsz", 0, 0);
+    put_u32(b, 0);
+    put_u32(b, 0);
+    box_end(b, stsz);
+    size_t stco = full_box_begin(b, "stco", 0, 0);
+    put_u32(b, 0);
+    box_end(b, stco);
+    box_end(b, stbl);
+    box_end(b, minf);
+    box_end(b, mdia);
+    box_end(b, trak);
+
+    size_t mvex = box_begin(b, "mvex");
+    size_t trex = full_box_begin(b, "trex", 0, 0);
+    put_u32(b, 1);
+    put_u32(b, 1);
+    put_zeros(b, 12);
+    box_end(b, trex);
+    box_end(b, mvex);
+    box_end(b, moov);
+
+    return b->failed ? -1 : 0;
+}
+
+// The first keyframe carries SPS and PPS (h264parse repeats them before
+// every IDR); they go into the init segment.
+static int init_from_keyframe(cs_hls *hls, const uint8_t *data, size_t len) {
+    const uint8_t *sps = NULL;
+    const uint8_t *pps = NULL;
+    size_t sps_len = 0;
+    size_t pps_len = 0;
+    size_t pos = 0;
+    size_t nal_len = 0;
+    const uint8_t *nal;
+    while ((nal = next_nal(data, len, &pos, &nal_len)) != NULL) {
+        int type = nal_len > 0 ? nal[0] & 0x1f : 0;
+        if (type == 7 && !sps) {
+            sps = nal;
+            sps_len = nal_len;
+        } else if (type == 8 && !pps) {
+            pps = nal;
+            pps_len = nal_len;
+        }
+    }
+    if (!sps || sps_len < 4 || !pps || sps_len > 0xffff || pps_len > 0xffff) {
+        return -1;
+    }
+    return build_init(hls, sps, sps_len, pps, pps_len);
+}
+
+static void segment_unref(cs_hls_segment *segment) {
+    if (segment && --segment->refs == 0) {
+        free(segment->parts);
+        free(segment->data);
+        free(segment);
+    }
+}
+
+static cs_hls_segment *open_segment(cs_hls *hls) {
+    cs_hls_segment *segment = (cs_hls_segment *)calloc(1, sizeof(cs_hls_segment));
+    if (!segment) {
+        return NULL;
+    }
+    segment->data = (uint8_t *)malloc(hls->config.max_segment_bytes);
+    if (!segment->data) {
+        free(segment);
+        return NULL;
+    }
+    segment->refs = 1;
+    segment->cap = hls->config.max_segment_bytes;
+    segment->msn = hls->next_msn++;
+    hls->segments[hls->segment_count++] = segment;
+    hls->open = segment;
+    return segment;
+}
+
+static void close_segment(cs_hls *hls) {
+    if (!hls->open) {
+        return;
+    }
+    hls->open->complete = 1;
+    hls->open = NULL;
+    hls->key_requested = 0;
+    // Responses still being written keep their own reference.
+    while (hls->segment_count > hls->config.window) {
+        segment_unref(hls->segments[0]);
+        memmove(hls->segments, hls->segments + 1, (size_t)(hls->segment_count - 1) * sizeof(cs_hls_segment *));
+        hls->segment_count--;
+    }
+}
+
+static void reset_part(cs_hls *hls) {
+    hls->sample_count = 0;
+    hls->mdat.len = 0;
+    hls->mdat.failed = 0;
+}
+
+static uint64_t part_duration(const cs_hls *hls) {
+    uint64_t duration = 0;
+    for (int i = 0; i < hls->sample_count; ++i) {
+        duration += hls->samples[i].duration;
+    }
+    return duration;
+}
+
+// Writes the staged samples as one moof + mdat into the open segment,
+// starting a new segment when it would not fit.
+static void flush_part(cs_hls *hls) {
+    if (hls->sample_count == 0) {
+        return;
+    }
+
+    hls_buf *m = &hls->moof;
+    m->len = 0;
+    m->failed = 0;
+    size_t moof = box_begin(m, "moof");
+    size_t mfhd = full_box_begin(m, "mfhd", 0, 0);
+    put_u32(m, ++hls->sequence);
+    box_end(m, mfhd);
+    size_t traf = box_begin(m, "traf");
+    size_t tfhd = full_box_begin(m, "tfhd", 0, 0x020000); // default-base-is-moof
+    put_u32(m, 1);
+    box_end(m, tfhd);
+    size_t tfdt = full_box_begin(m, "tfdt", 1, 0);
+    put_u64(m, hls->part_start);
+    box_end(m, tfdt);
+    // data-offset, sample duration, size and flags present.
+    size_t trun = full_box_begin(m, "trun", 0, 0x000701);
+    put_u32(m, (uint32_t)hls->sample_count);
+    size_t data_offset = m->len;
+    put_u32(m, 0);
+    for (int i = 0; i < hls->sample_count; ++i) {
+        put_u32(m, hls->samples[i].duration);
+        put_u32(m, hls->samples[i].size);
+        put_u32(m, hls->samples[i].keyframe ? CS_HLS_SYNC_FLAGS : CS_HLS_DELTA_FLAGS);
+    }
+    box_end(m, trun);
+    box_end(m, traf);
+    box_end(m, moof);
+    if (m->failed || hls->mdat.failed) {
+        reset_part(hls);
+        return;
+    }
+    set_u32(m->data + data_offset, (uint32_t)(m->len + 8));
+
+    size_t len = m->len + 8 + hls->mdat.len;
+    cs_hls_segment *segment = hls->open;
+    if (segment && segment->len + len > segment->cap) {
+        close_segment(hls);
+        segment = NULL;
+    }
+    if (!segment) {
+        segment = open_segment(hls);
+    }
+    if (!segment || len > segment->cap) {
+        fprintf(stderr, "HLS part of %zu bytes dropped\n", len);
+        reset_part(hls);
+        return;
+    }
+    if (segment->part_count == segment->part_cap) {
+        int cap = segment->part_cap ? segment->part_cap * 2 : 16;
+        hls_part *grown = (hls_part *)realloc(segment->parts, (size_t)cap * sizeof(hls_part));
+        if (!grown) {
+            reset_part(hls);
+            return;
+        }
+        segment->parts = grown;
+        segment->part_cap = cap;
+    }
+
+    hls_part *part = &segment->parts[segment->part_count];
+    part->offset = segment->len;
+    part->len = len;
+    part->duration = (uint32_t)part_duration(hls);
+    part->independent = hls->samples[0].keyframe;
+
+    uint8_t *out = segment->data + segment->len;
+    memcpy(out, m->data, m->len);
+    set_u32(out + m->len, (uint32_t)(8 + hls->mdat.len));
+    memcpy(out + m->len + 4, "mdat", 4);
+    memcpy(out + m->len + 8, hls->mdat.data, hls->mdat.len);
+    segment->len += len;
+    segment->duration += part->duration;
+    segment->part_count++;
+    reset_part(hls);
+}
+
+static int stage_sample(cs_hls *hls, const uint8_t *data, size_t len, int keyframe) {
+    if (hls->sample_count == hls->sample_cap) {
+        int cap = hls->sample_cap ? hls->sample_cap * 2 : 16;
+        hls_sample *grown = (hls_sample *)realloc(hls->samples, (size_t)cap * sizeof(hls_sample));
+        if (!grown) {
+            return -1;
+        }
+        hls->samples = grown;
+        hls->sample_cap = cap;
+    }
+
+    size_t start = hls->mdat.len;
+    size_t pos = 0;
+    size_t nal_len = 0;
+    const uint8_t *nal;
+    while ((nal = next_nal(data, len, &pos, &nal_len)) != NULL) {
+        int type = nal_len > 0 ? nal[0] & 0x1f : 0;
+        // Parameter sets are in the init segment; delimiters are not needed.
+        if (nal_len == 0 || type == 7 || type == 8 || type == 9) {
+            continue;
+        }
+        put_u32(&hls->mdat, (uint32_t)nal_len);
+        put_bytes(&hls->mdat, nal, nal_len);
+    }
+    if (hls->mdat.failed) {
+        return -1;
+    }
+    if (hls->mdat.len == start) {
+        return 0;
+    }
+
+    hls_sample *sample = &hls->samples[hls->sample_count++];
+    sample->size = (uint32_t)(hls->mdat.len - start);
+    sample->duration = 0;
+    sample->keyframe = keyframe;
+    return 0;
+}
+
+cs_hls *cs_hls_create(const cs_hls_config *config) {
+    if (!config || config->width <= 0 || config->height <= 0 || config->segment_ms <= 0 || config->part_ms <= 0 ||
+        config->part_ms > config->segment_ms || config->window <= 0 || config->max_segment_bytes == 0) {
+        return NULL;
+    }
+
+    cs_hls *hls = (cs_hls *)calloc(1, sizeof(cs_hls));
+    if (!hls) {
+        return NULL;
+    }
+    hls->config = *config;
+    hls->segments = (cs_hls_segment **)calloc((size_t)config->window + 1, sizeof(cs_hls_segment *));
+    if (!hls->segments) {
+        free(hls);
+        return NULL;
+    }
+    hls->part_ticks = (uint32_t)((uint64_t)config->part_ms * CS_HLS_TIMESCALE / 1000);
+    hls->segment_ticks = (uint32_t)((uint64_t)config->segment_ms * CS_HLS_TIMESCALE / 1000);
+    // Segments never run past twice their target, so this bound holds.
+    hls->target_duration = (2 * config->segment_ms + 999) / 1000;
+    hls->last_duration = CS_HLS_TIMESCALE / 30;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snprintf(hls->prefix, sizeof(hls->prefix), "%llx",
+             (unsigned long long)now.tv_sec * 1000ull + (unsigned long long)now.tv_nsec / 1000000ull);
+    return hls;
+}
+
+void cs_hls_destroy(cs_hls *hls) {
+    if (!hls) {
+        return;
+    }
+    for (int i = 0; i < hls->segment_count; ++i) {
+        segment_unref(hls->segments[i]);
+    }
+    free(hls->segments);
+    free(hls->samples);
+    free(hls->mdat.data);
+    free(hls->moof.data);
+    free(hls->init.data);
+    free(hls);
+}
+
+int cs_hls_push(cs_hls *hls, const uint8_t *data, size_t len, uint64_t pts_us, int keyframe) {
+    if (!hls || !data || len == 0) {
+        return 0;
+    }
+    if (!hls->have_init) {
+        // Nothing is packaged before the first keyframe.
+        if (!keyframe || init_from_keyframe(hls, data, len) != 0) {
+            return 0;
+        }
+        hls->have_init = 1;
+        hls->base_us = pts_us;
+        hls->have_base = 1;
+    }
+
+    uint64_t ts = pts_us > hls->base_us ? (pts_us - hls->base_us) * CS_HLS_TIMESCALE / 1000000ull : 0;
+    if (hls->sample_count > 0) {
+        uint64_t duration = ts > hls->last_ts ? ts - hls->last_ts : hls->last_duration;
+        if (duration > hls->segment_ticks) {
+            duration = hls->last_duration;
+        }
+        ts = hls->last_ts + duration;
+        hls->samples[hls->sample_count - 1].duration = (uint32_t)duration;
+        hls->last_duration = (uint32_t)duration;
+    } else if (hls->sequence > 0 && ts <= hls->last_ts) {
+        ts = hls->last_ts + hls->last_duration;
+    }
+
+    // Parts close before a keyframe, or before the next sample could push
+    // them past the part target; segments close at a keyframe past their
+    // target, or are cut at twice that.
+    uint64_t staged = part_duration(hls);
+    uint64_t segment = (hls->open ? hls->open->duration : 0) + staged;
+    int cut_segment = hls->sample_count > 0 &&
+                      ((keyframe && segment >= hls->segment_ticks) || segment >= 2ull * hls->segment_ticks);
+    int cut_part = hls->sample_count > 0 &&
+                   (keyframe || cut_segment || staged + hls->last_duration * 3 / 2 > hls->part_ticks);
+    if (cut_part) {
+        flush_part(hls);
+    }
+    if (cut_segment) {
+        close_segment(hls);
+        segment = 0;
+    }
+
+    if (hls->sample_count == 0) {
+        hls->part_start = ts;
+    }
+    if (stage_sample(hls, data, len, keyframe) != 0) {
+        reset_part(hls);
+        return 0;
+    }
+    hls->last_ts = ts;
+
+    if (!hls->key_requested && segment + hls->last_duration >= hls->segment_ticks) {
+        hls->key_requested = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static long long open_msn(const cs_hls *hls, int *parts) {
+    *parts = hls->open ? hls->open->part_count : 0;
+    return hls->open ? hls->open->msn : hls->next_msn;
+}
+
+int cs_hls_playlist_ready(const cs_hls *hls, long long msn, int part) {
+    if (!hls) {
+        return -1;
+    }
+    int parts = 0;
+    long long current = open_msn(hls, &parts);
+    if (msn > current + 2) {
+        return -1;
+    }
+    if (hls->segment_count == 0) {
+        return 0;
+    }
+    if (msn < 0 || msn < current) {
+        return 1;
+    }
+    return msn == current && part >= 0 && part < parts ? 1 : 0;
+}
+
+char *cs_hls_playlist(const cs_hls *hls, size_t *len) {
+    if (!hls || hls->segment_count == 0) {
+        return NULL;
+    }
+
+    size_t cap = 1024;
+    for (int i = 0; i < hls->segment_count; ++i) {
+        cap += 160 + (size_t)hls->segments[i]->part_count * 128;
+    }
+    char *out = (char *)malloc(cap);
+    if (!out) {
+        return NULL;
+    }
+
+    double part_target = (double)hls->part_ticks / CS_HLS_TIMESCALE;
+    size_t n = (size_t)snprintf(out, cap,
+                                "#EXTM3U\n"
+                                "#EXT-X-VERSION:6\n"
+                                "#EXT-X-TARGETDURATION:%d\n"
+                                "#EXT-X-PART-INF:PART-TARGET=%.5f\n"
+                                "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.5f\n"
+                                "#EXT-X-MEDIA-SEQUENCE:%lld\n"
+                                "#EXT-X-MAP:URI=\"%s-init.mp4\"\n",
+                                hls->target_duration, part_target, part_target * 3.0, hls->segments[0]->msn,
+                                hls->prefix);
+
+    for (int i = 0; i < hls->segment_count; ++i) {
+        const cs_hls_segment *segment = hls->segments[i];
+        if (i >= hls->segment_count - CS_HLS_PART_SEGMENTS) {
+            for (int p = 0; p < segment->part_count; ++p) {
+                n += (size_t)snprintf(out + n, cap - n, "#EXT-X-PART:DURATION=%.5f,URI=\"%s-%lld.%d.m4s\"%s\n",
+                                      (double)segment->parts[p].duration / CS_HLS_TIMESCALE, hls->prefix,
+                                      segment->msn, p, segment->parts[p].independent ? ",INDEPENDENT=YES" : "");
+            }
+        }
+        if (segment->complete) {
+            n += (size_t)snprintf(out + n, cap - n, "#EXTINF:%.5f,\n%s-%lld.m4s\n",
+                                  (double)segment->duration / CS_HLS_TIMESCALE, hls->prefix, segment->msn);
+        }
+    }
+
+    int parts = 0;
+    long long msn = open_msn(hls, &parts);
+    n += (size_t)snprintf(out + n, cap - n, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s-%lld.%d.m4s\"\n", hls->prefix,
+                          msn, parts);
+    if (len) {
+        *len = n;
+    }
+    return out;
+}
+
+static cs_hls_segment *find_segment(const cs_hls *hls, long long msn) {
+    for (int i = 0; i < hls->segment_count; ++i) {
+        if (hls->segments[i]->msn == msn) {
+            return hls->segments[i];
+        }
+    }
+    return NULL;
+}
+
+cs_hls_status cs_hls_lookup(cs_hls *hls, const char *name, cs_hls_blob *blob) {
+    if (!hls || !name || !blob) {
+        return CS_HLS_MISSING;
+    }
+    memset(blob, 0, sizeof(*blob));
+    size_t prefix_len = strlen(hls->prefix);
+    if (strncmp(name, hls->prefix, prefix_len) != 0 || name[prefix_len] != '-') {
+        return CS_HLS_MISSING;
+    }
+    const char *rest = name + prefix_len + 1;
+
+    if (strcmp(rest, "init.mp4") == 0) {
+        if (!hls->have_init) {
+            return CS_HLS_PENDING;
+        }
+        blob->data = hls->init.data;
+        blob->len = hls->init.len;
+        return CS_HLS_FOUND;
+    }
+
+    char *end = NULL;
+    long long msn = strtoll(rest, &end, 10);
+    if (end == rest || *end != '.' || msn < 0) {
+        return CS_HLS_MISSING;
+    }
+    int part = -1;
+    if (strcmp(end, ".m4s") != 0) {
+        char *part_end = NULL;
+        long value = strtol(end + 1, &part_end, 10);
+        if (part_end == end + 1 || strcmp(part_end, ".m4s") != 0 || value < 0 || value > 0xffff) {
+            return CS_HLS_MISSING;
+        }
+        part = (int)value;
+    }
+
+    int parts = 0;
+    long long current = open_msn(hls, &parts);
+    cs_hls_segment *segment = find_segment(hls, msn);
+    if (!segment) {
+        // The hinted part of a segment that has not been opened yet.
+        return msn >= current && msn <= current + 1 && part == 0 ? CS_HLS_PENDING : CS_HLS_MISSING;
+    }
+    if (part < 0) {
+        if (!segment->complete) {
+            return CS_HLS_PENDING;
+        }
+        blob->data = segment->data;
+        blob->len = segment->len;
+    } else if (part < segment->part_count) {
+        blob->data = segment->data + segment->parts[part].offset;
+        blob->len = segment->parts[part].len;
+    } else {
+        return !segment->complete && part == segment->part_count ? CS_HLS_PENDING : CS_HLS_MISSING;
+    }
+    segment->refs++;
+    blob->segment = segment;
+    return CS_HLS_FOUND;
+}
+
+void cs_hls_blob_release(cs_hls_blob *blob) {
+    if (blob) {
+        segment_unref(blob->segment);
+        memset(blob, 0, sizeof(*blob));
+    }
+}
+
+int cs_hls_block_ms(const cs_hls *hls) {
+    return hls ? hls->target_duration * 3000 : 0;
+}
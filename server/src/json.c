@@ -0,0 +1,129 @@
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char *cs_json_escape(const char *input) {
+    size_t len = strlen(input);
+    size_t extra = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = input[i];
+        if (c == '"' || c == '\\') {
+            extra += 1;
+        } else if (c == '\n' || c == '\r') {
+            extra += 1;
+        }
+    }
+    char *out = (char *)malloc(len + extra + 1);
+    if (!out) {
+        return NULL;
+    }
+    size_t j = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = input[i];
+        if (c == '"' || c == '\\') {
+            out[j++] = '\\';
+            out[j++] = c;
+        } else if (c == '\n') {
+            out[j++] = '\\';
+            out[j++] = 'n';
+        } else if (c == '\r') {
+            out[j++] = '\\';
+            out[j++] = 'r';
+        } else {
+            out[j++] = c;
+        }
+    }
+    out[j] = '\0';
+    return out;
+}
+
+static void json_unescape_inplace(char *value) {
+    size_t len = strlen(value);
+    size_t j = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (value[i] == '\\' && i + 1 < len) {
+            char next = value[i + 1];
+            if (next == 'n') {
+                value[j++] = '\n';
+                i++;
+                continue;
+            }
+            if (next == 'r') {
+                value[j++] = '\r';
+                i++;
+                continue;
+            }
+            if (next == '"' || next == '\\') {
+                value[j++] = next;
+                i++;
+                continue;
+            }
+        }
+        value[j++] = value[i];
+    }
+    value[j] = '\0';
+}
+
+static const char *find_value(const char *json, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    const char *pos = strstr(json, pattern);
+    if (!pos) {
+        return NULL;
+    }
+    pos = strchr(pos + strlen(pattern), ':');
+    if (!pos) {
+        return NULL;
+    }
+    return pos + 1;
+}
+
+int cs_json_get_string(const char *json, const char *key, char *out, size_t out_len) {
+    const char *pos = find_value(json, key);
+    if (!pos) {
+        return -1;
+    }
+    pos = strchr(pos, '"');
+    if (!pos) {
+        return -1;
+    }
+    pos++;
+    const char *end = pos;
+    while (*end && *end != '"') {
+        if (*end == '\\' && end[1]) {
+            end++;
+        }
+        end++;
+    }
+    if (*end != '"') {
+        return -1;
+    }
+    size_t len = (size_t)(end - pos);
+    if (len >= out_len) {
+        len = out_len - 1;
+    }
+    memcpy(out, pos, len);
+    out[len] = '\0';
+    json_unescape_inplace(out);
+    return 0;
+}
+
+int cs_json_get_int(const char *json, const char *key, int *out_value) {
+    const char *pos = find_value(json, key);
+    if (!pos) {
+        return -1;
+    }
+    *out_value = atoi(pos);
+    return 0;
+}
+
+int cs_json_get_double(const char *json, const char *key, double *out_value) {
+    const char *pos = find_value(json, key);
+    if (!pos) {
+        return -1;
+    }
+    *out_value = strtod(pos, NULL);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "load.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+struct cs_load_monitor {
+    uint64_t frame_ns;
+    uint64_t busy_ns;
+    uint64_t frames;
+    uint64_t last_wall_ns;
+    uint64_t last_cpu_ns;
+    long cores;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t process_cpu_ns(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    uint64_t user = (uint64_t)usage.ru_utime.tv_sec * 1000000000ull + (uint64_t)usage.ru_utime.tv_usec * 1000ull;
+    uint64_t sys = (uint64_t)usage.ru_stime.tv_sec * 1000000000ull + (uint64_t)usage.ru_stime.tv_usec * 1000ull;
+    return user + sys;
+}
+
+cs_load_monitor *cs_load_monitor_create(float fps) {
+    if (fps <= 0.0f) {
+        return NULL;
+    }
+
+    cs_load_monitor *monitor = (cs_load_monitor *)calloc(1, sizeof(cs_load_monitor));
+    if (!monitor) {
+        return NULL;
+    }
+
+    monitor->frame_ns = (uint64_t)(1000000000.0 / fps);
+    monitor->last_wall_ns = monotonic_ns();
+    monitor->last_cpu_ns = process_cpu_ns();
+    monitor->cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (monitor->cores < 1) {
+        monitor->cores = 1;
+    }
+    return monitor;
+}
+
+void cs_load_monitor_destroy(cs_load_monitor *monitor) {
+    free(monitor);
+}
+
+void cs_load_monitor_frame(cs_load_monitor *monitor, uint64_t busy_ns) {
+    if (!monitor) {
+        return;
+    }
+    monitor->busy_ns += busy_ns;
+    monitor->frames++;
+}
+
+int cs_load_monitor_sample(cs_load_monitor *monitor, cs_load_report *report) {
+    if (!monitor || !report) {
+        return -1;
+    }
+
+    uint64_t wall = monotonic_ns();
+    uint64_t cpu = process_cpu_ns();
+    uint64_t wall_delta = wall - monitor->last_wall_ns;
+
+    report->cpu = 0.0;
+    if (wall_delta > 0) {
+        report->cpu = (double)(cpu - monitor->last_cpu_ns) / ((double)wall_delta * (double)monitor->cores);
+    }
+
+    report->encode_headroom = 1.0;
+    if (monitor->frames > 0) {
+        double busy = (double)monitor->busy_ns / ((double)monitor->frames * (double)monitor->frame_ns);
+        report->encode_headroom = busy >= 1.0 ? 0.0 : 1.0 - busy;
+    }
+
+    monitor->last_wall_ns = wall;
+    monitor->last_cpu_ns = cpu;
+    monitor->busy_ns = 0;
+    monitor->frames = 0;
+    return 0;
+}
+
+void cs_process_stats_sample(cs_process_stats *stats) {
+    if (!stats) {
+        return;
+    }
+    stats->rss_kb = -1;
+    stats->fds = -1;
+    stats->threads = -1;
+
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[128];
+        while (fgets(line, sizeof(line), status)) {
+            if (strncmp(line, "VmRSS:", 6) == 0) {
+                stats->rss_kb = strtol(line + 6, NULL, 10);
+            } else if (strncmp(line, "Threads:", 8) == 0) {
+                stats->threads = (int)strtol(line + 8, NULL, 10);
+            }
+        }
+        fclose(status);
+    }
+
+    DIR *fds = opendir("/proc/self/fd");
+    if (fds) {
+        int count = 0;
+        struct dirent *entry;
+        while ((entry = readdir(fds)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                ++count;
+            }
+        }
+        closedir(fds);
+        // The directory stream holds one descriptor of its own.
+        stats->fds = count - 1;
+    }
+}
@@ -1,11 +1,25 @@
 #include "config.h"
+#include "event_loop.h"
+#include "frame_ring.h"
+#include "hls.h"
+#include "json.h"
+#include "load.h"
 #include "pipeline.h"
+#include "recorder.h"
 #include "render.h"
+#include "render_process.h"
+#include "router.h"
 #include "signaling.h"
+#include "trace.h"
+#include "views.h"
 
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 static uint64_t monotonic_ns(void) {
     struct timespec ts;
@@ -13,40 +27,472 @@ static uint64_t monotonic_ns(void) {
     return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
+#define CS_LATENCY_LOG_NS 5000000000ull
+#define CS_STARTUP_PHASES 8
+// The LL-HLS output holds a place in the view set like a viewer that never
+// moves its camera; signaling peer ids are all positive.
+#define CS_HLS_PEER_ID -1
+
+// Per-viewer input tracking. An input is acked once the first frame rendered
+// after it leaves the viewer's encoder; the client then reports the
+// input-to-photon time it observed.
+typedef struct {
+    int peer_id;
+    // Takes access units over a cs-stream WebSocket instead of WebRTC.
+    int stream;
+    long long input_seq;
+    uint64_t input_ns;
+    uint64_t tracked_frame;
+    double server_ms_sum;
+    double photon_ms_sum;
+    double photon_ms_max;
+    int server_samples;
+    int photon_samples;
+} cs_viewer;
+
 typedef struct {
     cs_pipeline *pipeline;
     cs_signaling *signaling;
+    cs_view_set *views;
+    cs_viewer *viewers;
+    int max_viewers;
+    cs_frame_ring *ring;
+    cs_load_monitor *load;
+    cs_hls *hls;
+    // Pooled rendering (render_threads > 1): results come back through the
+    // loop rather than from the tick.
+    cs_renderer *renderer;
+    cs_pipeline_region *regions;
+    uint64_t renderer_epoch;
+    uint64_t frame_index;
+    const char *trace_dir;
+    int trace_seconds;
 } cs_app;
 
-static void on_offer_needed(void *user) {
+// Set by SIGUSR2; the main loop starts a trace capture.
+static volatile sig_atomic_t trace_requested;
+
+// Time spent in each startup phase, logged once the server is ready.
+typedef struct {
+    uint64_t start_ns;
+    uint64_t last_ns;
+    int count;
+    const char *names[CS_STARTUP_PHASES];
+    uint64_t phase_ns[CS_STARTUP_PHASES];
+} cs_startup;
+
+static void startup_mark(cs_startup *startup, const char *name) {
+    uint64_t now = monotonic_ns();
+    if (startup->count < CS_STARTUP_PHASES) {
+        startup->names[startup->count] = name;
+        startup->phase_ns[startup->count] = now - startup->last_ns;
+        ++startup->count;
+    }
+    startup->last_ns = now;
+}
+
+static void startup_log(const cs_startup *startup) {
+    fprintf(stderr, "Startup:");
+    for (int i = 0; i < startup->count; ++i) {
+        fprintf(stderr, " %s %.1f ms%s", startup->names[i], startup->phase_ns[i] / 1e6,
+                i + 1 < startup->count ? "," : ";");
+    }
+    fprintf(stderr, " ready in %.1f ms\n", (startup->last_ns - startup->start_ns) / 1e6);
+}
+
+static cs_viewer *find_viewer(cs_app *app, int peer_id) {
+    for (int i = 0; i < app->max_viewers; ++i) {
+        if (app->viewers[i].peer_id == peer_id) {
+            return &app->viewers[i];
+        }
+    }
+    return NULL;
+}
+
+static int add_viewer(cs_app *app, int peer_id) {
+    cs_viewer *viewer = find_viewer(app, 0); // free slot
+    if (!viewer) {
+        return -1;
+    }
+    int view = cs_view_set_add_peer(app->views, peer_id);
+    if (view < 0 || cs_pipeline_add_peer(app->pipeline, peer_id, view) != 0) {
+        fprintf(stderr, "Peer %d setup failed\n", peer_id);
+        cs_view_set_remove_peer(app->views, peer_id);
+        return -1;
+    }
+    memset(viewer, 0, sizeof(*viewer));
+    viewer->peer_id = peer_id;
+    viewer->input_seq = -1;
+    return 0;
+}
+
+static void on_offer_needed(void *user, int peer_id) {
+    cs_app *app = (cs_app *)user;
+    uint64_t trace = cs_trace_begin();
+    if (add_viewer(app, peer_id) == 0) {
+        char *offer = cs_pipeline_create_offer(app->pipeline, peer_id);
+        if (offer) {
+            free(offer);
+        }
+    }
+    cs_trace_end(trace, "signaling.offer", "peer", peer_id);
+}
+
+static void on_stream_opened(void *user, int peer_id) {
+    cs_app *app = (cs_app *)user;
+    cs_viewer *viewer = find_viewer(app, 0); // free slot
+    int view = viewer ? cs_view_set_add_peer(app->views, peer_id) : -1;
+    if (view < 0) {
+        fprintf(stderr, "Stream viewer %d setup failed\n", peer_id);
+        cs_signaling_close_peer(app->signaling, peer_id);
+        return;
+    }
+    memset(viewer, 0, sizeof(*viewer));
+    viewer->peer_id = peer_id;
+    viewer->stream = 1;
+    viewer->input_seq = -1;
+    cs_pipeline_watch_view(app->pipeline, view, 1);
+    cs_pipeline_request_keyframe(app->pipeline, view);
+}
+
+static int on_remote_offer(void *user, int peer_id, const char *sdp) {
+    cs_app *app = (cs_app *)user;
+    uint64_t trace = cs_trace_begin();
+    char *answer = NULL;
+    if (add_viewer(app, peer_id) == 0 &&
+        cs_pipeline_set_remote_description(app->pipeline, peer_id, "offer", sdp) == 0) {
+        answer = cs_pipeline_create_answer(app->pipeline, peer_id);
+    }
+    cs_trace_end(trace, "signaling.answer", "peer", peer_id);
+    if (!answer) {
+        // The caller reports the session closed, which drops the viewer.
+        return -1;
+    }
+    free(answer);
+    return 0;
+}
+
+static void on_peer_closed(void *user, int peer_id) {
+    cs_app *app = (cs_app *)user;
+    uint64_t trace = cs_trace_begin();
+    cs_viewer *viewer = find_viewer(app, peer_id);
+    if (viewer && viewer->stream) {
+        cs_pipeline_watch_view(app->pipeline, cs_view_set_view_of(app->views, peer_id), -1);
+    } else {
+        cs_pipeline_remove_peer(app->pipeline, peer_id);
+    }
+    if (viewer) {
+        viewer->peer_id = 0;
+    }
+    cs_view_set_remove_peer(app->views, peer_id);
+    cs_trace_end(trace, "signaling.close", "peer", peer_id);
+}
+
+static void on_local_sdp(void *user, int peer_id, const char *type, const char *sdp) {
+    cs_app *app = (cs_app *)user;
+    cs_signaling_send_sdp(app->signaling, peer_id, type, sdp);
+}
+
+static void on_remote_sdp(void *user, int peer_id, const char *type, const char *sdp) {
+    cs_app *app = (cs_app *)user;
+    uint64_t trace = cs_trace_begin();
+    cs_pipeline_set_remote_description(app->pipeline, peer_id, type, sdp);
+    cs_trace_end(trace, "signaling.sdp", "peer", peer_id);
+}
+
+static void on_remote_ice(void *user, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
+    cs_app *app = (cs_app *)user;
+    uint64_t trace = cs_trace_begin();
+    cs_pipeline_add_ice_candidate(app->pipeline, peer_id, candidate, sdp_mline_index, sdp_mid);
+    cs_trace_end(trace, "signaling.ice", "peer", peer_id);
+}
+
+static void on_local_ice(void *user, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
+    cs_app *app = (cs_app *)user;
+    cs_signaling_send_ice(app->signaling, peer_id, candidate, sdp_mline_index, sdp_mid);
+}
+
+static void on_ice_gathering_done(void *user, int peer_id) {
+    cs_app *app = (cs_app *)user;
+    cs_signaling_ice_gathering_done(app->signaling, peer_id);
+}
+
+static void on_peer_failed(void *user, int peer_id) {
+    cs_app *app = (cs_app *)user;
+    fprintf(stderr, "Peer %d ICE failed\n", peer_id);
+    cs_signaling_close_peer(app->signaling, peer_id);
+}
+
+static void on_data_message(void *user, int peer_id, const char *message) {
+    cs_app *app = (cs_app *)user;
+    cs_viewer *viewer = find_viewer(app, peer_id);
+    char type[32];
+    if (!viewer || cs_json_get_string(message, "type", type, sizeof(type)) != 0) {
+        return;
+    }
+    uint64_t trace = cs_trace_begin();
+
+    if (strcmp(type, "camera") == 0) {
+        double yaw = 0.0;
+        double pitch = 0.0;
+        double zoom = 1.0;
+        int seq = 0;
+        cs_json_get_double(message, "yaw", &yaw);
+        cs_json_get_double(message, "pitch", &pitch);
+        cs_json_get_double(message, "zoom", &zoom);
+        cs_json_get_int(message, "seq", &seq);
+
+        cs_camera camera = { (float)yaw, (float)pitch, (float)zoom };
+        int previous = cs_view_set_view_of(app->views, peer_id);
+        int view = cs_view_set_update(app->views, peer_id, &camera);
+        if (view >= 0 && viewer->stream) {
+            if (view != previous) {
+                cs_pipeline_watch_view(app->pipeline, view, 1);
+                cs_pipeline_watch_view(app->pipeline, previous, -1);
+                cs_pipeline_request_keyframe(app->pipeline, view);
+            }
+        } else if (view >= 0) {
+            cs_pipeline_set_peer_view(app->pipeline, peer_id, view);
+        }
+        // Only the newest input is tracked; an older one still in flight
+        // is superseded.
+        viewer->input_seq = seq;
+        viewer->input_ns = monotonic_ns();
+        viewer->tracked_frame = 0;
+    } else if (strcmp(type, "latency") == 0) {
+        double ms = 0.0;
+        if (cs_json_get_double(message, "ms", &ms) == 0 && ms >= 0.0) {
+            viewer->photon_ms_sum += ms;
+            viewer->photon_samples++;
+            if (ms > viewer->photon_ms_max) {
+                viewer->photon_ms_max = ms;
+            }
+        }
+    } else if (strcmp(type, "keyframe") == 0 && viewer->stream) {
+        // A WebCodecs decoder that hit an error can only restart on a key.
+        cs_pipeline_request_keyframe(app->pipeline, cs_view_set_view_of(app->views, peer_id));
+    }
+    cs_trace_end(trace, "input", "peer", peer_id);
+}
+
+static void on_trace_signal(int signo) {
+    (void)signo;
+    trace_requested = 1;
+}
+
+static int start_trace(cs_app *app, int seconds) {
+    if (cs_trace_start(seconds > 0 ? seconds : app->trace_seconds, app->trace_dir) != 0) {
+        return -1;
+    }
+    cs_pipeline_trace(app->pipeline, 1);
+    return 0;
+}
+
+static int on_trace_start(void *user, int seconds) {
+    return start_trace((cs_app *)user, seconds);
+}
+
+static char *on_trace_dump(void *user, size_t *len) {
+    (void)user;
+    return cs_trace_copy_last(len);
+}
+
+// Served at GET /stats for soak runs, which expect every count back at its
+// baseline once their viewers have left.
+static int on_stats(void *user, char *out, size_t out_len) {
     cs_app *app = (cs_app *)user;
-    char *offer = cs_pipeline_create_offer(app->pipeline);
-    if (offer) {
-        free(offer);
+    cs_process_stats process;
+    cs_pipeline_stats pipeline = { 0, 0, 0, 0 };
+    cs_process_stats_sample(&process);
+    if (app->pipeline) {
+        cs_pipeline_get_stats(app->pipeline, &pipeline);
     }
+    return snprintf(out, out_len,
+                    "{\"peers\":%d,\"pipeline_peers\":%d,\"pipeline_pooled\":%d,\"rss_kb\":%ld,\"fds\":%d,"
+                    "\"threads\":%d,\"gst_elements\":%d,\"gst_pads\":%d}",
+                    cs_signaling_peer_count(app->signaling), pipeline.peers, pipeline.pooled, process.rss_kb, process.fds,
+                    process.threads, pipeline.elements, pipeline.pads);
 }
 
-static void on_local_sdp(void *user, const char *type, const char *sdp) {
+static void on_view_encoded(void *user, int view, uint64_t tag) {
     cs_app *app = (cs_app *)user;
-    cs_signaling_broadcast_sdp(app->signaling, type, sdp);
+    uint64_t now = monotonic_ns();
+    for (int i = 0; i < app->max_viewers; ++i) {
+        cs_viewer *viewer = &app->viewers[i];
+        if (viewer->peer_id == 0 || viewer->tracked_frame == 0 || viewer->tracked_frame > tag ||
+            cs_view_set_view_of(app->views, viewer->peer_id) != view) {
+            continue;
+        }
+        double server_ms = (double)(now - viewer->input_ns) / 1e6;
+        char ack[96];
+        snprintf(ack, sizeof(ack), "{\"type\":\"ack\",\"seq\":%lld,\"server_ms\":%.2f}",
+                 viewer->input_seq, server_ms);
+        if (viewer->stream) {
+            cs_signaling_stream_send_text(app->signaling, viewer->peer_id, ack);
+        } else {
+            cs_pipeline_send_data(app->pipeline, viewer->peer_id, ack);
+        }
+        viewer->server_ms_sum += server_ms;
+        viewer->server_samples++;
+        viewer->input_seq = -1;
+        viewer->tracked_frame = 0;
+    }
 }
 
-static void on_remote_sdp(void *user, const char *type, const char *sdp) {
+// One framed copy of the unit is shared by every stream viewer of the view.
+static void on_view_unit(void *user, int view, const cs_pipeline_unit *unit) {
     cs_app *app = (cs_app *)user;
-    cs_pipeline_set_remote_description(app->pipeline, type, sdp);
+    cs_stream_unit *framed = NULL;
+    int need_keyframe = 0;
+    if (app->hls && view == cs_view_set_view_of(app->views, CS_HLS_PEER_ID)) {
+        need_keyframe = cs_hls_push(app->hls, unit->data, unit->len, unit->pts_us, unit->keyframe) == 1;
+        cs_signaling_hls_updated(app->signaling);
+    }
+    for (int i = 0; i < app->max_viewers; ++i) {
+        cs_viewer *viewer = &app->viewers[i];
+        if (viewer->peer_id == 0 || !viewer->stream || cs_view_set_view_of(app->views, viewer->peer_id) != view) {
+            continue;
+        }
+        if (!framed) {
+            framed = cs_stream_unit_create(unit->data, unit->len, unit->pts_us, unit->keyframe);
+            if (!framed) {
+                break;
+            }
+        }
+        if (cs_signaling_stream_send(app->signaling, viewer->peer_id, framed) == 1) {
+            need_keyframe = 1;
+        }
+    }
+    cs_stream_unit_unref(framed);
+    if (need_keyframe) {
+        cs_pipeline_request_keyframe(app->pipeline, view);
+    }
+}
+
+// Called after frame_index was pushed: track it for every view that has
+// viewers waiting on an input.
+// drawn_ns is when the frame's draw started; inputs after it are left for
+// a later frame.
+static void track_inputs(cs_app *app, uint64_t frame_index, uint64_t drawn_ns) {
+    for (int i = 0; i < app->max_viewers; ++i) {
+        cs_viewer *viewer = &app->viewers[i];
+        if (viewer->peer_id == 0 || viewer->input_seq < 0 || viewer->tracked_frame != 0 ||
+            viewer->input_ns > drawn_ns) {
+            continue;
+        }
+        int view = cs_view_set_view_of(app->views, viewer->peer_id);
+        if (cs_pipeline_track_view(app->pipeline, view, frame_index) == 0) {
+            viewer->tracked_frame = frame_index;
+        }
+    }
+}
+
+static void log_latency(cs_app *app) {
+    for (int i = 0; i < app->max_viewers; ++i) {
+        cs_viewer *viewer = &app->viewers[i];
+        if (viewer->peer_id == 0 || (viewer->server_samples == 0 && viewer->photon_samples == 0)) {
+            continue;
+        }
+        fprintf(stderr, "Peer %d view %d: input->encoded %.1f ms avg (%d), input->photon %.1f ms avg %.1f ms max (%d)\n",
+                viewer->peer_id, cs_view_set_view_of(app->views, viewer->peer_id),
+                viewer->server_samples ? viewer->server_ms_sum / viewer->server_samples : 0.0,
+                viewer->server_samples,
+                viewer->photon_samples ? viewer->photon_ms_sum / viewer->photon_samples : 0.0,
+                viewer->photon_ms_max, viewer->photon_samples);
+        viewer->server_ms_sum = 0.0;
+        viewer->photon_ms_sum = 0.0;
+        viewer->photon_ms_max = 0.0;
+        viewer->server_samples = 0;
+        viewer->photon_samples = 0;
+    }
 }
 
-static void on_remote_ice(void *user, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
+// Split mode: the renderer process paces frames; each one wakes the loop.
+static void on_ring_ready(void *user, int fd, uint32_t events) {
     cs_app *app = (cs_app *)user;
-    cs_pipeline_add_ice_candidate(app->pipeline, candidate, sdp_mline_index, sdp_mid);
+    if (cs_frame_ring_wait(app->ring, 0) <= 0) {
+        return;
+    }
+
+    uint64_t start = monotonic_ns();
+    cs_frame_slot slot;
+    if (cs_frame_ring_acquire_latest(app->ring, &slot) == 0) {
+        if (slot.epoch != app->renderer_epoch) {
+            fprintf(stderr, "Renderer epoch %llu attached at frame %llu\n",
+                    (unsigned long long)slot.epoch, (unsigned long long)slot.seq);
+            app->renderer_epoch = slot.epoch;
+        }
+        cs_pipeline_region region = { 0, slot.roi[0], slot.roi[1], slot.roi[2], slot.roi[3] };
+        uint64_t trace = cs_trace_begin();
+        if (cs_pipeline_push_wrapped(app->pipeline, slot.data, slot.len, slot.pts_ns, &region, 1,
+                                     cs_frame_ring_release_token, slot.token) == 0) {
+            track_inputs(app, ++app->frame_index, start);
+        }
+        cs_trace_end(trace, "push", "frame", (int64_t)app->frame_index);
+    }
+    cs_load_monitor_frame(app->load, monotonic_ns() - start);
 }
 
-static void on_local_ice(void *user, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
+// Pooled rendering: frames finish on the workers in any order and are taken
+// back in submission order. Each was tagged with its tick time.
+static void on_render_ready(void *user, int fd, uint32_t events) {
     cs_app *app = (cs_app *)user;
-    cs_signaling_broadcast_ice(app->signaling, candidate, sdp_mline_index, sdp_mid);
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        return;
+    }
+
+    cs_render_result result;
+    while (cs_render_take(app->renderer, &result) == 0) {
+        if (result.status == 0) {
+            for (int i = 0; i < result.view_count; ++i) {
+                app->regions[i].view = result.views[i].tile;
+                app->regions[i].x = result.views[i].roi.x;
+                app->regions[i].y = result.views[i].roi.y;
+                app->regions[i].width = result.views[i].roi.width;
+                app->regions[i].height = result.views[i].roi.height;
+            }
+            uint64_t trace = cs_trace_begin();
+            if (cs_pipeline_push_frame(app->pipeline, result.rgba, result.len, result.tag, app->regions,
+                                       result.view_count) == 0) {
+                track_inputs(app, ++app->frame_index, result.tag);
+            }
+            cs_trace_end(trace, "push", "frame", (int64_t)app->frame_index);
+        }
+        // The workers split the frame budget between them.
+        cs_load_monitor_frame(app->load, result.render_ns / (uint64_t)cs_render_threads(app->renderer));
+        cs_render_release(app->renderer, &result);
+    }
+}
+
+static int run_router(const cs_config *config) {
+    cs_router_config router_cfg = {
+        .port = config->signaling_port,
+        .worker_iface = config->router_worker_iface,
+        .worker_port = config->router_worker_port,
+        .max_workers = config->router_max_workers,
+        .worker_timeout_ms = 3000
+    };
+    cs_router *router = cs_router_create(&router_cfg);
+    if (!router) {
+        fprintf(stderr, "Router init failed\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Router listening on port %d, workers on %s:%d\n", config->signaling_port,
+            config->router_worker_iface[0] ? config->router_worker_iface : "*", config->router_worker_port);
+    while (1) {
+        cs_router_poll(router, 100);
+    }
+
+    cs_router_destroy(router);
+    return 0;
 }
 
 int main(int argc, char **argv) {
+    cs_startup startup = { .count = 0 };
+    startup.start_ns = monotonic_ns();
+    startup.last_ns = startup.start_ns;
     const char *config_path = NULL;
     if (argc > 1) {
         config_path = argv[1];
@@ -58,86 +504,424 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    cs_render_config render_cfg = {
-        .width = config.width,
-        .height = config.height,
-        .fps = config.fps
-    };
-    cs_renderer *renderer = cs_render_create(&render_cfg);
-    if (!renderer) {
-        fprintf(stderr, "Renderer init failed\n");
+    if (config.mode == CS_MODE_ROUTER) {
+        return run_router(&config);
+    }
+    startup_mark(&startup, "config");
+
+    // Split mode renders the default camera only: the renderer process
+    // draws a single view into the frame ring.
+    int max_views = config.render_process ? 1 : (config.max_views > 0 ? config.max_views : 1);
+    int atlas_cols = 1;
+    int atlas_rows = 1;
+    cs_view_atlas_layout(max_views, &atlas_cols, &atlas_rows);
+    const int atlas_width = config.width * atlas_cols;
+    const int atlas_height = config.height * atlas_rows;
+
+    // Signaling sockets, the pipeline bus and split-mode frames all wake one
+    // loop; rendering and housekeeping run on its timeouts.
+    cs_event_loop *loop = cs_event_loop_create();
+    if (!loop) {
+        fprintf(stderr, "Event loop init failed\n");
         return 1;
     }
 
-    cs_app app = { .pipeline = NULL, .signaling = NULL };
+    cs_renderer *renderer = NULL;
+    cs_frame_ring *ring = NULL;
+    cs_render_process *render_process = NULL;
 
-    cs_pipeline_config pipeline_cfg = {
-        .width = config.width,
-        .height = config.height,
-        .fps = config.fps,
-        .bitrate_kbps = config.bitrate_kbps,
-        .user = &app,
-        .on_local_sdp = on_local_sdp,
-        .on_local_ice = on_local_ice
-    };
-    cs_pipeline *pipeline = cs_pipeline_create(&pipeline_cfg);
-    if (!pipeline) {
-        fprintf(stderr, "Pipeline init failed\n");
+    // GStreamer's registry and plugins load on a background thread while
+    // EGL, lws and everything else start here; cs_pipeline_create joins it.
+    cs_pipeline_preload(config.encoder);
+
+    if (config.render_process) {
+        ring = cs_frame_ring_create(config.width, config.height, config.frame_ring_slots);
+        if (!ring) {
+            fprintf(stderr, "Frame ring init failed\n");
+            cs_event_loop_destroy(loop);
+            return 1;
+        }
+        // Started early so the child's EGL setup overlaps ours; frames it
+        // publishes before the loop runs are recycled as stale.
+        cs_render_process_config process_cfg = {
+            .renderer_path = config.renderer_path,
+            .config_path = config_path,
+            .ring = ring,
+            .respawn_delay_ms = 500
+        };
+        render_process = cs_render_process_create(&process_cfg);
+        if (!render_process) {
+            fprintf(stderr, "Renderer process spawn failed\n");
+            cs_frame_ring_destroy(ring);
+            cs_event_loop_destroy(loop);
+            return 1;
+        }
+    } else {
+        cs_render_config render_cfg = {
+            .width = config.width,
+            .height = config.height,
+            .fps = config.fps,
+            .scene_objects = config.scene_objects,
+            .atlas_cols = atlas_cols,
+            .atlas_rows = atlas_rows,
+            .asset_dir = config.asset_dir,
+            .shader_cache_dir = config.shader_cache_dir,
+            .platform = config.egl_platform,
+            .threads = config.render_threads
+        };
+        renderer = cs_render_create(&render_cfg);
+        if (!renderer) {
+            fprintf(stderr, "Renderer init failed\n");
+            cs_event_loop_destroy(loop);
+            return 1;
+        }
+    }
+    startup_mark(&startup, "renderer");
+
+    cs_app app = { .pipeline = NULL, .signaling = NULL };
+    app.max_viewers = config.max_peers > 0 ? config.max_peers : 1;
+    app.trace_dir = config.trace_dir;
+    app.trace_seconds = config.trace_seconds;
+    app.viewers = (cs_viewer *)calloc((size_t)app.max_viewers, sizeof(cs_viewer));
+    app.views = cs_view_set_create(max_views);
+    if (!app.viewers || !app.views) {
+        fprintf(stderr, "View set init failed\n");
+        free(app.viewers);
+        cs_view_set_destroy(app.views);
+        cs_render_process_destroy(render_process);
+        cs_frame_ring_destroy(ring);
         cs_render_destroy(renderer);
+        cs_event_loop_destroy(loop);
         return 1;
     }
 
-    cs_signaling_config signaling_cfg = { .port = config.signaling_port };
+    cs_hls *hls = NULL;
+    if (config.hls) {
+        // Room for a segment cut at twice its target at twice the bitrate.
+        size_t bytes_per_sec = (size_t)(config.bitrate_kbps > 0 ? config.bitrate_kbps : 1500) * 125;
+        cs_hls_config hls_cfg = {
+            .width = config.width,
+            .height = config.height,
+            .segment_ms = config.hls_segment_ms,
+            .part_ms = config.hls_part_ms,
+            .window = config.hls_window,
+            .max_segment_bytes = bytes_per_sec * 2 * (size_t)(2 * config.hls_segment_ms) / 1000
+        };
+        hls = cs_hls_create(&hls_cfg);
+        if (!hls) {
+            fprintf(stderr, "HLS init failed\n");
+            free(app.viewers);
+            cs_view_set_destroy(app.views);
+            cs_render_process_destroy(render_process);
+            cs_frame_ring_destroy(ring);
+            cs_render_destroy(renderer);
+            cs_event_loop_destroy(loop);
+            return 1;
+        }
+    }
+
+    // Nothing is dispatched before the loop runs, so signaling can come up
+    // ahead of the pipeline its callbacks use.
+    cs_signaling_config signaling_cfg = {
+        .port = config.signaling_port,
+        .max_peers = app.max_viewers,
+        .router_host = config.router_host,
+        .router_port = config.router_port,
+        .advertise_host = config.advertise_host,
+        .loop = loop,
+        .hls = hls,
+        .client_dir = config.serve_client ? config.client_dir : NULL
+    };
     cs_signaling_callbacks callbacks = {
         .user = &app,
         .on_offer_needed = on_offer_needed,
-        .on_local_sdp = on_local_sdp,
+        .on_remote_offer = on_remote_offer,
+        .on_peer_closed = on_peer_closed,
         .on_remote_sdp = on_remote_sdp,
-        .on_remote_ice = on_remote_ice
+        .on_remote_ice = on_remote_ice,
+        .on_stream_opened = on_stream_opened,
+        .on_stream_message = on_data_message,
+        .on_stats = on_stats,
+        .on_trace_start = on_trace_start,
+        .on_trace_dump = on_trace_dump
     };
     cs_signaling *signaling = cs_signaling_create(&signaling_cfg, &callbacks);
     if (!signaling) {
         fprintf(stderr, "Signaling init failed\n");
-        cs_pipeline_destroy(pipeline);
+        cs_hls_destroy(hls);
+        free(app.viewers);
+        cs_view_set_destroy(app.views);
+        cs_render_process_destroy(render_process);
+        cs_frame_ring_destroy(ring);
+        cs_render_destroy(renderer);
+        cs_event_loop_destroy(loop);
+        return 1;
+    }
+    startup_mark(&startup, "signaling");
+
+    cs_recorder *recorder = NULL;
+    if (config.record_dir[0]) {
+        // Four seconds of the full bitrate of every view can wait on the disk
+        // before recordings start dropping up to the next keyframe.
+        size_t bytes_per_sec = (size_t)(config.bitrate_kbps > 0 ? config.bitrate_kbps : 1500) * 125;
+        size_t buffer_bytes = 1u << 20;
+        size_t backlog = bytes_per_sec * (size_t)max_views * 4;
+        cs_recorder_config recorder_cfg = {
+            .dir = config.record_dir,
+            .tracks = max_views,
+            .segment_s = config.record_segment_s,
+            .max_bytes = (uint64_t)(config.record_max_mb > 0 ? config.record_max_mb : 0) << 20,
+            .buffer_bytes = buffer_bytes,
+            .buffers = (int)((backlog + buffer_bytes - 1) / buffer_bytes) + max_views
+        };
+        recorder = cs_recorder_create(&recorder_cfg);
+        if (!recorder) {
+            fprintf(stderr, "Recorder init failed\n");
+            cs_signaling_destroy(signaling);
+            cs_hls_destroy(hls);
+            free(app.viewers);
+            cs_view_set_destroy(app.views);
+            cs_render_process_destroy(render_process);
+            cs_frame_ring_destroy(ring);
+            cs_render_destroy(renderer);
+            cs_event_loop_destroy(loop);
+            return 1;
+        }
+        fprintf(stderr, "Recording to %s\n", config.record_dir);
+    }
+
+    cs_pipeline_config pipeline_cfg = {
+        .width = config.width,
+        .height = config.height,
+        .atlas_cols = atlas_cols,
+        .atlas_rows = atlas_rows,
+        .fps = config.fps,
+        .bitrate_kbps = config.bitrate_kbps,
+        .encoder = config.encoder,
+        .encoder_preset = config.encoder_preset,
+        .peer_pool = config.peer_pool,
+        .dtls_pem = config.dtls_pem,
+        .rtp_port_min = config.rtp_port_min,
+        .rtp_port_max = config.rtp_port_max,
+        .ice_tcp = config.ice_tcp,
+        .roi_delta_qp = config.roi_delta_qp,
+        .recorder = recorder,
+        .loop = loop,
+        .user = &app,
+        .on_local_sdp = on_local_sdp,
+        .on_local_ice = on_local_ice,
+        .on_ice_gathering_done = on_ice_gathering_done,
+        .on_peer_failed = on_peer_failed,
+        .on_data_message = on_data_message,
+        .on_view_encoded = on_view_encoded,
+        .on_view_unit = on_view_unit
+    };
+    cs_pipeline *pipeline = cs_pipeline_create(&pipeline_cfg);
+    if (!pipeline) {
+        fprintf(stderr, "Pipeline init failed\n");
+        cs_recorder_destroy(recorder);
+        cs_signaling_destroy(signaling);
+        cs_hls_destroy(hls);
+        free(app.viewers);
+        cs_view_set_destroy(app.views);
+        cs_render_process_destroy(render_process);
+        cs_frame_ring_destroy(ring);
         cs_render_destroy(renderer);
+        cs_event_loop_destroy(loop);
         return 1;
     }
+    startup_mark(&startup, "pipeline");
 
     app.pipeline = pipeline;
     app.signaling = signaling;
+    app.hls = hls;
+    if (hls) {
+        int view = cs_view_set_add_peer(app.views, CS_HLS_PEER_ID);
+        cs_pipeline_watch_view(pipeline, view, 1);
+        cs_pipeline_request_keyframe(pipeline, view);
+        fprintf(stderr, "LL-HLS on /hls/live.m3u8\n");
+    }
+
+    const size_t frame_size = (size_t)atlas_width * (size_t)atlas_height * 4;
+    uint8_t *frame = NULL;
+    cs_render_view *active_views = NULL;
+    cs_pipeline_region *regions = NULL;
+    if (renderer) {
+        frame = (uint8_t *)malloc(frame_size);
+        active_views = (cs_render_view *)calloc((size_t)max_views, sizeof(cs_render_view));
+        regions = (cs_pipeline_region *)calloc((size_t)max_views, sizeof(cs_pipeline_region));
+        if (!frame || !active_views || !regions) {
+            fprintf(stderr, "Frame buffer alloc failed\n");
+            free(frame);
+            free(active_views);
+            free(regions);
+            cs_signaling_destroy(signaling);
+            cs_pipeline_destroy(pipeline);
+            cs_recorder_destroy(recorder);
+            cs_hls_destroy(hls);
+            free(app.viewers);
+            cs_view_set_destroy(app.views);
+            cs_render_destroy(renderer);
+            cs_event_loop_destroy(loop);
+            return 1;
+        }
+    }
 
-    const size_t frame_size = (size_t)config.width * (size_t)config.height * 4;
-    uint8_t *frame = (uint8_t *)malloc(frame_size);
-    if (!frame) {
-        fprintf(stderr, "Frame buffer alloc failed\n");
+    cs_load_monitor *load = cs_load_monitor_create(config.fps);
+
+    app.load = load;
+    app.ring = ring;
+    app.renderer = renderer;
+    app.regions = regions;
+    const int pooled = cs_render_threads(renderer) > 1;
+    if ((ring && cs_event_loop_add(loop, cs_frame_ring_notify_fd(ring), POLLIN, on_ring_ready, &app) != 0) ||
+        (pooled && cs_event_loop_add(loop, cs_render_fd(renderer), POLLIN, on_render_ready, &app) != 0)) {
+        fprintf(stderr, "Frame source registration failed\n");
+        cs_load_monitor_destroy(load);
+        cs_render_process_destroy(render_process);
         cs_signaling_destroy(signaling);
         cs_pipeline_destroy(pipeline);
+        cs_recorder_destroy(recorder);
+        cs_hls_destroy(hls);
+        free(app.viewers);
+        cs_view_set_destroy(app.views);
+        free(regions);
+        free(active_views);
+        free(frame);
+        cs_frame_ring_destroy(ring);
         cs_render_destroy(renderer);
+        cs_event_loop_destroy(loop);
         return 1;
     }
 
+    startup_mark(&startup, "setup");
+    startup_log(&startup);
+
+    signal(SIGUSR2, on_trace_signal);
+
     const uint64_t frame_ns = (uint64_t)(1000000000.0 / config.fps);
+    // Timers only; sockets, the bus and new frames wake the loop directly.
+    const uint64_t housekeeping_ns = ring ? 250000000ull : 1000000000ull;
+    const uint64_t report_ns = 1000000000ull;
     uint64_t next_tick = monotonic_ns();
+    uint64_t next_housekeeping = next_tick + housekeeping_ns;
+    uint64_t next_report = next_tick + report_ns;
+    uint64_t next_latency_log = next_tick + CS_LATENCY_LOG_NS;
 
     while (1) {
+        if (trace_requested) {
+            trace_requested = 0;
+            if (start_trace(&app, 0) != 0) {
+                fprintf(stderr, "Trace: a capture is already running\n");
+            }
+        }
+        if (cs_trace_poll()) {
+            cs_pipeline_trace(pipeline, 0);
+        }
+
         uint64_t now = monotonic_ns();
-        if (now < next_tick) {
-            struct timespec sleep_ts = { .tv_sec = 0, .tv_nsec = (long)(next_tick - now) };
-            nanosleep(&sleep_ts, NULL);
-            continue;
+        uint64_t deadline = next_housekeeping;
+
+        if (renderer) {
+            // Every distinct camera is drawn into its atlas tile in one pass
+            // and read back once; without viewers the loop only sleeps.
+            int view_count = cs_view_set_active(app.views, active_views, max_views);
+            if (view_count == 0) {
+                next_tick = now;
+            } else {
+                if (now >= next_tick && pooled) {
+                    // Pushed from on_render_ready. With every worker busy
+                    // the tick is dropped, as a slow frame would drop it.
+                    uint64_t trace_frame = cs_trace_begin();
+                    cs_render_submit(renderer, active_views, view_count, now);
+                    cs_trace_end(trace_frame, "frame", "frame", (int64_t)app.frame_index);
+                    next_tick += frame_ns;
+                    if (next_tick < now) {
+                        next_tick = now + frame_ns;
+                    }
+                } else if (now >= next_tick) {
+                    uint64_t trace_frame = cs_trace_begin();
+                    if (cs_render_frame_views(renderer, active_views, view_count, frame, frame_size) == 0) {
+                        for (int i = 0; i < view_count; ++i) {
+                            regions[i].view = active_views[i].tile;
+                            regions[i].x = active_views[i].roi.x;
+                            regions[i].y = active_views[i].roi.y;
+                            regions[i].width = active_views[i].roi.width;
+                            regions[i].height = active_views[i].roi.height;
+                        }
+                        uint64_t trace_push = cs_trace_begin();
+                        if (cs_pipeline_push_frame(pipeline, frame, frame_size, now, regions, view_count) == 0) {
+                            track_inputs(&app, ++app.frame_index, now);
+                        }
+                        cs_trace_end(trace_push, "push", "frame", (int64_t)app.frame_index);
+                    }
+                    cs_trace_end(trace_frame, "frame", "frame", (int64_t)app.frame_index);
+                    uint64_t done = monotonic_ns();
+                    cs_load_monitor_frame(load, done - now);
+                    next_tick += frame_ns;
+                    // Skip ticks missed by a slow frame instead of bursting.
+                    if (next_tick < done) {
+                        next_tick = done + frame_ns;
+                    }
+                    now = done;
+                }
+                if (next_tick < deadline) {
+                    deadline = next_tick;
+                }
+            }
         }
 
-        if (cs_render_frame(renderer, frame, frame_size) == 0) {
-            cs_pipeline_push_frame(pipeline, frame, frame_size, now);
+        if (now >= next_housekeeping) {
+            cs_render_process_check(render_process);
+            cs_signaling_poll(signaling);
+            next_housekeeping = now + housekeeping_ns;
+
+            if (config.router_host[0] && now >= next_report) {
+                cs_load_report report = { 0 };
+                cs_load_monitor_sample(load, &report);
+                report.peers = cs_signaling_peer_count(signaling);
+                report.capacity = app.max_viewers;
+                cs_signaling_report_load(signaling, &report);
+                next_report = now + report_ns;
+            }
+
+            if (now >= next_latency_log) {
+                log_latency(&app);
+                next_latency_log = now + CS_LATENCY_LOG_NS;
+            }
+            if (next_housekeeping < deadline) {
+                deadline = next_housekeeping;
+            }
         }
 
-        cs_signaling_poll(signaling);
-        next_tick += frame_ns;
+        int timeout_ms = deadline > now ? (int)((deadline - now + 999999ull) / 1000000ull) : 0;
+        int lws_ms = cs_signaling_timeout_ms(signaling, timeout_ms);
+        if (lws_ms < timeout_ms) {
+            // lws has timer work due sooner than ours.
+            timeout_ms = lws_ms;
+            next_housekeeping = now + (uint64_t)lws_ms * 1000000ull;
+        }
+        // Pacing: everything between frames, including socket and bus work.
+        uint64_t trace_wait = cs_trace_begin();
+        cs_event_loop_run_once(loop, timeout_ms);
+        cs_trace_end(trace_wait, "pace", NULL, 0);
     }
 
+    cs_load_monitor_destroy(load);
+    cs_render_process_destroy(render_process);
+    free(regions);
+    free(active_views);
     free(frame);
     cs_signaling_destroy(signaling);
+    // Buffers in flight reference ring memory, so the pipeline goes first.
     cs_pipeline_destroy(pipeline);
+    cs_recorder_destroy(recorder);
+    cs_trace_shutdown();
+    cs_hls_destroy(hls);
+    free(app.viewers);
+    cs_view_set_destroy(app.views);
+    cs_frame_ring_destroy(ring);
     cs_render_destroy(renderer);
+    cs_event_loop_destroy(loop);
     return 0;
 }
@@ -0,0 +1,66 @@
+#include "mat4.h"
+
+#include <math.h>
+
+mat4 mat4_identity(void) {
+    mat4 out = { {1, 0, 0, 0,
+                 0, 1, 0, 0,
+                 0, 0, 1, 0,
+                 0, 0, 0, 1} };
+    return out;
+}
+
+mat4 mat4_mul(mat4 a, mat4 b) {
+    mat4 out = { {0} };
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            out.m[col * 4 + row] =
+                a.m[0 * 4 + row] * b.m[col * 4 + 0] +
+                a.m[1 * 4 + row] * b.m[col * 4 + 1] +
+                a.m[2 * 4 + row] * b.m[col * 4 + 2] +
+                a.m[3 * 4 + row] * b.m[col * 4 + 3];
+        }
+    }
+    return out;
+}
+
+mat4 mat4_translate(float x, float y, float z) {
+    mat4 out = mat4_identity();
+    out.m[12] = x;
+    out.m[13] = y;
+    out.m[14] = z;
+    return out;
+}
+
+mat4 mat4_rotate_y(float r) {
+    mat4 out = mat4_identity();
+    float c = cosf(r);
+    float s = sinf(r);
+    out.m[0] = c;
+    out.m[2] = -s;
+    out.m[8] = s;
+    out.m[10] = c;
+    return out;
+}
+
+mat4 mat4_rotate_x(float r) {
+    mat4 out = mat4_identity();
+    float c = cosf(r);
+    float s = sinf(r);
+    out.m[5] = c;
+    out.m[6] = s;
+    out.m[9] = -s;
+    out.m[10] = c;
+    return out;
+}
+
+mat4 mat4_perspective(float fovy_rad, float aspect, float z_near, float z_far) {
+    float f = 1.0f / tanf(fovy_rad * 0.5f);
+    mat4 out = { {0} };
+    out.m[0] = f / aspect;
+    out.m[5] = f;
+    out.m[10] = (z_far + z_near) / (z_near - z_far);
+    out.m[11] = -1.0f;
+    out.m[14] = (2.0f * z_far * z_near) / (z_near - z_far);
+    return out;
+}
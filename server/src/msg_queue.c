@@ -0,0 +1,89 @@
+#include "msg_queue.h"
+
+#include <libwebsockets.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct cs_msg {
+    cs_msg *next;
+    size_t len;
+    unsigned char buf[];
+};
+
+int cs_msg_queue_push(cs_msg_queue *queue, const char *data, size_t len) {
+    if (!queue || !data) {
+        return -1;
+    }
+
+    cs_msg *msg = (cs_msg *)malloc(sizeof(cs_msg) + LWS_PRE + len + 1);
+    if (!msg) {
+        return -1;
+    }
+    msg->next = NULL;
+    msg->len = len;
+    memcpy(msg->buf + LWS_PRE, data, len);
+    msg->buf[LWS_PRE + len] = '\0';
+
+    if (queue->tail) {
+        queue->tail->next = msg;
+    } else {
+        queue->head = msg;
+    }
+    queue->tail = msg;
+    queue->count++;
+    return 0;
+}
+
+int cs_msg_queue_push_str(cs_msg_queue *queue, const char *text) {
+    if (!text) {
+        return -1;
+    }
+    return cs_msg_queue_push(queue, text, strlen(text));
+}
+
+unsigned char *cs_msg_queue_peek(cs_msg_queue *queue, size_t *len) {
+    if (!queue || !queue->head) {
+        return NULL;
+    }
+    if (len) {
+        *len = queue->head->len;
+    }
+    return queue->head->buf + LWS_PRE;
+}
+
+void cs_msg_queue_pop(cs_msg_queue *queue) {
+    if (!queue || !queue->head) {
+        return;
+    }
+    cs_msg *msg = queue->head;
+    queue->head = msg->next;
+    if (!queue->head) {
+        queue->tail = NULL;
+    }
+    queue->count--;
+    free(msg);
+}
+
+void cs_msg_queue_clear(cs_msg_queue *queue) {
+    while (queue && queue->head) {
+        cs_msg_queue_pop(queue);
+    }
+}
+
+int cs_msg_assembler_append(cs_msg_assembler *assembler, struct lws *wsi, const void *in, size_t len) {
+    char *grown = (char *)realloc(assembler->buf, assembler->len + len + 1);
+    if (!grown) {
+        return -1;
+    }
+    memcpy(grown + assembler->len, in, len);
+    assembler->len += len;
+    grown[assembler->len] = '\0';
+    assembler->buf = grown;
+    return lws_is_final_fragment(wsi) && lws_remaining_packet_payload(wsi) == 0 ? 1 : 0;
+}
+
+void cs_msg_assembler_reset(cs_msg_assembler *assembler) {
+    free(assembler->buf);
+    assembler->buf = NULL;
+    assembler->len = 0;
+}
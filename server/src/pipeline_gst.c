@@ -1,19 +1,175 @@
 #include "pipeline.h"
+#include "trace.h"
 
 #include <gst/gst.h>
+#include <gst/app/gstappsink.h>
 #include <gst/app/gstappsrc.h>
 #include <gst/sdp/sdp.h>
+#include <gst/video/video.h>
 #include <gst/webrtc/webrtc.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Layout:
+//   appsrc (atlas) -> videoconvert -> I420 -> tee
+//     per view: queue (leaky) -> valve -> videocrop -> x264enc -> tee
+//       per peer: queue -> rtph264pay -> webrtcbin
+//       (pooled peers are built and PLAYING but linked to no view)
+//       stream: queue -> valve -> h264parse -> appsink (WebSocket viewers)
+//       record: queue (leaky) -> h264parse -> mpegtsmux -> appsink (recorder)
+// A view's valve is closed while no peer watches it, so idle views cost
+// nothing beyond the shared conversion.
+
+typedef enum {
+    CS_EVENT_LOCAL_ICE,
+    CS_EVENT_GATHERING_DONE,
+    CS_EVENT_ICE_FAILED,
+    CS_EVENT_DATA,
+    CS_EVENT_VIEW_ENCODED,
+    CS_EVENT_UNIT,
+    CS_EVENT_RECORD_GAP
+} cs_pipeline_event_type;
+
+typedef struct cs_pipeline_event {
+    struct cs_pipeline_event *next;
+    cs_pipeline_event_type type;
+    int id;
+    int mline;
+    uint64_t tag;
+    char *text;
+    GstBuffer *buffer;
+} cs_pipeline_event;
+
+// Regions of recent frames, matched to encoder input by PTS.
+#define CS_ROI_PENDING 8
+
+typedef struct {
+    GstClockTime pts;
+    int x;
+    int y;
+    int width;
+    int height;
+} cs_pipeline_roi;
+
+// Times one element for trace captures: in at its sink pad, out at the
+// first src buffer carrying the same PTS. The probes exist only while a
+// capture runs.
+typedef struct {
+    const char *name;
+    const char *arg_name;
+    int id;
+    GstPad *sink;
+    GstPad *src;
+    gulong sink_probe;
+    gulong src_probe;
+    GstClockTime pts;
+    uint64_t in_ns;
+} cs_pipeline_span;
+
+typedef struct {
+    cs_pipeline *pipeline;
+    int index;
+    GstElement *queue;
+    GstElement *valve;
+    GstElement *crop;
+    GstElement *encoder;
+    GstElement *tee;
+    int peers;
+    // Access units for WebSocket viewers; the valve is open while any watch.
+    GstElement *stream_queue;
+    GstElement *stream_valve;
+    GstElement *stream_parse;
+    GstElement *stream_sink;
+    int stream_viewers;
+    // Set until the pre-roll frame leaves the encoder; guarded by
+    // cs_pipeline.lock like peers.
+    int prerolling;
+    // Optional recording; the leaky queue keeps a stalled writer from ever
+    // blocking the encoder tee.
+    GstElement *record_queue;
+    GstElement *record_parse;
+    GstElement *record_mux;
+    GstElement *record_sink;
+    // Set when the record queue drops units; delta units leaving it are
+    // dropped too until the next keyframe, which the overrun requests.
+    gint record_resync;
+    // Guarded by cs_pipeline.lock; written on the main thread, read by the
+    // encoder src probe.
+    int tracking;
+    GstClockTime track_pts;
+    uint64_t track_tag;
+    cs_pipeline_roi roi[CS_ROI_PENDING];
+    int roi_next;
+    cs_pipeline_span encode_span;
+} cs_pipeline_view;
+
+typedef struct cs_pipeline_peer {
+    struct cs_pipeline_peer *next;
+    cs_pipeline *pipeline;
+    int peer_id;
+    // View the branch is linked to; only the relink probe writes it while
+    // relinking is set.
+    int view;
+    int next_view;
+    int target_view;
+    int removing;
+    gint relinking;
+    gint detached;
+    GstElement *queue;
+    GstElement *pay;
+    GstElement *webrtcbin;
+    GstPad *tee_pad;
+    // Request pad on webrtcbin, released before the peer's elements go.
+    GstPad *webrtc_sink;
+    GstWebRTCDataChannel *channel;
+    cs_pipeline_span payload_span;
+} cs_pipeline_peer;
 
 struct cs_pipeline {
     GstElement *pipeline;
     GstElement *appsrc;
-    GstElement *webrtcbin;
+    GstElement *tee;
     cs_pipeline_config cfg;
+    int view_count;
+    cs_pipeline_view *views;
+    cs_pipeline_peer *peers;
+    GstClockTime last_pts;
+    GstBus *bus;
+    int bus_fd;
+    uint64_t next_qos_log_ns;
+    guint64 qos_dropped;
+    GMutex lock;
+    cs_pipeline_event *events_head;
+    cs_pipeline_event *events_tail;
+    // Wakes the event loop when a streaming thread queues work.
+    int wake_fd;
+    // A trace capture is running; new peers get their spans attached.
+    int tracing;
+    // Peer branches built ahead of joins; the serial only names them.
+    cs_pipeline_peer *pool;
+    int pooled;
+    int pool_serial;
+    // Certificate every peer's DTLS decoder gets, and an idle decoder that
+    // keeps the parsed agent cached so peers do not parse it again.
+    gchar *dtls_pem;
+    GstElement *dtls_keeper;
+    // Logged once when webrtcbin's ICE agent lacks the port range.
+    int port_range_warned;
 };
 
+static GThread *preload_thread;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 static GstWebRTCSDPType sdp_type_from_string(const char *type) {
     if (!type) {
         return GST_WEBRTC_SDP_TYPE_OFFER;
@@ -30,11 +186,883 @@ static GstWebRTCSDPType sdp_type_from_string(const char *type) {
     return GST_WEBRTC_SDP_TYPE_ROLLBACK;
 }
 
+static void wake(cs_pipeline *pipeline) {
+    if (pipeline->wake_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t ret = write(pipeline->wake_fd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+// Events raised on streaming threads are queued here and delivered from
+// cs_pipeline_poll so callbacks never race the signaling loop.
+static void queue_event_locked(cs_pipeline *pipeline, cs_pipeline_event *event) {
+    if (pipeline->events_tail) {
+        pipeline->events_tail->next = event;
+    } else {
+        pipeline->events_head = event;
+        wake(pipeline);
+    }
+    pipeline->events_tail = event;
+}
+
+static void post_event_locked(cs_pipeline *pipeline, cs_pipeline_event_type type, int id, int mline,
+                              uint64_t tag, const char *text) {
+    cs_pipeline_event *event = (cs_pipeline_event *)calloc(1, sizeof(cs_pipeline_event));
+    if (!event) {
+        return;
+    }
+    event->type = type;
+    event->id = id;
+    event->mline = mline;
+    event->tag = tag;
+    if (text) {
+        event->text = strdup(text);
+        if (!event->text) {
+            free(event);
+            return;
+        }
+    }
+    queue_event_locked(pipeline, event);
+}
+
+static void free_event(cs_pipeline_event *event) {
+    if (event->buffer) {
+        gst_buffer_unref(event->buffer);
+    }
+    free(event->text);
+    free(event);
+}
+
+static void post_event(cs_pipeline *pipeline, cs_pipeline_event_type type, int id, int mline,
+                       uint64_t tag, const char *text) {
+    g_mutex_lock(&pipeline->lock);
+    post_event_locked(pipeline, type, id, mline, tag, text);
+    g_mutex_unlock(&pipeline->lock);
+}
+
+// Hands each access unit to the main loop by reference; every WebSocket
+// viewer of the view then shares that one buffer.
+static GstFlowReturn on_stream_sample(GstAppSink *sink, gpointer user_data) {
+    cs_pipeline_view *view = (cs_pipeline_view *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    cs_pipeline_event *event = (cs_pipeline_event *)calloc(1, sizeof(cs_pipeline_event));
+    if (event) {
+        event->type = CS_EVENT_UNIT;
+        event->id = view->index;
+        event->buffer = gst_buffer_ref(gst_sample_get_buffer(sample));
+        g_mutex_lock(&view->pipeline->lock);
+        queue_event_locked(view->pipeline, event);
+        g_mutex_unlock(&view->pipeline->lock);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// Copies muxed packets into the recorder; it never waits on the disk, so the
+// queue thread is not held up either.
+static GstFlowReturn on_record_sample(GstAppSink *sink, gpointer user_data) {
+    cs_pipeline_view *view = (cs_pipeline_view *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        // mpegtsmux leaves the delta flag off the packets that start a
+        // keyframe, so files can begin there.
+        int keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        cs_recorder_write(view->pipeline->cfg.recorder, view->index, map.data, map.size, keyframe);
+        gst_buffer_unmap(buffer, &map);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// The leaky record queue is about to drop its oldest units. What is still
+// queued behind them references frames the file will never have, so the
+// record branch skips to the next keyframe and asks for one now.
+static void on_record_overrun(GstElement *queue, gpointer user_data) {
+    (void)queue;
+    cs_pipeline_view *view = (cs_pipeline_view *)user_data;
+    if (g_atomic_int_compare_and_exchange(&view->record_resync, 0, 1)) {
+        post_event(view->pipeline, CS_EVENT_RECORD_GAP, view->index, 0, 0, NULL);
+    }
+}
+
+static GstPadProbeReturn on_record_unit(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    cs_pipeline_view *view = (cs_pipeline_view *)user_data;
+    if (!g_atomic_int_get(&view->record_resync)) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT)) {
+        return GST_PAD_PROBE_DROP;
+    }
+    g_atomic_int_set(&view->record_resync, 0);
+    return GST_PAD_PROBE_OK;
+}
+
 static void on_ice_candidate(GstElement *webrtcbin, guint mlineindex, gchar *candidate, gpointer user_data) {
-    cs_pipeline *pipeline = (cs_pipeline *)user_data;
-    if (pipeline->cfg.on_local_ice) {
-        pipeline->cfg.on_local_ice(pipeline->cfg.user, candidate, (int)mlineindex, "0");
+    cs_pipeline_peer *peer = (cs_pipeline_peer *)user_data;
+    post_event(peer->pipeline, CS_EVENT_LOCAL_ICE, peer->peer_id, (int)mlineindex, 0, candidate);
+}
+
+static void on_gathering_state(GObject *webrtcbin, GParamSpec *pspec, gpointer user_data) {
+    (void)pspec;
+    cs_pipeline_peer *peer = (cs_pipeline_peer *)user_data;
+    GstWebRTCICEGatheringState state = GST_WEBRTC_ICE_GATHERING_STATE_NEW;
+    g_object_get(webrtcbin, "ice-gathering-state", &state, NULL);
+    if (state == GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE) {
+        post_event(peer->pipeline, CS_EVENT_GATHERING_DONE, peer->peer_id, 0, 0, NULL);
+    }
+}
+
+static void on_connection_state(GObject *webrtcbin, GParamSpec *pspec, gpointer user_data) {
+    (void)pspec;
+    cs_pipeline_peer *peer = (cs_pipeline_peer *)user_data;
+    GstWebRTCICEConnectionState state = GST_WEBRTC_ICE_CONNECTION_STATE_NEW;
+    g_object_get(webrtcbin, "ice-connection-state", &state, NULL);
+    if (state == GST_WEBRTC_ICE_CONNECTION_STATE_FAILED) {
+        post_event(peer->pipeline, CS_EVENT_ICE_FAILED, peer->peer_id, 0, 0, NULL);
+    }
+}
+
+// The DTLS decoder comes with the peer's transport, created inside
+// webrtcbin during the first offer or answer.
+static void on_deep_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+    cs_pipeline_peer *peer = (cs_pipeline_peer *)user_data;
+    GstElementFactory *factory = gst_element_get_factory(element);
+    if (factory && strcmp(GST_OBJECT_NAME(factory), "dtlsdec") == 0) {
+        g_object_set(G_OBJECT(element), "pem", peer->pipeline->dtls_pem, NULL);
+    }
+}
+
+static void on_data_string(GstWebRTCDataChannel *channel, gchar *message, gpointer user_data) {
+    cs_pipeline_peer *peer = (cs_pipeline_peer *)user_data;
+    if (message) {
+        post_event(peer->pipeline, CS_EVENT_DATA, peer->peer_id, 0, 0, message);
+    }
+}
+
+static GstPadProbeReturn on_encoded(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    cs_pipeline_view *view = (cs_pipeline_view *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    cs_pipeline *pipeline = view->pipeline;
+
+    g_mutex_lock(&pipeline->lock);
+    if (view->prerolling) {
+        // The pre-roll frame only warms the encoder up; nobody sees it.
+        view->prerolling = 0;
+        if (view->peers == 0) {
+            g_object_set(G_OBJECT(view->valve), "drop", TRUE, NULL);
+        }
+        g_mutex_unlock(&pipeline->lock);
+        return GST_PAD_PROBE_DROP;
+    }
+    if (view->tracking && GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)) &&
+        GST_BUFFER_PTS(buffer) >= view->track_pts) {
+        view->tracking = 0;
+        post_event_locked(pipeline, CS_EVENT_VIEW_ENCODED, view->index, 0, view->track_tag, NULL);
+    }
+    g_mutex_unlock(&pipeline->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+// Attaches the frame's region of interest right before the encoder, since
+// converters and croppers in between drop or misplace ROI metadata. The box
+// is widened to whole macroblocks.
+static GstPadProbeReturn on_encoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    cs_pipeline_view *view = (cs_pipeline_view *)user_data;
+    cs_pipeline *pipeline = view->pipeline;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    cs_pipeline_roi roi = { GST_CLOCK_TIME_NONE, 0, 0, 0, 0 };
+
+    g_mutex_lock(&pipeline->lock);
+    for (int i = 0; i < CS_ROI_PENDING; ++i) {
+        if (view->roi[i].pts == pts) {
+            roi = view->roi[i];
+            break;
+        }
+    }
+    g_mutex_unlock(&pipeline->lock);
+
+    if (!GST_CLOCK_TIME_IS_VALID(roi.pts) || roi.width <= 0 || roi.height <= 0) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    int x0 = roi.x & ~15;
+    int y0 = roi.y & ~15;
+    int x1 = (roi.x + roi.width + 15) & ~15;
+    int y1 = (roi.y + roi.height + 15) & ~15;
+    if (x1 > pipeline->cfg.width) {
+        x1 = pipeline->cfg.width;
+    }
+    if (y1 > pipeline->cfg.height) {
+        y1 = pipeline->cfg.height;
+    }
+
+    buffer = gst_buffer_make_writable(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    GstVideoRegionOfInterestMeta *meta = gst_buffer_add_video_region_of_interest_meta(
+        buffer, "cube", (guint)x0, (guint)y0, (guint)(x1 - x0), (guint)(y1 - y0));
+    if (meta) {
+        gst_video_region_of_interest_meta_add_param(
+            meta, gst_structure_new("roi/vaapi", "delta-qp", G_TYPE_INT, pipeline->cfg.roi_delta_qp, NULL));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void request_keyframe(cs_pipeline_view *view) {
+    GstPad *src = gst_element_get_static_pad(view->encoder, "src");
+    if (!src) {
+        return;
+    }
+    gst_pad_send_event(src, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+    gst_object_unref(src);
+}
+
+static void set_view_peers(cs_pipeline *pipeline, int index, int delta) {
+    cs_pipeline_view *view = &pipeline->views[index];
+    // Locked against the pre-roll probe, which closes the valve too.
+    g_mutex_lock(&pipeline->lock);
+    int was_active = view->peers > 0;
+    view->peers += delta;
+    int active = view->peers > 0;
+    if (active != was_active) {
+        g_object_set(G_OBJECT(view->valve), "drop", active ? FALSE : TRUE, NULL);
+        if (!active) {
+            // The pre-roll frame may never get through now; its probe must
+            // not eat a real frame later.
+            view->prerolling = 0;
+        }
+    }
+    g_mutex_unlock(&pipeline->lock);
+}
+
+static int link_peer(cs_pipeline_peer *peer, int index) {
+    cs_pipeline_view *view = &peer->pipeline->views[index];
+    GstPad *tee_pad = gst_element_get_request_pad(view->tee, "src_%u");
+    GstPad *queue_sink = gst_element_get_static_pad(peer->queue, "sink");
+    int ok = tee_pad && queue_sink && gst_pad_link(tee_pad, queue_sink) == GST_PAD_LINK_OK;
+    if (queue_sink) {
+        gst_object_unref(queue_sink);
+    }
+    if (!ok) {
+        if (tee_pad) {
+            gst_element_release_request_pad(view->tee, tee_pad);
+            gst_object_unref(tee_pad);
+        }
+        return -1;
+    }
+    peer->tee_pad = tee_pad;
+    peer->view = index;
+    // A joining decoder needs an IDR; the other viewers of the view pay for
+    // one extra keyframe.
+    request_keyframe(view);
+    return 0;
+}
+
+static void unlink_peer(cs_pipeline_peer *peer) {
+    if (!peer->tee_pad) {
+        return;
+    }
+    GstPad *queue_sink = gst_element_get_static_pad(peer->queue, "sink");
+    if (queue_sink) {
+        gst_pad_unlink(peer->tee_pad, queue_sink);
+        gst_object_unref(queue_sink);
+    }
+    gst_element_release_request_pad(peer->pipeline->views[peer->view].tee, peer->tee_pad);
+    gst_object_unref(peer->tee_pad);
+    peer->tee_pad = NULL;
+}
+
+// Runs once the peer's tee pad carries no data, on whichever thread saw it
+// idle. Moves the branch to next_view, or detaches it for removal.
+static GstPadProbeReturn on_peer_idle(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    cs_pipeline_peer *peer = (cs_pipeline_peer *)user_data;
+    // IDLE probes can fire from both the installing call and the streaming
+    // thread; only the first one acts.
+    if (!g_atomic_int_compare_and_exchange(&peer->relinking, 1, 2)) {
+        return GST_PAD_PROBE_REMOVE;
+    }
+
+    unlink_peer(peer);
+    if (g_atomic_int_get(&peer->removing)) {
+        g_atomic_int_set(&peer->detached, 1);
+    } else if (link_peer(peer, peer->next_view) != 0) {
+        fprintf(stderr, "Peer %d failed to join view %d\n", peer->peer_id, peer->next_view);
+        g_atomic_int_set(&peer->detached, 1);
+    }
+    g_atomic_int_set(&peer->relinking, 0);
+    // Reaping or a queued view change finishes in cs_pipeline_poll.
+    wake(peer->pipeline);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void start_relink(cs_pipeline_peer *peer) {
+    if (!peer->tee_pad) {
+        g_atomic_int_set(&peer->detached, 1);
+        return;
+    }
+    peer->next_view = peer->target_view;
+    g_atomic_int_set(&peer->relinking, 1);
+    // The probe may run (and release the pad) before add_probe returns.
+    GstPad *pad = (GstPad *)gst_object_ref(peer->tee_pad);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_IDLE, on_peer_idle, peer, NULL);
+    gst_object_unref(pad);
+}
+
+static cs_pipeline_peer *find_peer(cs_pipeline *pipeline, int peer_id) {
+    for (cs_pipeline_peer *peer = pipeline->peers; peer; peer = peer->next) {
+        if (peer->peer_id == peer_id && !peer->removing) {
+            return peer;
+        }
+    }
+    return NULL;
+}
+
+static GstClockTime probe_pts(GstPadProbeInfo *info) {
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        return gst_buffer_list_length(list) ? GST_BUFFER_PTS(gst_buffer_list_get(list, 0)) : GST_CLOCK_TIME_NONE;
+    }
+    return GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+}
+
+static GstPadProbeReturn on_span_in(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    cs_pipeline_span *span = (cs_pipeline_span *)user_data;
+    span->pts = probe_pts(info);
+    __atomic_store_n(&span->in_ns, cs_trace_now_ns(), __ATOMIC_RELEASE);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn on_span_out(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    cs_pipeline_span *span = (cs_pipeline_span *)user_data;
+    // Payloaders emit many packets per frame; only the first closes the span.
+    uint64_t in_ns = __atomic_exchange_n(&span->in_ns, 0, __ATOMIC_ACQ_REL);
+    if (in_ns && probe_pts(info) == span->pts) {
+        cs_trace_record(span->name, in_ns, cs_trace_now_ns(), span->arg_name, span->id, NULL);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void span_detach(cs_pipeline_span *span) {
+    if (span->sink) {
+        if (span->sink_probe) {
+            gst_pad_remove_probe(span->sink, span->sink_probe);
+        }
+        gst_object_unref(span->sink);
+    }
+    if (span->src) {
+        if (span->src_probe) {
+            gst_pad_remove_probe(span->src, span->src_probe);
+        }
+        gst_object_unref(span->src);
+    }
+    span->sink = NULL;
+    span->src = NULL;
+    span->sink_probe = 0;
+    span->src_probe = 0;
+}
+
+static void span_attach(cs_pipeline_span *span, GstElement *element) {
+    if (span->sink || !element) {
+        return;
+    }
+    span->sink = gst_element_get_static_pad(element, "sink");
+    span->src = gst_element_get_static_pad(element, "src");
+    if (!span->sink || !span->src) {
+        span_detach(span);
+        return;
+    }
+    span->in_ns = 0;
+    GstPadProbeType types = GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST;
+    span->sink_probe = gst_pad_add_probe(span->sink, types, on_span_in, span, NULL);
+    span->src_probe = gst_pad_add_probe(span->src, types, on_span_out, span, NULL);
+}
+
+// Lines of the GStreamer latency tracer, when GST_TRACERS enabled it, become
+// spans ending when they were logged. This is where time spent inside
+// webrtcbin (RTP session, SRTP, the ICE sink) shows up.
+static void on_gst_log(GstDebugCategory *category, GstDebugLevel level, const gchar *file, const gchar *function,
+                       gint line, GObject *object, GstDebugMessage *message, gpointer user_data) {
+    if (level != GST_LEVEL_TRACE || !__atomic_load_n(&cs_trace_active, __ATOMIC_RELAXED) ||
+        strcmp(gst_debug_category_get_name(category), "GST_TRACER") != 0) {
+        return;
+    }
+    const gchar *text = gst_debug_message_get(message);
+    GstStructure *record = text ? gst_structure_from_string(text, NULL) : NULL;
+    if (!record) {
+        return;
+    }
+    guint64 latency = 0;
+    const char *detail = NULL;
+    const char *name = NULL;
+    if (gst_structure_has_name(record, "element-latency")) {
+        name = "element-latency";
+        detail = gst_structure_get_string(record, "element");
+    } else if (gst_structure_has_name(record, "latency")) {
+        name = "pipeline-latency";
+        detail = gst_structure_get_string(record, "sink-element");
+    }
+    if (name && gst_structure_get_uint64(record, "time", &latency)) {
+        uint64_t now = cs_trace_now_ns();
+        cs_trace_record(name, now > latency ? now - latency : 0, now, NULL, 0, detail);
+    }
+    gst_structure_free(record);
+}
+
+static void trace_gst_log(int on) {
+    // The tracer only exists if GST_TRACERS named it before gst_init.
+    const char *tracers = getenv("GST_TRACERS");
+    if (!tracers || !strstr(tracers, "latency")) {
+        return;
+    }
+    // Without GST_DEBUG nobody asked for tracer lines on stderr.
+    const char *debug = getenv("GST_DEBUG");
+    int quiet = !debug || !debug[0];
+    if (on) {
+        gst_debug_set_threshold_for_name("GST_TRACER", GST_LEVEL_TRACE);
+        if (quiet) {
+            gst_debug_remove_log_function(gst_debug_log_default);
+        }
+        gst_debug_add_log_function(on_gst_log, NULL, NULL);
+    } else {
+        gst_debug_remove_log_function(on_gst_log);
+        if (quiet) {
+            gst_debug_unset_threshold_for_name("GST_TRACER");
+            gst_debug_add_log_function(gst_debug_log_default, NULL, NULL);
+        }
+    }
+}
+
+static void free_peer(cs_pipeline *pipeline, cs_pipeline_peer *peer) {
+    if (peer->channel) {
+        g_signal_handlers_disconnect_by_data(peer->channel, peer);
+        gst_object_unref(peer->channel);
+    }
+    if (peer->webrtcbin) {
+        g_signal_handlers_disconnect_by_data(peer->webrtcbin, peer);
+    }
+    GstElement *elements[] = { peer->webrtcbin, peer->pay, peer->queue };
+    for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); ++i) {
+        if (elements[i]) {
+            gst_element_set_state(elements[i], GST_STATE_NULL);
+        }
+    }
+    span_detach(&peer->payload_span);
+    // Released explicitly: webrtcbin ties a transceiver to each sink pad,
+    // and a soak run should see both go with the peer.
+    if (peer->webrtc_sink) {
+        gst_element_release_request_pad(peer->webrtcbin, peer->webrtc_sink);
+        gst_object_unref(peer->webrtc_sink);
+    }
+    for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); ++i) {
+        if (elements[i]) {
+            gst_bin_remove(GST_BIN(pipeline->pipeline), elements[i]);
+        }
+    }
+    free(peer);
+}
+
+static GstClockTime frame_running_time(cs_pipeline *pipeline, uint64_t capture_ns) {
+    GstClock *clock = gst_element_get_clock(pipeline->pipeline);
+    if (!clock) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    GstClockTime now = gst_clock_get_time(clock);
+    GstClockTime base = gst_element_get_base_time(pipeline->pipeline);
+    gst_object_unref(clock);
+    if (now < base) {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    // Back-date by the frame's age so PTS reflects render time rather than
+    // push time; trackers compare encoder output against it.
+    GstClockTime running = now - base;
+    uint64_t mono = monotonic_ns();
+    uint64_t age = mono > capture_ns ? mono - capture_ns : 0;
+    running = running > age ? running - age : 0;
+    if (GST_CLOCK_TIME_IS_VALID(pipeline->last_pts) && running <= pipeline->last_pts) {
+        running = pipeline->last_pts + 1;
+    }
+    pipeline->last_pts = running;
+    return running;
+}
+
+static int push_buffer(cs_pipeline *pipeline, GstBuffer *buffer, uint64_t pts_ns,
+                       const cs_pipeline_region *regions, int region_count) {
+    // Invalid timestamps (before PLAYING) fall back to appsrc do-timestamp.
+    GstClockTime pts = frame_running_time(pipeline, pts_ns);
+    if (pipeline->cfg.roi_delta_qp != 0 && regions && GST_CLOCK_TIME_IS_VALID(pts)) {
+        g_mutex_lock(&pipeline->lock);
+        for (int i = 0; i < region_count; ++i) {
+            if (regions[i].view < 0 || regions[i].view >= pipeline->view_count) {
+                continue;
+            }
+            cs_pipeline_view *view = &pipeline->views[regions[i].view];
+            cs_pipeline_roi *roi = &view->roi[view->roi_next];
+            view->roi_next = (view->roi_next + 1) % CS_ROI_PENDING;
+            roi->pts = pts;
+            roi->x = regions[i].x;
+            roi->y = regions[i].y;
+            roi->width = regions[i].width;
+            roi->height = regions[i].height;
+        }
+        g_mutex_unlock(&pipeline->lock);
+    }
+    GST_BUFFER_PTS(buffer) = pts;
+    GST_BUFFER_DTS(buffer) = pts;
+    GST_BUFFER_DURATION(buffer) = (GstClockTime)(GST_SECOND / pipeline->cfg.fps);
+
+    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(pipeline->appsrc), buffer);
+    return ret == GST_FLOW_OK ? 0 : -1;
+}
+
+static void drain_bus(cs_pipeline *pipeline) {
+    if (!pipeline->bus) {
+        return;
+    }
+
+    GstMessage *msg;
+    while ((msg = gst_bus_pop(pipeline->bus)) != NULL) {
+        switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_ERROR:
+        case GST_MESSAGE_WARNING: {
+            GError *err = NULL;
+            gchar *debug = NULL;
+            int is_error = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR;
+            if (is_error) {
+                gst_message_parse_error(msg, &err, &debug);
+            } else {
+                gst_message_parse_warning(msg, &err, &debug);
+            }
+            fprintf(stderr, "Pipeline %s from %s: %s%s%s\n", is_error ? "error" : "warning",
+                    GST_MESSAGE_SRC_NAME(msg), err ? err->message : "unknown",
+                    debug ? " | " : "", debug ? debug : "");
+            g_clear_error(&err);
+            g_free(debug);
+            break;
+        }
+        case GST_MESSAGE_QOS: {
+            GstFormat format;
+            guint64 processed = 0;
+            guint64 dropped = 0;
+            gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+            pipeline->qos_dropped += dropped;
+            uint64_t now = monotonic_ns();
+            if (now >= pipeline->next_qos_log_ns) {
+                fprintf(stderr, "Pipeline QoS from %s: %llu dropped since last report\n",
+                        GST_MESSAGE_SRC_NAME(msg), (unsigned long long)pipeline->qos_dropped);
+                pipeline->qos_dropped = 0;
+                pipeline->next_qos_log_ns = now + 5000000000ull;
+            }
+            break;
+        }
+        case GST_MESSAGE_LATENCY:
+            // Peers joining change the latency of the live branches.
+            gst_bin_recalculate_latency(GST_BIN(pipeline->pipeline));
+            break;
+        case GST_MESSAGE_STATE_CHANGED:
+            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline->pipeline)) {
+                GstState old_state;
+                GstState new_state;
+                gst_message_parse_state_changed(msg, &old_state, &new_state, NULL);
+                fprintf(stderr, "Pipeline %s -> %s\n",
+                        gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
+            }
+            break;
+        case GST_MESSAGE_EOS:
+            fprintf(stderr, "Pipeline reached end of stream\n");
+            break;
+        default:
+            break;
+        }
+        gst_message_unref(msg);
+    }
+}
+
+static void on_loop_ready(void *user, int fd, uint32_t events) {
+    cs_pipeline_poll((cs_pipeline *)user);
+}
+
+static int build_stream_branch(cs_pipeline_view *view) {
+    cs_pipeline *pipeline = view->pipeline;
+    char name[32];
+    snprintf(name, sizeof(name), "cs-view%d-stream-queue", view->index);
+    view->stream_queue = gst_element_factory_make("queue", name);
+    snprintf(name, sizeof(name), "cs-view%d-stream-valve", view->index);
+    view->stream_valve = gst_element_factory_make("valve", name);
+    snprintf(name, sizeof(name), "cs-view%d-stream-parse", view->index);
+    view->stream_parse = gst_element_factory_make("h264parse", name);
+    snprintf(name, sizeof(name), "cs-view%d-stream-sink", view->index);
+    view->stream_sink = gst_element_factory_make("appsink", name);
+    if (!view->stream_queue || !view->stream_valve || !view->stream_parse || !view->stream_sink) {
+        return -1;
+    }
+
+    // Viewers join mid-stream: SPS/PPS go out in front of every IDR.
+    g_object_set(G_OBJECT(view->stream_valve), "drop", TRUE, NULL);
+    g_object_set(G_OBJECT(view->stream_parse), "config-interval", -1, NULL);
+    GstCaps *caps = gst_caps_new_simple("video/x-h264",
+                                        "stream-format", G_TYPE_STRING, "byte-stream",
+                                        "alignment", G_TYPE_STRING, "au",
+                                        NULL);
+    g_object_set(G_OBJECT(view->stream_sink), "caps", caps, "sync", FALSE, "max-buffers", 1, NULL);
+    gst_caps_unref(caps);
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = on_stream_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(view->stream_sink), &callbacks, view, NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline->pipeline), view->stream_queue, view->stream_valve, view->stream_parse,
+                     view->stream_sink, NULL);
+    if (!gst_element_link_many(view->stream_queue, view->stream_valve, view->stream_parse, view->stream_sink, NULL)) {
+        return -1;
+    }
+
+    GstPad *tee_src = gst_element_get_request_pad(view->tee, "src_%u");
+    GstPad *queue_sink = gst_element_get_static_pad(view->stream_queue, "sink");
+    int ok = tee_src && queue_sink && gst_pad_link(tee_src, queue_sink) == GST_PAD_LINK_OK;
+    if (tee_src) {
+        gst_object_unref(tee_src);
+    }
+    if (queue_sink) {
+        gst_object_unref(queue_sink);
+    }
+    return ok ? 0 : -1;
+}
+
+static int build_record_branch(cs_pipeline_view *view) {
+    cs_pipeline *pipeline = view->pipeline;
+    char name[32];
+    snprintf(name, sizeof(name), "cs-view%d-record-queue", view->index);
+    view->record_queue = gst_element_factory_make("queue", name);
+    snprintf(name, sizeof(name), "cs-view%d-record-parse", view->index);
+    view->record_parse = gst_element_factory_make("h264parse", name);
+    snprintf(name, sizeof(name), "cs-view%d-record-mux", view->index);
+    view->record_mux = gst_element_factory_make("mpegtsmux", name);
+    snprintf(name, sizeof(name), "cs-view%d-record-sink", view->index);
+    view->record_sink = gst_element_factory_make("appsink", name);
+    if (!view->record_queue || !view->record_parse || !view->record_mux || !view->record_sink) {
+        return -1;
+    }
+
+    // Up to a second of backlog, then the oldest units go; the recording
+    // gets a gap rather than the live branches a stall, and resumes at a
+    // keyframe.
+    g_object_set(G_OBJECT(view->record_queue),
+                 "leaky", 2, /* downstream */
+                 "max-size-buffers", 0,
+                 "max-size-bytes", 0,
+                 "max-size-time", (guint64)GST_SECOND,
+                 NULL);
+    g_signal_connect(view->record_queue, "overrun", G_CALLBACK(on_record_overrun), view);
+    GstPad *queue_src = gst_element_get_static_pad(view->record_queue, "src");
+    if (!queue_src) {
+        return -1;
+    }
+    gst_pad_add_probe(queue_src, GST_PAD_PROBE_TYPE_BUFFER, on_record_unit, view, NULL);
+    gst_object_unref(queue_src);
+    // Files start at a keyframe, so every one needs SPS/PPS in front of it.
+    g_object_set(G_OBJECT(view->record_parse), "config-interval", -1, NULL);
+    // Seven packets per buffer instead of one keeps the callbacks down.
+    g_object_set(G_OBJECT(view->record_mux), "alignment", 7, NULL);
+    g_object_set(G_OBJECT(view->record_sink), "sync", FALSE, "async", FALSE, NULL);
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = on_record_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(view->record_sink), &callbacks, view, NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline->pipeline), view->record_queue, view->record_parse, view->record_mux,
+                     view->record_sink, NULL);
+    if (!gst_element_link_many(view->record_queue, view->record_parse, view->record_mux, view->record_sink, NULL)) {
+        return -1;
+    }
+
+    GstPad *tee_src = gst_element_get_request_pad(view->tee, "src_%u");
+    GstPad *queue_sink = gst_element_get_static_pad(view->record_queue, "sink");
+    int ok = tee_src && queue_sink && gst_pad_link(tee_src, queue_sink) == GST_PAD_LINK_OK;
+    if (tee_src) {
+        gst_object_unref(tee_src);
+    }
+    if (queue_sink) {
+        gst_object_unref(queue_sink);
+    }
+    return ok ? 0 : -1;
+}
+
+static void set_encoder_preset(GstElement *encoder, const char *preset) {
+    static const char *properties[] = { "speed-preset", "preset", "complexity", "quality-level" };
+    for (size_t i = 0; i < sizeof(properties) / sizeof(properties[0]); ++i) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), properties[i])) {
+            gst_util_set_object_arg(G_OBJECT(encoder), properties[i], preset);
+            return;
+        }
+    }
+    fprintf(stderr, "Encoder %s has no preset; ignoring encoder_preset %s\n",
+            GST_OBJECT_NAME(gst_element_get_factory(encoder)), preset);
+}
+
+static int build_view(cs_pipeline *pipeline, int index) {
+    cs_pipeline_view *view = &pipeline->views[index];
+    char name[32];
+    view->pipeline = pipeline;
+    view->index = index;
+    view->encode_span.name = "encode";
+    view->encode_span.arg_name = "view";
+    view->encode_span.id = index;
+
+    snprintf(name, sizeof(name), "cs-view%d-queue", index);
+    view->queue = gst_element_factory_make("queue", name);
+    snprintf(name, sizeof(name), "cs-view%d-valve", index);
+    view->valve = gst_element_factory_make("valve", name);
+    snprintf(name, sizeof(name), "cs-view%d-crop", index);
+    view->crop = gst_element_factory_make("videocrop", name);
+    snprintf(name, sizeof(name), "cs-view%d-x264enc", index);
+    const char *encoder = pipeline->cfg.encoder && pipeline->cfg.encoder[0] ? pipeline->cfg.encoder : "x264enc";
+    view->encoder = gst_element_factory_make(encoder, name);
+    snprintf(name, sizeof(name), "cs-view%d-tee", index);
+    view->tee = gst_element_factory_make("tee", name);
+    if (!view->queue || !view->valve || !view->crop || !view->encoder || !view->tee) {
+        return -1;
+    }
+
+    // Each view encodes on its own queue thread; a slow encoder drops its
+    // own stale frames instead of stalling the shared tee.
+    g_object_set(G_OBJECT(view->queue),
+                 "leaky", 2, /* downstream */
+                 "max-size-buffers", 1,
+                 "max-size-bytes", 0,
+                 "max-size-time", (guint64)0,
+                 NULL);
+    g_object_set(G_OBJECT(view->valve), "drop", TRUE, NULL);
+
+    int cols = pipeline->cfg.atlas_cols;
+    int rows = pipeline->cfg.atlas_rows;
+    int col = index % cols;
+    int row = index / cols;
+    g_object_set(G_OBJECT(view->crop),
+                 "left", col * pipeline->cfg.width,
+                 "right", (cols - col - 1) * pipeline->cfg.width,
+                 "top", row * pipeline->cfg.height,
+                 "bottom", (rows - row - 1) * pipeline->cfg.height,
+                 NULL);
+
+    if (strcmp(encoder, "x264enc") == 0) {
+        g_object_set(G_OBJECT(view->encoder),
+                     "tune", 0x00000004, /* zerolatency */
+                     "speed-preset", 1, /* ultrafast */
+                     "bitrate", pipeline->cfg.bitrate_kbps,
+                     NULL);
+    } else {
+        // Hardware encoders take kbit/s too; everything else stays default.
+        g_object_set(G_OBJECT(view->encoder), "bitrate", (guint)pipeline->cfg.bitrate_kbps, NULL);
+    }
+    if (pipeline->cfg.encoder_preset && pipeline->cfg.encoder_preset[0]) {
+        set_encoder_preset(view->encoder, pipeline->cfg.encoder_preset);
+    }
+    g_object_set(G_OBJECT(view->tee), "allow-not-linked", TRUE, NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline->pipeline), view->queue, view->valve, view->crop, view->encoder, view->tee, NULL);
+    if (!gst_element_link_many(view->queue, view->valve, view->crop, view->encoder, view->tee, NULL)) {
+        return -1;
+    }
+
+    GstPad *tee_src = gst_element_get_request_pad(pipeline->tee, "src_%u");
+    GstPad *queue_sink = gst_element_get_static_pad(view->queue, "sink");
+    int ok = tee_src && queue_sink && gst_pad_link(tee_src, queue_sink) == GST_PAD_LINK_OK;
+    if (tee_src) {
+        gst_object_unref(tee_src);
+    }
+    if (queue_sink) {
+        gst_object_unref(queue_sink);
+    }
+    if (!ok) {
+        return -1;
+    }
+
+    if (build_stream_branch(view) != 0) {
+        return -1;
+    }
+    if (pipeline->cfg.recorder && build_record_branch(view) != 0) {
+        return -1;
+    }
+
+    if (pipeline->cfg.roi_delta_qp != 0) {
+        GstPad *encoder_sink = gst_element_get_static_pad(view->encoder, "sink");
+        if (encoder_sink) {
+            gst_pad_add_probe(encoder_sink, GST_PAD_PROBE_TYPE_BUFFER, on_encoder_input, view, NULL);
+            gst_object_unref(encoder_sink);
+        }
+    }
+
+    GstPad *encoder_src = gst_element_get_static_pad(view->encoder, "src");
+    if (encoder_src) {
+        gst_pad_add_probe(encoder_src, GST_PAD_PROBE_TYPE_BUFFER, on_encoded, view, NULL);
+        gst_object_unref(encoder_src);
+    }
+    return 0;
+}
+
+static gpointer preload_main(gpointer user_data) {
+    char *encoder = (char *)user_data;
+    gst_init(NULL, NULL);
+    const char *elements[] = {
+        encoder, "appsrc", "videoconvert", "videocrop", "valve", "queue", "tee",
+        "h264parse", "appsink", "rtph264pay", "webrtcbin", "mpegtsmux"
+    };
+    for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); ++i) {
+        GstElementFactory *factory = gst_element_factory_find(elements[i]);
+        if (!factory) {
+            continue;
+        }
+        // Loading the feature dlopens its plugin and registers its types.
+        GstPluginFeature *loaded = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+        if (loaded) {
+            gst_object_unref(loaded);
+        }
+        gst_object_unref(factory);
+    }
+    // The first DTLS decoder generates the RSA key every later one shares
+    // (unless dtls_pem replaces it); that takes a while, so not on a join.
+    GstElement *dtls = gst_element_factory_make("dtlsdec", NULL);
+    if (dtls) {
+        gst_object_unref(dtls);
+    }
+    g_free(encoder);
+    return NULL;
+}
+
+void cs_pipeline_preload(const char *encoder) {
+    if (preload_thread) {
+        return;
+    }
+    preload_thread = g_thread_new("cs-preload", preload_main,
+                                  g_strdup(encoder && encoder[0] ? encoder : "x264enc"));
+}
+
+// Opens every valve for one black frame; on_encoded drops its output and
+// closes the valves of views nobody has joined yet.
+static void preroll(cs_pipeline *pipeline) {
+    size_t len = (size_t)pipeline->cfg.width * (size_t)pipeline->cfg.atlas_cols *
+                 (size_t)pipeline->cfg.height * (size_t)pipeline->cfg.atlas_rows * 4;
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, len, NULL);
+    if (!buffer) {
+        return;
+    }
+    gst_buffer_memset(buffer, 0, 0, len);
+
+    g_mutex_lock(&pipeline->lock);
+    for (int i = 0; i < pipeline->view_count; ++i) {
+        pipeline->views[i].prerolling = 1;
+        g_object_set(G_OBJECT(pipeline->views[i].valve), "drop", FALSE, NULL);
     }
+    g_mutex_unlock(&pipeline->lock);
+    push_buffer(pipeline, buffer, monotonic_ns(), NULL, 0);
 }
 
 cs_pipeline *cs_pipeline_create(const cs_pipeline_config *config) {
@@ -42,6 +1070,10 @@ cs_pipeline *cs_pipeline_create(const cs_pipeline_config *config) {
         return NULL;
     }
 
+    if (preload_thread) {
+        g_thread_join(preload_thread);
+        preload_thread = NULL;
+    }
     gst_init(NULL, NULL);
 
     cs_pipeline *pipeline = (cs_pipeline *)calloc(1, sizeof(cs_pipeline));
@@ -49,17 +1081,42 @@ cs_pipeline *cs_pipeline_create(const cs_pipeline_config *config) {
         return NULL;
     }
 
+    pipeline->bus_fd = -1;
+    pipeline->wake_fd = -1;
     pipeline->cfg = *config;
+    if (pipeline->cfg.atlas_cols < 1) {
+        pipeline->cfg.atlas_cols = 1;
+    }
+    if (pipeline->cfg.atlas_rows < 1) {
+        pipeline->cfg.atlas_rows = 1;
+    }
+    if (pipeline->cfg.rtp_port_min > 0 && pipeline->cfg.rtp_port_max < pipeline->cfg.rtp_port_min) {
+        pipeline->cfg.rtp_port_max = 65535;
+    }
+    // x264enc never reads ROI metadata; without this, every frame would pay
+    // for the lookup, a writable buffer and a meta nothing uses.
+    if (pipeline->cfg.roi_delta_qp != 0 &&
+        (!pipeline->cfg.encoder || !pipeline->cfg.encoder[0] || strcmp(pipeline->cfg.encoder, "x264enc") == 0)) {
+        fprintf(stderr, "roi_delta_qp=%d ignored: x264enc does not read ROI metadata\n", pipeline->cfg.roi_delta_qp);
+        pipeline->cfg.roi_delta_qp = 0;
+    }
+    pipeline->view_count = pipeline->cfg.atlas_cols * pipeline->cfg.atlas_rows;
+    pipeline->last_pts = GST_CLOCK_TIME_NONE;
+    g_mutex_init(&pipeline->lock);
+
+    pipeline->views = (cs_pipeline_view *)calloc((size_t)pipeline->view_count, sizeof(cs_pipeline_view));
+    if (!pipeline->views) {
+        cs_pipeline_destroy(pipeline);
+        return NULL;
+    }
 
     pipeline->pipeline = gst_pipeline_new("cs-pipeline");
     pipeline->appsrc = gst_element_factory_make("appsrc", "cs-appsrc");
     GstElement *videoconvert = gst_element_factory_make("videoconvert", "cs-videoconvert");
     GstElement *capsfilter = gst_element_factory_make("capsfilter", "cs-capsfilter");
-    GstElement *encoder = gst_element_factory_make("x264enc", "cs-x264enc");
-    GstElement *pay = gst_element_factory_make("rtph264pay", "cs-pay");
-    pipeline->webrtcbin = gst_element_factory_make("webrtcbin", "cs-webrtcbin");
+    pipeline->tee = gst_element_factory_make("tee", "cs-atlas-tee");
 
-    if (!pipeline->pipeline || !pipeline->appsrc || !videoconvert || !capsfilter || !encoder || !pay || !pipeline->webrtcbin) {
+    if (!pipeline->pipeline || !pipeline->appsrc || !videoconvert || !capsfilter || !pipeline->tee) {
         cs_pipeline_destroy(pipeline);
         return NULL;
     }
@@ -67,8 +1124,8 @@ cs_pipeline *cs_pipeline_create(const cs_pipeline_config *config) {
     GstCaps *app_caps = gst_caps_new_simple(
         "video/x-raw",
         "format", G_TYPE_STRING, "RGBA",
-        "width", G_TYPE_INT, pipeline->cfg.width,
-        "height", G_TYPE_INT, pipeline->cfg.height,
+        "width", G_TYPE_INT, pipeline->cfg.width * pipeline->cfg.atlas_cols,
+        "height", G_TYPE_INT, pipeline->cfg.height * pipeline->cfg.atlas_rows,
         "framerate", GST_TYPE_FRACTION, (int)(pipeline->cfg.fps + 0.5f), 1,
         NULL);
 
@@ -87,45 +1144,57 @@ cs_pipeline *cs_pipeline_create(const cs_pipeline_config *config) {
     g_object_set(G_OBJECT(capsfilter), "caps", i420_caps, NULL);
     gst_caps_unref(i420_caps);
 
-    g_object_set(G_OBJECT(encoder),
-                 "tune", 0x00000004, /* zerolatency */
-                 "speed-preset", 1, /* ultrafast */
-                 "bitrate", pipeline->cfg.bitrate_kbps,
-                 NULL);
-
-    g_object_set(G_OBJECT(pay), "config-interval", 1, "pt", 96, NULL);
-
-    const char *stun = getenv("CS_STUN_SERVER");
-    if (stun) {
-        g_object_set(G_OBJECT(pipeline->webrtcbin), "stun-server", stun, NULL);
-    }
-
-    gst_bin_add_many(GST_BIN(pipeline->pipeline),
-                     pipeline->appsrc, videoconvert, capsfilter, encoder, pay, pipeline->webrtcbin, NULL);
-
-    if (!gst_element_link_many(pipeline->appsrc, videoconvert, capsfilter, encoder, pay, NULL)) {
+    gst_bin_add_many(GST_BIN(pipeline->pipeline), pipeline->appsrc, videoconvert, capsfilter, pipeline->tee, NULL);
+    if (!gst_element_link_many(pipeline->appsrc, videoconvert, capsfilter, pipeline->tee, NULL)) {
         cs_pipeline_destroy(pipeline);
         return NULL;
     }
 
-    GstPad *pay_src = gst_element_get_static_pad(pay, "src");
-    GstPad *webrtc_sink = gst_element_get_request_pad(pipeline->webrtcbin, "sink_%u");
-    if (!pay_src || !webrtc_sink || gst_pad_link(pay_src, webrtc_sink) != GST_PAD_LINK_OK) {
-        if (pay_src) {
-            gst_object_unref(pay_src);
+    for (int i = 0; i < pipeline->view_count; ++i) {
+        if (build_view(pipeline, i) != 0) {
+            fprintf(stderr, "Pipeline view %d init failed\n", i);
+            cs_pipeline_destroy(pipeline);
+            return NULL;
         }
-        if (webrtc_sink) {
-            gst_object_unref(webrtc_sink);
+    }
+
+    if (pipeline->cfg.dtls_pem && pipeline->cfg.dtls_pem[0]) {
+        GError *error = NULL;
+        if (!g_file_get_contents(pipeline->cfg.dtls_pem, &pipeline->dtls_pem, NULL, &error) ||
+            !strstr(pipeline->dtls_pem, "-----BEGIN CERTIFICATE-----") ||
+            !strstr(pipeline->dtls_pem, "PRIVATE KEY-----")) {
+            fprintf(stderr, "DTLS certificate %s: %s\n", pipeline->cfg.dtls_pem,
+                    error ? error->message : "needs a certificate and its private key");
+            g_clear_error(&error);
+            cs_pipeline_destroy(pipeline);
+            return NULL;
         }
-        cs_pipeline_destroy(pipeline);
-        return NULL;
     }
-    gst_object_unref(pay_src);
-    gst_object_unref(webrtc_sink);
+    // Decoders share one agent per PEM only while some decoder holds it;
+    // this one does for the pipeline's lifetime.
+    pipeline->dtls_keeper = gst_element_factory_make("dtlsdec", "cs-dtls-keeper");
+    if (pipeline->dtls_keeper && pipeline->dtls_pem) {
+        g_object_set(G_OBJECT(pipeline->dtls_keeper), "pem", pipeline->dtls_pem, NULL);
+    }
 
-    g_signal_connect(pipeline->webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate), pipeline);
+    pipeline->bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline->pipeline));
+    if (pipeline->cfg.loop) {
+        GPollFD bus_poll;
+        gst_bus_get_pollfd(pipeline->bus, &bus_poll);
+        pipeline->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (pipeline->wake_fd < 0 ||
+            cs_event_loop_add(pipeline->cfg.loop, pipeline->wake_fd, POLLIN, on_loop_ready, pipeline) != 0 ||
+            cs_event_loop_add(pipeline->cfg.loop, bus_poll.fd, POLLIN, on_loop_ready, pipeline) != 0) {
+            cs_pipeline_destroy(pipeline);
+            return NULL;
+        }
+        pipeline->bus_fd = bus_poll.fd;
+    }
 
     gst_element_set_state(pipeline->pipeline, GST_STATE_PLAYING);
+    preroll(pipeline);
+    // The pool fills from the loop, after startup has finished.
+    wake(pipeline);
     return pipeline;
 }
 
@@ -134,15 +1203,73 @@ void cs_pipeline_destroy(cs_pipeline *pipeline) {
         return;
     }
 
+    if (pipeline->cfg.loop) {
+        if (pipeline->bus_fd >= 0) {
+            cs_event_loop_remove(pipeline->cfg.loop, pipeline->bus_fd);
+        }
+        if (pipeline->wake_fd >= 0) {
+            cs_event_loop_remove(pipeline->cfg.loop, pipeline->wake_fd);
+        }
+    }
+    if (pipeline->wake_fd >= 0) {
+        close(pipeline->wake_fd);
+    }
+
     if (pipeline->pipeline) {
         gst_element_set_state(pipeline->pipeline, GST_STATE_NULL);
+    }
+    if (pipeline->bus) {
+        gst_object_unref(pipeline->bus);
+    }
+
+    cs_pipeline_peer *lists[] = { pipeline->peers, pipeline->pool };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+        while (lists[i]) {
+            cs_pipeline_peer *next = lists[i]->next;
+            if (lists[i]->channel) {
+                gst_object_unref(lists[i]->channel);
+            }
+            if (lists[i]->tee_pad) {
+                gst_object_unref(lists[i]->tee_pad);
+            }
+            if (lists[i]->webrtc_sink) {
+                gst_object_unref(lists[i]->webrtc_sink);
+            }
+            span_detach(&lists[i]->payload_span);
+            free(lists[i]);
+            lists[i] = next;
+        }
+    }
+    pipeline->peers = NULL;
+    pipeline->pool = NULL;
+
+    for (int i = 0; i < pipeline->view_count; ++i) {
+        span_detach(&pipeline->views[i].encode_span);
+    }
+    if (pipeline->tracing) {
+        trace_gst_log(0);
+    }
+    if (pipeline->pipeline) {
         gst_object_unref(pipeline->pipeline);
     }
+    if (pipeline->dtls_keeper) {
+        gst_object_unref(pipeline->dtls_keeper);
+    }
+    g_free(pipeline->dtls_pem);
 
+    while (pipeline->events_head) {
+        cs_pipeline_event *next = pipeline->events_head->next;
+        free_event(pipeline->events_head);
+        pipeline->events_head = next;
+    }
+
+    g_mutex_clear(&pipeline->lock);
+    free(pipeline->views);
     free(pipeline);
 }
 
-int cs_pipeline_push_frame(cs_pipeline *pipeline, const uint8_t *rgba, size_t len, uint64_t pts_ns) {
+int cs_pipeline_push_frame(cs_pipeline *pipeline, const uint8_t *rgba, size_t len, uint64_t pts_ns,
+                           const cs_pipeline_region *regions, int region_count) {
     if (!pipeline || !rgba) {
         return -1;
     }
@@ -153,18 +1280,376 @@ int cs_pipeline_push_frame(cs_pipeline *pipeline, const uint8_t *rgba, size_t le
     }
 
     gst_buffer_fill(buffer, 0, rgba, len);
-    GST_BUFFER_PTS(buffer) = pts_ns;
-    GST_BUFFER_DTS(buffer) = pts_ns;
-    GST_BUFFER_DURATION(buffer) = (GstClockTime)(GST_SECOND / pipeline->cfg.fps);
+    return push_buffer(pipeline, buffer, pts_ns, regions, region_count);
+}
 
-    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(pipeline->appsrc), buffer);
-    return ret == GST_FLOW_OK ? 0 : -1;
+int cs_pipeline_push_wrapped(cs_pipeline *pipeline, uint8_t *rgba, size_t len, uint64_t pts_ns,
+                             const cs_pipeline_region *regions, int region_count,
+                             void (*release)(void *user), void *user) {
+    if (!pipeline || !rgba) {
+        return -1;
+    }
+
+    GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, rgba, len, 0, len, user, release);
+    if (!buffer) {
+        if (release) {
+            release(user);
+        }
+        return -1;
+    }
+
+    return push_buffer(pipeline, buffer, pts_ns, regions, region_count);
+}
+
+// Port range and ICE-TCP are properties of webrtcbin's ICE agent; the
+// range only exists from GStreamer 1.20 on.
+static void configure_ice(cs_pipeline *pipeline, GstElement *webrtcbin) {
+    GObject *ice = NULL;
+    g_object_get(G_OBJECT(webrtcbin), "ice-agent", &ice, NULL);
+    if (!ice) {
+        return;
+    }
+    GObjectClass *klass = G_OBJECT_GET_CLASS(ice);
+    if (pipeline->cfg.rtp_port_min > 0) {
+        if (g_object_class_find_property(klass, "min-rtp-port")) {
+            g_object_set(ice,
+                         "min-rtp-port", (guint)pipeline->cfg.rtp_port_min,
+                         "max-rtp-port", (guint)pipeline->cfg.rtp_port_max,
+                         NULL);
+        } else if (!pipeline->port_range_warned) {
+            fprintf(stderr, "RTP port range needs GStreamer 1.20; peers use ephemeral ports\n");
+            pipeline->port_range_warned = 1;
+        }
+    }
+    if (!pipeline->cfg.ice_tcp && g_object_class_find_property(klass, "ice-tcp")) {
+        g_object_set(ice, "ice-tcp", FALSE, NULL);
+    }
+    gst_object_unref(ice);
+}
+
+// Builds a peer branch up to a PLAYING webrtcbin with its data channel,
+// linked to no view yet. prefix and id only name the elements.
+static cs_pipeline_peer *build_peer(cs_pipeline *pipeline, const char *prefix, int id) {
+    cs_pipeline_peer *peer = (cs_pipeline_peer *)calloc(1, sizeof(cs_pipeline_peer));
+    if (!peer) {
+        return NULL;
+    }
+    peer->pipeline = pipeline;
+    peer->payload_span.name = "payload";
+    peer->payload_span.arg_name = "peer";
+
+    char name[32];
+    snprintf(name, sizeof(name), "cs-%s%d-queue", prefix, id);
+    peer->queue = gst_element_factory_make("queue", name);
+    snprintf(name, sizeof(name), "cs-%s%d-pay", prefix, id);
+    peer->pay = gst_element_factory_make("rtph264pay", name);
+    snprintf(name, sizeof(name), "cs-%s%d-webrtcbin", prefix, id);
+    peer->webrtcbin = gst_element_factory_make("webrtcbin", name);
+    if (!peer->queue || !peer->pay || !peer->webrtcbin) {
+        GstElement *elements[] = { peer->queue, peer->pay, peer->webrtcbin };
+        for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); ++i) {
+            if (elements[i]) {
+                gst_object_unref(elements[i]);
+            }
+        }
+        free(peer);
+        return NULL;
+    }
+
+    // Peers join mid-stream, so SPS/PPS go out with every IDR.
+    g_object_set(G_OBJECT(peer->pay), "config-interval", -1, "pt", 96, NULL);
+
+    const char *stun = getenv("CS_STUN_SERVER");
+    if (stun) {
+        g_object_set(G_OBJECT(peer->webrtcbin), "stun-server", stun, NULL);
+    }
+    // Video and the data channel share one ICE transport, so each peer
+    // holds one socket per interface rather than one per m-line.
+    g_object_set(G_OBJECT(peer->webrtcbin), "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+    configure_ice(pipeline, peer->webrtcbin);
+
+    gst_bin_add_many(GST_BIN(pipeline->pipeline), peer->queue, peer->pay, peer->webrtcbin, NULL);
+
+    GstPad *pay_src = gst_element_get_static_pad(peer->pay, "src");
+    peer->webrtc_sink = gst_element_get_request_pad(peer->webrtcbin, "sink_%u");
+    int ok = gst_element_link(peer->queue, peer->pay) &&
+             pay_src && peer->webrtc_sink && gst_pad_link(pay_src, peer->webrtc_sink) == GST_PAD_LINK_OK;
+    if (pay_src) {
+        gst_object_unref(pay_src);
+    }
+    if (!ok) {
+        // Nothing flows into an unlinked branch, so it can go right away.
+        free_peer(pipeline, peer);
+        return NULL;
+    }
+
+    g_signal_connect(peer->webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate), peer);
+    g_signal_connect(peer->webrtcbin, "notify::ice-gathering-state", G_CALLBACK(on_gathering_state), peer);
+    g_signal_connect(peer->webrtcbin, "notify::ice-connection-state", G_CALLBACK(on_connection_state), peer);
+    if (pipeline->dtls_pem) {
+        g_signal_connect(peer->webrtcbin, "deep-element-added", G_CALLBACK(on_deep_element_added), peer);
+    }
+
+    gst_element_sync_state_with_parent(peer->webrtcbin);
+    gst_element_sync_state_with_parent(peer->pay);
+    gst_element_sync_state_with_parent(peer->queue);
+
+    // Camera input wants the latest state, not every intermediate one.
+    GstStructure *options = gst_structure_new("cs-input",
+                                              "ordered", G_TYPE_BOOLEAN, FALSE,
+                                              "max-retransmits", G_TYPE_INT, 0,
+                                              NULL);
+    g_signal_emit_by_name(peer->webrtcbin, "create-data-channel", "input", options, &peer->channel);
+    gst_structure_free(options);
+    if (peer->channel) {
+        g_signal_connect(peer->channel, "on-message-string", G_CALLBACK(on_data_string), peer);
+    }
+    return peer;
+}
+
+// Keeps the pool at peer_pool branches. One per call, so joins arriving
+// while it refills are not held up behind a batch of webrtcbins.
+static void refill_pool(cs_pipeline *pipeline) {
+    if (pipeline->pooled >= pipeline->cfg.peer_pool) {
+        return;
+    }
+    cs_pipeline_peer *peer = build_peer(pipeline, "pool", ++pipeline->pool_serial);
+    if (!peer) {
+        // Retried on the next poll rather than spinning on a broken plugin.
+        return;
+    }
+    peer->next = pipeline->pool;
+    pipeline->pool = peer;
+    ++pipeline->pooled;
+    if (pipeline->pooled < pipeline->cfg.peer_pool) {
+        wake(pipeline);
+    }
+}
+
+int cs_pipeline_add_peer(cs_pipeline *pipeline, int peer_id, int view) {
+    if (!pipeline || view < 0 || view >= pipeline->view_count || find_peer(pipeline, peer_id)) {
+        return -1;
+    }
+
+    cs_pipeline_peer *peer = pipeline->pool;
+    if (peer) {
+        pipeline->pool = peer->next;
+        --pipeline->pooled;
+        // The refill runs from the loop once this join has been answered.
+        wake(pipeline);
+    } else {
+        peer = build_peer(pipeline, "peer", peer_id);
+        if (!peer) {
+            return -1;
+        }
+    }
+    // A pooled webrtcbin has not negotiated yet, so none of its signal
+    // handlers can be reading peer_id concurrently.
+    peer->peer_id = peer_id;
+    peer->payload_span.id = peer_id;
+    peer->view = view;
+    peer->target_view = view;
+    peer->next = pipeline->peers;
+    pipeline->peers = peer;
+
+    if (pipeline->tracing) {
+        span_attach(&peer->payload_span, peer->pay);
+    }
+    if (link_peer(peer, view) != 0) {
+        peer->removing = 1;
+        g_atomic_int_set(&peer->detached, 1);
+        return -1;
+    }
+    set_view_peers(pipeline, view, 1);
+    return 0;
+}
+
+int cs_pipeline_remove_peer(cs_pipeline *pipeline, int peer_id) {
+    if (!pipeline) {
+        return -1;
+    }
+    cs_pipeline_peer *peer = find_peer(pipeline, peer_id);
+    if (!peer) {
+        return -1;
+    }
+
+    set_view_peers(pipeline, peer->target_view, -1);
+    g_atomic_int_set(&peer->removing, 1);
+    // A relink already in flight detaches instead, or poll retries.
+    if (!g_atomic_int_get(&peer->relinking)) {
+        start_relink(peer);
+    }
+    return 0;
+}
+
+int cs_pipeline_set_peer_view(cs_pipeline *pipeline, int peer_id, int view) {
+    if (!pipeline || view < 0 || view >= pipeline->view_count) {
+        return -1;
+    }
+    cs_pipeline_peer *peer = find_peer(pipeline, peer_id);
+    if (!peer) {
+        return -1;
+    }
+    if (peer->target_view == view) {
+        return 0;
+    }
+
+    set_view_peers(pipeline, view, 1);
+    set_view_peers(pipeline, peer->target_view, -1);
+    peer->target_view = view;
+    // Otherwise cs_pipeline_poll retries once the current relink lands.
+    if (!g_atomic_int_get(&peer->relinking)) {
+        start_relink(peer);
+    }
+    return 0;
+}
+
+int cs_pipeline_send_data(cs_pipeline *pipeline, int peer_id, const char *message) {
+    if (!pipeline || !message) {
+        return -1;
+    }
+    cs_pipeline_peer *peer = find_peer(pipeline, peer_id);
+    if (!peer || !peer->channel) {
+        return -1;
+    }
+    gst_webrtc_data_channel_send_string(peer->channel, message);
+    return 0;
+}
+
+int cs_pipeline_watch_view(cs_pipeline *pipeline, int view, int delta) {
+    if (!pipeline || view < 0 || view >= pipeline->view_count) {
+        return -1;
+    }
+    cs_pipeline_view *target = &pipeline->views[view];
+    set_view_peers(pipeline, view, delta);
+    int was_active = target->stream_viewers > 0;
+    target->stream_viewers += delta;
+    int active = target->stream_viewers > 0;
+    if (active != was_active) {
+        g_object_set(G_OBJECT(target->stream_valve), "drop", active ? FALSE : TRUE, NULL);
+    }
+    return 0;
+}
+
+int cs_pipeline_request_keyframe(cs_pipeline *pipeline, int view) {
+    if (!pipeline || view < 0 || view >= pipeline->view_count) {
+        return -1;
+    }
+    request_keyframe(&pipeline->views[view]);
+    return 0;
+}
+
+int cs_pipeline_track_view(cs_pipeline *pipeline, int view, uint64_t tag) {
+    if (!pipeline || view < 0 || view >= pipeline->view_count ||
+        !GST_CLOCK_TIME_IS_VALID(pipeline->last_pts)) {
+        return -1;
+    }
+
+    g_mutex_lock(&pipeline->lock);
+    pipeline->views[view].tracking = 1;
+    pipeline->views[view].track_pts = pipeline->last_pts;
+    pipeline->views[view].track_tag = tag;
+    g_mutex_unlock(&pipeline->lock);
+    return 0;
+}
+
+void cs_pipeline_poll(cs_pipeline *pipeline) {
+    if (!pipeline) {
+        return;
+    }
+
+    if (pipeline->wake_fd >= 0) {
+        uint64_t count;
+        ssize_t ret = read(pipeline->wake_fd, &count, sizeof(count));
+        (void)ret;
+    }
+    drain_bus(pipeline);
+
+    cs_pipeline_peer **link = &pipeline->peers;
+    while (*link) {
+        cs_pipeline_peer *peer = *link;
+        if (g_atomic_int_get(&peer->detached)) {
+            *link = peer->next;
+            free_peer(pipeline, peer);
+            continue;
+        }
+        // Catches view changes and removals that arrived while a relink
+        // was already running.
+        if (!g_atomic_int_get(&peer->relinking) && (peer->removing || peer->view != peer->target_view)) {
+            start_relink(peer);
+        }
+        link = &peer->next;
+    }
+    refill_pool(pipeline);
+
+    g_mutex_lock(&pipeline->lock);
+    cs_pipeline_event *event = pipeline->events_head;
+    pipeline->events_head = NULL;
+    pipeline->events_tail = NULL;
+    g_mutex_unlock(&pipeline->lock);
+
+    while (event) {
+        cs_pipeline_event *next = event->next;
+        switch (event->type) {
+        case CS_EVENT_LOCAL_ICE:
+            if (pipeline->cfg.on_local_ice) {
+                pipeline->cfg.on_local_ice(pipeline->cfg.user, event->id, event->text, event->mline, NULL);
+            }
+            break;
+        case CS_EVENT_GATHERING_DONE:
+            if (pipeline->cfg.on_ice_gathering_done) {
+                pipeline->cfg.on_ice_gathering_done(pipeline->cfg.user, event->id);
+            }
+            break;
+        case CS_EVENT_ICE_FAILED:
+            if (pipeline->cfg.on_peer_failed) {
+                pipeline->cfg.on_peer_failed(pipeline->cfg.user, event->id);
+            }
+            break;
+        case CS_EVENT_DATA:
+            if (pipeline->cfg.on_data_message) {
+                pipeline->cfg.on_data_message(pipeline->cfg.user, event->id, event->text);
+            }
+            break;
+        case CS_EVENT_VIEW_ENCODED:
+            if (pipeline->cfg.on_view_encoded) {
+                pipeline->cfg.on_view_encoded(pipeline->cfg.user, event->id, event->tag);
+            }
+            break;
+        case CS_EVENT_UNIT: {
+            GstMapInfo map;
+            if (pipeline->cfg.on_view_unit && pipeline->views[event->id].stream_viewers > 0 &&
+                gst_buffer_map(event->buffer, &map, GST_MAP_READ)) {
+                cs_pipeline_unit unit = {
+                    .data = map.data,
+                    .len = map.size,
+                    .pts_us = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(event->buffer))
+                                  ? GST_BUFFER_PTS(event->buffer) / 1000
+                                  : 0,
+                    .keyframe = !GST_BUFFER_FLAG_IS_SET(event->buffer, GST_BUFFER_FLAG_DELTA_UNIT),
+                };
+                pipeline->cfg.on_view_unit(pipeline->cfg.user, event->id, &unit);
+                gst_buffer_unmap(event->buffer, &map);
+            }
+            break;
+        }
+        case CS_EVENT_RECORD_GAP:
+            request_keyframe(&pipeline->views[event->id]);
+            break;
+        }
+        free_event(event);
+        event = next;
+    }
 }
 
-int cs_pipeline_set_remote_description(cs_pipeline *pipeline, const char *sdp_type, const char *sdp) {
+int cs_pipeline_set_remote_description(cs_pipeline *pipeline, int peer_id, const char *sdp_type, const char *sdp) {
     if (!pipeline || !sdp) {
         return -1;
     }
+    cs_pipeline_peer *peer = find_peer(pipeline, peer_id);
+    if (!peer) {
+        return -1;
+    }
 
     GstSDPMessage *sdp_msg = NULL;
     gst_sdp_message_new(&sdp_msg);
@@ -174,32 +1659,42 @@ int cs_pipeline_set_remote_description(cs_pipeline *pipeline, const char *sdp_ty
     }
 
     GstWebRTCSessionDescription *desc = gst_webrtc_session_description_new(sdp_type_from_string(sdp_type), sdp_msg);
-    g_signal_emit_by_name(pipeline->webrtcbin, "set-remote-description", desc, NULL);
+    g_signal_emit_by_name(peer->webrtcbin, "set-remote-description", desc, NULL);
     gst_webrtc_session_description_free(desc);
     return 0;
 }
 
-char *cs_pipeline_create_offer(cs_pipeline *pipeline) {
+// Runs create-offer or create-answer, applies the result locally and hands
+// the SDP text to on_local_sdp.
+static char *create_local_description(cs_pipeline *pipeline, int peer_id, const char *type) {
     if (!pipeline) {
         return NULL;
     }
+    cs_pipeline_peer *peer = find_peer(pipeline, peer_id);
+    if (!peer) {
+        return NULL;
+    }
 
+    char signal[16];
+    snprintf(signal, sizeof(signal), "create-%s", type);
     GstPromise *promise = gst_promise_new();
-    g_signal_emit_by_name(pipeline->webrtcbin, "create-offer", NULL, promise);
+    g_signal_emit_by_name(peer->webrtcbin, signal, NULL, promise);
     gst_promise_wait(promise);
 
     const GstStructure *reply = gst_promise_get_reply(promise);
-    GstWebRTCSessionDescription *offer = NULL;
-    gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
+    GstWebRTCSessionDescription *desc = NULL;
+    if (reply) {
+        gst_structure_get(reply, type, GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &desc, NULL);
+    }
     gst_promise_unref(promise);
 
-    if (!offer) {
+    if (!desc) {
         return NULL;
     }
 
-    g_signal_emit_by_name(pipeline->webrtcbin, "set-local-description", offer, NULL);
-    char *sdp_text = gst_sdp_message_as_text(offer->sdp);
-    gst_webrtc_session_description_free(offer);
+    g_signal_emit_by_name(peer->webrtcbin, "set-local-description", desc, NULL);
+    char *sdp_text = gst_sdp_message_as_text(desc->sdp);
+    gst_webrtc_session_description_free(desc);
 
     if (!sdp_text) {
         return NULL;
@@ -209,18 +1704,91 @@ char *cs_pipeline_create_offer(cs_pipeline *pipeline) {
     g_free(sdp_text);
 
     if (pipeline->cfg.on_local_sdp && out) {
-        pipeline->cfg.on_local_sdp(pipeline->cfg.user, "offer", out);
+        pipeline->cfg.on_local_sdp(pipeline->cfg.user, peer_id, type, out);
     }
 
     return out;
 }
 
-int cs_pipeline_add_ice_candidate(cs_pipeline *pipeline, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
+char *cs_pipeline_create_offer(cs_pipeline *pipeline, int peer_id) {
+    return create_local_description(pipeline, peer_id, "offer");
+}
+
+char *cs_pipeline_create_answer(cs_pipeline *pipeline, int peer_id) {
+    return create_local_description(pipeline, peer_id, "answer");
+}
+
+int cs_pipeline_add_ice_candidate(cs_pipeline *pipeline, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
     (void)sdp_mid;
     if (!pipeline || !candidate) {
         return -1;
     }
+    cs_pipeline_peer *peer = find_peer(pipeline, peer_id);
+    if (!peer) {
+        return -1;
+    }
+
+    g_signal_emit_by_name(peer->webrtcbin, "add-ice-candidate", sdp_mline_index, candidate);
+    return 0;
+}
+
+int cs_pipeline_get_stats(cs_pipeline *pipeline, cs_pipeline_stats *stats) {
+    if (!pipeline || !stats) {
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    for (cs_pipeline_peer *peer = pipeline->peers; peer; peer = peer->next) {
+        ++stats->peers;
+    }
+    stats->pooled = pipeline->pooled;
 
-    g_signal_emit_by_name(pipeline->webrtcbin, "add-ice-candidate", sdp_mline_index, candidate);
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline->pipeline));
+    GValue item = G_VALUE_INIT;
+    int done = 0;
+    while (!done) {
+        switch (gst_iterator_next(it, &item)) {
+        case GST_ITERATOR_OK: {
+            GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+            ++stats->elements;
+            GST_OBJECT_LOCK(element);
+            stats->pads += (int)element->numpads;
+            GST_OBJECT_UNLOCK(element);
+            g_value_reset(&item);
+            break;
+        }
+        case GST_ITERATOR_RESYNC:
+            gst_iterator_resync(it);
+            stats->elements = 0;
+            stats->pads = 0;
+            break;
+        default:
+            done = 1;
+            break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
     return 0;
 }
+
+void cs_pipeline_trace(cs_pipeline *pipeline, int on) {
+    if (!pipeline || pipeline->tracing == !!on) {
+        return;
+    }
+    pipeline->tracing = !!on;
+    for (int i = 0; i < pipeline->view_count; ++i) {
+        if (on) {
+            span_attach(&pipeline->views[i].encode_span, pipeline->views[i].encoder);
+        } else {
+            span_detach(&pipeline->views[i].encode_span);
+        }
+    }
+    for (cs_pipeline_peer *peer = pipeline->peers; peer; peer = peer->next) {
+        if (on && !peer->removing) {
+            span_attach(&peer->payload_span, peer->pay);
+        } else if (!on) {
+            span_detach(&peer->payload_span);
+        }
+    }
+    trace_gst_log(on);
+}
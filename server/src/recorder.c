@@ -0,0 +1,481 @@
+#include "recorder.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CS_RECORDER_ALIGN 4096u
+#define CS_RECORDER_FLUSH_NS 1000000000ull
+#define CS_RECORDER_PATH 576
+
+typedef struct cs_record_buffer {
+    struct cs_record_buffer *next;
+    uint8_t *data;
+    size_t len;
+    int track;
+    // The writer opens a new file before writing this buffer.
+    int rotate;
+} cs_record_buffer;
+
+// A recording on disk, oldest first; the writer thread owns the list.
+typedef struct cs_record_file {
+    struct cs_record_file *next;
+    char path[CS_RECORDER_PATH];
+    uint64_t bytes;
+    int open;
+} cs_record_file;
+
+typedef struct {
+    // Guarded by cs_recorder.lock.
+    cs_record_buffer *current;
+    uint64_t filled_ns;
+    uint64_t segment_start_ns;
+    int resync;
+    int rotate_pending;
+    // Writer thread only.
+    int fd;
+    cs_record_file *file;
+} cs_record_track;
+
+struct cs_recorder {
+    cs_recorder_config cfg;
+    char dir[256];
+    size_t buffer_bytes;
+    cs_record_buffer *buffers;
+    cs_record_track *tracks;
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    cs_record_buffer *free_list;
+    int free_count;
+    cs_record_buffer *full_head;
+    cs_record_buffer *full_tail;
+    cs_recorder_stats stats;
+    cs_record_file *files;
+    uint64_t total_bytes;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void enqueue_locked(cs_recorder *recorder, cs_record_buffer *buffer) {
+    buffer->next = NULL;
+    if (recorder->full_tail) {
+        recorder->full_tail->next = buffer;
+    } else {
+        recorder->full_head = buffer;
+    }
+    recorder->full_tail = buffer;
+    pthread_cond_signal(&recorder->cond);
+}
+
+// Partly filled buffers go out after a while so a crash loses at most that
+// much of a slow stream.
+static void flush_idle_locked(cs_recorder *recorder, uint64_t now, int all) {
+    for (int i = 0; i < recorder->cfg.tracks; ++i) {
+        cs_record_track *track = &recorder->tracks[i];
+        if (track->current && track->current->len > 0 &&
+            (all || now - track->filled_ns >= CS_RECORDER_FLUSH_NS)) {
+            enqueue_locked(recorder, track->current);
+            track->current = NULL;
+        }
+    }
+}
+
+static void add_file(cs_recorder *recorder, cs_record_file *file) {
+    cs_record_file **link = &recorder->files;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = file;
+}
+
+static void enforce_retention(cs_recorder *recorder) {
+    if (recorder->cfg.max_bytes == 0) {
+        return;
+    }
+    cs_record_file **link = &recorder->files;
+    while (recorder->total_bytes > recorder->cfg.max_bytes && *link) {
+        cs_record_file *file = *link;
+        if (file->open) {
+            link = &file->next;
+            continue;
+        }
+        if (unlink(file->path) != 0 && errno != ENOENT) {
+            fprintf(stderr, "Recorder: cannot delete %s: %s\n", file->path, strerror(errno));
+        }
+        recorder->total_bytes -= file->bytes;
+        *link = file->next;
+        free(file);
+    }
+}
+
+static void close_track_file(cs_record_track *track) {
+    if (track->fd < 0) {
+        return;
+    }
+    // The file is finished; push it out and keep it from crowding the page
+    // cache.
+    fdatasync(track->fd);
+    posix_fadvise(track->fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(track->fd);
+    track->fd = -1;
+    if (track->file) {
+        track->file->open = 0;
+        track->file = NULL;
+    }
+}
+
+static void open_track_file(cs_recorder *recorder, int index) {
+    cs_record_track *track = &recorder->tracks[index];
+    close_track_file(track);
+
+    cs_record_file *file = (cs_record_file *)calloc(1, sizeof(cs_record_file));
+    if (!file) {
+        return;
+    }
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm);
+    snprintf(file->path, sizeof(file->path), "%s/view%d-%s.ts", recorder->dir, index, stamp);
+
+    track->fd = open(file->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (track->fd < 0) {
+        fprintf(stderr, "Recorder: cannot open %s: %s\n", file->path, strerror(errno));
+        free(file);
+        return;
+    }
+    file->open = 1;
+    track->file = file;
+    add_file(recorder, file);
+}
+
+static void write_buffer(cs_recorder *recorder, cs_record_buffer *buffer) {
+    cs_record_track *track = &recorder->tracks[buffer->track];
+    if (buffer->rotate) {
+        open_track_file(recorder, buffer->track);
+    }
+    if (track->fd < 0) {
+        // Lost with the file; the next rotation starts over.
+        pthread_mutex_lock(&recorder->lock);
+        recorder->stats.dropped_bytes += buffer->len;
+        pthread_mutex_unlock(&recorder->lock);
+        return;
+    }
+
+    size_t done = 0;
+    while (done < buffer->len) {
+        ssize_t ret = write(track->fd, buffer->data + done, buffer->len - done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            fprintf(stderr, "Recorder: write to %s failed: %s\n", track->file->path, strerror(errno));
+            close_track_file(track);
+            break;
+        }
+        done += (size_t)ret;
+    }
+
+    if (track->file) {
+        track->file->bytes += done;
+    }
+    recorder->total_bytes += done;
+    pthread_mutex_lock(&recorder->lock);
+    recorder->stats.written_bytes += done;
+    recorder->stats.dropped_bytes += buffer->len - done;
+    pthread_mutex_unlock(&recorder->lock);
+    enforce_retention(recorder);
+}
+
+static void *writer_main(void *user) {
+    cs_recorder *recorder = (cs_recorder *)user;
+    pthread_mutex_lock(&recorder->lock);
+    while (1) {
+        if (!recorder->full_head) {
+            if (recorder->stop) {
+                break;
+            }
+            struct timespec until;
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            until.tv_sec += 1;
+            pthread_cond_timedwait(&recorder->cond, &recorder->lock, &until);
+            flush_idle_locked(recorder, monotonic_ns(), recorder->stop);
+            continue;
+        }
+
+        cs_record_buffer *buffer = recorder->full_head;
+        recorder->full_head = buffer->next;
+        if (!recorder->full_head) {
+            recorder->full_tail = NULL;
+        }
+        pthread_mutex_unlock(&recorder->lock);
+
+        write_buffer(recorder, buffer);
+
+        pthread_mutex_lock(&recorder->lock);
+        buffer->len = 0;
+        buffer->rotate = 0;
+        buffer->next = recorder->free_list;
+        recorder->free_list = buffer;
+        ++recorder->free_count;
+    }
+    pthread_mutex_unlock(&recorder->lock);
+
+    for (int i = 0; i < recorder->cfg.tracks; ++i) {
+        close_track_file(&recorder->tracks[i]);
+    }
+    return NULL;
+}
+
+typedef struct {
+    time_t mtime;
+    cs_record_file *file;
+} cs_record_found;
+
+static int compare_mtime(const void *a, const void *b) {
+    const cs_record_found *fa = (const cs_record_found *)a;
+    const cs_record_found *fb = (const cs_record_found *)b;
+    return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+// Picks up recordings of earlier runs so the cap covers the whole directory.
+static void scan_existing(cs_recorder *recorder) {
+    DIR *dir = opendir(recorder->dir);
+    if (!dir) {
+        return;
+    }
+    cs_record_found *found = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int track = 0;
+        int end = 0;
+        size_t name_len = strlen(entry->d_name);
+        if (sscanf(entry->d_name, "view%d-%*[0-9TZ]%n", &track, &end) != 1 || end == 0 ||
+            name_len < 3 || strcmp(entry->d_name + name_len - 3, ".ts") != 0) {
+            continue;
+        }
+        cs_record_file *file = (cs_record_file *)calloc(1, sizeof(cs_record_file));
+        if (!file) {
+            break;
+        }
+        snprintf(file->path, sizeof(file->path), "%s/%s", recorder->dir, entry->d_name);
+        struct stat st;
+        if (stat(file->path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(file);
+            continue;
+        }
+        if (count == capacity) {
+            size_t next = capacity ? capacity * 2 : 32;
+            void *grown = realloc(found, next * sizeof(*found));
+            if (!grown) {
+                free(file);
+                break;
+            }
+            found = (cs_record_found *)grown;
+            capacity = next;
+        }
+        file->bytes = (uint64_t)st.st_size;
+        found[count].mtime = st.st_mtime;
+        found[count].file = file;
+        ++count;
+    }
+    closedir(dir);
+
+    if (count > 0) {
+        qsort(found, count, sizeof(*found), compare_mtime);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        add_file(recorder, found[i].file);
+        recorder->total_bytes += found[i].file->bytes;
+    }
+    free(found);
+}
+
+cs_recorder *cs_recorder_create(const cs_recorder_config *config) {
+    if (!config || !config->dir || !config->dir[0] || config->tracks <= 0) {
+        return NULL;
+    }
+
+    cs_recorder *recorder = (cs_recorder *)calloc(1, sizeof(cs_recorder));
+    if (!recorder) {
+        return NULL;
+    }
+    recorder->cfg = *config;
+    snprintf(recorder->dir, sizeof(recorder->dir), "%s", config->dir);
+    recorder->cfg.dir = recorder->dir;
+    if (recorder->cfg.segment_s <= 0) {
+        recorder->cfg.segment_s = 60;
+    }
+    if (recorder->cfg.buffers < 2) {
+        recorder->cfg.buffers = 2;
+    }
+    size_t bytes = config->buffer_bytes ? config->buffer_bytes : 1u << 20;
+    recorder->buffer_bytes = (bytes + CS_RECORDER_ALIGN - 1) / CS_RECORDER_ALIGN * CS_RECORDER_ALIGN;
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&recorder->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (mkdir(recorder->dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Recorder: cannot create %s: %s\n", recorder->dir, strerror(errno));
+        cs_recorder_destroy(recorder);
+        return NULL;
+    }
+
+    recorder->tracks = (cs_record_track *)calloc((size_t)config->tracks, sizeof(cs_record_track));
+    recorder->buffers = (cs_record_buffer *)calloc((size_t)recorder->cfg.buffers, sizeof(cs_record_buffer));
+    if (!recorder->tracks || !recorder->buffers) {
+        cs_recorder_destroy(recorder);
+        return NULL;
+    }
+    for (int i = 0; i < config->tracks; ++i) {
+        recorder->tracks[i].fd = -1;
+        recorder->tracks[i].resync = 1;
+    }
+    for (int i = 0; i < recorder->cfg.buffers; ++i) {
+        cs_record_buffer *buffer = &recorder->buffers[i];
+        void *data = NULL;
+        if (posix_memalign(&data, CS_RECORDER_ALIGN, recorder->buffer_bytes) != 0) {
+            cs_recorder_destroy(recorder);
+            return NULL;
+        }
+        buffer->data = (uint8_t *)data;
+        buffer->next = recorder->free_list;
+        recorder->free_list = buffer;
+        ++recorder->free_count;
+    }
+
+    scan_existing(recorder);
+    enforce_retention(recorder);
+
+    if (pthread_create(&recorder->thread, NULL, writer_main, recorder) != 0) {
+        cs_recorder_destroy(recorder);
+        return NULL;
+    }
+    recorder->thread_started = 1;
+    return recorder;
+}
+
+void cs_recorder_destroy(cs_recorder *recorder) {
+    if (!recorder) {
+        return;
+    }
+
+    if (recorder->thread_started) {
+        pthread_mutex_lock(&recorder->lock);
+        flush_idle_locked(recorder, 0, 1);
+        recorder->stop = 1;
+        pthread_cond_signal(&recorder->cond);
+        pthread_mutex_unlock(&recorder->lock);
+        pthread_join(recorder->thread, NULL);
+    }
+
+    while (recorder->files) {
+        cs_record_file *next = recorder->files->next;
+        free(recorder->files);
+        recorder->files = next;
+    }
+    if (recorder->buffers) {
+        for (int i = 0; i < recorder->cfg.buffers; ++i) {
+            free(recorder->buffers[i].data);
+        }
+    }
+    free(recorder->buffers);
+    free(recorder->tracks);
+    pthread_cond_destroy(&recorder->cond);
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder);
+}
+
+int cs_recorder_write(cs_recorder *recorder, int track_index, const uint8_t *data, size_t len, int keyframe) {
+    if (!recorder || !data || track_index < 0 || track_index >= recorder->cfg.tracks) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&recorder->lock);
+    cs_record_track *track = &recorder->tracks[track_index];
+    uint64_t now = monotonic_ns();
+    int rotate = keyframe && (track->segment_start_ns == 0 ||
+                              now - track->segment_start_ns >= (uint64_t)recorder->cfg.segment_s * 1000000000ull);
+
+    // Either the whole chunk fits in free buffer space or none of it is
+    // queued; a file never holds half a chunk.
+    size_t room = (size_t)recorder->free_count * recorder->buffer_bytes;
+    if (track->current && !rotate) {
+        room += recorder->buffer_bytes - track->current->len;
+    }
+    if ((track->resync && !keyframe) || len > room) {
+        track->resync = 1;
+        recorder->stats.dropped_bytes += len;
+        pthread_mutex_unlock(&recorder->lock);
+        return -1;
+    }
+
+    track->resync = 0;
+    if (rotate) {
+        if (track->current && track->current->len > 0) {
+            enqueue_locked(recorder, track->current);
+            track->current = NULL;
+        }
+        track->rotate_pending = 1;
+        track->segment_start_ns = now;
+        ++recorder->stats.files;
+    }
+
+    while (len > 0) {
+        if (!track->current) {
+            cs_record_buffer *buffer = recorder->free_list;
+            recorder->free_list = buffer->next;
+            --recorder->free_count;
+            buffer->next = NULL;
+            buffer->track = track_index;
+            buffer->rotate = track->rotate_pending;
+            track->rotate_pending = 0;
+            track->current = buffer;
+            track->filled_ns = now;
+        }
+        cs_record_buffer *buffer = track->current;
+        size_t chunk = recorder->buffer_bytes - buffer->len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(buffer->data + buffer->len, data, chunk);
+        buffer->len += chunk;
+        data += chunk;
+        len -= chunk;
+        if (buffer->len == recorder->buffer_bytes) {
+            enqueue_locked(recorder, buffer);
+            track->current = NULL;
+        }
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    return 0;
+}
+
+void cs_recorder_get_stats(cs_recorder *recorder, cs_recorder_stats *stats) {
+    if (!recorder || !stats) {
+        return;
+    }
+    pthread_mutex_lock(&recorder->lock);
+    *stats = recorder->stats;
+    pthread_mutex_unlock(&recorder->lock);
+}
@@ -1,164 +1,532 @@
 #include "render.h"
 
+#include "mat4.h"
+#include "scene.h"
+#include "trace.h"
+
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+// From EGL_EXT_platform_base/device and EGL_MESA_platform_surfaceless.
+#define CS_EGL_PLATFORM_DEVICE 0x313F
+#define CS_EGL_PLATFORM_SURFACELESS 0x31DD
+#define CS_GL_DEPTH_COMPONENT24 0x81A6
+
+typedef EGLDisplay (*cs_pfn_get_platform_display)(EGLenum platform, void *native_display, const EGLint *attribs);
+typedef EGLBoolean (*cs_pfn_query_devices)(EGLint max_devices, void **devices, EGLint *num_devices);
+
+// One GL context and everything bound to it. Frames are drawn into an FBO,
+// so no window or full-size pbuffer is needed; the 1x1 pbuffer is only for
+// drivers without EGL_KHR_surfaceless_context.
+typedef struct {
+    EGLContext context;
+    EGLSurface surface;
+    GLuint fbo;
+    GLuint color;
+    GLuint depth;
+    cs_scene *scene;
+    // Last frame drawn; the scene catches up to the next one it draws.
+    uint64_t frame;
+} cs_render_context;
+
+enum {
+    CS_RENDER_JOB_FREE,
+    CS_RENDER_JOB_QUEUED,
+    CS_RENDER_JOB_RENDERING,
+    CS_RENDER_JOB_DONE,
+    CS_RENDER_JOB_TAKEN
+};
+
+typedef struct {
+    int state;
+    int status;
+    uint64_t seq;
+    uint64_t tag;
+    uint64_t render_ns;
+    int view_count;
+    cs_render_view *views;
+    uint8_t *rgba;
+} cs_render_job;
+
 typedef struct {
-    float m[16];
-} mat4;
-
-static mat4 mat4_identity(void) {
-    mat4 out = { {1, 0, 0, 0,
-                 0, 1, 0, 0,
-                 0, 0, 1, 0,
-                 0, 0, 0, 1} };
-    return out;
+    cs_renderer *renderer;
+    int index;
+    pthread_t thread;
+    cs_render_context context;
+} cs_render_worker;
+
+struct cs_renderer {
+    int width;
+    int height;
+    int atlas_cols;
+    int atlas_rows;
+    float fps;
+    EGLDisplay display;
+    EGLConfig egl_config;
+    int surfaceless;
+    mat4 proj;
+    float default_distance;
+    // Only valid inside cs_render_create.
+    const cs_render_config *config;
+
+    // Single-threaded: current on the creating thread.
+    cs_render_context main;
+
+    // Pooled: worker 0 owns the scene, the others share it. Job slots are
+    // used in submission order, seq % job_count.
+    int threads;
+    cs_render_worker *workers;
+    cs_render_job *jobs;
+    int job_count;
+    int pending;
+    int ready;
+    int failed;
+    int stopping;
+    uint64_t submitted;
+    uint64_t taken;
+    int notify_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
-static mat4 mat4_mul(mat4 a, mat4 b) {
-    mat4 out = { {0} };
-    for (int row = 0; row < 4; ++row) {
-        for (int col = 0; col < 4; ++col) {
-            out.m[row * 4 + col] =
-                a.m[row * 4 + 0] * b.m[0 * 4 + col] +
-                a.m[row * 4 + 1] * b.m[1 * 4 + col] +
-                a.m[row * 4 + 2] * b.m[2 * 4 + col] +
-                a.m[row * 4 + 3] * b.m[3 * 4 + col];
+static int has_token(const char *list, const char *name) {
+    size_t len = strlen(name);
+    while (list && *list) {
+        const char *end = strchr(list, ' ');
+        size_t n = end ? (size_t)(end - list) : strlen(list);
+        if (n == len && strncmp(list, name, len) == 0) {
+            return 1;
         }
+        list = end ? end + 1 : NULL;
     }
-    return out;
+    return 0;
 }
 
-static mat4 mat4_translate(float x, float y, float z) {
-    mat4 out = mat4_identity();
-    out.m[12] = x;
-    out.m[13] = y;
-    out.m[14] = z;
-    return out;
+static EGLDisplay open_platform(cs_pfn_get_platform_display get_display, const char *client_exts, int device) {
+    if (!get_display) {
+        return EGL_NO_DISPLAY;
+    }
+    if (!device) {
+        if (!has_token(client_exts, "EGL_MESA_platform_surfaceless")) {
+            return EGL_NO_DISPLAY;
+        }
+        return get_display(CS_EGL_PLATFORM_SURFACELESS, (void *)EGL_DEFAULT_DISPLAY, NULL);
+    }
+
+    if (!has_token(client_exts, "EGL_EXT_platform_device")) {
+        return EGL_NO_DISPLAY;
+    }
+    cs_pfn_query_devices query_devices = (cs_pfn_query_devices)eglGetProcAddress("eglQueryDevicesEXT");
+    void *devices[8];
+    EGLint count = 0;
+    if (!query_devices || !query_devices(8, devices, &count) || count == 0) {
+        return EGL_NO_DISPLAY;
+    }
+    // Drivers list hardware devices ahead of software ones.
+    return get_display(CS_EGL_PLATFORM_DEVICE, devices[0], NULL);
 }
 
-static mat4 mat4_rotate_y(float r) {
-    mat4 out = mat4_identity();
-    float c = cosf(r);
-    float s = sinf(r);
-    out.m[0] = c;
-    out.m[2] = s;
-    out.m[8] = -s;
-    out.m[10] = c;
-    return out;
+// Headless first: surfaceless and device displays need no X, Wayland or GBM
+// node, which EGL_DEFAULT_DISPLAY may try to open.
+static EGLDisplay open_display(const char *platform, const char **name) {
+    const char *client_exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    cs_pfn_get_platform_display get_display = NULL;
+    if (has_token(client_exts, "EGL_EXT_platform_base")) {
+        get_display = (cs_pfn_get_platform_display)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    }
+
+    int any = !platform || !platform[0] || strcmp(platform, "auto") == 0;
+    static const char *const names[] = { "surfaceless", "device", "default" };
+    for (int i = 0; i < 3; ++i) {
+        if (!any && strcmp(platform, names[i]) != 0) {
+            continue;
+        }
+        EGLDisplay display = i < 2 ? open_platform(get_display, client_exts, i == 1)
+                                   : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY) {
+            continue;
+        }
+        if (eglInitialize(display, NULL, NULL)) {
+            *name = names[i];
+            return display;
+        }
+    }
+    return EGL_NO_DISPLAY;
 }
 
-static mat4 mat4_rotate_x(float r) {
-    mat4 out = mat4_identity();
-    float c = cosf(r);
-    float s = sinf(r);
-    out.m[5] = c;
-    out.m[6] = -s;
-    out.m[9] = s;
-    out.m[10] = c;
-    return out;
+static mat4 camera_view_proj(const cs_renderer *renderer, const cs_camera *camera) {
+    float zoom = camera->zoom > 0.0f ? camera->zoom : 1.0f;
+    // The far plane sits at 4x the default distance.
+    if (zoom < 0.1f) {
+        zoom = 0.1f;
+    } else if (zoom > 3.0f) {
+        zoom = 3.0f;
+    }
+    float distance = zoom * renderer->default_distance;
+    mat4 view = mat4_mul(mat4_translate(0.0f, 0.0f, -distance),
+                         mat4_mul(mat4_rotate_x(camera->pitch), mat4_rotate_y(camera->yaw)));
+    return mat4_mul(renderer->proj, view);
 }
 
-static mat4 mat4_perspective(float fovy_rad, float aspect, float z_near, float z_far) {
-    float f = 1.0f / tanf(fovy_rad * 0.5f);
-    mat4 out = { {0} };
-    out.m[0] = f / aspect;
-    out.m[5] = f;
-    out.m[10] = (z_far + z_near) / (z_near - z_far);
-    out.m[11] = -1.0f;
-    out.m[14] = (2.0f * z_far * z_near) / (z_near - z_far);
-    return out;
+static void context_release(cs_renderer *renderer, cs_render_context *ctx) {
+    if (ctx->context == EGL_NO_CONTEXT) {
+        return;
+    }
+
+    cs_scene_destroy(ctx->scene);
+    if (ctx->fbo) {
+        glDeleteFramebuffers(1, &ctx->fbo);
+    }
+    if (ctx->depth) {
+        glDeleteRenderbuffers(1, &ctx->depth);
+    }
+    if (ctx->color) {
+        glDeleteTextures(1, &ctx->color);
+    }
+
+    eglMakeCurrent(renderer->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(renderer->display, ctx->context);
+    if (ctx->surface != EGL_NO_SURFACE) {
+        eglDestroySurface(renderer->display, ctx->surface);
+    }
+    memset(ctx, 0, sizeof(*ctx));
 }
 
-typedef struct {
-    float pos[3];
-    float color[3];
-} vertex;
-
-static const vertex cube_vertices[] = {
-    // Front (red)
-    {{-1, -1,  1}, {1, 0, 0}},
-    {{ 1, -1,  1}, {1, 0, 0}},
-    {{ 1,  1,  1}, {1, 0, 0}},
-    {{-1, -1,  1}, {1, 0, 0}},
-    {{ 1,  1,  1}, {1, 0, 0}},
-    {{-1,  1,  1}, {1, 0, 0}},
-    // Back (green)
-    {{-1, -1, -1}, {0, 1, 0}},
-    {{-1,  1, -1}, {0, 1, 0}},
-    {{ 1,  1, -1}, {0, 1, 0}},
-    {{-1, -1, -1}, {0, 1, 0}},
-    {{ 1,  1, -1}, {0, 1, 0}},
-    {{ 1, -1, -1}, {0, 1, 0}},
-    // Left (blue)
-    {{-1, -1, -1}, {0, 0, 1}},
-    {{-1, -1,  1}, {0, 0, 1}},
-    {{-1,  1,  1}, {0, 0, 1}},
-    {{-1, -1, -1}, {0, 0, 1}},
-    {{-1,  1,  1}, {0, 0, 1}},
-    {{-1,  1, -1}, {0, 0, 1}},
-    // Right (yellow)
-    {{ 1, -1, -1}, {1, 1, 0}},
-    {{ 1,  1, -1}, {1, 1, 0}},
-    {{ 1,  1,  1}, {1, 1, 0}},
-    {{ 1, -1, -1}, {1, 1, 0}},
-    {{ 1,  1,  1}, {1, 1, 0}},
-    {{ 1, -1,  1}, {1, 1, 0}},
-    // Top (cyan)
-    {{-1,  1, -1}, {0, 1, 1}},
-    {{-1,  1,  1}, {0, 1, 1}},
-    {{ 1,  1,  1}, {0, 1, 1}},
-    {{-1,  1, -1}, {0, 1, 1}},
-    {{ 1,  1,  1}, {0, 1, 1}},
-    {{ 1,  1, -1}, {0, 1, 1}},
-    // Bottom (magenta)
-    {{-1, -1, -1}, {1, 0, 1}},
-    {{ 1, -1, -1}, {1, 0, 1}},
-    {{ 1, -1,  1}, {1, 0, 1}},
-    {{-1, -1, -1}, {1, 0, 1}},
-    {{ 1, -1,  1}, {1, 0, 1}},
-    {{-1, -1,  1}, {1, 0, 1}},
-};
+static int create_target(cs_renderer *renderer, cs_render_context *ctx) {
+    int atlas_width = renderer->width * renderer->atlas_cols;
+    int atlas_height = renderer->height * renderer->atlas_rows;
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+    int es3 = version && strncmp(version, "OpenGL ES 3", 11) == 0;
+
+    glGenTextures(1, &ctx->color);
+    glBindTexture(GL_TEXTURE_2D, ctx->color);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas_width, atlas_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenRenderbuffers(1, &ctx->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER,
+                          es3 || has_token(exts, "GL_OES_depth24") ? CS_GL_DEPTH_COMPONENT24 : GL_DEPTH_COMPONENT16,
+                          atlas_width, atlas_height);
+
+    glGenFramebuffers(1, &ctx->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ctx->color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, ctx->depth);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE ? 0 : -1;
+}
 
-struct cs_renderer {
-    int width;
-    int height;
-    float fps;
-    float angle;
-    EGLDisplay display;
-    EGLContext context;
-    EGLSurface surface;
-    GLuint program;
-    GLuint vbo;
-    GLint loc_pos;
-    GLint loc_color;
-    GLint loc_mvp;
-};
+// Creates a context (sharing objects with share's, if any), makes it
+// current on the calling thread and sets up its FBO and scene.
+static int context_init(cs_renderer *renderer, cs_render_context *ctx, const cs_render_context *share) {
+    ctx->surface = EGL_NO_SURFACE;
+    if (!renderer->surfaceless) {
+        EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        ctx->surface = eglCreatePbufferSurface(renderer->display, renderer->egl_config, pbuffer_attribs);
+        if (ctx->surface == EGL_NO_SURFACE) {
+            return -1;
+        }
+    }
+
+    // Prefer ES 3 for core VAOs and instancing; the scene copes with ES 2.
+    EGLContext share_context = share ? share->context : EGL_NO_CONTEXT;
+    EGLint ctx_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    ctx->context = eglCreateContext(renderer->display, renderer->egl_config, share_context, ctx_attribs);
+    if (ctx->context == EGL_NO_CONTEXT) {
+        ctx_attribs[1] = 2;
+        ctx->context = eglCreateContext(renderer->display, renderer->egl_config, share_context, ctx_attribs);
+    }
+    if (ctx->context == EGL_NO_CONTEXT) {
+        if (ctx->surface != EGL_NO_SURFACE) {
+            eglDestroySurface(renderer->display, ctx->surface);
+        }
+        return -1;
+    }
+
+    if (!eglMakeCurrent(renderer->display, ctx->surface, ctx->surface, ctx->context)) {
+        eglDestroyContext(renderer->display, ctx->context);
+        if (ctx->surface != EGL_NO_SURFACE) {
+            eglDestroySurface(renderer->display, ctx->surface);
+        }
+        ctx->context = EGL_NO_CONTEXT;
+        return -1;
+    }
+
+    const cs_render_config *config = renderer->config;
+    cs_scene_config scene_cfg = {
+        .object_count = config->scene_objects > 0 ? config->scene_objects : 1,
+        .seed = 1,
+        .asset_dir = config->asset_dir,
+        .shader_cache_dir = config->shader_cache_dir
+    };
+    ctx->scene = share ? cs_scene_create_shared(share->scene, &scene_cfg) : cs_scene_create(&scene_cfg);
+    if (!ctx->scene || create_target(renderer, ctx) != 0) {
+        context_release(renderer, ctx);
+        return -1;
+    }
+
+    if (!share) {
+        renderer->default_distance = cs_scene_view_distance(ctx->scene);
+        renderer->proj = mat4_perspective(60.0f * (float)M_PI / 180.0f,
+                                          (float)renderer->width / (float)renderer->height,
+                                          0.1f, renderer->default_distance * 4.0f);
+        // glReadPixels returns rows bottom-up while video is top-down;
+        // flipping Y in the projection makes the readback come out upright.
+        renderer->proj.m[1] = -renderer->proj.m[1];
+        renderer->proj.m[5] = -renderer->proj.m[5];
+        renderer->proj.m[9] = -renderer->proj.m[9];
+        renderer->proj.m[13] = -renderer->proj.m[13];
+        // Shared contexts only see the geometry uploads once this context
+        // has completed them.
+        glFinish();
+    }
 
-static GLuint compile_shader(GLenum type, const char *source) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, NULL);
-    glCompileShader(shader);
-    return shader;
+    glClearColor(0.05f, 0.07f, 0.1f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+    return 0;
 }
 
-static GLuint link_program(const char *vs_src, const char *fs_src) {
-    GLuint vs = compile_shader(GL_VERTEX_SHADER, vs_src);
-    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fs_src);
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    glLinkProgram(program);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-    return program;
+// NDC bounds to a pixel rect in the tile. The projection flips Y so that
+// readback rows run top-down, which makes NDC -1 the top row.
+static cs_render_rect bounds_to_rect(const cs_renderer *renderer, const float bounds[4]) {
+    cs_render_rect rect = { 0, 0, 0, 0 };
+    if (bounds[0] >= bounds[2] || bounds[1] >= bounds[3]) {
+        return rect;
+    }
+    int x0 = (int)floorf((bounds[0] * 0.5f + 0.5f) * (float)renderer->width);
+    int y0 = (int)floorf((bounds[1] * 0.5f + 0.5f) * (float)renderer->height);
+    int x1 = (int)ceilf((bounds[2] * 0.5f + 0.5f) * (float)renderer->width);
+    int y1 = (int)ceilf((bounds[3] * 0.5f + 0.5f) * (float)renderer->height);
+    rect.x = x0 < 0 ? 0 : x0;
+    rect.y = y0 < 0 ? 0 : y0;
+    rect.width = (x1 > renderer->width ? renderer->width : x1) - rect.x;
+    rect.height = (y1 > renderer->height ? renderer->height : y1) - rect.y;
+    if (rect.width <= 0 || rect.height <= 0) {
+        rect.width = 0;
+        rect.height = 0;
+    }
+    return rect;
+}
+
+// Advances ctx's scene to frame and draws the views; ctx must be current.
+static void render_views(cs_renderer *renderer, cs_render_context *ctx, uint64_t frame,
+                         cs_render_view *views, int view_count, uint8_t *rgba_out) {
+    int atlas_width = renderer->width * renderer->atlas_cols;
+    int atlas_height = renderer->height * renderer->atlas_rows;
+
+    uint64_t draw_start = cs_trace_begin();
+    // One step per frame so that every context's animation matches the
+    // single-threaded one exactly.
+    while (ctx->frame < frame) {
+        cs_scene_update(ctx->scene, 1.0f / renderer->fps);
+        ctx->frame++;
+    }
+
+    glViewport(0, 0, atlas_width, atlas_height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    for (int i = 0; i < view_count; ++i) {
+        int tile = views[i].tile;
+        if (tile < 0 || tile >= renderer->atlas_cols * renderer->atlas_rows) {
+            views[i].roi = (cs_render_rect){ 0, 0, 0, 0 };
+            continue;
+        }
+        // Tile rows count down from the top of the video frame, which is
+        // the bottom of the GL framebuffer once read back.
+        glViewport((tile % renderer->atlas_cols) * renderer->width,
+                   (tile / renderer->atlas_cols) * renderer->height,
+                   renderer->width, renderer->height);
+        mat4 view_proj = camera_view_proj(renderer, &views[i].camera);
+        cs_scene_stats stats;
+        cs_scene_draw(ctx->scene, &view_proj, &stats);
+        views[i].roi = bounds_to_rect(renderer, stats.bounds);
+    }
+
+    // Draw covers command submission; readback includes waiting for the GPU.
+    cs_trace_end(draw_start, "draw", "views", view_count);
+    uint64_t readback_start = cs_trace_begin();
+    glReadPixels(0, 0, atlas_width, atlas_height, GL_RGBA, GL_UNSIGNED_BYTE, rgba_out);
+    cs_trace_end(readback_start, "readback", NULL, 0);
+}
+
+static cs_render_job *next_queued(cs_renderer *renderer) {
+    cs_render_job *next = NULL;
+    for (int i = 0; i < renderer->job_count; ++i) {
+        cs_render_job *job = &renderer->jobs[i];
+        if (job->state == CS_RENDER_JOB_QUEUED && (!next || job->seq < next->seq)) {
+            next = job;
+        }
+    }
+    return next;
+}
+
+static void *render_worker(void *arg) {
+    cs_render_worker *worker = (cs_render_worker *)arg;
+    cs_renderer *renderer = worker->renderer;
+    const cs_render_context *share = worker->index > 0 ? &renderer->workers[0].context : NULL;
+    int ok = context_init(renderer, &worker->context, share) == 0;
+
+    pthread_mutex_lock(&renderer->lock);
+    if (ok) {
+        renderer->ready++;
+    } else {
+        renderer->failed = 1;
+    }
+    pthread_cond_broadcast(&renderer->done);
+
+    while (ok && !renderer->stopping) {
+        cs_render_job *job = next_queued(renderer);
+        if (!job) {
+            pthread_cond_wait(&renderer->work, &renderer->lock);
+            continue;
+        }
+        job->state = CS_RENDER_JOB_RENDERING;
+        pthread_mutex_unlock(&renderer->lock);
+
+        uint64_t start = monotonic_ns();
+        render_views(renderer, &worker->context, job->seq, job->views, job->view_count, job->rgba);
+        job->render_ns = monotonic_ns() - start;
+        job->status = glGetError() == GL_NO_ERROR ? 0 : -1;
+
+        pthread_mutex_lock(&renderer->lock);
+        job->state = CS_RENDER_JOB_DONE;
+        renderer->pending--;
+        pthread_cond_broadcast(&renderer->done);
+        uint64_t one = 1;
+        if (write(renderer->notify_fd, &one, sizeof(one)) < 0) {
+            // The counter only saturates if nobody drains it.
+        }
+    }
+    pthread_mutex_unlock(&renderer->lock);
+
+    // Worker 0's context holds the shared scene; cs_render_destroy releases
+    // it once every other worker has gone.
+    if (worker->index > 0) {
+        context_release(renderer, &worker->context);
+    } else {
+        eglMakeCurrent(renderer->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+    eglReleaseThread();
+    return NULL;
+}
+
+// Starts workers [first, last) and waits until they are ready or one fails.
+// Returns the number started.
+static int start_workers(cs_renderer *renderer, int first, int last) {
+    int started = first;
+    for (int i = first; i < last; ++i) {
+        cs_render_worker *worker = &renderer->workers[i];
+        worker->renderer = renderer;
+        worker->index = i;
+        if (pthread_create(&worker->thread, NULL, render_worker, worker) != 0) {
+            pthread_mutex_lock(&renderer->lock);
+            renderer->failed = 1;
+            pthread_mutex_unlock(&renderer->lock);
+            break;
+        }
+        started++;
+    }
+
+    pthread_mutex_lock(&renderer->lock);
+    while (!renderer->failed && renderer->ready < started) {
+        pthread_cond_wait(&renderer->done, &renderer->lock);
+    }
+    pthread_mutex_unlock(&renderer->lock);
+    return started;
+}
+
+static void stop_workers(cs_renderer *renderer, int started) {
+    pthread_mutex_lock(&renderer->lock);
+    renderer->stopping = 1;
+    pthread_cond_broadcast(&renderer->work);
+    pthread_mutex_unlock(&renderer->lock);
+    for (int i = started - 1; i >= 0; --i) {
+        pthread_join(renderer->workers[i].thread, NULL);
+    }
+
+    cs_render_context *primary = &renderer->workers[0].context;
+    if (started > 0 && primary->context != EGL_NO_CONTEXT) {
+        eglMakeCurrent(renderer->display, primary->surface, primary->surface, primary->context);
+        context_release(renderer, primary);
+        eglReleaseThread();
+    }
+}
+
+static int create_pool(cs_renderer *renderer) {
+    size_t rgba_len = (size_t)renderer->width * (size_t)renderer->atlas_cols *
+                      (size_t)renderer->height * (size_t)renderer->atlas_rows * 4;
+    int tiles = renderer->atlas_cols * renderer->atlas_rows;
+
+    // Twice the workers: a finished frame can wait to be taken while every
+    // worker draws the next.
+    renderer->job_count = renderer->threads * 2;
+    renderer->workers = (cs_render_worker *)calloc((size_t)renderer->threads, sizeof(cs_render_worker));
+    renderer->jobs = (cs_render_job *)calloc((size_t)renderer->job_count, sizeof(cs_render_job));
+    if (!renderer->workers || !renderer->jobs) {
+        return -1;
+    }
+    for (int i = 0; i < renderer->job_count; ++i) {
+        renderer->jobs[i].views = (cs_render_view *)calloc((size_t)tiles, sizeof(cs_render_view));
+        renderer->jobs[i].rgba = (uint8_t *)malloc(rgba_len);
+        if (!renderer->jobs[i].views || !renderer->jobs[i].rgba) {
+            return -1;
+        }
+    }
+
+    renderer->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (renderer->notify_fd < 0) {
+        return -1;
+    }
+    pthread_mutex_init(&renderer->lock, NULL);
+    pthread_cond_init(&renderer->work, NULL);
+    pthread_cond_init(&renderer->done, NULL);
+
+    // Shared contexts need worker 0's context and scene to exist first.
+    int started = start_workers(renderer, 0, 1);
+    if (started == 1 && !renderer->failed) {
+        started = start_workers(renderer, 1, renderer->threads);
+    }
+    if (renderer->failed) {
+        stop_workers(renderer, started);
+        return -1;
+    }
+    return 0;
+}
+
+static void destroy_pool(cs_renderer *renderer) {
+    if (renderer->notify_fd >= 0) {
+        close(renderer->notify_fd);
+        pthread_cond_destroy(&renderer->done);
+        pthread_cond_destroy(&renderer->work);
+        pthread_mutex_destroy(&renderer->lock);
+    }
+    for (int i = 0; renderer->jobs && i < renderer->job_count; ++i) {
+        free(renderer->jobs[i].views);
+        free(renderer->jobs[i].rgba);
+    }
+    free(renderer->jobs);
+    free(renderer->workers);
 }
 
 cs_renderer *cs_render_create(const cs_render_config *config) {
@@ -174,91 +542,52 @@ cs_renderer *cs_render_create(const cs_render_config *config) {
     renderer->width = config->width;
     renderer->height = config->height;
     renderer->fps = config->fps;
-
-    renderer->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    renderer->atlas_cols = config->atlas_cols > 0 ? config->atlas_cols : 1;
+    renderer->atlas_rows = config->atlas_rows > 0 ? config->atlas_rows : 1;
+    renderer->threads = config->threads > 1 ? config->threads : 0;
+    renderer->notify_fd = -1;
+    renderer->config = config;
+
+    const char *platform = NULL;
+    renderer->display = open_display(config->platform, &platform);
     if (renderer->display == EGL_NO_DISPLAY) {
         free(renderer);
         return NULL;
     }
 
-    if (!eglInitialize(renderer->display, NULL, NULL)) {
-        free(renderer);
-        return NULL;
-    }
-
+    // Rendering goes to an FBO, so the config needs no color or depth
+    // buffers of its own.
+    renderer->surfaceless = has_token(eglQueryString(renderer->display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
     EGLint attribs[] = {
-        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_SURFACE_TYPE, renderer->surfaceless ? 0 : EGL_PBUFFER_BIT,
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-        EGL_RED_SIZE, 8,
-        EGL_GREEN_SIZE, 8,
-        EGL_BLUE_SIZE, 8,
-        EGL_ALPHA_SIZE, 8,
-        EGL_DEPTH_SIZE, 24,
         EGL_NONE
     };
 
-    EGLConfig cfg;
     EGLint num_configs = 0;
-    if (!eglChooseConfig(renderer->display, attribs, &cfg, 1, &num_configs) || num_configs == 0) {
+    if (!eglChooseConfig(renderer->display, attribs, &renderer->egl_config, 1, &num_configs) || num_configs == 0) {
         eglTerminate(renderer->display);
         free(renderer);
         return NULL;
     }
 
-    EGLint pbuffer_attribs[] = {
-        EGL_WIDTH, renderer->width,
-        EGL_HEIGHT, renderer->height,
-        EGL_NONE
-    };
-
-    renderer->surface = eglCreatePbufferSurface(renderer->display, cfg, pbuffer_attribs);
-    if (renderer->surface == EGL_NO_SURFACE) {
-        eglTerminate(renderer->display);
-        free(renderer);
-        return NULL;
-    }
-
-    EGLint ctx_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
-    renderer->context = eglCreateContext(renderer->display, cfg, EGL_NO_CONTEXT, ctx_attribs);
-    if (renderer->context == EGL_NO_CONTEXT) {
-        eglDestroySurface(renderer->display, renderer->surface);
-        eglTerminate(renderer->display);
-        free(renderer);
-        return NULL;
-    }
-
-    if (!eglMakeCurrent(renderer->display, renderer->surface, renderer->surface, renderer->context)) {
-        eglDestroyContext(renderer->display, renderer->context);
-        eglDestroySurface(renderer->display, renderer->surface);
+    if (renderer->threads > 0) {
+        if (create_pool(renderer) != 0) {
+            destroy_pool(renderer);
+            eglTerminate(renderer->display);
+            free(renderer);
+            return NULL;
+        }
+    } else if (context_init(renderer, &renderer->main, NULL) != 0) {
         eglTerminate(renderer->display);
         free(renderer);
         return NULL;
     }
+    renderer->config = NULL;
 
-    const char *vs_src =
-        "attribute vec3 a_pos;\n"
-        "attribute vec3 a_color;\n"
-        "uniform mat4 u_mvp;\n"
-        "varying vec3 v_color;\n"
-        "void main() { v_color = a_color; gl_Position = u_mvp * vec4(a_pos, 1.0); }\n";
-
-    const char *fs_src =
-        "precision mediump float;\n"
-        "varying vec3 v_color;\n"
-        "void main() { gl_FragColor = vec4(v_color, 1.0); }\n";
-
-    renderer->program = link_program(vs_src, fs_src);
-    renderer->loc_pos = glGetAttribLocation(renderer->program, "a_pos");
-    renderer->loc_color = glGetAttribLocation(renderer->program, "a_color");
-    renderer->loc_mvp = glGetUniformLocation(renderer->program, "u_mvp");
-
-    glGenBuffers(1, &renderer->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
-
-    glEnable(GL_DEPTH_TEST);
-    glViewport(0, 0, renderer->width, renderer->height);
-
+    fprintf(stderr, "Render: EGL %s platform%s, %d thread%s\n", platform,
+            renderer->surfaceless ? ", surfaceless context" : "",
+            renderer->threads > 0 ? renderer->threads : 1, renderer->threads > 1 ? "s" : "");
     return renderer;
 }
 
@@ -267,62 +596,137 @@ void cs_render_destroy(cs_renderer *renderer) {
         return;
     }
 
-    glDeleteBuffers(1, &renderer->vbo);
-    glDeleteProgram(renderer->program);
-
-    if (renderer->display != EGL_NO_DISPLAY) {
-        eglMakeCurrent(renderer->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-        if (renderer->context != EGL_NO_CONTEXT) {
-            eglDestroyContext(renderer->display, renderer->context);
-        }
-        if (renderer->surface != EGL_NO_SURFACE) {
-            eglDestroySurface(renderer->display, renderer->surface);
-        }
-        eglTerminate(renderer->display);
+    if (renderer->threads > 0) {
+        stop_workers(renderer, renderer->threads);
+        destroy_pool(renderer);
+    } else {
+        context_release(renderer, &renderer->main);
     }
-
+    eglTerminate(renderer->display);
     free(renderer);
 }
 
-int cs_render_frame(cs_renderer *renderer, uint8_t *rgba_out, size_t rgba_len) {
-    if (!renderer || !rgba_out) {
+int cs_render_frame(cs_renderer *renderer, uint8_t *rgba_out, size_t rgba_len, cs_render_rect *roi_out) {
+    cs_render_view view = { .tile = 0, .camera = { 0.0f, 0.0f, 0.0f } };
+    int ret = cs_render_frame_views(renderer, &view, 1, rgba_out, rgba_len);
+    if (ret == 0 && roi_out) {
+        *roi_out = view.roi;
+    }
+    return ret;
+}
+
+int cs_render_frame_views(cs_renderer *renderer, cs_render_view *views, int view_count,
+                          uint8_t *rgba_out, size_t rgba_len) {
+    if (!renderer || !rgba_out || (!views && view_count > 0)) {
         return -1;
     }
 
-    size_t expected = (size_t)renderer->width * (size_t)renderer->height * 4;
+    size_t expected = (size_t)renderer->width * (size_t)renderer->atlas_cols *
+                      (size_t)renderer->height * (size_t)renderer->atlas_rows * 4;
     if (rgba_len < expected) {
         return -1;
     }
 
-    renderer->angle += (float)(2.0 * M_PI) / (renderer->fps * 4.0f);
+    if (renderer->threads == 0) {
+        render_views(renderer, &renderer->main, renderer->main.frame + 1, views, view_count, rgba_out);
+        return 0;
+    }
 
-    glClearColor(0.05f, 0.07f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Pooled: hand the frame to a worker and wait for it.
+    if (cs_render_submit(renderer, views, view_count, 0) != 0) {
+        return -1;
+    }
+    cs_render_result result;
+    pthread_mutex_lock(&renderer->lock);
+    cs_render_job *job = &renderer->jobs[renderer->submitted % (uint64_t)renderer->job_count];
+    while (job->state != CS_RENDER_JOB_DONE) {
+        pthread_cond_wait(&renderer->done, &renderer->lock);
+    }
+    pthread_mutex_unlock(&renderer->lock);
+    if (cs_render_take(renderer, &result) != 0) {
+        return -1;
+    }
+    int ret = result.status;
+    if (ret == 0) {
+        memcpy(rgba_out, result.rgba, expected);
+        for (int i = 0; i < view_count; ++i) {
+            views[i].roi = result.views[i].roi;
+        }
+    }
+    cs_render_release(renderer, &result);
+    return ret;
+}
 
-    mat4 proj = mat4_perspective(60.0f * (float)M_PI / 180.0f,
-                                (float)renderer->width / (float)renderer->height,
-                                0.1f, 100.0f);
-    mat4 view = mat4_translate(0.0f, 0.0f, -5.0f);
-    mat4 rot_y = mat4_rotate_y(renderer->angle);
-    mat4 rot_x = mat4_rotate_x(renderer->angle * 0.7f);
-    mat4 model = mat4_mul(rot_y, rot_x);
-    mat4 mvp = mat4_mul(proj, mat4_mul(view, model));
+int cs_render_threads(const cs_renderer *renderer) {
+    return renderer && renderer->threads > 0 ? renderer->threads : 1;
+}
 
-    glUseProgram(renderer->program);
-    glUniformMatrix4fv(renderer->loc_mvp, 1, GL_FALSE, mvp.m);
-    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
+int cs_render_fd(const cs_renderer *renderer) {
+    return renderer ? renderer->notify_fd : -1;
+}
 
-    glEnableVertexAttribArray((GLuint)renderer->loc_pos);
-    glEnableVertexAttribArray((GLuint)renderer->loc_color);
-    glVertexAttribPointer((GLuint)renderer->loc_pos, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)0);
-    glVertexAttribPointer((GLuint)renderer->loc_color, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(sizeof(float) * 3));
+int cs_render_submit(cs_renderer *renderer, const cs_render_view *views, int view_count, uint64_t tag) {
+    if (!renderer || renderer->threads == 0 || view_count < 0 || (!views && view_count > 0) ||
+        view_count > renderer->atlas_cols * renderer->atlas_rows) {
+        return -1;
+    }
 
-    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(sizeof(cube_vertices) / sizeof(vertex)));
+    pthread_mutex_lock(&renderer->lock);
+    cs_render_job *job = &renderer->jobs[(renderer->submitted + 1) % (uint64_t)renderer->job_count];
+    // Queueing behind busy workers would only add latency.
+    if (renderer->pending >= renderer->threads || job->state != CS_RENDER_JOB_FREE) {
+        pthread_mutex_unlock(&renderer->lock);
+        return -1;
+    }
+    job->seq = ++renderer->submitted;
+    job->tag = tag;
+    job->view_count = view_count;
+    if (view_count > 0) {
+        memcpy(job->views, views, (size_t)view_count * sizeof(cs_render_view));
+    }
+    job->state = CS_RENDER_JOB_QUEUED;
+    renderer->pending++;
+    pthread_cond_signal(&renderer->work);
+    pthread_mutex_unlock(&renderer->lock);
+    return 0;
+}
 
-    glDisableVertexAttribArray((GLuint)renderer->loc_pos);
-    glDisableVertexAttribArray((GLuint)renderer->loc_color);
+int cs_render_take(cs_renderer *renderer, cs_render_result *result) {
+    if (!renderer || renderer->threads == 0 || !result) {
+        return -1;
+    }
 
-    glReadPixels(0, 0, renderer->width, renderer->height, GL_RGBA, GL_UNSIGNED_BYTE, rgba_out);
+    int ret = -1;
+    pthread_mutex_lock(&renderer->lock);
+    uint64_t seq = renderer->taken + 1;
+    cs_render_job *job = &renderer->jobs[seq % (uint64_t)renderer->job_count];
+    if (job->state == CS_RENDER_JOB_DONE && job->seq == seq) {
+        job->state = CS_RENDER_JOB_TAKEN;
+        renderer->taken = seq;
+        result->seq = seq;
+        result->tag = job->tag;
+        result->status = job->status;
+        result->rgba = job->rgba;
+        result->len = (size_t)renderer->width * (size_t)renderer->atlas_cols *
+                      (size_t)renderer->height * (size_t)renderer->atlas_rows * 4;
+        result->views = job->views;
+        result->view_count = job->view_count;
+        result->render_ns = job->render_ns;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&renderer->lock);
+    return ret;
+}
 
-    return 0;
+void cs_render_release(cs_renderer *renderer, const cs_render_result *result) {
+    if (!renderer || renderer->threads == 0 || !result) {
+        return;
+    }
+
+    pthread_mutex_lock(&renderer->lock);
+    cs_render_job *job = &renderer->jobs[result->seq % (uint64_t)renderer->job_count];
+    if (job->seq == result->seq && job->state == CS_RENDER_JOB_TAKEN) {
+        job->state = CS_RENDER_JOB_FREE;
+    }
+    pthread_mutex_unlock(&renderer->lock);
 }
@@ -0,0 +1,148 @@
+#include "render_process.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct cs_render_process {
+    char renderer_path[512];
+    char config_path[512];
+    cs_frame_ring *ring;
+    uint64_t respawn_delay_ns;
+    uint64_t next_spawn_ns;
+    pid_t pid;
+    int restarts;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void default_renderer_path(char *out, size_t out_len) {
+    char self[512];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        snprintf(out, out_len, "cs_renderer");
+        return;
+    }
+    self[n] = '\0';
+    char *slash = strrchr(self, '/');
+    if (slash) {
+        *slash = '\0';
+    }
+    snprintf(out, out_len, "%s/cs_renderer", self);
+}
+
+static int spawn(cs_render_process *process) {
+    char mem_fd[16];
+    char notify_fd[16];
+    int mfd = cs_frame_ring_mem_fd(process->ring);
+    int nfd = cs_frame_ring_notify_fd(process->ring);
+    snprintf(mem_fd, sizeof(mem_fd), "%d", mfd);
+    snprintf(notify_fd, sizeof(notify_fd), "%d", nfd);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        // Only async-signal-safe calls between fork and exec.
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        fcntl(mfd, F_SETFD, 0);
+        fcntl(nfd, F_SETFD, 0);
+        char *argv[] = {
+            process->renderer_path, mem_fd, notify_fd,
+            process->config_path[0] ? process->config_path : NULL, NULL
+        };
+        execv(process->renderer_path, argv);
+        _exit(127);
+    }
+
+    process->pid = pid;
+    return 0;
+}
+
+cs_render_process *cs_render_process_create(const cs_render_process_config *config) {
+    if (!config || !config->ring) {
+        return NULL;
+    }
+
+    cs_render_process *process = (cs_render_process *)calloc(1, sizeof(cs_render_process));
+    if (!process) {
+        return NULL;
+    }
+
+    process->ring = config->ring;
+    process->respawn_delay_ns = (uint64_t)(config->respawn_delay_ms > 0 ? config->respawn_delay_ms : 500) * 1000000ull;
+    if (config->renderer_path && config->renderer_path[0]) {
+        snprintf(process->renderer_path, sizeof(process->renderer_path), "%s", config->renderer_path);
+    } else {
+        default_renderer_path(process->renderer_path, sizeof(process->renderer_path));
+    }
+    if (config->config_path) {
+        snprintf(process->config_path, sizeof(process->config_path), "%s", config->config_path);
+    }
+
+    if (spawn(process) != 0) {
+        free(process);
+        return NULL;
+    }
+    return process;
+}
+
+void cs_render_process_destroy(cs_render_process *process) {
+    if (!process) {
+        return;
+    }
+
+    if (process->pid > 0) {
+        kill(process->pid, SIGTERM);
+        waitpid(process->pid, NULL, 0);
+    }
+    free(process);
+}
+
+int cs_render_process_check(cs_render_process *process) {
+    if (!process) {
+        return 0;
+    }
+
+    if (process->pid > 0) {
+        int status = 0;
+        pid_t ret = waitpid(process->pid, &status, WNOHANG);
+        if (ret == 0) {
+            return 1;
+        }
+        if (ret > 0 && WIFSIGNALED(status)) {
+            fprintf(stderr, "Renderer %d killed by signal %d\n", (int)process->pid, WTERMSIG(status));
+        } else if (ret > 0) {
+            fprintf(stderr, "Renderer %d exited with status %d\n", (int)process->pid, WEXITSTATUS(status));
+        }
+        process->pid = 0;
+        // The dead producer may have left a slot half written.
+        cs_frame_ring_recover(process->ring);
+        process->next_spawn_ns = monotonic_ns() + process->respawn_delay_ns;
+        return 0;
+    }
+
+    if (monotonic_ns() < process->next_spawn_ns) {
+        return 0;
+    }
+    if (spawn(process) != 0) {
+        process->next_spawn_ns = monotonic_ns() + process->respawn_delay_ns;
+        return 0;
+    }
+    process->restarts++;
+    fprintf(stderr, "Renderer respawned (restart %d)\n", process->restarts);
+    return 1;
+}
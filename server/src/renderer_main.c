@@ -0,0 +1,93 @@
+#include "config.h"
+#include "frame_ring.h"
+#include "render.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// cs_renderer: producer half of the split mode. Started by cube_server with
+// the frame ring's memfd and eventfd inherited as argv[1] and argv[2].
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <ring-fd> <notify-fd> [config]\n", argv[0]);
+        return 2;
+    }
+
+    cs_config config;
+    if (cs_config_load(&config, argc > 3 ? argv[3] : NULL) != 0) {
+        fprintf(stderr, "Failed to load config\n");
+        return 1;
+    }
+
+    cs_frame_ring *ring = cs_frame_ring_attach(atoi(argv[1]), atoi(argv[2]));
+    if (!ring) {
+        fprintf(stderr, "Frame ring attach failed\n");
+        return 1;
+    }
+
+    cs_render_config render_cfg = {
+        .width = cs_frame_ring_width(ring),
+        .height = cs_frame_ring_height(ring),
+        .fps = config.fps,
+        .scene_objects = config.scene_objects,
+        .asset_dir = config.asset_dir,
+        .shader_cache_dir = config.shader_cache_dir,
+        .platform = config.egl_platform
+    };
+    cs_renderer *renderer = cs_render_create(&render_cfg);
+    if (!renderer) {
+        fprintf(stderr, "Renderer init failed\n");
+        cs_frame_ring_destroy(ring);
+        return 1;
+    }
+
+    signal(SIGTERM, on_signal);
+    signal(SIGINT, on_signal);
+
+    const uint64_t frame_ns = (uint64_t)(1000000000.0 / config.fps);
+    uint64_t next_tick = monotonic_ns();
+
+    while (running) {
+        uint64_t now = monotonic_ns();
+        if (now < next_tick) {
+            struct timespec sleep_ts = { .tv_sec = 0, .tv_nsec = (long)(next_tick - now) };
+            nanosleep(&sleep_ts, NULL);
+            continue;
+        }
+
+        cs_frame_slot slot;
+        if (cs_frame_ring_begin_write(ring, &slot) == 0) {
+            cs_render_rect roi;
+            if (cs_render_frame(renderer, slot.data, slot.len, &roi) == 0) {
+                slot.roi[0] = roi.x;
+                slot.roi[1] = roi.y;
+                slot.roi[2] = roi.width;
+                slot.roi[3] = roi.height;
+                cs_frame_ring_publish(ring, &slot, now);
+            } else {
+                cs_frame_ring_abort_write(ring, &slot);
+            }
+        }
+        next_tick += frame_ns;
+    }
+
+    cs_render_destroy(renderer);
+    cs_frame_ring_destroy(ring);
+    return 0;
+}
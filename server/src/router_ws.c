@@ -0,0 +1,501 @@
+#include "router.h"
+
+#include "json.h"
+#include "msg_queue.h"
+
+#include <libwebsockets.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Longest register or load message a worker may send.
+#define CS_ROUTER_MAX_CONTROL 4096
+
+typedef struct {
+    int active;
+    struct lws *wsi;
+    char host[128];
+    int port;
+    double cpu;
+    double encode_headroom;
+    int peers;
+    int capacity;
+    // Viewers placed since the last report, so a burst of joins between
+    // reports does not all land on the same worker.
+    int placed;
+    uint64_t last_report_ns;
+    // A relay to the worker failed; it gets no new viewers before this.
+    uint64_t backoff_until_ns;
+} cs_router_worker;
+
+typedef struct {
+    struct lws *viewer;
+    struct lws *upstream;
+    int worker;
+    int upstream_ready;
+    cs_msg_queue to_viewer;
+    cs_msg_queue to_worker;
+    cs_msg_assembler viewer_rx;
+    cs_msg_assembler upstream_rx;
+} cs_router_session;
+
+typedef struct {
+    cs_router_session *session;
+} cs_router_viewer_data;
+
+typedef struct {
+    int worker;
+    cs_msg_assembler rx;
+} cs_router_worker_data;
+
+struct cs_router {
+    struct lws_context *context;
+    struct lws_vhost *public_vhost;
+    cs_router_config cfg;
+    cs_router_worker *workers;
+    int session_count;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static double worker_load(const cs_router_worker *worker) {
+    double load = worker->cpu;
+    double busy = 1.0 - worker->encode_headroom;
+    if (busy > load) {
+        load = busy;
+    }
+    if (worker->capacity > 0) {
+        double fill = (double)(worker->peers + worker->placed) / (double)worker->capacity;
+        if (fill > load) {
+            load = fill;
+        }
+    }
+    return load;
+}
+
+static int pick_worker(cs_router *router) {
+    uint64_t now = monotonic_ns();
+    uint64_t timeout_ns = (uint64_t)router->cfg.worker_timeout_ms * 1000000ull;
+    int best = -1;
+    double best_load = 0.0;
+
+    for (int i = 0; i < router->cfg.max_workers; ++i) {
+        cs_router_worker *worker = &router->workers[i];
+        if (!worker->active || now - worker->last_report_ns > timeout_ns || now < worker->backoff_until_ns) {
+            continue;
+        }
+        if (worker->capacity > 0 && worker->peers + worker->placed >= worker->capacity) {
+            continue;
+        }
+        double load = worker_load(worker);
+        if (best < 0 || load < best_load ||
+            (load == best_load && worker->peers + worker->placed < router->workers[best].peers + router->workers[best].placed)) {
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+static void free_session(cs_router *router, cs_router_session *session) {
+    cs_msg_queue_clear(&session->to_viewer);
+    cs_msg_queue_clear(&session->to_worker);
+    cs_msg_assembler_reset(&session->viewer_rx);
+    cs_msg_assembler_reset(&session->upstream_rx);
+    free(session);
+    router->session_count--;
+}
+
+static int connect_upstream(cs_router *router, cs_router_session *session) {
+    cs_router_worker *worker = &router->workers[session->worker];
+
+    struct lws_client_connect_info info;
+    memset(&info, 0, sizeof(info));
+    info.context = router->context;
+    info.vhost = router->public_vhost;
+    info.address = worker->host;
+    info.port = worker->port;
+    info.path = "/";
+    info.host = worker->host;
+    info.origin = worker->host;
+    info.protocol = "cs-signaling";
+    info.userdata = session;
+    info.pwsi = &session->upstream;
+
+    return lws_client_connect_via_info(&info) ? 0 : -1;
+}
+
+static int write_next(struct lws *wsi, cs_msg_queue *queue) {
+    size_t msg_len = 0;
+    unsigned char *msg = cs_msg_queue_peek(queue, &msg_len);
+    if (!msg) {
+        return 0;
+    }
+    if (lws_write(wsi, msg, msg_len, LWS_WRITE_TEXT) < (int)msg_len) {
+        return -1;
+    }
+    cs_msg_queue_pop(queue);
+    if (queue->head) {
+        lws_callback_on_writable(wsi);
+    }
+    return 0;
+}
+
+static int viewer_callback(cs_router *router, struct lws *wsi, enum lws_callback_reasons reason,
+                           cs_router_viewer_data *data, void *in, size_t len) {
+    cs_router_session *session = data ? data->session : NULL;
+
+    switch (reason) {
+    case LWS_CALLBACK_ESTABLISHED: {
+        int worker = pick_worker(router);
+        if (worker < 0) {
+            fprintf(stderr, "router: no worker available, rejecting viewer\n");
+            return -1;
+        }
+        session = (cs_router_session *)calloc(1, sizeof(cs_router_session));
+        if (!session) {
+            return -1;
+        }
+        session->viewer = wsi;
+        session->worker = worker;
+        data->session = session;
+        router->session_count++;
+        router->workers[worker].placed++;
+
+        if (connect_upstream(router, session) != 0) {
+            data->session = NULL;
+            router->workers[worker].placed--;
+            free_session(router, session);
+            return -1;
+        }
+        fprintf(stderr, "router: viewer placed on %s:%d (load %.2f)\n",
+                router->workers[worker].host, router->workers[worker].port,
+                worker_load(&router->workers[worker]));
+        break;
+    }
+    case LWS_CALLBACK_RECEIVE: {
+        if (!session) {
+            return -1;
+        }
+        int complete = cs_msg_assembler_append(&session->viewer_rx, wsi, in, len);
+        if (complete < 0) {
+            return -1;
+        }
+        if (complete) {
+            cs_msg_queue_push(&session->to_worker, session->viewer_rx.buf, session->viewer_rx.len);
+            cs_msg_assembler_reset(&session->viewer_rx);
+            if (session->upstream && session->upstream_ready) {
+                lws_callback_on_writable(session->upstream);
+            }
+        }
+        break;
+    }
+    case LWS_CALLBACK_SERVER_WRITEABLE:
+        if (!session) {
+            return -1;
+        }
+        if (write_next(wsi, &session->to_viewer) != 0) {
+            return -1;
+        }
+        // The worker went away; close once everything it sent is delivered.
+        if (!session->upstream && !session->to_viewer.head) {
+            return -1;
+        }
+        break;
+    case LWS_CALLBACK_CLOSED:
+        if (!session) {
+            break;
+        }
+        data->session = NULL;
+        session->viewer = NULL;
+        if (session->upstream) {
+            lws_callback_on_writable(session->upstream);
+        } else {
+            free_session(router, session);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int upstream_callback(cs_router *router, struct lws *wsi, enum lws_callback_reasons reason,
+                             cs_router_session *session, void *in, size_t len) {
+    if (!session) {
+        return 0;
+    }
+
+    switch (reason) {
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        session->upstream_ready = 1;
+        if (!session->viewer) {
+            return -1;
+        }
+        if (session->to_worker.head) {
+            lws_callback_on_writable(wsi);
+        }
+        break;
+    case LWS_CALLBACK_CLIENT_RECEIVE: {
+        int complete = cs_msg_assembler_append(&session->upstream_rx, wsi, in, len);
+        if (complete < 0) {
+            return -1;
+        }
+        if (complete) {
+            cs_msg_queue_push(&session->to_viewer, session->upstream_rx.buf, session->upstream_rx.len);
+            cs_msg_assembler_reset(&session->upstream_rx);
+            if (session->viewer) {
+                lws_callback_on_writable(session->viewer);
+            }
+        }
+        break;
+    }
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+        if (!session->viewer) {
+            return -1;
+        }
+        if (write_next(wsi, &session->to_worker) != 0) {
+            return -1;
+        }
+        break;
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        session->upstream = NULL;
+        session->upstream_ready = 0;
+        if (reason == LWS_CALLBACK_CLIENT_CONNECTION_ERROR) {
+            // Its control connection may still be fine, so only stop placing
+            // on it for a while; the slot stays with that connection.
+            cs_router_worker *worker = &router->workers[session->worker];
+            fprintf(stderr, "router: worker %s:%d unreachable\n", worker->host, worker->port);
+            worker->backoff_until_ns = monotonic_ns() + (uint64_t)router->cfg.worker_timeout_ms * 1000000ull;
+        }
+        if (session->viewer) {
+            lws_callback_on_writable(session->viewer);
+        } else {
+            free_session(router, session);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int signaling_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_router *router = (cs_router *)lws_context_user(lws_get_context(wsi));
+
+    switch (reason) {
+    case LWS_CALLBACK_ESTABLISHED:
+    case LWS_CALLBACK_RECEIVE:
+    case LWS_CALLBACK_SERVER_WRITEABLE:
+    case LWS_CALLBACK_CLOSED:
+        return viewer_callback(router, wsi, reason, (cs_router_viewer_data *)user, in, len);
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+    case LWS_CALLBACK_CLIENT_RECEIVE:
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        return upstream_callback(router, wsi, reason, (cs_router_session *)user, in, len);
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int register_worker(cs_router *router, struct lws *wsi, int current, const char *payload) {
+    char host[128];
+    int port = 0;
+    if (cs_json_get_string(payload, "host", host, sizeof(host)) != 0 ||
+        cs_json_get_int(payload, "port", &port) != 0 || port <= 0) {
+        return current;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < router->cfg.max_workers; ++i) {
+        cs_router_worker *worker = &router->workers[i];
+        if (worker->port == port && strcmp(worker->host, host) == 0) {
+            // A live worker keeps its slot until its own connection closes.
+            if (worker->wsi && worker->wsi != wsi) {
+                fprintf(stderr, "router: %s:%d is already registered on another connection\n", host, port);
+                return current;
+            }
+            slot = i;
+            break;
+        }
+        // A slot is free only once its control connection has closed.
+        if (slot < 0 && !worker->active && !worker->wsi) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        fprintf(stderr, "router: worker table full, ignoring %s:%d\n", host, port);
+        return current;
+    }
+    if (current >= 0 && current != slot) {
+        fprintf(stderr, "router: connection already registered, ignoring %s:%d\n", host, port);
+        return current;
+    }
+
+    cs_router_worker *worker = &router->workers[slot];
+    memset(worker, 0, sizeof(*worker));
+    worker->active = 1;
+    worker->wsi = wsi;
+    snprintf(worker->host, sizeof(worker->host), "%s", host);
+    worker->port = port;
+    worker->encode_headroom = 1.0;
+    worker->last_report_ns = monotonic_ns();
+    fprintf(stderr, "router: worker %s:%d registered\n", worker->host, worker->port);
+    return slot;
+}
+
+static int worker_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_router *router = (cs_router *)lws_context_user(lws_get_context(wsi));
+    cs_router_worker_data *data = (cs_router_worker_data *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_ESTABLISHED:
+        data->worker = -1;
+        memset(&data->rx, 0, sizeof(data->rx));
+        break;
+    case LWS_CALLBACK_RECEIVE: {
+        if (data->rx.len + len > CS_ROUTER_MAX_CONTROL) {
+            return -1;
+        }
+        int complete = cs_msg_assembler_append(&data->rx, wsi, in, len);
+        if (complete < 0) {
+            return -1;
+        }
+        if (!complete) {
+            break;
+        }
+        const char *payload = data->rx.buf;
+        char type[16];
+        if (cs_json_get_string(payload, "type", type, sizeof(type)) != 0) {
+            cs_msg_assembler_reset(&data->rx);
+            break;
+        }
+        if (strcmp(type, "register") == 0) {
+            data->worker = register_worker(router, wsi, data->worker, payload);
+        } else if (strcmp(type, "load") == 0 && data->worker >= 0 &&
+                   router->workers[data->worker].wsi == wsi) {
+            // A worker that re-registered on a new connection owns the slot;
+            // reports from the old one are dropped.
+            cs_router_worker *worker = &router->workers[data->worker];
+            cs_json_get_double(payload, "cpu", &worker->cpu);
+            cs_json_get_double(payload, "encode_headroom", &worker->encode_headroom);
+            cs_json_get_int(payload, "peers", &worker->peers);
+            cs_json_get_int(payload, "capacity", &worker->capacity);
+            worker->placed = 0;
+            worker->last_report_ns = monotonic_ns();
+        }
+        cs_msg_assembler_reset(&data->rx);
+        break;
+    }
+    case LWS_CALLBACK_CLOSED:
+        cs_msg_assembler_reset(&data->rx);
+        if (data->worker >= 0 && router->workers[data->worker].wsi == wsi) {
+            fprintf(stderr, "router: worker %s:%d disconnected\n",
+                    router->workers[data->worker].host, router->workers[data->worker].port);
+            router->workers[data->worker].active = 0;
+            router->workers[data->worker].wsi = NULL;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+cs_router *cs_router_create(const cs_router_config *config) {
+    if (!config || config->max_workers <= 0) {
+        return NULL;
+    }
+
+    cs_router *router = (cs_router *)calloc(1, sizeof(cs_router));
+    if (!router) {
+        return NULL;
+    }
+
+    router->cfg = *config;
+    if (router->cfg.worker_timeout_ms <= 0) {
+        router->cfg.worker_timeout_ms = 3000;
+    }
+
+    router->workers = (cs_router_worker *)calloc((size_t)router->cfg.max_workers, sizeof(cs_router_worker));
+    if (!router->workers) {
+        free(router);
+        return NULL;
+    }
+
+    static const struct lws_protocols viewer_protocols[] = {
+        { "cs-signaling", signaling_callback, sizeof(cs_router_viewer_data), 8192 },
+        { NULL, NULL, 0, 0 }
+    };
+    static const struct lws_protocols worker_protocols[] = {
+        { "cs-worker", worker_callback, sizeof(cs_router_worker_data), 1024 },
+        { NULL, NULL, 0, 0 }
+    };
+
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.user = router;
+    info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT | LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
+
+    router->context = lws_create_context(&info);
+    if (!router->context) {
+        free(router->workers);
+        free(router);
+        return NULL;
+    }
+
+    // Viewers and workers get separate listeners: a viewer cannot register
+    // as a worker and have other viewers' signaling relayed to it.
+    info.vhost_name = "signaling";
+    info.port = router->cfg.port;
+    info.protocols = viewer_protocols;
+    router->public_vhost = lws_create_vhost(router->context, &info);
+    info.vhost_name = "workers";
+    info.port = router->cfg.worker_port;
+    info.iface = router->cfg.worker_iface && router->cfg.worker_iface[0] ? router->cfg.worker_iface : NULL;
+    info.protocols = worker_protocols;
+    if (!router->public_vhost || !lws_create_vhost(router->context, &info)) {
+        lws_context_destroy(router->context);
+        free(router->workers);
+        free(router);
+        return NULL;
+    }
+
+    return router;
+}
+
+void cs_router_destroy(cs_router *router) {
+    if (!router) {
+        return;
+    }
+
+    // Destroying the context closes every connection, which frees sessions.
+    if (router->context) {
+        lws_context_destroy(router->context);
+    }
+
+    free(router->workers);
+    free(router);
+}
+
+int cs_router_poll(cs_router *router, int timeout_ms) {
+    if (!router || !router->context) {
+        return -1;
+    }
+    lws_service(router->context, timeout_ms);
+    return 0;
+}
@@ -0,0 +1,524 @@
+#include "scene.h"
+
+#include "shader.h"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define CS_SCENE_SPACING 3.0f
+#define CS_SCENE_BASE_SPIN ((float)(2.0 * M_PI) / 4.0f)
+#define CS_SCENE_INSTANCE_FLOATS 6
+
+typedef void (GL_APIENTRYP cs_pfn_gen_vertex_arrays)(GLsizei n, GLuint *arrays);
+typedef void (GL_APIENTRYP cs_pfn_bind_vertex_array)(GLuint array);
+typedef void (GL_APIENTRYP cs_pfn_delete_vertex_arrays)(GLsizei n, const GLuint *arrays);
+typedef void (GL_APIENTRYP cs_pfn_vertex_attrib_divisor)(GLuint index, GLuint divisor);
+typedef void (GL_APIENTRYP cs_pfn_draw_elements_instanced)(GLenum mode, GLsizei count, GLenum type,
+                                                           const void *indices, GLsizei instances);
+
+typedef struct {
+    float pos[3];
+    float color[3];
+} vertex;
+
+// 4 vertices per face so each face keeps a flat colour.
+static const vertex cube_vertices[] = {
+    // Front (red)
+    {{-1, -1,  1}, {1, 0, 0}}, {{ 1, -1,  1}, {1, 0, 0}}, {{ 1,  1,  1}, {1, 0, 0}}, {{-1,  1,  1}, {1, 0, 0}},
+    // Back (green)
+    {{ 1, -1, -1}, {0, 1, 0}}, {{-1, -1, -1}, {0, 1, 0}}, {{-1,  1, -1}, {0, 1, 0}}, {{ 1,  1, -1}, {0, 1, 0}},
+    // Left (blue)
+    {{-1, -1, -1}, {0, 0, 1}}, {{-1, -1,  1}, {0, 0, 1}}, {{-1,  1,  1}, {0, 0, 1}}, {{-1,  1, -1}, {0, 0, 1}},
+    // Right (yellow)
+    {{ 1, -1,  1}, {1, 1, 0}}, {{ 1, -1, -1}, {1, 1, 0}}, {{ 1,  1, -1}, {1, 1, 0}}, {{ 1,  1,  1}, {1, 1, 0}},
+    // Top (cyan)
+    {{-1,  1,  1}, {0, 1, 1}}, {{ 1,  1,  1}, {0, 1, 1}}, {{ 1,  1, -1}, {0, 1, 1}}, {{-1,  1, -1}, {0, 1, 1}},
+    // Bottom (magenta)
+    {{-1, -1, -1}, {1, 0, 1}}, {{ 1, -1, -1}, {1, 0, 1}}, {{ 1, -1,  1}, {1, 0, 1}}, {{-1, -1,  1}, {1, 0, 1}},
+};
+
+static const GLushort cube_indices[] = {
+     0,  1,  2,  0,  2,  3,
+     4,  5,  6,  4,  6,  7,
+     8,  9, 10,  8, 10, 11,
+    12, 13, 14, 12, 14, 15,
+    16, 17, 18, 16, 18, 19,
+    20, 21, 22, 20, 22, 23,
+};
+
+#define CS_CUBE_INDEX_COUNT ((GLsizei)(sizeof(cube_indices) / sizeof(cube_indices[0])))
+
+struct cs_scene {
+    int count;
+    float extent;
+
+    // Instance state, structure-of-arrays.
+    float *x;
+    float *y;
+    float *z;
+    float *scale;
+    float *yaw;
+    float *pitch;
+    float *spin;
+
+    // Packed per-visible-instance upload: x, y, z, scale, yaw, pitch.
+    float *upload;
+
+    // Set on scenes made by cs_scene_create_shared: layout and geometry
+    // belong to the source; yaw and pitch live in angles.
+    const cs_scene *source;
+    float *angles;
+
+    GLuint program;
+    GLuint vbo;
+    GLuint ibo;
+    GLuint instance_vbo;
+    GLuint vao;
+    GLint loc_pos;
+    GLint loc_color;
+    GLint loc_offset_scale;
+    GLint loc_rotation;
+    GLint loc_view_proj;
+
+    cs_pfn_gen_vertex_arrays gen_vertex_arrays;
+    cs_pfn_bind_vertex_array bind_vertex_array;
+    cs_pfn_delete_vertex_arrays delete_vertex_arrays;
+    cs_pfn_vertex_attrib_divisor vertex_attrib_divisor;
+    cs_pfn_draw_elements_instanced draw_elements_instanced;
+};
+
+static int has_extension(const char *name) {
+    const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+    size_t len = strlen(name);
+    while (exts && *exts) {
+        const char *end = strchr(exts, ' ');
+        size_t n = end ? (size_t)(end - exts) : strlen(exts);
+        if (n == len && strncmp(exts, name, len) == 0) {
+            return 1;
+        }
+        exts = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+// ES 3.0 has VAOs and instancing in core; ES 2.0 may expose them as extensions.
+static void load_entry_points(cs_scene *scene) {
+    const char *version = (const char *)glGetString(GL_VERSION);
+    int es3 = version && strncmp(version, "OpenGL ES 3", 11) == 0;
+
+    if (es3) {
+        scene->gen_vertex_arrays = (cs_pfn_gen_vertex_arrays)eglGetProcAddress("glGenVertexArrays");
+        scene->bind_vertex_array = (cs_pfn_bind_vertex_array)eglGetProcAddress("glBindVertexArray");
+        scene->delete_vertex_arrays = (cs_pfn_delete_vertex_arrays)eglGetProcAddress("glDeleteVertexArrays");
+        scene->vertex_attrib_divisor = (cs_pfn_vertex_attrib_divisor)eglGetProcAddress("glVertexAttribDivisor");
+        scene->draw_elements_instanced = (cs_pfn_draw_elements_instanced)eglGetProcAddress("glDrawElementsInstanced");
+    } else {
+        if (has_extension("GL_OES_vertex_array_object")) {
+            scene->gen_vertex_arrays = (cs_pfn_gen_vertex_arrays)eglGetProcAddress("glGenVertexArraysOES");
+            scene->bind_vertex_array = (cs_pfn_bind_vertex_array)eglGetProcAddress("glBindVertexArrayOES");
+            scene->delete_vertex_arrays = (cs_pfn_delete_vertex_arrays)eglGetProcAddress("glDeleteVertexArraysOES");
+        }
+        if (has_extension("GL_EXT_instanced_arrays")) {
+            scene->vertex_attrib_divisor = (cs_pfn_vertex_attrib_divisor)eglGetProcAddress("glVertexAttribDivisorEXT");
+            scene->draw_elements_instanced = (cs_pfn_draw_elements_instanced)eglGetProcAddress("glDrawElementsInstancedEXT");
+        } else if (has_extension("GL_ANGLE_instanced_arrays")) {
+            scene->vertex_attrib_divisor = (cs_pfn_vertex_attrib_divisor)eglGetProcAddress("glVertexAttribDivisorANGLE");
+            scene->draw_elements_instanced = (cs_pfn_draw_elements_instanced)eglGetProcAddress("glDrawElementsInstancedANGLE");
+        }
+    }
+
+    if (!scene->gen_vertex_arrays || !scene->bind_vertex_array || !scene->delete_vertex_arrays) {
+        scene->gen_vertex_arrays = NULL;
+        scene->bind_vertex_array = NULL;
+        scene->delete_vertex_arrays = NULL;
+    }
+    if (!scene->vertex_attrib_divisor || !scene->draw_elements_instanced) {
+        scene->vertex_attrib_divisor = NULL;
+        scene->draw_elements_instanced = NULL;
+    }
+}
+
+static float random_unit(unsigned int *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return (float)(*state >> 8) / (float)(1u << 24);
+}
+
+static void layout_instances(cs_scene *scene, unsigned int seed) {
+    if (scene->count == 1) {
+        // The classic single cube at the origin.
+        scene->x[0] = scene->y[0] = scene->z[0] = 0.0f;
+        scene->scale[0] = 1.0f;
+        scene->yaw[0] = scene->pitch[0] = 0.0f;
+        scene->spin[0] = 1.0f;
+        scene->extent = 1.0f;
+        return;
+    }
+
+    int side = (int)ceilf(cbrtf((float)scene->count));
+    float half = (float)(side - 1) * 0.5f;
+    unsigned int state = seed ? seed : 1u;
+    for (int i = 0; i < scene->count; ++i) {
+        int ix = i % side;
+        int iy = (i / side) % side;
+        int iz = i / (side * side);
+        scene->x[i] = ((float)ix - half) * CS_SCENE_SPACING;
+        scene->y[i] = ((float)iy - half) * CS_SCENE_SPACING;
+        scene->z[i] = ((float)iz - half) * CS_SCENE_SPACING;
+        scene->scale[i] = 0.5f + 0.5f * random_unit(&state);
+        scene->yaw[i] = random_unit(&state) * (float)(2.0 * M_PI);
+        scene->pitch[i] = random_unit(&state) * (float)(2.0 * M_PI);
+        scene->spin[i] = 0.5f + random_unit(&state);
+    }
+    scene->extent = (half + 1.0f) * CS_SCENE_SPACING;
+}
+
+static void bind_attributes(cs_scene *scene) {
+    glBindBuffer(GL_ARRAY_BUFFER, scene->vbo);
+    glEnableVertexAttribArray((GLuint)scene->loc_pos);
+    glEnableVertexAttribArray((GLuint)scene->loc_color);
+    glVertexAttribPointer((GLuint)scene->loc_pos, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)0);
+    glVertexAttribPointer((GLuint)scene->loc_color, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(sizeof(float) * 3));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene->ibo);
+
+    if (scene->draw_elements_instanced) {
+        GLsizei stride = (GLsizei)(sizeof(float) * CS_SCENE_INSTANCE_FLOATS);
+        glBindBuffer(GL_ARRAY_BUFFER, scene->instance_vbo);
+        glEnableVertexAttribArray((GLuint)scene->loc_offset_scale);
+        glEnableVertexAttribArray((GLuint)scene->loc_rotation);
+        glVertexAttribPointer((GLuint)scene->loc_offset_scale, 4, GL_FLOAT, GL_FALSE, stride, (void *)0);
+        glVertexAttribPointer((GLuint)scene->loc_rotation, 2, GL_FLOAT, GL_FALSE, stride, (void *)(sizeof(float) * 4));
+        scene->vertex_attrib_divisor((GLuint)scene->loc_offset_scale, 1);
+        scene->vertex_attrib_divisor((GLuint)scene->loc_rotation, 1);
+    }
+}
+
+cs_scene *cs_scene_create(const cs_scene_config *config) {
+    if (!config || config->object_count <= 0) {
+        return NULL;
+    }
+
+    cs_scene *scene = (cs_scene *)calloc(1, sizeof(cs_scene));
+    if (!scene) {
+        return NULL;
+    }
+
+    size_t n = (size_t)config->object_count;
+    scene->count = config->object_count;
+    scene->x = (float *)malloc(n * sizeof(float) * 7);
+    scene->upload = (float *)malloc(n * sizeof(float) * CS_SCENE_INSTANCE_FLOATS);
+    if (!scene->x || !scene->upload) {
+        cs_scene_destroy(scene);
+        return NULL;
+    }
+    scene->y = scene->x + n;
+    scene->z = scene->y + n;
+    scene->scale = scene->z + n;
+    scene->yaw = scene->scale + n;
+    scene->pitch = scene->yaw + n;
+    scene->spin = scene->pitch + n;
+    layout_instances(scene, config->seed);
+
+    cs_shader_config shader_cfg = { .asset_dir = config->asset_dir, .cache_dir = config->shader_cache_dir };
+    scene->program = cs_shader_program(&shader_cfg, "cube");
+    if (!scene->program) {
+        cs_scene_destroy(scene);
+        return NULL;
+    }
+    scene->loc_pos = glGetAttribLocation(scene->program, "a_pos");
+    scene->loc_color = glGetAttribLocation(scene->program, "a_color");
+    scene->loc_offset_scale = glGetAttribLocation(scene->program, "a_offset_scale");
+    scene->loc_rotation = glGetAttribLocation(scene->program, "a_rotation");
+    scene->loc_view_proj = glGetUniformLocation(scene->program, "u_view_proj");
+
+    load_entry_points(scene);
+
+    glGenBuffers(1, &scene->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, scene->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &scene->ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_indices), cube_indices, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &scene->instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, scene->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(n * sizeof(float) * CS_SCENE_INSTANCE_FLOATS), NULL, GL_STREAM_DRAW);
+
+    // Attribute state is captured once in the VAO; without one it is set here
+    // and left bound, since the scene is the only user of the context.
+    if (scene->gen_vertex_arrays) {
+        scene->gen_vertex_arrays(1, &scene->vao);
+        scene->bind_vertex_array(scene->vao);
+    }
+    bind_attributes(scene);
+
+    glUseProgram(scene->program);
+    return scene;
+}
+
+cs_scene *cs_scene_create_shared(const cs_scene *source, const cs_scene_config *config) {
+    if (!source || source->source || !config) {
+        return NULL;
+    }
+
+    cs_scene *scene = (cs_scene *)calloc(1, sizeof(cs_scene));
+    if (!scene) {
+        return NULL;
+    }
+
+    size_t n = (size_t)source->count;
+    scene->source = source;
+    scene->count = source->count;
+    scene->extent = source->extent;
+    scene->angles = (float *)malloc(n * sizeof(float) * 2);
+    scene->upload = (float *)malloc(n * sizeof(float) * CS_SCENE_INSTANCE_FLOATS);
+    if (!scene->angles || !scene->upload) {
+        cs_scene_destroy(scene);
+        return NULL;
+    }
+    scene->x = source->x;
+    scene->y = source->y;
+    scene->z = source->z;
+    scene->scale = source->scale;
+    scene->spin = source->spin;
+    scene->yaw = scene->angles;
+    scene->pitch = scene->angles + n;
+    memcpy(scene->yaw, source->yaw, n * sizeof(float));
+    memcpy(scene->pitch, source->pitch, n * sizeof(float));
+
+    // Uniforms are program state, so a shared program would let contexts
+    // drawing concurrently overwrite each other's u_view_proj.
+    cs_shader_config shader_cfg = { .asset_dir = config->asset_dir, .cache_dir = config->shader_cache_dir };
+    scene->program = cs_shader_program(&shader_cfg, "cube");
+    if (!scene->program) {
+        cs_scene_destroy(scene);
+        return NULL;
+    }
+    scene->loc_pos = glGetAttribLocation(scene->program, "a_pos");
+    scene->loc_color = glGetAttribLocation(scene->program, "a_color");
+    scene->loc_offset_scale = glGetAttribLocation(scene->program, "a_offset_scale");
+    scene->loc_rotation = glGetAttribLocation(scene->program, "a_rotation");
+    scene->loc_view_proj = glGetUniformLocation(scene->program, "u_view_proj");
+    scene->vbo = source->vbo;
+    scene->ibo = source->ibo;
+
+    load_entry_points(scene);
+
+    // Container objects (VAOs) are never shared between contexts, and the
+    // instance buffer is rewritten every frame.
+    glGenBuffers(1, &scene->instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, scene->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(n * sizeof(float) * CS_SCENE_INSTANCE_FLOATS), NULL, GL_STREAM_DRAW);
+    if (scene->gen_vertex_arrays) {
+        scene->gen_vertex_arrays(1, &scene->vao);
+        scene->bind_vertex_array(scene->vao);
+    }
+    bind_attributes(scene);
+
+    glUseProgram(scene->program);
+    return scene;
+}
+
+void cs_scene_destroy(cs_scene *scene) {
+    if (!scene) {
+        return;
+    }
+
+    if (scene->vao) {
+        scene->delete_vertex_arrays(1, &scene->vao);
+    }
+    if (scene->instance_vbo) {
+        glDeleteBuffers(1, &scene->instance_vbo);
+    }
+    if (scene->program) {
+        glDeleteProgram(scene->program);
+    }
+    if (scene->source) {
+        free(scene->angles);
+        free(scene->upload);
+        free(scene);
+        return;
+    }
+    if (scene->ibo) {
+        glDeleteBuffers(1, &scene->ibo);
+    }
+    if (scene->vbo) {
+        glDeleteBuffers(1, &scene->vbo);
+    }
+
+    free(scene->x);
+    free(scene->upload);
+    free(scene);
+}
+
+float cs_scene_view_distance(const cs_scene *scene) {
+    if (!scene || scene->count == 1) {
+        return 5.0f;
+    }
+    return scene->extent * 2.5f;
+}
+
+void cs_scene_update(cs_scene *scene, float dt) {
+    if (!scene) {
+        return;
+    }
+
+    const float step = CS_SCENE_BASE_SPIN * dt;
+    const float two_pi = (float)(2.0 * M_PI);
+    for (int i = 0; i < scene->count; ++i) {
+        float yaw = scene->yaw[i] + scene->spin[i] * step;
+        scene->yaw[i] = yaw >= two_pi ? yaw - two_pi : yaw;
+        float pitch = scene->pitch[i] + scene->spin[i] * step * 0.7f;
+        scene->pitch[i] = pitch >= two_pi ? pitch - two_pi : pitch;
+    }
+}
+
+typedef struct {
+    float a, b, c, d;
+} plane;
+
+// Gribb/Hartmann plane extraction from a column-major view-projection matrix.
+static void extract_frustum(const mat4 *vp, plane planes[6]) {
+    const float *m = vp->m;
+    for (int i = 0; i < 3; ++i) {
+        for (int sign = 0; sign < 2; ++sign) {
+            float s = sign ? -1.0f : 1.0f;
+            plane *p = &planes[i * 2 + sign];
+            p->a = m[3] + s * m[i];
+            p->b = m[7] + s * m[4 + i];
+            p->c = m[11] + s * m[8 + i];
+            p->d = m[15] + s * m[12 + i];
+            float len = sqrtf(p->a * p->a + p->b * p->b + p->c * p->c);
+            if (len > 0.0f) {
+                p->a /= len;
+                p->b /= len;
+                p->c /= len;
+                p->d /= len;
+            }
+        }
+    }
+}
+
+// Grows bounds by the projection of a bounding sphere. The view part of
+// view_proj is rigid, so the clip-space x/y rows have the projection's scale
+// as their length; dividing by the nearest depth (w - r) keeps it conservative.
+static void grow_bounds(const mat4 *view_proj, float sx, float sy, float x, float y, float z, float r,
+                        float bounds[4]) {
+    const float *m = view_proj->m;
+    float cx = m[0] * x + m[4] * y + m[8] * z + m[12];
+    float cy = m[1] * x + m[5] * y + m[9] * z + m[13];
+    float w = m[3] * x + m[7] * y + m[11] * z + m[15];
+    float near_w = w - r;
+    if (near_w <= 1e-3f) {
+        // The sphere reaches the camera plane; it can cover anything.
+        bounds[0] = -1.0f;
+        bounds[1] = -1.0f;
+        bounds[2] = 1.0f;
+        bounds[3] = 1.0f;
+        return;
+    }
+    float rx = r * sx / near_w;
+    float ry = r * sy / near_w;
+    cx /= w;
+    cy /= w;
+    bounds[0] = fminf(bounds[0], cx - rx);
+    bounds[1] = fminf(bounds[1], cy - ry);
+    bounds[2] = fmaxf(bounds[2], cx + rx);
+    bounds[3] = fmaxf(bounds[3], cy + ry);
+}
+
+static int cull_and_pack(cs_scene *scene, const mat4 *view_proj, float *bounds) {
+    plane planes[6];
+    extract_frustum(view_proj, planes);
+
+    // Bounding sphere of a unit cube scaled by s has radius s * sqrt(3).
+    const float radius_scale = 1.7320508f;
+    float *out = scene->upload;
+    int visible = 0;
+
+    const float *m = view_proj->m;
+    float sx = sqrtf(m[0] * m[0] + m[4] * m[4] + m[8] * m[8]);
+    float sy = sqrtf(m[1] * m[1] + m[5] * m[5] + m[9] * m[9]);
+    if (bounds) {
+        bounds[0] = 1.0f;
+        bounds[1] = 1.0f;
+        bounds[2] = -1.0f;
+        bounds[3] = -1.0f;
+    }
+
+    for (int i = 0; i < scene->count; ++i) {
+        float x = scene->x[i];
+        float y = scene->y[i];
+        float z = scene->z[i];
+        float r = -scene->scale[i] * radius_scale;
+        int inside = 1;
+        for (int p = 0; p < 6; ++p) {
+            inside &= planes[p].a * x + planes[p].b * y + planes[p].c * z + planes[p].d >= r;
+        }
+        if (!inside) {
+            continue;
+        }
+        if (bounds) {
+            grow_bounds(view_proj, sx, sy, x, y, z, -r, bounds);
+        }
+        out[0] = x;
+        out[1] = y;
+        out[2] = z;
+        out[3] = scene->scale[i];
+        out[4] = scene->yaw[i];
+        out[5] = scene->pitch[i];
+        out += CS_SCENE_INSTANCE_FLOATS;
+        visible++;
+    }
+    return visible;
+}
+
+int cs_scene_draw(cs_scene *scene, const mat4 *view_proj, cs_scene_stats *stats) {
+    if (!scene || !view_proj) {
+        return -1;
+    }
+
+    int visible = cull_and_pack(scene, view_proj, stats ? stats->bounds : NULL);
+    int draw_calls = 0;
+
+    if (scene->bind_vertex_array) {
+        scene->bind_vertex_array(scene->vao);
+    }
+    glUniformMatrix4fv(scene->loc_view_proj, 1, GL_FALSE, view_proj->m);
+
+    if (visible > 0 && scene->draw_elements_instanced) {
+        GLsizeiptr bytes = (GLsizeiptr)((size_t)visible * sizeof(float) * CS_SCENE_INSTANCE_FLOATS);
+        glBindBuffer(GL_ARRAY_BUFFER, scene->instance_vbo);
+        // Orphan the previous contents so the upload does not wait on the GPU.
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((size_t)scene->count * sizeof(float) * CS_SCENE_INSTANCE_FLOATS),
+                     NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, scene->upload);
+        scene->draw_elements_instanced(GL_TRIANGLES, CS_CUBE_INDEX_COUNT, GL_UNSIGNED_SHORT, (void *)0, visible);
+        draw_calls = 1;
+    } else {
+        // No instancing: feed instance data as constant attributes per draw.
+        const float *inst = scene->upload;
+        for (int i = 0; i < visible; ++i, inst += CS_SCENE_INSTANCE_FLOATS) {
+            glVertexAttrib4f((GLuint)scene->loc_offset_scale, inst[0], inst[1], inst[2], inst[3]);
+            glVertexAttrib2f((GLuint)scene->loc_rotation, inst[4], inst[5]);
+            glDrawElements(GL_TRIANGLES, CS_CUBE_INDEX_COUNT, GL_UNSIGNED_SHORT, (void *)0);
+        }
+        draw_calls = visible;
+    }
+
+    if (stats) {
+        stats->visible = visible;
+        stats->draw_calls = draw_calls;
+        for (int i = 0; i < 4; ++i) {
+            stats->bounds[i] = fmaxf(-1.0f, fminf(1.0f, stats->bounds[i]));
+        }
+    }
+    return 0;
+}
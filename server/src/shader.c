@@ -0,0 +1,260 @@
+#include "shader.h"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef CS_ASSET_DIR
+#define CS_ASSET_DIR "assets"
+#endif
+
+#define CS_SHADER_MAX_SOURCE (64 * 1024)
+#define CS_SHADER_CACHE_MAGIC 0x42505343u /* "CSPB" */
+#define CS_SHADER_GL_PROGRAM_BINARY_LENGTH 0x8741
+#define CS_SHADER_GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+typedef void (GL_APIENTRYP cs_pfn_get_program_binary)(GLuint program, GLsizei buf_size, GLsizei *length,
+                                                      GLenum *format, void *binary);
+typedef void (GL_APIENTRYP cs_pfn_program_binary)(GLuint program, GLenum format, const void *binary,
+                                                  GLint length);
+
+typedef struct {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t length;
+    uint32_t reserved;
+} cs_shader_cache_header;
+
+typedef struct {
+    cs_pfn_get_program_binary get_binary;
+    cs_pfn_program_binary load_binary;
+} cs_shader_binary_api;
+
+static char *read_text(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Shader: cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    char *text = (char *)malloc(CS_SHADER_MAX_SOURCE + 1);
+    size_t len = text ? fread(text, 1, CS_SHADER_MAX_SOURCE + 1, file) : 0;
+    fclose(file);
+    if (!text || len > CS_SHADER_MAX_SOURCE) {
+        fprintf(stderr, "Shader: %s is too large\n", path);
+        free(text);
+        return NULL;
+    }
+    text[len] = '\0';
+    return text;
+}
+
+static uint64_t fnv1a(uint64_t hash, const char *text) {
+    for (const unsigned char *p = (const unsigned char *)(text ? text : ""); *p; ++p) {
+        hash ^= *p;
+        hash *= 0x100000001b3ull;
+    }
+    // Separator so ("ab", "c") and ("a", "bc") differ.
+    hash ^= 0xff;
+    return hash * 0x100000001b3ull;
+}
+
+static int has_extension(const char *name) {
+    const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+    size_t len = strlen(name);
+    while (exts && *exts) {
+        const char *end = strchr(exts, ' ');
+        size_t n = end ? (size_t)(end - exts) : strlen(exts);
+        if (n == len && strncmp(exts, name, len) == 0) {
+            return 1;
+        }
+        exts = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+// ES 3.0 has program binaries in core; ES 2.0 may expose the OES extension.
+// Either way a driver reporting no binary formats cannot use them.
+static int load_binary_api(cs_shader_binary_api *api) {
+    const char *version = (const char *)glGetString(GL_VERSION);
+    memset(api, 0, sizeof(*api));
+    if (version && strncmp(version, "OpenGL ES 3", 11) == 0) {
+        api->get_binary = (cs_pfn_get_program_binary)eglGetProcAddress("glGetProgramBinary");
+        api->load_binary = (cs_pfn_program_binary)eglGetProcAddress("glProgramBinary");
+    } else if (has_extension("GL_OES_get_program_binary")) {
+        api->get_binary = (cs_pfn_get_program_binary)eglGetProcAddress("glGetProgramBinaryOES");
+        api->load_binary = (cs_pfn_program_binary)eglGetProcAddress("glProgramBinaryOES");
+    }
+    GLint formats = 0;
+    glGetIntegerv(CS_SHADER_GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    return api->get_binary && api->load_binary && formats > 0 ? 0 : -1;
+}
+
+static int make_dirs(const char *path) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char *p = buf + 1; *p; ++p) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(buf, 0755) != 0 && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    return mkdir(buf, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+static GLuint load_cached(const cs_shader_binary_api *api, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    cs_shader_cache_header header;
+    void *binary = NULL;
+    GLuint program = 0;
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == CS_SHADER_CACHE_MAGIC &&
+        header.length > 0 && header.length <= 16u * 1024 * 1024) {
+        binary = malloc(header.length);
+        if (binary && fread(binary, 1, header.length, file) == header.length) {
+            program = glCreateProgram();
+            api->load_binary(program, (GLenum)header.format, binary, (GLint)header.length);
+            GLint ok = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &ok);
+            if (!ok) {
+                // A driver update invalidates binaries; rebuild from source.
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+    }
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    free(binary);
+    fclose(file);
+    return program;
+}
+
+static void store_cached(const cs_shader_binary_api *api, GLuint program, const char *cache_dir,
+                         const char *path) {
+    GLint length = 0;
+    glGetProgramiv(program, CS_SHADER_GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || make_dirs(cache_dir) != 0) {
+        return;
+    }
+    void *binary = malloc((size_t)length);
+    if (!binary) {
+        return;
+    }
+    GLenum format = 0;
+    GLsizei written = 0;
+    api->get_binary(program, length, &written, &format, binary);
+    if (glGetError() != GL_NO_ERROR || written <= 0) {
+        free(binary);
+        return;
+    }
+
+    // Written aside and renamed so a concurrent start never reads half a file.
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    FILE *file = fopen(tmp, "wb");
+    if (file) {
+        cs_shader_cache_header header = { CS_SHADER_CACHE_MAGIC, (uint32_t)format, (uint32_t)written, 0 };
+        int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(binary, 1, (size_t)written, file) == (size_t)written;
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(tmp, path) != 0) {
+            unlink(tmp);
+        }
+    }
+    free(binary);
+}
+
+static GLuint compile_shader(GLenum type, const char *source, const char *path) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024] = "";
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "Shader: %s failed to compile: %s\n", path, log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static GLuint link_program(const char *vs_src, const char *fs_src, const char *vs_path, const char *fs_path) {
+    GLuint vs = compile_shader(GL_VERTEX_SHADER, vs_src, vs_path);
+    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fs_src, fs_path);
+    if (!vs || !fs) {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return 0;
+    }
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024] = "";
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        fprintf(stderr, "Shader: %s + %s failed to link: %s\n", vs_path, fs_path, log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+unsigned int cs_shader_program(const cs_shader_config *config, const char *name) {
+    const char *asset_dir = config && config->asset_dir && config->asset_dir[0] ? config->asset_dir : CS_ASSET_DIR;
+    const char *cache_dir = config && config->cache_dir && config->cache_dir[0] ? config->cache_dir : NULL;
+
+    char vs_path[512];
+    char fs_path[512];
+    snprintf(vs_path, sizeof(vs_path), "%s/shaders/%s.vert", asset_dir, name);
+    snprintf(fs_path, sizeof(fs_path), "%s/shaders/%s.frag", asset_dir, name);
+    char *vs_src = read_text(vs_path);
+    char *fs_src = read_text(fs_path);
+    if (!vs_src || !fs_src) {
+        free(vs_src);
+        free(fs_src);
+        return 0;
+    }
+
+    cs_shader_binary_api api;
+    char cache_path[560] = "";
+    if (cache_dir && load_binary_api(&api) == 0) {
+        uint64_t key = 0xcbf29ce484222325ull;
+        key = fnv1a(key, vs_src);
+        key = fnv1a(key, fs_src);
+        key = fnv1a(key, (const char *)glGetString(GL_VENDOR));
+        key = fnv1a(key, (const char *)glGetString(GL_RENDERER));
+        key = fnv1a(key, (const char *)glGetString(GL_VERSION));
+        snprintf(cache_path, sizeof(cache_path), "%s/%s-%016llx.bin", cache_dir, name, (unsigned long long)key);
+    }
+
+    GLuint program = cache_path[0] ? load_cached(&api, cache_path) : 0;
+    if (!program) {
+        program = link_program(vs_src, fs_src, vs_path, fs_path);
+        if (program && cache_path[0]) {
+            store_cached(&api, program, cache_dir, cache_path);
+        }
+    }
+    free(vs_src);
+    free(fs_src);
+    return program;
+}
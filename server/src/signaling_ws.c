@@ -1,187 +1,1399 @@
 #include "signaling.h"
 
+#include "assets.h"
+#include "json.h"
+#include "msg_queue.h"
+
 #include <libwebsockets.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+
+#ifndef CS_CLIENT_DIR
+#define CS_CLIENT_DIR "../client/dist"
+#endif
+
+#define CS_ROUTER_RETRY_NS 1000000000ull
+#define CS_WHEP_MAX_BODY (64 * 1024)
+// Answers go out with whatever was gathered by then, e.g. when STUN is
+// unreachable.
+#define CS_WHEP_GATHER_TIMEOUT_NS 2000000000ull
+
+typedef struct cs_signaling_client {
+    struct cs_signaling_client *next;
+    struct lws *wsi;
+    int peer_id;
+    cs_msg_queue queue;
+    cs_msg_assembler rx;
+} cs_signaling_client;
+
+// Units queued per stream viewer; a viewer further behind than this drops
+// its backlog and resumes at the next keyframe.
+#define CS_STREAM_QUEUE 32
+#define CS_STREAM_HEADER 12
+
+typedef struct cs_stream_client {
+    struct cs_stream_client *next;
+    struct lws *wsi;
+    int peer_id;
+    cs_msg_queue queue;
+    cs_msg_assembler rx;
+    cs_stream_unit *units[CS_STREAM_QUEUE];
+    int unit_head;
+    int unit_count;
+    int waiting_key;
+} cs_stream_client;
+
+// Largest body slice written per writable callback for /hls responses.
+#define CS_HLS_CHUNK 16384
+
+// One HTTP request under /hls. Requests for things that do not exist yet (a
+// blocking playlist reload, the preload-hinted part) wait on hls_waiting
+// until cs_signaling_hls_updated can answer them or their deadline passes.
+typedef struct cs_hls_request {
+    struct cs_hls_request *next;
+    struct lws *wsi;
+    int waiting;
+    uint64_t deadline_ns;
+    int playlist;
+    long long msn;
+    int part;
+    char name[64];
+    int status;
+    const char *content_type;
+    char cache_control[48];
+    char *text;
+    cs_hls_blob blob;
+    const uint8_t *body;
+    size_t body_len;
+    size_t sent;
+    int responding;
+    int headers_sent;
+} cs_hls_request;
+
+// Longest body a POST /trace may carry.
+#define CS_OPS_MAX_BODY 256
+
+// One request to an operator endpoint (/stats, /trace). These are for local tools,
+// so they carry no CORS headers; the body is owned and goes out in
+// CS_HLS_CHUNK slices like /hls responses.
+typedef struct {
+    int post;
+    char args[CS_OPS_MAX_BODY + 1];
+    size_t args_len;
+    int status;
+    const char *content_type;
+    char *body;
+    size_t body_len;
+    size_t sent;
+    int responding;
+    int headers_sent;
+} cs_ops_request;
+
+// One GET for the web client; the body stays in cs_assets, which outlives
+// every connection.
+typedef struct {
+    int status;
+    cs_asset asset;
+    int responding;
+} cs_client_request;
+
+typedef struct {
+    int mline;
+    char *candidate;
+} cs_whep_candidate;
+
+// A WHEP viewer: a peer created by an HTTP POST instead of a WebSocket. The
+// answer is held until ICE gathering finishes so it carries every server
+// candidate and no trickle is needed from the server side.
+typedef struct cs_whep_session {
+    struct cs_whep_session *next;
+    int peer_id;
+    // POST still waiting for the answer.
+    struct lws *pending;
+    char *answer;
+    cs_whep_candidate *candidates;
+    int candidate_count;
+    int candidate_cap;
+    int gathered;
+    uint64_t deadline_ns;
+} cs_whep_session;
+
+typedef enum {
+    CS_WHEP_OTHER,
+    CS_WHEP_POST,
+    CS_WHEP_PATCH,
+    CS_WHEP_DELETE,
+    CS_WHEP_OPTIONS
+} cs_whep_method;
+
+// Per-connection HTTP state, reset for each request on a kept-alive
+// connection.
+typedef struct {
+    cs_whep_method method;
+    int peer_id;
+    char *body;
+    size_t body_len;
+    int status;
+    const char *content_type;
+    char location[48];
+    // LWS_PRE bytes of headroom, then the response body.
+    unsigned char *response;
+    size_t response_len;
+    int responding;
+} cs_whep_request;
 
 struct cs_signaling {
     struct lws_context *context;
+    cs_event_loop *loop;
     cs_signaling_callbacks callbacks;
     int port;
-    struct lws *client_wsi;
-    char *pending;
+    int max_peers;
+    int next_peer_id;
+    int client_count;
+    cs_signaling_client *clients;
+    cs_whep_session *sessions;
+    cs_stream_client *streams;
+    cs_hls *hls;
+    cs_hls_request *hls_waiting;
+    cs_assets *assets;
+    char router_host[128];
+    char advertise_host[128];
+    int router_port;
+    struct lws *router_wsi;
+    int router_ready;
+    // The register message has been written; until then it heads the queue.
+    int router_registered;
+    cs_msg_queue router_queue;
+    uint64_t next_router_connect_ns;
 };
 
-static char *json_escape(const char *input) {
-    size_t len = strlen(input);
-    size_t extra = 0;
-    for (size_t i = 0; i < len; ++i) {
-        char c = input[i];
-        if (c == '"' || c == '\\') {
-            extra += 1;
-        } else if (c == '\n' || c == '\r') {
-            extra += 1;
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void on_socket_ready(void *user, int fd, uint32_t events) {
+    cs_signaling *signaling = (cs_signaling *)user;
+    struct lws_pollfd pollfd = { .fd = fd, .events = (short)events, .revents = (short)events };
+    lws_service_fd(signaling->context, &pollfd);
+}
+
+// lws reports every socket it opens, closes or wants writability on through
+// protocol 0; mirror them into the shared event loop.
+static int update_poll_fd(cs_signaling *signaling, enum lws_callback_reasons reason, const struct lws_pollargs *args) {
+    if (!signaling->loop || !args) {
+        return 0;
+    }
+    switch (reason) {
+    case LWS_CALLBACK_ADD_POLL_FD:
+        return cs_event_loop_add(signaling->loop, args->fd, (uint32_t)args->events, on_socket_ready, signaling) == 0 ? 0 : 1;
+    case LWS_CALLBACK_DEL_POLL_FD:
+        cs_event_loop_remove(signaling->loop, args->fd);
+        return 0;
+    case LWS_CALLBACK_CHANGE_MODE_POLL_FD:
+        return cs_event_loop_modify(signaling->loop, args->fd, (uint32_t)args->events) == 0 ? 0 : 1;
+    default:
+        return 0;
+    }
+}
+
+static void handle_message(cs_signaling *signaling, cs_signaling_client *client, const char *payload) {
+    char type[16];
+    if (cs_json_get_string(payload, "type", type, sizeof(type)) != 0) {
+        return;
+    }
+
+    if (strcmp(type, "answer") == 0 || strcmp(type, "offer") == 0) {
+        char sdp[8192];
+        if (cs_json_get_string(payload, "sdp", sdp, sizeof(sdp)) == 0 && signaling->callbacks.on_remote_sdp) {
+            signaling->callbacks.on_remote_sdp(signaling->callbacks.user, client->peer_id, type, sdp);
         }
+    } else if (strcmp(type, "ice") == 0) {
+        char candidate[1024];
+        char sdp_mid[32] = "0";
+        int sdp_mline_index = 0;
+        if (cs_json_get_string(payload, "candidate", candidate, sizeof(candidate)) == 0 &&
+            signaling->callbacks.on_remote_ice) {
+            cs_json_get_string(payload, "sdpMid", sdp_mid, sizeof(sdp_mid));
+            cs_json_get_int(payload, "sdpMLineIndex", &sdp_mline_index);
+            signaling->callbacks.on_remote_ice(signaling->callbacks.user, client->peer_id, candidate, sdp_mline_index, sdp_mid);
+        }
+    }
+}
+
+static void unlink_client(cs_signaling *signaling, cs_signaling_client *client) {
+    for (cs_signaling_client **it = &signaling->clients; *it; it = &(*it)->next) {
+        if (*it == client) {
+            *it = client->next;
+            signaling->client_count--;
+            break;
+        }
+    }
+    client->next = NULL;
+}
+
+static cs_signaling_client *find_client(cs_signaling *signaling, int peer_id) {
+    for (cs_signaling_client *client = signaling->clients; client; client = client->next) {
+        if (client->peer_id == peer_id) {
+            return client;
+        }
+    }
+    return NULL;
+}
+
+static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+    cs_signaling_client *client = (cs_signaling_client *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_ADD_POLL_FD:
+    case LWS_CALLBACK_DEL_POLL_FD:
+    case LWS_CALLBACK_CHANGE_MODE_POLL_FD:
+        return update_poll_fd(signaling, reason, (const struct lws_pollargs *)in);
+    case LWS_CALLBACK_ESTABLISHED:
+        if (signaling->max_peers > 0 && signaling->client_count >= signaling->max_peers) {
+            return -1;
+        }
+        memset(client, 0, sizeof(*client));
+        client->wsi = wsi;
+        client->peer_id = ++signaling->next_peer_id;
+        client->next = signaling->clients;
+        signaling->clients = client;
+        signaling->client_count++;
+        if (signaling->callbacks.on_offer_needed) {
+            signaling->callbacks.on_offer_needed(signaling->callbacks.user, client->peer_id);
+        }
+        break;
+    case LWS_CALLBACK_RECEIVE: {
+        if (!client->wsi) {
+            break;
+        }
+        int complete = cs_msg_assembler_append(&client->rx, wsi, in, len);
+        if (complete < 0) {
+            return -1;
+        }
+        if (complete) {
+            handle_message(signaling, client, client->rx.buf);
+            cs_msg_assembler_reset(&client->rx);
+        }
+        break;
+    }
+    case LWS_CALLBACK_SERVER_WRITEABLE: {
+        size_t msg_len = 0;
+        unsigned char *msg = cs_msg_queue_peek(&client->queue, &msg_len);
+        if (!msg) {
+            break;
+        }
+        if (lws_write(wsi, msg, msg_len, LWS_WRITE_TEXT) < (int)msg_len) {
+            return -1;
+        }
+        cs_msg_queue_pop(&client->queue);
+        if (client->queue.head) {
+            lws_callback_on_writable(wsi);
+        }
+        break;
+    }
+    case LWS_CALLBACK_CLOSED:
+        if (!client->wsi) {
+            break;
+        }
+        unlink_client(signaling, client);
+        cs_msg_queue_clear(&client->queue);
+        cs_msg_assembler_reset(&client->rx);
+        client->wsi = NULL;
+        if (signaling->callbacks.on_peer_closed) {
+            signaling->callbacks.on_peer_closed(signaling->callbacks.user, client->peer_id);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static void queue_register(cs_signaling *signaling) {
+    char msg[256];
+    snprintf(msg, sizeof(msg), "{\"type\":\"register\",\"host\":\"%s\",\"port\":%d}",
+             signaling->advertise_host, signaling->port);
+    cs_msg_queue_push_str(&signaling->router_queue, msg);
+}
+
+static int router_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    (void)user;
+    (void)in;
+    (void)len;
+    cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+
+    switch (reason) {
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        cs_msg_queue_clear(&signaling->router_queue);
+        queue_register(signaling);
+        signaling->router_ready = 1;
+        signaling->router_registered = 0;
+        lws_callback_on_writable(wsi);
+        break;
+    case LWS_CALLBACK_CLIENT_WRITEABLE: {
+        size_t msg_len = 0;
+        unsigned char *msg = cs_msg_queue_peek(&signaling->router_queue, &msg_len);
+        if (!msg) {
+            break;
+        }
+        if (lws_write(wsi, msg, msg_len, LWS_WRITE_TEXT) < (int)msg_len) {
+            return -1;
+        }
+        cs_msg_queue_pop(&signaling->router_queue);
+        signaling->router_registered = 1;
+        if (signaling->router_queue.head) {
+            lws_callback_on_writable(wsi);
+        }
+        break;
+    }
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        if (signaling->router_wsi == wsi) {
+            signaling->router_wsi = NULL;
+            signaling->router_ready = 0;
+            signaling->next_router_connect_ns = monotonic_ns() + CS_ROUTER_RETRY_NS;
+            cs_msg_queue_clear(&signaling->router_queue);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static cs_whep_session *find_session(cs_signaling *signaling, int peer_id) {
+    for (cs_whep_session *session = signaling->sessions; session; session = session->next) {
+        if (session->peer_id == peer_id) {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+static void free_session(cs_whep_session *session) {
+    for (int i = 0; i < session->candidate_count; ++i) {
+        free(session->candidates[i].candidate);
+    }
+    free(session->candidates);
+    free(session->answer);
+    free(session);
+}
+
+static void close_session(cs_signaling *signaling, cs_whep_session *session) {
+    for (cs_whep_session **it = &signaling->sessions; *it; it = &(*it)->next) {
+        if (*it == session) {
+            *it = session->next;
+            signaling->client_count--;
+            break;
+        }
+    }
+    int peer_id = session->peer_id;
+    free_session(session);
+    if (signaling->callbacks.on_peer_closed) {
+        signaling->callbacks.on_peer_closed(signaling->callbacks.user, peer_id);
+    }
+}
+
+static int add_session_candidate(cs_whep_session *session, const char *candidate, int mline) {
+    if (session->candidate_count == session->candidate_cap) {
+        int cap = session->candidate_cap ? session->candidate_cap * 2 : 8;
+        cs_whep_candidate *grown =
+            (cs_whep_candidate *)realloc(session->candidates, (size_t)cap * sizeof(cs_whep_candidate));
+        if (!grown) {
+            return -1;
+        }
+        session->candidates = grown;
+        session->candidate_cap = cap;
+    }
+    char *copy = strdup(candidate);
+    if (!copy) {
+        return -1;
+    }
+    session->candidates[session->candidate_count].mline = mline;
+    session->candidates[session->candidate_count].candidate = copy;
+    session->candidate_count++;
+    return 0;
+}
+
+static size_t append_candidates(const cs_whep_session *session, int mline, char *out, size_t len) {
+    if (mline < 0) {
+        return len;
+    }
+    for (int i = 0; i < session->candidate_count; ++i) {
+        if (session->candidates[i].mline == mline) {
+            size_t n = strlen(session->candidates[i].candidate);
+            memcpy(out + len, "a=", 2);
+            memcpy(out + len + 2, session->candidates[i].candidate, n);
+            memcpy(out + len + 2 + n, "\r\n", 2);
+            len += n + 4;
+        }
+    }
+    if (session->gathered) {
+        memcpy(out + len, "a=end-of-candidates\r\n", 21);
+        len += 21;
+    }
+    return len;
+}
+
+// The answer with the gathered candidates appended to their m-sections.
+static char *build_answer(const cs_whep_session *session) {
+    size_t needed = strlen(session->answer) + 3;
+    for (int i = 0; i < session->candidate_count; ++i) {
+        needed += strlen(session->candidates[i].candidate) + 4;
     }
-    char *out = (char *)malloc(len + extra + 1);
+    for (const char *m = session->answer; (m = strstr(m, "m=")) != NULL; m += 2) {
+        needed += 21;
+    }
+    char *out = (char *)malloc(needed);
     if (!out) {
         return NULL;
     }
-    size_t j = 0;
-    for (size_t i = 0; i < len; ++i) {
-        char c = input[i];
-        if (c == '"' || c == '\\') {
-            out[j++] = '\\';
-            out[j++] = c;
-        } else if (c == '\n') {
-            out[j++] = '\\';
-            out[j++] = 'n';
-        } else if (c == '\r') {
-            out[j++] = '\\';
-            out[j++] = 'r';
-        } else {
-            out[j++] = c;
+
+    size_t len = 0;
+    int mline = -1;
+    const char *line = session->answer;
+    while (*line) {
+        const char *eol = strchr(line, '\n');
+        size_t n = eol ? (size_t)(eol - line) + 1 : strlen(line);
+        if (strncmp(line, "m=", 2) == 0) {
+            len = append_candidates(session, mline, out, len);
+            mline++;
         }
+        memcpy(out + len, line, n);
+        len += n;
+        line += n;
+    }
+    if (len > 0 && out[len - 1] != '\n') {
+        memcpy(out + len, "\r\n", 2);
+        len += 2;
     }
-    out[j] = '\0';
+    len = append_candidates(session, mline, out, len);
+    out[len] = '\0';
     return out;
 }
 
-static void json_unescape_inplace(char *value) {
-    size_t len = strlen(value);
-    size_t j = 0;
-    for (size_t i = 0; i < len; ++i) {
-        if (value[i] == '\\' && i + 1 < len) {
-            char next = value[i + 1];
-            if (next == 'n') {
-                value[j++] = '\n';
-                i++;
-                continue;
-            }
-            if (next == 'r') {
-                value[j++] = '\r';
-                i++;
-                continue;
-            }
-            if (next == '"' || next == '\\') {
-                value[j++] = next;
-                i++;
-                continue;
-            }
-        }
-        value[j++] = value[i];
+static void reset_request(cs_whep_request *req) {
+    free(req->body);
+    free(req->response);
+    memset(req, 0, sizeof(*req));
+}
+
+static void respond(struct lws *wsi, cs_whep_request *req, int status, const char *content_type,
+                    const char *body, size_t len) {
+    free(req->response);
+    req->response = (unsigned char *)malloc(LWS_PRE + len + 1);
+    req->response_len = req->response ? len : 0;
+    if (req->response && len) {
+        memcpy(req->response + LWS_PRE, body, len);
     }
-    value[j] = '\0';
+    req->status = req->response ? status : HTTP_STATUS_INTERNAL_SERVER_ERROR;
+    req->content_type = content_type;
+    req->responding = 1;
+    lws_callback_on_writable(wsi);
 }
 
-static int extract_json_string(const char *json, const char *key, char *out, size_t out_len) {
-    char pattern[64];
-    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
-    const char *pos = strstr(json, pattern);
-    if (!pos) {
+static int write_response(struct lws *wsi, cs_whep_request *req) {
+    unsigned char headers[LWS_PRE + 768];
+    unsigned char *start = headers + LWS_PRE;
+    unsigned char *p = start;
+    unsigned char *end = headers + sizeof(headers) - 1;
+
+    static const char *cors[][2] = {
+        { "access-control-allow-origin:", "*" },
+        { "access-control-allow-methods:", "POST, PATCH, DELETE, OPTIONS" },
+        { "access-control-allow-headers:", "content-type" },
+        { "access-control-expose-headers:", "location" },
+    };
+
+    req->responding = 0;
+    if (lws_add_http_common_headers(wsi, (unsigned int)req->status, req->content_type,
+                                    (uint64_t)req->response_len, &p, end)) {
         return -1;
     }
-    pos = strchr(pos, ':');
-    if (!pos) {
+    for (size_t i = 0; i < sizeof(cors) / sizeof(cors[0]); ++i) {
+        if (lws_add_http_header_by_name(wsi, (const unsigned char *)cors[i][0], (const unsigned char *)cors[i][1],
+                                        (int)strlen(cors[i][1]), &p, end)) {
+            return -1;
+        }
+    }
+    if (req->location[0] &&
+        lws_add_http_header_by_name(wsi, (const unsigned char *)"location:", (const unsigned char *)req->location,
+                                    (int)strlen(req->location), &p, end)) {
         return -1;
     }
-    pos = strchr(pos, '"');
-    if (!pos) {
+    if (lws_finalize_write_http_header(wsi, start, &p, end)) {
         return -1;
     }
-    pos++;
-    const char *end = strchr(pos, '"');
-    if (!end) {
+    if (req->response_len > 0 &&
+        lws_write(wsi, req->response + LWS_PRE, req->response_len, LWS_WRITE_HTTP_FINAL) < (int)req->response_len) {
         return -1;
     }
-    size_t len = (size_t)(end - pos);
-    if (len >= out_len) {
-        len = out_len - 1;
+    reset_request(req);
+    return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+// Sends the answer to the waiting POST once gathering is done or has timed
+// out.
+static void finish_session(cs_signaling *signaling, cs_whep_session *session) {
+    struct lws *wsi = session->pending;
+    if (!wsi) {
+        return;
     }
-    memcpy(out, pos, len);
-    out[len] = '\0';
-    json_unescape_inplace(out);
-    return 0;
+    session->pending = NULL;
+    cs_whep_request *req = (cs_whep_request *)lws_wsi_user(wsi);
+
+    char *answer = session->answer ? build_answer(session) : NULL;
+    if (!answer) {
+        respond(wsi, req, HTTP_STATUS_INTERNAL_SERVER_ERROR, "text/plain", NULL, 0);
+        close_session(signaling, session);
+        return;
+    }
+    snprintf(req->location, sizeof(req->location), "/whep/%d", session->peer_id);
+    respond(wsi, req, HTTP_STATUS_CREATED, "application/sdp", answer, strlen(answer));
+    free(answer);
 }
 
-static int extract_json_int(const char *json, const char *key, int *out_value) {
-    char pattern[64];
-    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
-    const char *pos = strstr(json, pattern);
-    if (!pos) {
-        return -1;
+static void handle_offer(cs_signaling *signaling, struct lws *wsi, cs_whep_request *req) {
+    if (!req->body || strncmp(req->body, "v=0", 3) != 0) {
+        respond(wsi, req, HTTP_STATUS_BAD_REQUEST, "text/plain", NULL, 0);
+        return;
+    }
+    if ((signaling->max_peers > 0 && signaling->client_count >= signaling->max_peers) ||
+        !signaling->callbacks.on_remote_offer) {
+        respond(wsi, req, HTTP_STATUS_SERVICE_UNAVAILABLE, "text/plain", NULL, 0);
+        return;
     }
-    pos = strchr(pos, ':');
-    if (!pos) {
+
+    cs_whep_session *session = (cs_whep_session *)calloc(1, sizeof(cs_whep_session));
+    if (!session) {
+        respond(wsi, req, HTTP_STATUS_INTERNAL_SERVER_ERROR, "text/plain", NULL, 0);
+        return;
+    }
+    session->peer_id = ++signaling->next_peer_id;
+    session->pending = wsi;
+    session->deadline_ns = monotonic_ns() + CS_WHEP_GATHER_TIMEOUT_NS;
+    session->next = signaling->sessions;
+    signaling->sessions = session;
+    signaling->client_count++;
+    req->peer_id = session->peer_id;
+
+    // The answer and candidates arrive through cs_signaling_send_sdp/ice,
+    // possibly from inside this call.
+    if (signaling->callbacks.on_remote_offer(signaling->callbacks.user, session->peer_id, req->body) != 0) {
+        session->pending = NULL;
+        respond(wsi, req, HTTP_STATUS_SERVICE_UNAVAILABLE, "text/plain", NULL, 0);
+        close_session(signaling, session);
+        return;
+    }
+    if (session->gathered) {
+        finish_session(signaling, session);
+    }
+}
+
+// Index of the answer's m-section carrying a=mid:<mid>, or -1.
+static int mline_for_mid(const cs_whep_session *session, const char *mid) {
+    if (!session->answer) {
         return -1;
     }
-    pos++;
-    *out_value = atoi(pos);
+    size_t mid_len = strlen(mid);
+    int mline = -1;
+    const char *line = session->answer;
+    while (line) {
+        if (strncmp(line, "m=", 2) == 0) {
+            mline++;
+        } else if (strncmp(line, "a=mid:", 6) == 0 && strncmp(line + 6, mid, mid_len) == 0 &&
+                   strchr("\r\n", line[6 + mid_len])) {
+            return mline;
+        }
+        line = strchr(line, '\n');
+        if (line) {
+            line++;
+        }
+    }
+    return -1;
+}
+
+// Trickled client candidates arrive as an SDP fragment (RFC 8840). The mid
+// locates the m-section; fragments without one count their own m= lines.
+static void handle_patch(cs_signaling *signaling, struct lws *wsi, cs_whep_request *req) {
+    cs_whep_session *session = find_session(signaling, req->peer_id);
+    if (!session) {
+        respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", NULL, 0);
+        return;
+    }
+
+    int mline = -1;
+    char mid[32] = "";
+    char *save = NULL;
+    for (char *line = strtok_r(req->body ? req->body : "", "\r\n", &save); line;
+         line = strtok_r(NULL, "\r\n", &save)) {
+        if (strncmp(line, "m=", 2) == 0) {
+            mline++;
+            mid[0] = '\0';
+        } else if (strncmp(line, "a=mid:", 6) == 0) {
+            snprintf(mid, sizeof(mid), "%s", line + 6);
+        } else if (strncmp(line, "a=candidate:", 12) == 0 && signaling->callbacks.on_remote_ice) {
+            int index = mid[0] ? mline_for_mid(session, mid) : -1;
+            if (index < 0) {
+                index = mline < 0 ? 0 : mline;
+            }
+            signaling->callbacks.on_remote_ice(signaling->callbacks.user, req->peer_id, line + 2, index,
+                                               mid[0] ? mid : NULL);
+        }
+    }
+    respond(wsi, req, HTTP_STATUS_NO_CONTENT, NULL, NULL, 0);
+}
+
+static int content_type_is(struct lws *wsi, const char *type) {
+    char value[64];
+    if (lws_hdr_copy(wsi, value, sizeof(value), WSI_TOKEN_HTTP_CONTENT_TYPE) <= 0) {
+        return 0;
+    }
+    return strncmp(value, type, strlen(type)) == 0;
+}
+
+// WHEP (WebRTC-HTTP Egress Protocol) on the signaling port: POST /whep with
+// an SDP offer creates a session, PATCH /whep/<id> trickles candidates and
+// DELETE /whep/<id> ends it.
+static int whep_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+    cs_whep_request *req = (cs_whep_request *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_HTTP: {
+        reset_request(req);
+        const char *path = (const char *)in;
+        req->peer_id = path && path[0] == '/' ? atoi(path + 1) : 0;
+        if (lws_hdr_total_length(wsi, WSI_TOKEN_OPTIONS_URI)) {
+            respond(wsi, req, HTTP_STATUS_NO_CONTENT, NULL, NULL, 0);
+        } else if (lws_hdr_total_length(wsi, WSI_TOKEN_DELETE_URI)) {
+            cs_whep_session *session = find_session(signaling, req->peer_id);
+            if (session) {
+                if (session->pending) {
+                    cs_whep_request *waiting = (cs_whep_request *)lws_wsi_user(session->pending);
+                    waiting->peer_id = 0;
+                    respond(session->pending, waiting, HTTP_STATUS_NOT_FOUND, "text/plain", NULL, 0);
+                }
+                close_session(signaling, session);
+            }
+            respond(wsi, req, session ? HTTP_STATUS_OK : HTTP_STATUS_NOT_FOUND, "text/plain", NULL, 0);
+        } else if (lws_hdr_total_length(wsi, WSI_TOKEN_POST_URI) && req->peer_id == 0) {
+            if (!content_type_is(wsi, "application/sdp")) {
+                respond(wsi, req, HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE, "text/plain", NULL, 0);
+            } else if (!lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_CONTENT_LENGTH)) {
+                respond(wsi, req, HTTP_STATUS_LENGTH_REQUIRED, "text/plain", NULL, 0);
+            } else {
+                req->method = CS_WHEP_POST;
+            }
+        } else if (lws_hdr_total_length(wsi, WSI_TOKEN_PATCH_URI) && req->peer_id > 0) {
+            if (!content_type_is(wsi, "application/trickle-ice-sdpfrag")) {
+                respond(wsi, req, HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE, "text/plain", NULL, 0);
+            } else {
+                req->method = CS_WHEP_PATCH;
+            }
+        } else {
+            respond(wsi, req, HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", NULL, 0);
+        }
+        break;
+    }
+    case LWS_CALLBACK_HTTP_BODY: {
+        if (req->method != CS_WHEP_POST && req->method != CS_WHEP_PATCH) {
+            break;
+        }
+        if (req->body_len + len > CS_WHEP_MAX_BODY) {
+            req->method = CS_WHEP_OTHER;
+            respond(wsi, req, HTTP_STATUS_REQ_ENTITY_TOO_LARGE, "text/plain", NULL, 0);
+            break;
+        }
+        char *grown = (char *)realloc(req->body, req->body_len + len + 1);
+        if (!grown) {
+            return -1;
+        }
+        memcpy(grown + req->body_len, in, len);
+        req->body = grown;
+        req->body_len += len;
+        req->body[req->body_len] = '\0';
+        break;
+    }
+    case LWS_CALLBACK_HTTP_BODY_COMPLETION:
+        if (req->method == CS_WHEP_POST) {
+            handle_offer(signaling, wsi, req);
+        } else if (req->method == CS_WHEP_PATCH) {
+            handle_patch(signaling, wsi, req);
+        }
+        break;
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        if (req->responding) {
+            return write_response(wsi, req);
+        }
+        break;
+    case LWS_CALLBACK_CLOSED_HTTP:
+        if (req) {
+            // A POST abandoned before its answer takes the session with it.
+            cs_whep_session *session = req->method == CS_WHEP_POST ? find_session(signaling, req->peer_id) : NULL;
+            if (session && session->pending == wsi) {
+                session->pending = NULL;
+                close_session(signaling, session);
+            }
+            reset_request(req);
+        }
+        break;
+    default:
+        break;
+    }
+
     return 0;
 }
 
-static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
-    (void)user;
-    (void)len;
+struct cs_stream_unit {
+    int refs;
+    size_t len;
+    unsigned char buf[];
+};
+
+cs_stream_unit *cs_stream_unit_create(const uint8_t *data, size_t len, uint64_t pts_us, int keyframe) {
+    if (!data) {
+        return NULL;
+    }
+    cs_stream_unit *unit = (cs_stream_unit *)malloc(sizeof(cs_stream_unit) + LWS_PRE + CS_STREAM_HEADER + len);
+    if (!unit) {
+        return NULL;
+    }
+    unit->refs = 1;
+    unit->len = CS_STREAM_HEADER + len;
+
+    // version, flags, two reserved bytes, then the timestamp little-endian.
+    unsigned char *header = unit->buf + LWS_PRE;
+    header[0] = 1;
+    header[1] = keyframe ? 1 : 0;
+    header[2] = 0;
+    header[3] = 0;
+    for (int i = 0; i < 8; ++i) {
+        header[4 + i] = (unsigned char)(pts_us >> (8 * i));
+    }
+    memcpy(header + CS_STREAM_HEADER, data, len);
+    return unit;
+}
+
+void cs_stream_unit_unref(cs_stream_unit *unit) {
+    if (unit && --unit->refs == 0) {
+        free(unit);
+    }
+}
+
+static cs_stream_client *find_stream_client(cs_signaling *signaling, int peer_id) {
+    for (cs_stream_client *client = signaling->streams; client; client = client->next) {
+        if (client->peer_id == peer_id) {
+            return client;
+        }
+    }
+    return NULL;
+}
+
+static void drop_stream_units(cs_stream_client *client) {
+    while (client->unit_count > 0) {
+        cs_stream_unit_unref(client->units[client->unit_head]);
+        client->unit_head = (client->unit_head + 1) % CS_STREAM_QUEUE;
+        client->unit_count--;
+    }
+}
+
+// WebSocket viewers that take the encoded stream directly: binary frames of
+// one access unit each, shared by reference, plus JSON text both ways for
+// camera input and acks.
+static int stream_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
     cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+    cs_stream_client *client = (cs_stream_client *)user;
 
     switch (reason) {
     case LWS_CALLBACK_ESTABLISHED:
-        signaling->client_wsi = wsi;
-        if (signaling->callbacks.on_offer_needed) {
-            signaling->callbacks.on_offer_needed(signaling->callbacks.user);
+        if (signaling->max_peers > 0 && signaling->client_count >= signaling->max_peers) {
+            return -1;
+        }
+        memset(client, 0, sizeof(*client));
+        client->wsi = wsi;
+        client->peer_id = ++signaling->next_peer_id;
+        client->waiting_key = 1;
+        client->next = signaling->streams;
+        signaling->streams = client;
+        signaling->client_count++;
+        if (signaling->callbacks.on_stream_opened) {
+            signaling->callbacks.on_stream_opened(signaling->callbacks.user, client->peer_id);
         }
         break;
     case LWS_CALLBACK_RECEIVE: {
-        const char *payload = (const char *)in;
-        char type[16];
-        if (extract_json_string(payload, "type", type, sizeof(type)) != 0) {
+        if (!client->wsi) {
             break;
         }
+        int complete = cs_msg_assembler_append(&client->rx, wsi, in, len);
+        if (complete < 0) {
+            return -1;
+        }
+        if (complete) {
+            if (signaling->callbacks.on_stream_message) {
+                signaling->callbacks.on_stream_message(signaling->callbacks.user, client->peer_id, client->rx.buf);
+            }
+            cs_msg_assembler_reset(&client->rx);
+        }
+        break;
+    }
+    case LWS_CALLBACK_SERVER_WRITEABLE: {
+        // Acks go ahead of video so latency probes are not queued behind it.
+        size_t msg_len = 0;
+        unsigned char *msg = cs_msg_queue_peek(&client->queue, &msg_len);
+        if (msg) {
+            if (lws_write(wsi, msg, msg_len, LWS_WRITE_TEXT) < (int)msg_len) {
+                return -1;
+            }
+            cs_msg_queue_pop(&client->queue);
+        } else if (client->unit_count > 0) {
+            cs_stream_unit *unit = client->units[client->unit_head];
+            if (lws_write(wsi, unit->buf + LWS_PRE, unit->len, LWS_WRITE_BINARY) < (int)unit->len) {
+                return -1;
+            }
+            cs_stream_unit_unref(unit);
+            client->unit_head = (client->unit_head + 1) % CS_STREAM_QUEUE;
+            client->unit_count--;
+        }
+        if (client->queue.head || client->unit_count > 0) {
+            lws_callback_on_writable(wsi);
+        }
+        break;
+    }
+    case LWS_CALLBACK_CLOSED:
+        if (!client->wsi) {
+            break;
+        }
+        for (cs_stream_client **it = &signaling->streams; *it; it = &(*it)->next) {
+            if (*it == client) {
+                *it = client->next;
+                signaling->client_count--;
+                break;
+            }
+        }
+        drop_stream_units(client);
+        cs_msg_queue_clear(&client->queue);
+        cs_msg_assembler_reset(&client->rx);
+        client->wsi = NULL;
+        if (signaling->callbacks.on_peer_closed) {
+            signaling->callbacks.on_peer_closed(signaling->callbacks.user, client->peer_id);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static void unlink_hls_request(cs_signaling *signaling, cs_hls_request *req) {
+    if (!req->waiting) {
+        return;
+    }
+    for (cs_hls_request **it = &signaling->hls_waiting; *it; it = &(*it)->next) {
+        if (*it == req) {
+            *it = req->next;
+            break;
+        }
+    }
+    req->next = NULL;
+    req->waiting = 0;
+}
+
+static void reset_hls_request(cs_signaling *signaling, cs_hls_request *req) {
+    unlink_hls_request(signaling, req);
+    free(req->text);
+    cs_hls_blob_release(&req->blob);
+    memset(req, 0, sizeof(*req));
+}
+
+static void hls_respond(struct lws *wsi, cs_hls_request *req, int status, const char *content_type,
+                        const char *cache_control, const uint8_t *body, size_t len) {
+    req->status = status;
+    req->content_type = content_type;
+    snprintf(req->cache_control, sizeof(req->cache_control), "%s", cache_control);
+    req->body = body;
+    req->body_len = len;
+    req->sent = 0;
+    req->responding = 1;
+    lws_callback_on_writable(wsi);
+}
+
+static void hls_wait(cs_signaling *signaling, cs_hls_request *req) {
+    if (req->deadline_ns == 0) {
+        req->deadline_ns = monotonic_ns() + (uint64_t)cs_hls_block_ms(signaling->hls) * 1000000ull;
+    }
+    req->waiting = 1;
+    req->next = signaling->hls_waiting;
+    signaling->hls_waiting = req;
+}
 
-        if (strcmp(type, "answer") == 0 || strcmp(type, "offer") == 0) {
-            char sdp[8192];
-            if (extract_json_string(payload, "sdp", sdp, sizeof(sdp)) == 0) {
-                signaling->callbacks.on_remote_sdp(signaling->callbacks.user, type, sdp);
+// Answers the request, or parks it until the resource exists. Segments and
+// parts are named per process and never change, so caches may keep them
+// forever; a blocking reload names a fixed point of the stream and may be
+// cached briefly, a plain reload not at all.
+static void hls_answer(cs_signaling *signaling, struct lws *wsi, cs_hls_request *req) {
+    if (!signaling->hls) {
+        hls_respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", "no-cache", NULL, 0);
+        return;
+    }
+
+    if (req->playlist) {
+        int ready = cs_hls_playlist_ready(signaling->hls, req->msn, req->part);
+        if (ready < 0) {
+            hls_respond(wsi, req, HTTP_STATUS_BAD_REQUEST, "text/plain", "no-cache", NULL, 0);
+        } else if (ready == 0) {
+            hls_wait(signaling, req);
+        } else {
+            size_t len = 0;
+            req->text = cs_hls_playlist(signaling->hls, &len);
+            if (!req->text) {
+                hls_respond(wsi, req, HTTP_STATUS_INTERNAL_SERVER_ERROR, "text/plain", "no-cache", NULL, 0);
+                return;
             }
-        } else if (strcmp(type, "ice") == 0) {
-            char candidate[1024];
-            char sdp_mid[32] = "0";
-            int sdp_mline_index = 0;
-            if (extract_json_string(payload, "candidate", candidate, sizeof(candidate)) == 0) {
-                extract_json_string(payload, "sdpMid", sdp_mid, sizeof(sdp_mid));
-                extract_json_int(payload, "sdpMLineIndex", &sdp_mline_index);
-                signaling->callbacks.on_remote_ice(signaling->callbacks.user, candidate, sdp_mline_index, sdp_mid);
+            char cache_control[48] = "no-cache";
+            if (req->msn >= 0) {
+                snprintf(cache_control, sizeof(cache_control), "public, max-age=%d",
+                         cs_hls_block_ms(signaling->hls) / 1000);
             }
+            hls_respond(wsi, req, HTTP_STATUS_OK, "application/vnd.apple.mpegurl", cache_control,
+                        (const uint8_t *)req->text, len);
         }
+        return;
+    }
+
+    switch (cs_hls_lookup(signaling->hls, req->name, &req->blob)) {
+    case CS_HLS_FOUND: {
+        size_t name_len = strlen(req->name);
+        int init = name_len > 4 && strcmp(req->name + name_len - 4, ".mp4") == 0;
+        hls_respond(wsi, req, HTTP_STATUS_OK, init ? "video/mp4" : "video/iso.segment",
+                    "public, max-age=31536000, immutable", req->blob.data, req->blob.len);
         break;
     }
-    case LWS_CALLBACK_SERVER_WRITEABLE: {
-        if (!signaling->pending || signaling->client_wsi != wsi) {
+    case CS_HLS_PENDING:
+        hls_wait(signaling, req);
+        break;
+    case CS_HLS_MISSING:
+        hls_respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", "no-cache", NULL, 0);
+        break;
+    }
+}
+
+// Headers first, then the body in CS_HLS_CHUNK slices, one per writable
+// callback, so large segments do not stall other sockets.
+static int write_hls_response(cs_signaling *signaling, struct lws *wsi, cs_hls_request *req) {
+    unsigned char buf[LWS_PRE + CS_HLS_CHUNK];
+
+    if (!req->headers_sent) {
+        unsigned char *start = buf + LWS_PRE;
+        unsigned char *p = start;
+        unsigned char *end = buf + sizeof(buf) - 1;
+        if (lws_add_http_common_headers(wsi, (unsigned int)req->status, req->content_type,
+                                        (uint64_t)req->body_len, &p, end) ||
+            lws_add_http_header_by_name(wsi, (const unsigned char *)"cache-control:",
+                                        (const unsigned char *)req->cache_control,
+                                        (int)strlen(req->cache_control), &p, end) ||
+            lws_add_http_header_by_name(wsi, (const unsigned char *)"access-control-allow-origin:",
+                                        (const unsigned char *)"*", 1, &p, end) ||
+            lws_finalize_write_http_header(wsi, start, &p, end)) {
+            return -1;
+        }
+        req->headers_sent = 1;
+        if (req->body_len > 0) {
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+    } else {
+        size_t n = req->body_len - req->sent;
+        if (n > CS_HLS_CHUNK) {
+            n = CS_HLS_CHUNK;
+        }
+        int final = req->sent + n == req->body_len;
+        memcpy(buf + LWS_PRE, req->body + req->sent, n);
+        if (lws_write(wsi, buf + LWS_PRE, n, final ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) < (int)n) {
+            return -1;
+        }
+        req->sent += n;
+        if (!final) {
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+    }
+
+    reset_hls_request(signaling, req);
+    return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+// LL-HLS on the signaling port: GET /hls/live.m3u8 (with optional _HLS_msn
+// and _HLS_part for blocking reloads), plus the init segment, segments and
+// parts it names.
+static int hls_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+    cs_hls_request *req = (cs_hls_request *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_HTTP: {
+        reset_hls_request(signaling, req);
+        req->wsi = wsi;
+        const char *path = in ? (const char *)in : "";
+        if (path[0] == '/') {
+            path++;
+        }
+        if (!lws_hdr_total_length(wsi, WSI_TOKEN_GET_URI)) {
+            hls_respond(wsi, req, HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", "no-cache", NULL, 0);
+        } else if (strcmp(path, "live.m3u8") == 0) {
+            char arg[32];
+            const char *value = lws_get_urlarg_by_name(wsi, "_HLS_msn=", arg, sizeof(arg));
+            req->playlist = 1;
+            req->msn = value ? atoll(value) : -1;
+            req->part = -1;
+            value = req->msn >= 0 ? lws_get_urlarg_by_name(wsi, "_HLS_part=", arg, sizeof(arg)) : NULL;
+            if (value) {
+                req->part = atoi(value);
+            }
+            hls_answer(signaling, wsi, req);
+        } else if (path[0] && strlen(path) < sizeof(req->name) && !strchr(path, '/')) {
+            snprintf(req->name, sizeof(req->name), "%s", path);
+            hls_answer(signaling, wsi, req);
+        } else {
+            hls_respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", "no-cache", NULL, 0);
+        }
+        break;
+    }
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        if (req->responding) {
+            return write_hls_response(signaling, wsi, req);
+        }
+        break;
+    case LWS_CALLBACK_CLOSED_HTTP:
+        if (req) {
+            reset_hls_request(signaling, req);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static void connect_router(cs_signaling *signaling) {
+    struct lws_client_connect_info info;
+    memset(&info, 0, sizeof(info));
+    info.context = signaling->context;
+    info.address = signaling->router_host;
+    info.port = signaling->router_port;
+    info.path = "/";
+    info.host = signaling->router_host;
+    info.origin = signaling->router_host;
+    info.protocol = "cs-worker";
+    info.pwsi = &signaling->router_wsi;
+
+    signaling->next_router_connect_ns = monotonic_ns() + CS_ROUTER_RETRY_NS;
+    lws_client_connect_via_info(&info);
+}
+
+static void client_respond(struct lws *wsi, cs_client_request *req, int status) {
+    req->status = status;
+    req->responding = 1;
+    lws_callback_on_writable(wsi);
+}
+
+// The body goes out in one write straight from cs_assets, which keeps
+// LWS_PRE bytes free in front of it; lws holds back whatever the socket
+// does not take at once. Bundles are small, so that stays cheap.
+static int write_client_response(struct lws *wsi, cs_client_request *req) {
+    unsigned char headers[LWS_PRE + 768];
+    unsigned char *start = headers + LWS_PRE;
+    unsigned char *p = start;
+    unsigned char *end = headers + sizeof(headers) - 1;
+    int ok = req->status == HTTP_STATUS_OK;
+
+    req->responding = 0;
+    // A 304 has no body and so no content-length.
+    if (req->status == HTTP_STATUS_NOT_MODIFIED
+            ? lws_add_http_header_status(wsi, HTTP_STATUS_NOT_MODIFIED, &p, end)
+            : lws_add_http_common_headers(wsi, (unsigned int)req->status,
+                                          ok ? req->asset.content_type : "text/plain",
+                                          ok ? (uint64_t)req->asset.len : 0, &p, end)) {
+        return -1;
+    }
+    if (req->asset.etag) {
+        const char *headers_by_name[][2] = {
+            { "etag:", req->asset.etag },
+            { "cache-control:", req->asset.cache_control },
+            { "vary:", "accept-encoding" },
+            { "content-encoding:", ok ? req->asset.encoding : NULL },
+        };
+        for (size_t i = 0; i < sizeof(headers_by_name) / sizeof(headers_by_name[0]); ++i) {
+            const char *value = headers_by_name[i][1];
+            if (value && lws_add_http_header_by_name(wsi, (const unsigned char *)headers_by_name[i][0],
+                                                     (const unsigned char *)value, (int)strlen(value), &p, end)) {
+                return -1;
+            }
+        }
+    }
+    if (lws_finalize_write_http_header(wsi, start, &p, end)) {
+        return -1;
+    }
+    if (ok && req->asset.len > 0 &&
+        lws_write(wsi, req->asset.data, req->asset.len, LWS_WRITE_HTTP_FINAL) < (int)req->asset.len) {
+        return -1;
+    }
+    memset(req, 0, sizeof(*req));
+    return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+// GET on every other path: the web client. Vite's hashed files under
+// assets/ are immutable; the HTML revalidates with If-None-Match, so a
+// returning viewer costs one round trip and a 304.
+static int client_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+    cs_client_request *req = (cs_client_request *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_HTTP: {
+        memset(req, 0, sizeof(*req));
+        if (!lws_hdr_total_length(wsi, WSI_TOKEN_GET_URI)) {
+            client_respond(wsi, req, HTTP_STATUS_METHOD_NOT_ALLOWED);
+            break;
+        }
+        char value[256];
+        unsigned int accept = cs_assets_accept(
+            lws_hdr_copy(wsi, value, sizeof(value), WSI_TOKEN_HTTP_ACCEPT_ENCODING) > 0 ? value : NULL);
+        if (!signaling->assets ||
+            cs_assets_lookup(signaling->assets, in ? (const char *)in : "", accept, &req->asset) != 0) {
+            memset(&req->asset, 0, sizeof(req->asset));
+            client_respond(wsi, req, HTTP_STATUS_NOT_FOUND);
+        } else if (lws_hdr_copy(wsi, value, sizeof(value), WSI_TOKEN_HTTP_IF_NONE_MATCH) > 0 &&
+                   strstr(value, req->asset.etag)) {
+            client_respond(wsi, req, HTTP_STATUS_NOT_MODIFIED);
+        } else {
+            client_respond(wsi, req, HTTP_STATUS_OK);
+        }
+        break;
+    }
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        if (req->responding) {
+            return write_client_response(wsi, req);
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void reset_ops_request(cs_ops_request *req) {
+    free(req->body);
+    memset(req, 0, sizeof(*req));
+}
+
+// Takes ownership of body, which must come from malloc.
+static void ops_respond(struct lws *wsi, cs_ops_request *req, int status, const char *content_type, char *body,
+                        size_t len) {
+    free(req->body);
+    req->status = status;
+    req->content_type = content_type;
+    req->body = body;
+    req->body_len = body ? len : 0;
+    req->sent = 0;
+    req->headers_sent = 0;
+    req->responding = 1;
+    lws_callback_on_writable(wsi);
+}
+
+// Same slicing as write_hls_response, without CORS and never cached.
+static int write_ops_response(struct lws *wsi, cs_ops_request *req) {
+    unsigned char buf[LWS_PRE + CS_HLS_CHUNK];
+
+    if (!req->headers_sent) {
+        unsigned char *start = buf + LWS_PRE;
+        unsigned char *p = start;
+        unsigned char *end = buf + sizeof(buf) - 1;
+        if (lws_add_http_common_headers(wsi, (unsigned int)req->status, req->content_type,
+                                        (uint64_t)req->body_len, &p, end) ||
+            lws_add_http_header_by_name(wsi, (const unsigned char *)"cache-control:",
+                                        (const unsigned char *)"no-store", 8, &p, end) ||
+            lws_finalize_write_http_header(wsi, start, &p, end)) {
+            return -1;
+        }
+        req->headers_sent = 1;
+        if (req->body_len > 0) {
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+    } else {
+        size_t n = req->body_len - req->sent;
+        if (n > CS_HLS_CHUNK) {
+            n = CS_HLS_CHUNK;
+        }
+        int final = req->sent + n == req->body_len;
+        memcpy(buf + LWS_PRE, req->body + req->sent, n);
+        if (lws_write(wsi, buf + LWS_PRE, n, final ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) < (int)n) {
+            return -1;
+        }
+        req->sent += n;
+        if (!final) {
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+    }
+
+    reset_ops_request(req);
+    return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+// GET /stats: the embedder's counters as JSON, for soak runs and probes.
+// on_stats reports the length it needed, like snprintf, so a short buffer
+// is grown once; a report that still does not fit is a 500.
+static int stats_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+    cs_ops_request *req = (cs_ops_request *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_HTTP: {
+        reset_ops_request(req);
+        if (!lws_hdr_total_length(wsi, WSI_TOKEN_GET_URI)) {
+            ops_respond(wsi, req, HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", NULL, 0);
             break;
         }
-        size_t msg_len = strlen(signaling->pending);
-        unsigned char *buf = (unsigned char *)malloc(LWS_PRE + msg_len + 1);
-        if (!buf) {
+        if (!signaling->callbacks.on_stats) {
+            ops_respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", NULL, 0);
             break;
         }
-        memcpy(buf + LWS_PRE, signaling->pending, msg_len);
-        lws_write(wsi, buf + LWS_PRE, msg_len, LWS_WRITE_TEXT);
-        free(buf);
-        free(signaling->pending);
-        signaling->pending = NULL;
+        size_t cap = 1024;
+        char *body = (char *)malloc(cap);
+        int n = body ? signaling->callbacks.on_stats(signaling->callbacks.user, body, cap) : -1;
+        if (n >= 0 && (size_t)n >= cap) {
+            char *grown = (char *)realloc(body, (size_t)n + 1);
+            if (grown) {
+                body = grown;
+                cap = (size_t)n + 1;
+                n = signaling->callbacks.on_stats(signaling->callbacks.user, body, cap);
+            }
+        }
+        if (n < 0 && body) {
+            free(body);
+            ops_respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", NULL, 0);
+        } else if (n < 0 || (size_t)n >= cap) {
+            free(body);
+            ops_respond(wsi, req, HTTP_STATUS_INTERNAL_SERVER_ERROR, "text/plain", NULL, 0);
+        } else {
+            ops_respond(wsi, req, HTTP_STATUS_OK, "application/json", body, (size_t)n);
+        }
         break;
     }
-    case LWS_CALLBACK_CLOSED:
-        if (signaling->client_wsi == wsi) {
-            signaling->client_wsi = NULL;
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        if (req->responding) {
+            return write_ops_response(wsi, req);
+        }
+        break;
+    case LWS_CALLBACK_CLOSED_HTTP:
+        if (req) {
+            reset_ops_request(req);
         }
         break;
     default:
         break;
     }
+    return 0;
+}
 
+static void handle_trace_start(cs_signaling *signaling, struct lws *wsi, cs_ops_request *req) {
+    int seconds = 0;
+    req->post = 0;
+    if (cs_json_get_int(req->args, "seconds", &seconds) != 0) {
+        seconds = 0;
+    }
+    if (!signaling->callbacks.on_trace_start) {
+        ops_respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", NULL, 0);
+    } else if (signaling->callbacks.on_trace_start(signaling->callbacks.user, seconds) != 0) {
+        ops_respond(wsi, req, HTTP_STATUS_CONFLICT, "text/plain", NULL, 0);
+    } else {
+        ops_respond(wsi, req, HTTP_STATUS_ACCEPTED, "text/plain", NULL, 0);
+    }
+}
+
+// POST /trace with {"seconds":<s>} starts a trace capture; GET /trace
+// fetches the last finished one as Chrome trace JSON. The JSON content type
+// keeps browsers from starting a capture cross-origin without a preflight,
+// which gets no CORS headers.
+static int trace_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+    cs_signaling *signaling = (cs_signaling *)lws_context_user(lws_get_context(wsi));
+    cs_ops_request *req = (cs_ops_request *)user;
+
+    switch (reason) {
+    case LWS_CALLBACK_HTTP: {
+        reset_ops_request(req);
+        if (lws_hdr_total_length(wsi, WSI_TOKEN_POST_URI)) {
+            char length[24];
+            if (!content_type_is(wsi, "application/json")) {
+                ops_respond(wsi, req, HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE, "text/plain", NULL, 0);
+            } else if (lws_hdr_copy(wsi, length, sizeof(length), WSI_TOKEN_HTTP_CONTENT_LENGTH) <= 0) {
+                ops_respond(wsi, req, HTTP_STATUS_LENGTH_REQUIRED, "text/plain", NULL, 0);
+            } else if (atoll(length) == 0) {
+                // No body follows, so there is no BODY_COMPLETION to wait for.
+                handle_trace_start(signaling, wsi, req);
+            } else {
+                req->post = 1;
+            }
+            break;
+        }
+        if (!lws_hdr_total_length(wsi, WSI_TOKEN_GET_URI)) {
+            ops_respond(wsi, req, HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", NULL, 0);
+            break;
+        }
+        size_t dump_len = 0;
+        char *dump = signaling->callbacks.on_trace_dump
+                         ? signaling->callbacks.on_trace_dump(signaling->callbacks.user, &dump_len)
+                         : NULL;
+        if (!dump) {
+            ops_respond(wsi, req, HTTP_STATUS_NOT_FOUND, "text/plain", NULL, 0);
+        } else {
+            ops_respond(wsi, req, HTTP_STATUS_OK, "application/json", dump, dump_len);
+        }
+        break;
+    }
+    case LWS_CALLBACK_HTTP_BODY:
+        if (!req->post) {
+            break;
+        }
+        if (req->args_len + len > CS_OPS_MAX_BODY) {
+            req->post = 0;
+            ops_respond(wsi, req, HTTP_STATUS_REQ_ENTITY_TOO_LARGE, "text/plain", NULL, 0);
+            break;
+        }
+        memcpy(req->args + req->args_len, in, len);
+        req->args_len += len;
+        req->args[req->args_len] = '\0';
+        break;
+    case LWS_CALLBACK_HTTP_BODY_COMPLETION:
+        if (req->post) {
+            handle_trace_start(signaling, wsi, req);
+        }
+        break;
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        if (req->responding) {
+            return write_ops_response(wsi, req);
+        }
+        break;
+    case LWS_CALLBACK_CLOSED_HTTP:
+        if (req) {
+            reset_ops_request(req);
+        }
+        break;
+    default:
+        break;
+    }
     return 0;
 }
 
@@ -196,22 +1408,101 @@ cs_signaling *cs_signaling_create(const cs_signaling_config *config, const cs_si
     }
 
     signaling->callbacks = *callbacks;
+    signaling->loop = config->loop;
     signaling->port = config->port;
+    signaling->max_peers = config->max_peers;
+    signaling->hls = config->hls;
+    if (config->client_dir) {
+        const char *dir = config->client_dir[0] ? config->client_dir : CS_CLIENT_DIR;
+        signaling->assets = cs_assets_load(dir, LWS_PRE);
+        if (signaling->assets) {
+            size_t files = 0;
+            size_t bytes = 0;
+            size_t stored = 0;
+            cs_assets_stats(signaling->assets, &files, &bytes, &stored);
+            fprintf(stderr, "Serving client from %s: %zu files, %zu KiB (%zu KiB with compressed copies)\n",
+                    dir, files, bytes / 1024, stored / 1024);
+        } else {
+            fprintf(stderr, "No client bundle in %s (run npm run build in client/); not serving it\n", dir);
+        }
+    }
+    if (config->router_host && config->router_host[0]) {
+        snprintf(signaling->router_host, sizeof(signaling->router_host), "%s", config->router_host);
+        snprintf(signaling->advertise_host, sizeof(signaling->advertise_host), "%s",
+                 config->advertise_host && config->advertise_host[0] ? config->advertise_host : "127.0.0.1");
+        signaling->router_port = config->router_port;
+    }
 
     static struct lws_protocols protocols[] = {
-        { "cs-signaling", ws_callback, 0, 8192 },
+        { "cs-signaling", ws_callback, sizeof(cs_signaling_client), 8192 },
+        { "cs-worker", router_callback, 0, 1024 },
+        { "cs-whep", whep_callback, sizeof(cs_whep_request), 0 },
+        { "cs-stream", stream_callback, sizeof(cs_stream_client), 4096 },
+        { "cs-hls", hls_callback, sizeof(cs_hls_request), 0 },
+        { "cs-stats", stats_callback, sizeof(cs_ops_request), 0 },
+        { "cs-trace", trace_callback, sizeof(cs_ops_request), 0 },
+        { "cs-client", client_callback, sizeof(cs_client_request), 0 },
         { NULL, NULL, 0, 0 }
     };
 
+    static const struct lws_http_mount trace_mount = {
+        .mountpoint = "/trace",
+        .mountpoint_len = 6,
+        .origin = "cs-trace",
+        .protocol = "cs-trace",
+        .origin_protocol = LWSMPRO_CALLBACK,
+    };
+
+    static const struct lws_http_mount stats_mount = {
+        .mount_next = &trace_mount,
+        .mountpoint = "/stats",
+        .mountpoint_len = 6,
+        .origin = "cs-stats",
+        .protocol = "cs-stats",
+        .origin_protocol = LWSMPRO_CALLBACK,
+    };
+
+    static const struct lws_http_mount hls_mount = {
+        .mount_next = &stats_mount,
+        .mountpoint = "/hls",
+        .mountpoint_len = 4,
+        .origin = "cs-hls",
+        .protocol = "cs-hls",
+        .origin_protocol = LWSMPRO_CALLBACK,
+    };
+
+    static const struct lws_http_mount whep_mount = {
+        .mount_next = &hls_mount,
+        .mountpoint = "/whep",
+        .mountpoint_len = 5,
+        .origin = "cs-whep",
+        .protocol = "cs-whep",
+        .origin_protocol = LWSMPRO_CALLBACK,
+    };
+
+    // lws lets a later matching callback mount override an earlier one, so
+    // the catch-all comes first. WebSocket upgrades never reach it.
+    static const struct lws_http_mount client_mount = {
+        .mount_next = &whep_mount,
+        .mountpoint = "/",
+        .mountpoint_len = 1,
+        .origin = "cs-client",
+        .protocol = "cs-client",
+        .origin_protocol = LWSMPRO_CALLBACK,
+    };
+
     struct lws_context_creation_info info;
     memset(&info, 0, sizeof(info));
     info.port = signaling->port;
     info.protocols = protocols;
+    info.mounts = &client_mount;
     info.user = signaling;
     info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
 
+    // The listen socket is registered with the loop from inside this call.
     signaling->context = lws_create_context(&info);
     if (!signaling->context) {
+        cs_assets_destroy(signaling->assets);
         free(signaling);
         return NULL;
     }
@@ -228,68 +1519,290 @@ void cs_signaling_destroy(cs_signaling *signaling) {
         lws_context_destroy(signaling->context);
     }
 
-    free(signaling->pending);
+    while (signaling->sessions) {
+        cs_whep_session *next = signaling->sessions->next;
+        free_session(signaling->sessions);
+        signaling->sessions = next;
+    }
+    cs_msg_queue_clear(&signaling->router_queue);
+    cs_assets_destroy(signaling->assets);
     free(signaling);
 }
 
-static int send_pending(cs_signaling *signaling) {
-    if (!signaling || !signaling->client_wsi) {
+static int queue_message(cs_signaling *signaling, int peer_id, const char *msg) {
+    cs_signaling_client *client = find_client(signaling, peer_id);
+    if (!client) {
+        return -1;
+    }
+    if (cs_msg_queue_push_str(&client->queue, msg) != 0) {
         return -1;
     }
-    lws_callback_on_writable(signaling->client_wsi);
+    lws_callback_on_writable(client->wsi);
     return 0;
 }
 
-int cs_signaling_broadcast_sdp(cs_signaling *signaling, const char *type, const char *sdp) {
+int cs_signaling_send_sdp(cs_signaling *signaling, int peer_id, const char *type, const char *sdp) {
     if (!signaling || !type || !sdp) {
         return -1;
     }
 
-    free(signaling->pending);
-    char *escaped = json_escape(sdp);
+    cs_whep_session *session = find_session(signaling, peer_id);
+    if (session) {
+        free(session->answer);
+        session->answer = strdup(sdp);
+        return session->answer ? 0 : -1;
+    }
+
+    char *escaped = cs_json_escape(sdp);
     if (!escaped) {
         return -1;
     }
     size_t needed = strlen(type) + strlen(escaped) + 32;
-    signaling->pending = (char *)malloc(needed);
-    if (!signaling->pending) {
+    char *msg = (char *)malloc(needed);
+    if (!msg) {
         free(escaped);
         return -1;
     }
 
-    snprintf(signaling->pending, needed, "{\"type\":\"%s\",\"sdp\":\"%s\"}", type, escaped);
+    snprintf(msg, needed, "{\"type\":\"%s\",\"sdp\":\"%s\"}", type, escaped);
     free(escaped);
-    return send_pending(signaling);
+    int ret = queue_message(signaling, peer_id, msg);
+    free(msg);
+    return ret;
 }
 
-int cs_signaling_broadcast_ice(cs_signaling *signaling, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
+int cs_signaling_send_ice(cs_signaling *signaling, int peer_id, const char *candidate, int sdp_mline_index, const char *sdp_mid) {
     if (!signaling || !candidate) {
         return -1;
     }
 
-    free(signaling->pending);
-    char *escaped = json_escape(candidate);
+    cs_whep_session *session = find_session(signaling, peer_id);
+    if (session) {
+        // Candidates found after the answer went out are not trickled.
+        return session->pending ? add_session_candidate(session, candidate, sdp_mline_index) : 0;
+    }
+
+    char *escaped = cs_json_escape(candidate);
     if (!escaped) {
         return -1;
     }
     size_t needed = strlen(escaped) + (sdp_mid ? strlen(sdp_mid) : 1) + 64;
-    signaling->pending = (char *)malloc(needed);
-    if (!signaling->pending) {
+    char *msg = (char *)malloc(needed);
+    if (!msg) {
         free(escaped);
         return -1;
     }
 
-    snprintf(signaling->pending, needed,
-             "{\"type\":\"ice\",\"candidate\":\"%s\",\"sdpMLineIndex\":%d,\"sdpMid\":\"%s\"}",
-             escaped, sdp_mline_index, sdp_mid ? sdp_mid : "0");
+    // webrtcbin only reports the m-line index; leave sdpMid out when unknown
+    // so the browser matches on sdpMLineIndex instead.
+    if (sdp_mid) {
+        snprintf(msg, needed,
+                 "{\"type\":\"ice\",\"candidate\":\"%s\",\"sdpMLineIndex\":%d,\"sdpMid\":\"%s\"}",
+                 escaped, sdp_mline_index, sdp_mid);
+    } else {
+        snprintf(msg, needed,
+                 "{\"type\":\"ice\",\"candidate\":\"%s\",\"sdpMLineIndex\":%d}",
+                 escaped, sdp_mline_index);
+    }
     free(escaped);
-    return send_pending(signaling);
+    int ret = queue_message(signaling, peer_id, msg);
+    free(msg);
+    return ret;
+}
+
+int cs_signaling_ice_gathering_done(cs_signaling *signaling, int peer_id) {
+    if (!signaling) {
+        return -1;
+    }
+    cs_whep_session *session = find_session(signaling, peer_id);
+    if (!session) {
+        return 0;
+    }
+    session->gathered = 1;
+    // Still inside on_remote_offer when no answer exists yet; handle_offer
+    // finishes the session on return.
+    if (session->answer) {
+        finish_session(signaling, session);
+    }
+    return 0;
+}
+
+int cs_signaling_close_peer(cs_signaling *signaling, int peer_id) {
+    if (!signaling) {
+        return -1;
+    }
+    cs_whep_session *session = find_session(signaling, peer_id);
+    if (session) {
+        if (session->pending) {
+            cs_whep_request *waiting = (cs_whep_request *)lws_wsi_user(session->pending);
+            waiting->peer_id = 0;
+            respond(session->pending, waiting, HTTP_STATUS_INTERNAL_SERVER_ERROR, "text/plain", NULL, 0);
+        }
+        close_session(signaling, session);
+        return 0;
+    }
+    cs_signaling_client *client = find_client(signaling, peer_id);
+    cs_stream_client *stream = client ? NULL : find_stream_client(signaling, peer_id);
+    if (!client && !stream) {
+        return -1;
+    }
+    // Closes on the next service; LWS_CALLBACK_CLOSED reports the peer.
+    lws_set_timeout(client ? client->wsi : stream->wsi, PENDING_TIMEOUT_CLOSE_SEND, LWS_TO_KILL_ASYNC);
+    return 0;
+}
+
+int cs_signaling_stream_send(cs_signaling *signaling, int peer_id, cs_stream_unit *unit) {
+    if (!signaling || !unit) {
+        return -1;
+    }
+    cs_stream_client *client = find_stream_client(signaling, peer_id);
+    if (!client) {
+        return -1;
+    }
+    int keyframe = unit->buf[LWS_PRE + 1] & 1;
+    int overflow = 0;
+    if (client->unit_count == CS_STREAM_QUEUE) {
+        // Too slow for the stream: rather than delivering stale frames,
+        // drop the backlog and restart at a keyframe.
+        drop_stream_units(client);
+        client->waiting_key = 1;
+        overflow = 1;
+    }
+    if (client->waiting_key && !keyframe) {
+        return overflow;
+    }
+    client->waiting_key = 0;
+    unit->refs++;
+    client->units[(client->unit_head + client->unit_count) % CS_STREAM_QUEUE] = unit;
+    client->unit_count++;
+    lws_callback_on_writable(client->wsi);
+    return 0;
+}
+
+int cs_signaling_stream_send_text(cs_signaling *signaling, int peer_id, const char *text) {
+    if (!signaling || !text) {
+        return -1;
+    }
+    cs_stream_client *client = find_stream_client(signaling, peer_id);
+    if (!client || cs_msg_queue_push_str(&client->queue, text) != 0) {
+        return -1;
+    }
+    lws_callback_on_writable(client->wsi);
+    return 0;
+}
+
+void cs_signaling_hls_updated(cs_signaling *signaling) {
+    if (!signaling || !signaling->hls_waiting) {
+        return;
+    }
+    // Answering may park a request again, so work on a detached list.
+    cs_hls_request *req = signaling->hls_waiting;
+    signaling->hls_waiting = NULL;
+    while (req) {
+        cs_hls_request *next = req->next;
+        req->next = NULL;
+        req->waiting = 0;
+        hls_answer(signaling, req->wsi, req);
+        req = next;
+    }
+}
+
+int cs_signaling_peer_count(const cs_signaling *signaling) {
+    if (!signaling) {
+        return 0;
+    }
+    return signaling->client_count;
+}
+
+int cs_signaling_report_load(cs_signaling *signaling, const cs_load_report *report) {
+    if (!signaling || !report) {
+        return -1;
+    }
+    if (!signaling->router_wsi || !signaling->router_ready) {
+        return -1;
+    }
+
+    // A report still waiting for the socket is replaced by this newer one.
+    if (signaling->router_queue.count > 0) {
+        cs_msg_queue_clear(&signaling->router_queue);
+        if (!signaling->router_registered) {
+            queue_register(signaling);
+        }
+    }
+
+    char msg[192];
+    snprintf(msg, sizeof(msg), "{\"type\":\"load\",\"cpu\":%.3f,\"encode_headroom\":%.3f,\"peers\":%d,\"capacity\":%d}",
+             report->cpu, report->encode_headroom, report->peers, report->capacity);
+    if (cs_msg_queue_push_str(&signaling->router_queue, msg) != 0) {
+        return -1;
+    }
+    lws_callback_on_writable(signaling->router_wsi);
+    return 0;
 }
 
 int cs_signaling_poll(cs_signaling *signaling) {
     if (!signaling || !signaling->context) {
         return -1;
     }
-    lws_service(signaling->context, 0);
+    uint64_t now = monotonic_ns();
+    if (signaling->router_host[0] && !signaling->router_wsi && now >= signaling->next_router_connect_ns) {
+        connect_router(signaling);
+    }
+    cs_whep_session *session = signaling->sessions;
+    while (session) {
+        cs_whep_session *next = session->next;
+        if (session->pending && now >= session->deadline_ns) {
+            finish_session(signaling, session);
+        }
+        session = next;
+    }
+    cs_hls_request *req = signaling->hls_waiting;
+    while (req) {
+        cs_hls_request *next = req->next;
+        if (now >= req->deadline_ns) {
+            unlink_hls_request(signaling, req);
+            hls_respond(req->wsi, req, HTTP_STATUS_SERVICE_UNAVAILABLE, "text/plain", "no-cache", NULL, 0);
+        }
+        req = next;
+    }
+    if (signaling->loop) {
+        // Socket activity is serviced as it happens; this only runs lws
+        // timers (handshake timeouts, pings, client connects).
+        lws_service_fd(signaling->context, NULL);
+    } else {
+        lws_service(signaling->context, 0);
+    }
     return 0;
 }
+
+int cs_signaling_timeout_ms(cs_signaling *signaling, int max_ms) {
+    if (!signaling || !signaling->context) {
+        return max_ms;
+    }
+    int timeout = lws_service_adjust_timeout(signaling->context, max_ms, 0);
+    if (signaling->router_host[0] && !signaling->router_wsi) {
+        uint64_t now = monotonic_ns();
+        int retry_ms = signaling->next_router_connect_ns > now
+                           ? (int)((signaling->next_router_connect_ns - now + 999999ull) / 1000000ull)
+                           : 0;
+        if (retry_ms < timeout) {
+            timeout = retry_ms;
+        }
+    }
+    uint64_t now = monotonic_ns();
+    for (cs_whep_session *session = signaling->sessions; session; session = session->next) {
+        if (session->pending) {
+            int wait_ms = session->deadline_ns > now ? (int)((session->deadline_ns - now + 999999ull) / 1000000ull) : 0;
+            if (wait_ms < timeout) {
+                timeout = wait_ms;
+            }
+        }
+    }
+    for (cs_hls_request *req = signaling->hls_waiting; req; req = req->next) {
+        int wait_ms = req->deadline_ns > now ? (int)((req->deadline_ns - now + 999999ull) / 1000000ull) : 0;
+        if (wait_ms < timeout) {
+            timeout = wait_ms;
+        }
+    }
+    return timeout;
+}
@@ -0,0 +1,385 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// 64-byte events: 8192 of them hold 10 s of a busy streaming thread in 512 KiB.
+#define CS_TRACE_RING_EVENTS 8192u
+#define CS_TRACE_DETAIL 24
+#define CS_TRACE_MAX_SECONDS 60
+
+typedef struct {
+    const char *name;
+    const char *arg_name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int64_t arg;
+    char detail[CS_TRACE_DETAIL];
+} cs_trace_event;
+
+// Written only by its owner thread. The dump reads events below head and
+// drops any the owner may have overwritten meanwhile. Rings are never freed
+// before shutdown; one whose thread has exited is handed to the next new
+// thread once it holds nothing from the current capture.
+typedef struct cs_trace_ring {
+    struct cs_trace_ring *next;
+    int tid;
+    char thread_name[16];
+    int exited;
+    unsigned int generation;
+    uint64_t head;
+    cs_trace_event events[CS_TRACE_RING_EVENTS];
+} cs_trace_ring;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} cs_trace_text;
+
+typedef struct {
+    unsigned int generation;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    char dir[256];
+} cs_trace_capture;
+
+int cs_trace_active;
+
+static unsigned int generation;
+static cs_trace_ring *rings;
+static _Thread_local cs_trace_ring *local_ring;
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    pthread_mutex_t lock;
+    // A capture or its dump is running.
+    int busy;
+    int dumper_joinable;
+    pthread_t dumper;
+    cs_trace_capture capture;
+    char *last;
+    size_t last_len;
+} state = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+uint64_t cs_trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void on_thread_exit(void *ring) {
+    __atomic_store_n(&((cs_trace_ring *)ring)->exited, 1, __ATOMIC_RELEASE);
+}
+
+static void make_exit_key(void) {
+    pthread_key_create(&exit_key, on_thread_exit);
+}
+
+static cs_trace_ring *attach_ring(void) {
+    pthread_once(&exit_key_once, make_exit_key);
+    unsigned int current = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+
+    cs_trace_ring *ring = NULL;
+    for (cs_trace_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int exited = 1;
+        if (__atomic_load_n(&r->generation, __ATOMIC_ACQUIRE) != current &&
+            __atomic_compare_exchange_n(&r->exited, &exited, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            ring = r;
+            break;
+        }
+    }
+    if (!ring) {
+        ring = (cs_trace_ring *)calloc(1, sizeof(*ring));
+        if (!ring) {
+            return NULL;
+        }
+        cs_trace_ring *head = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+        do {
+            ring->next = head;
+        } while (!__atomic_compare_exchange_n(&rings, &head, ring, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    }
+
+    ring->tid = (int)syscall(SYS_gettid);
+    memset(ring->thread_name, 0, sizeof(ring->thread_name));
+    prctl(PR_GET_NAME, ring->thread_name);
+    pthread_setspecific(exit_key, ring);
+    local_ring = ring;
+    return ring;
+}
+
+void cs_trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, const char *arg_name, int64_t arg,
+                     const char *detail) {
+    cs_trace_ring *ring = local_ring ? local_ring : attach_ring();
+    if (!ring) {
+        return;
+    }
+    unsigned int current = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+    uint64_t head = ring->head;
+    if (ring->generation != current) {
+        // First event of this capture on this thread.
+        head = 0;
+        __atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->generation, current, __ATOMIC_RELEASE);
+    }
+
+    cs_trace_event *event = &ring->events[head % CS_TRACE_RING_EVENTS];
+    event->name = name;
+    event->arg_name = arg_name;
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->arg = arg;
+    if (detail) {
+        snprintf(event->detail, sizeof(event->detail), "%s", detail);
+    } else {
+        event->detail[0] = '\0';
+    }
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void text_append(cs_trace_text *text, const char *format, ...) {
+    if (text->failed) {
+        return;
+    }
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->len, text->cap - text->len, format, args);
+        va_end(args);
+        if (n < 0) {
+            text->failed = 1;
+            return;
+        }
+        if ((size_t)n < text->cap - text->len) {
+            text->len += (size_t)n;
+            return;
+        }
+        size_t cap = text->cap * 2 > text->len + (size_t)n + 1 ? text->cap * 2 : text->len + (size_t)n + 1;
+        char *data = (char *)realloc(text->data, cap);
+        if (!data) {
+            text->failed = 1;
+            return;
+        }
+        text->data = data;
+        text->cap = cap;
+    }
+}
+
+// Names come from string literals and GStreamer element names; anything
+// that would need escaping in JSON is replaced.
+static void sanitize(char *out, size_t out_len, const char *in) {
+    size_t i = 0;
+    for (; in && in[i] && i + 1 < out_len; ++i) {
+        unsigned char c = (unsigned char)in[i];
+        out[i] = c < 0x20 || c == '"' || c == '\\' ? '_' : (char)c;
+    }
+    out[i] = '\0';
+}
+
+static void append_event(cs_trace_text *text, const cs_trace_capture *capture, int pid, int tid,
+                         const cs_trace_event *event) {
+    char name[64];
+    char detail[CS_TRACE_DETAIL];
+    sanitize(name, sizeof(name), event->name);
+    sanitize(detail, sizeof(detail), event->detail);
+    uint64_t end_ns = event->end_ns > event->start_ns ? event->end_ns : event->start_ns;
+    text_append(text, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                name, pid, tid, ((double)event->start_ns - (double)capture->start_ns) / 1000.0,
+                (double)(end_ns - event->start_ns) / 1000.0);
+    const char *separator = "";
+    if (event->arg_name) {
+        sanitize(name, sizeof(name), event->arg_name);
+        text_append(text, "\"%s\":%lld", name, (long long)event->arg);
+        separator = ",";
+    }
+    if (detail[0]) {
+        text_append(text, "%s\"detail\":\"%s\"", separator, detail);
+    }
+    text_append(text, "}}");
+}
+
+static char *format_capture(const cs_trace_capture *capture, size_t *len_out, int *count_out) {
+    cs_trace_text text = { NULL, 0, 0, 0 };
+    text.cap = 1 << 20;
+    text.data = (char *)malloc(text.cap);
+    if (!text.data) {
+        return NULL;
+    }
+    int pid = (int)getpid();
+    int count = 0;
+    text_append(&text, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"cube_server\"}}", pid);
+
+    for (cs_trace_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        if (__atomic_load_n(&ring->generation, __ATOMIC_ACQUIRE) != capture->generation) {
+            continue;
+        }
+        char thread_name[sizeof(ring->thread_name)];
+        sanitize(thread_name, sizeof(thread_name), ring->thread_name);
+        text_append(&text, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    pid, ring->tid, thread_name);
+
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > CS_TRACE_RING_EVENTS ? head - CS_TRACE_RING_EVENTS : 0;
+        for (uint64_t i = first; i < head; ++i) {
+            cs_trace_event event = ring->events[i % CS_TRACE_RING_EVENTS];
+            // A late writer may have wrapped onto this slot while it was copied.
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > i + CS_TRACE_RING_EVENTS) {
+                continue;
+            }
+            if (event.end_ns < capture->start_ns || event.start_ns > capture->end_ns) {
+                continue;
+            }
+            append_event(&text, capture, pid, ring->tid, &event);
+            ++count;
+        }
+    }
+    text_append(&text, "\n]}\n");
+    if (text.failed) {
+        free(text.data);
+        return NULL;
+    }
+    *len_out = text.len;
+    *count_out = count;
+    return text.data;
+}
+
+static void write_capture(const char *dir, const char *json, size_t len, int count) {
+    char stamp[32];
+    char path[320];
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm);
+    snprintf(path, sizeof(path), "%s/cube-trace-%s.json", dir, stamp);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Trace: cannot write %s\n", path);
+        return;
+    }
+    int ok = fwrite(json, 1, len, file) == len;
+    ok = fclose(file) == 0 && ok;
+    if (ok) {
+        fprintf(stderr, "Trace: %d events written to %s\n", count, path);
+    } else {
+        fprintf(stderr, "Trace: writing %s failed\n", path);
+        unlink(path);
+    }
+}
+
+static void *dump_main(void *user) {
+    (void)user;
+    // Only the dumper reads the capture while busy is set.
+    const cs_trace_capture *capture = &state.capture;
+    size_t len = 0;
+    int count = 0;
+    char *json = format_capture(capture, &len, &count);
+    if (!json) {
+        fprintf(stderr, "Trace: out of memory formatting the capture\n");
+    } else if (capture->dir[0]) {
+        write_capture(capture->dir, json, len, count);
+    }
+
+    pthread_mutex_lock(&state.lock);
+    if (json) {
+        free(state.last);
+        state.last = json;
+        state.last_len = len;
+    }
+    state.busy = 0;
+    pthread_mutex_unlock(&state.lock);
+    return NULL;
+}
+
+int cs_trace_start(int seconds, const char *dir) {
+    if (seconds < 1) {
+        seconds = 1;
+    } else if (seconds > CS_TRACE_MAX_SECONDS) {
+        seconds = CS_TRACE_MAX_SECONDS;
+    }
+
+    pthread_mutex_lock(&state.lock);
+    if (state.busy) {
+        pthread_mutex_unlock(&state.lock);
+        return -1;
+    }
+    if (state.dumper_joinable) {
+        // Finished: busy is cleared as its last step.
+        pthread_join(state.dumper, NULL);
+        state.dumper_joinable = 0;
+    }
+    state.busy = 1;
+    state.capture.generation = __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+    state.capture.start_ns = cs_trace_now_ns();
+    state.capture.end_ns = state.capture.start_ns + (uint64_t)seconds * 1000000000ull;
+    snprintf(state.capture.dir, sizeof(state.capture.dir), "%s", dir ? dir : "");
+    __atomic_store_n(&cs_trace_active, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&state.lock);
+    fprintf(stderr, "Trace: capturing %d s\n", seconds);
+    return 0;
+}
+
+int cs_trace_poll(void) {
+    if (!__atomic_load_n(&cs_trace_active, __ATOMIC_RELAXED) || cs_trace_now_ns() < state.capture.end_ns) {
+        return 0;
+    }
+    __atomic_store_n(&cs_trace_active, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&state.lock);
+    // Formatting megabytes of JSON would stall the caller's loop.
+    state.dumper_joinable = pthread_create(&state.dumper, NULL, dump_main, NULL) == 0;
+    pthread_mutex_unlock(&state.lock);
+    if (!state.dumper_joinable) {
+        dump_main(NULL);
+    }
+    return 1;
+}
+
+char *cs_trace_copy_last(size_t *len) {
+    char *copy = NULL;
+    pthread_mutex_lock(&state.lock);
+    if (state.last) {
+        copy = (char *)malloc(state.last_len + 1);
+        if (copy) {
+            memcpy(copy, state.last, state.last_len + 1);
+            *len = state.last_len;
+        }
+    }
+    pthread_mutex_unlock(&state.lock);
+    return copy;
+}
+
+void cs_trace_shutdown(void) {
+    __atomic_store_n(&cs_trace_active, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&state.lock);
+    int joinable = state.dumper_joinable;
+    state.dumper_joinable = 0;
+    pthread_mutex_unlock(&state.lock);
+    if (joinable) {
+        pthread_join(state.dumper, NULL);
+    }
+    // Threads still running must not touch their rings on exit.
+    pthread_once(&exit_key_once, make_exit_key);
+    pthread_key_delete(exit_key);
+
+    cs_trace_ring *ring = __atomic_exchange_n(&rings, NULL, __ATOMIC_ACQ_REL);
+    while (ring) {
+        cs_trace_ring *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    local_ring = NULL;
+    free(state.last);
+    state.last = NULL;
+    state.last_len = 0;
+}
@@ -0,0 +1,209 @@
+#include "views.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CS_VIEW_ANGLE_STEP 0.01f
+#define CS_VIEW_ZOOM_STEP 0.02f
+
+typedef struct {
+    int refs;
+    cs_camera camera;
+    long key[3];
+} view_slot;
+
+typedef struct {
+    int peer_id;
+    int view;
+} view_peer;
+
+struct cs_view_set {
+    int max_views;
+    view_slot *views;
+    view_peer *peers;
+    int peer_count;
+    int peer_capacity;
+};
+
+static void camera_key(const cs_camera *camera, long key[3]) {
+    key[0] = lroundf(camera->yaw / CS_VIEW_ANGLE_STEP);
+    key[1] = lroundf(camera->pitch / CS_VIEW_ANGLE_STEP);
+    key[2] = lroundf((camera->zoom > 0.0f ? camera->zoom : 1.0f) / CS_VIEW_ZOOM_STEP);
+}
+
+void cs_view_atlas_layout(int max_views, int *cols, int *rows) {
+    int n = max_views > 0 ? max_views : 1;
+    int c = (int)ceilf(sqrtf((float)n));
+    *cols = c;
+    *rows = (n + c - 1) / c;
+}
+
+cs_view_set *cs_view_set_create(int max_views) {
+    if (max_views <= 0) {
+        return NULL;
+    }
+
+    cs_view_set *set = (cs_view_set *)calloc(1, sizeof(cs_view_set));
+    if (!set) {
+        return NULL;
+    }
+    set->max_views = max_views;
+    set->views = (view_slot *)calloc((size_t)max_views, sizeof(view_slot));
+    if (!set->views) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void cs_view_set_destroy(cs_view_set *set) {
+    if (!set) {
+        return;
+    }
+    free(set->views);
+    free(set->peers);
+    free(set);
+}
+
+static view_peer *find_peer(const cs_view_set *set, int peer_id) {
+    for (int i = 0; i < set->peer_count; ++i) {
+        if (set->peers[i].peer_id == peer_id) {
+            return &set->peers[i];
+        }
+    }
+    return NULL;
+}
+
+static int find_view(const cs_view_set *set, const long key[3]) {
+    for (int i = 0; i < set->max_views; ++i) {
+        const view_slot *slot = &set->views[i];
+        if (slot->refs > 0 && memcmp(slot->key, key, sizeof(slot->key)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int claim_view(cs_view_set *set, const cs_camera *camera, const long key[3]) {
+    for (int i = 0; i < set->max_views; ++i) {
+        view_slot *slot = &set->views[i];
+        if (slot->refs == 0) {
+            slot->camera = *camera;
+            memcpy(slot->key, key, sizeof(slot->key));
+            return i;
+        }
+    }
+    return -1;
+}
+
+int cs_view_set_add_peer(cs_view_set *set, int peer_id) {
+    if (!set || find_peer(set, peer_id)) {
+        return -1;
+    }
+
+    if (set->peer_count == set->peer_capacity) {
+        int capacity = set->peer_capacity ? set->peer_capacity * 2 : 8;
+        view_peer *grown = (view_peer *)realloc(set->peers, sizeof(view_peer) * (size_t)capacity);
+        if (!grown) {
+            return -1;
+        }
+        set->peers = grown;
+        set->peer_capacity = capacity;
+    }
+
+    cs_camera camera = { 0.0f, 0.0f, 0.0f };
+    long key[3];
+    camera_key(&camera, key);
+    int view = find_view(set, key);
+    if (view < 0) {
+        view = claim_view(set, &camera, key);
+    }
+    if (view < 0) {
+        // Every view is held by a custom camera; share the first one until
+        // this peer sends a camera of its own.
+        view = 0;
+    }
+
+    set->views[view].refs++;
+    set->peers[set->peer_count].peer_id = peer_id;
+    set->peers[set->peer_count].view = view;
+    set->peer_count++;
+    return view;
+}
+
+void cs_view_set_remove_peer(cs_view_set *set, int peer_id) {
+    if (!set) {
+        return;
+    }
+    view_peer *peer = find_peer(set, peer_id);
+    if (!peer) {
+        return;
+    }
+    set->views[peer->view].refs--;
+    *peer = set->peers[set->peer_count - 1];
+    set->peer_count--;
+}
+
+int cs_view_set_update(cs_view_set *set, int peer_id, const cs_camera *camera) {
+    if (!set || !camera) {
+        return -1;
+    }
+    view_peer *peer = find_peer(set, peer_id);
+    if (!peer) {
+        return -1;
+    }
+
+    long key[3];
+    camera_key(camera, key);
+    view_slot *current = &set->views[peer->view];
+
+    int shared = find_view(set, key);
+    if (shared == peer->view) {
+        current->camera = *camera;
+        return peer->view;
+    }
+    if (shared >= 0) {
+        current->refs--;
+        set->views[shared].refs++;
+        peer->view = shared;
+        return shared;
+    }
+    if (current->refs == 1) {
+        current->camera = *camera;
+        memcpy(current->key, key, sizeof(current->key));
+        return peer->view;
+    }
+
+    int view = claim_view(set, camera, key);
+    if (view < 0) {
+        return peer->view;
+    }
+    current->refs--;
+    set->views[view].refs++;
+    peer->view = view;
+    return view;
+}
+
+int cs_view_set_view_of(const cs_view_set *set, int peer_id) {
+    if (!set) {
+        return -1;
+    }
+    const view_peer *peer = find_peer(set, peer_id);
+    return peer ? peer->view : -1;
+}
+
+int cs_view_set_active(const cs_view_set *set, cs_render_view *views, int max) {
+    if (!set || !views) {
+        return 0;
+    }
+    int count = 0;
+    for (int i = 0; i < set->max_views && count < max; ++i) {
+        if (set->views[i].refs > 0) {
+            views[count].tile = i;
+            views[count].camera = set->views[i].camera;
+            count++;
+        }
+    }
+    return count;
+}